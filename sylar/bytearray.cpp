@@ -3,9 +3,20 @@
 #include <sstream>
 #include <string.h>
 #include <iomanip>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "endian.h"
 #include "log.h"
+#include "macro.h"
 
 namespace sylar {
 
@@ -36,10 +47,76 @@ ByteArray::ByteArray(size_t base_size)
     ,m_size(0)
     ,m_endian(SYLAR_BIG_ENDIAN)
     ,m_root(new Node(base_size))
-    ,m_cur(m_root) {
+    ,m_cur(m_root)
+    ,m_readonly(false)
+    ,m_mapAddr(nullptr)
+    ,m_mapLen(0) {
+    m_nodes.push_back(m_root);
+}
+
+ByteArray::ByteArray(char* data, size_t size, void* map_addr, size_t map_len)
+    :m_baseSize(size)
+    ,m_position(0)
+    ,m_capacity(size)
+    ,m_size(size)
+    ,m_endian(SYLAR_BIG_ENDIAN)
+    ,m_root(new Node())
+    ,m_cur(m_root)
+    ,m_readonly(true)
+    ,m_mapAddr(map_addr)
+    ,m_mapLen(map_len) {
+    m_root->ptr = data;
+    m_root->size = size;
+    m_nodes.push_back(m_root);
+}
+
+ByteArray::ptr ByteArray::MapFile(const std::string& name, uint64_t offset, uint64_t length) {
+    int fd = ::open(name.c_str(), O_RDONLY);
+    if(fd == -1) {
+        SYLAR_LOG_ERROR(g_logger) << "MapFile open name=" << name
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    struct stat st;
+    if(fstat(fd, &st)) {
+        SYLAR_LOG_ERROR(g_logger) << "MapFile fstat name=" << name
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        ::close(fd);
+        return nullptr;
+    }
+    uint64_t file_size = st.st_size;
+    if(offset >= file_size || length == 0) {
+        // 空区域不能mmap(长度为0时EINVAL)
+        ::close(fd);
+        return ByteArray::ptr(new ByteArray);
+    }
+    if(length > file_size - offset) {
+        length = file_size - offset;
+    }
+
+    // mmap的offset必须按页对齐
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t map_offset = offset / page * page;
+    size_t map_len = length + (offset - map_offset);
+    void* addr = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, map_offset);
+    ::close(fd);
+    if(addr == MAP_FAILED) {
+        SYLAR_LOG_ERROR(g_logger) << "MapFile mmap name=" << name
+            << " offset=" << offset << " length=" << length
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    // 快照基本是顺序读取
+    madvise(addr, map_len, MADV_SEQUENTIAL);
+    return ByteArray::ptr(new ByteArray((char*)addr + (offset - map_offset)
+                                        ,length, addr, map_len));
 }
 
 ByteArray::~ByteArray() {
+    if(m_mapAddr) {
+        munmap(m_mapAddr, m_mapLen);
+        m_root->ptr = nullptr;
+    }
     Node* tmp = m_root;
     while(tmp) {
         m_cur = tmp;
@@ -48,6 +125,12 @@ ByteArray::~ByteArray() {
     }
 }
 
+void ByteArray::checkWritable() const {
+    if(SYLAR_UNLIKELY(m_readonly)) {
+        throw std::logic_error("ByteArray is read only");
+    }
+}
+
 bool ByteArray::isLittleEndian() const {
     return m_endian == SYLAR_LITTLE_ENDIAN;
 }
@@ -136,21 +219,283 @@ static int64_t DecodeZigzag64(const uint64_t& v) {
     return (v >> 1) ^ -(v & 1);
 }
 
+// Varint32/Varint64编码后的最大长度
+static const size_t VARINT32_MAX_LEN = 5;
+static const size_t VARINT64_MAX_LEN = 10;
 
-void ByteArray::writeInt32  (int32_t value) {
-    writeUint32(EncodeZigzag32(value));
+// value编码后的长度
+static inline size_t VarintSize(uint64_t value) {
+    size_t bits = 64 - __builtin_clzll(value | 1);
+    return (bits + 6) / 7;
 }
 
-void ByteArray::writeUint32 (uint32_t value) {
-    uint8_t tmp[5];
-    uint8_t i = 0;
+// 把value编码到p中,返回编码长度,调用方保证p处放得下
+template<class T>
+static inline size_t EncodeVarint(uint8_t* p, T value) {
+    size_t i = 0;
     while(value >= 0x80) {
-        tmp[i++] = (value & 0x7F) | 0x80;
+        p[i++] = (value & 0x7F) | 0x80;
         value >>= 7;
     }
-    tmp[i++] = value;
+    p[i++] = value;
+    return i;
+}
+
+// 从[p, end)中解码一个Varint,最多读取MaxLen个字节(与逐字节读取的语义一致)
+// 返回消耗的字节数, 数据不完整返回0
+template<class T, size_t MaxLen>
+static inline size_t DecodeVarint(const uint8_t* p, const uint8_t* end, T& value) {
+    size_t limit = (size_t)(end - p) < MaxLen ? (size_t)(end - p) : MaxLen;
+    T result = 0;
+    for(size_t i = 0; i < limit; ++i) {
+        result |= ((T)(p[i] & 0x7f)) << (7 * i);
+        if(p[i] < 0x80 || i + 1 == MaxLen) {
+            value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+#if defined(__SSE2__)
+// 16个单字节Varint零扩展后写入out
+static inline void StoreBytes16(__m128i v, uint32_t* out) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi16(hi, zero));
+}
+
+static inline void StoreBytes16(__m128i v, uint64_t* out) {
+    uint32_t tmp[16];
+    StoreBytes16(v, tmp);
+    for(int i = 0; i < 16; ++i) {
+        out[i] = tmp[i];
+    }
+}
+
+// 16个数据都小于0x80时直接打包成16个字节写入p
+static inline bool EncodeSmall16(uint8_t* p, const uint32_t* values) {
+    __m128i a = _mm_loadu_si128((const __m128i*)values);
+    __m128i b = _mm_loadu_si128((const __m128i*)(values + 4));
+    __m128i c = _mm_loadu_si128((const __m128i*)(values + 8));
+    __m128i d = _mm_loadu_si128((const __m128i*)(values + 12));
+    __m128i o = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+    __m128i high = _mm_cmpeq_epi32(_mm_srli_epi32(o, 7), _mm_setzero_si128());
+    if(_mm_movemask_epi8(high) != 0xFFFF) {
+        return false;
+    }
+    __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+    _mm_storeu_si128((__m128i*)p, bytes);
+    return true;
+}
+
+static inline bool EncodeSmall16(uint8_t* p, const uint64_t* values) {
+    return false;
+}
+#endif
+
+// 在连续内存[p, end)中批量编码,放不下下一个数据时停止
+// 返回写入的字节数, n返回编码的个数
+template<class T, size_t MaxLen>
+static size_t EncodeVarintBlock(uint8_t* p, uint8_t* end, const T* values
+                                ,size_t count, size_t& n) {
+    uint8_t* begin = p;
+    n = 0;
+#if defined(__SSE2__)
+    while(count - n >= 16 && end - p >= 16) {
+        if(!EncodeSmall16(p, values + n)) {
+            break;
+        }
+        p += 16;
+        n += 16;
+    }
+#endif
+    while(n < count) {
+        size_t left = end - p;
+        if(left < MaxLen && VarintSize(values[n]) > left) {
+            break;
+        }
+        p += EncodeVarint(p, values[n++]);
+    }
+    return p - begin;
+}
+
+// 在连续内存[p, end)中批量解码,遇到跨越end的不完整Varint时停止
+// 返回消耗的字节数, n返回解码的个数
+template<class T, size_t MaxLen>
+static size_t DecodeVarintBlock(const uint8_t* p, const uint8_t* end, T* out
+                                ,size_t count, size_t& n) {
+    const uint8_t* begin = p;
+    n = 0;
+#if defined(__SSE2__)
+    // masked-VByte: 一次取16个字节的续位掩码,由掩码直接定位每个Varint的结尾
+    while(n < count && end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        uint32_t mask = _mm_movemask_epi8(v);
+        if(mask == 0 && count - n >= 16) {
+            StoreBytes16(v, out + n);
+            p += 16;
+            n += 16;
+            continue;
+        }
+        uint32_t term = ~mask & 0xFFFF;
+        size_t consumed = 0;
+        while(term && n < count) {
+            size_t last = __builtin_ctz(term);
+            if(last + 1 - consumed > MaxLen) {
+                break;
+            }
+            T result = 0;
+            for(size_t i = consumed, shift = 0; i <= last; ++i, shift += 7) {
+                result |= ((T)(p[i] & 0x7f)) << shift;
+            }
+            out[n++] = result;
+            consumed = last + 1;
+            term &= term - 1;
+        }
+        if(consumed == 0) {
+            // 超过MaxLen的Varint,剩余数据不少于16字节,一定能解出
+            consumed = DecodeVarint<T, MaxLen>(p, end, out[n++]);
+        }
+        p += consumed;
+    }
+#endif
+    while(n < count && p < end) {
+        size_t len = DecodeVarint<T, MaxLen>(p, end, out[n]);
+        if(len == 0) {
+            break;
+        }
+        ++n;
+        p += len;
+    }
+    return p - begin;
+}
+
+void ByteArray::forwardInNode(size_t len) {
+    size_t npos = m_position % m_baseSize;
+    m_position += len;
+    if(npos + len == m_cur->size) {
+        m_cur = m_cur->next;
+    }
+}
+
+template<class T, size_t MaxLen>
+void ByteArray::writeVarint(T value) {
+    size_t npos = m_position % m_baseSize;
+    if(SYLAR_LIKELY(m_cur && !m_readonly && m_cur->size - npos >= MaxLen)) {
+        // 当前内存块放得下,直接编码到块内
+        forwardInNode(EncodeVarint((uint8_t*)m_cur->ptr + npos, value));
+        if(m_position > m_size) {
+            m_size = m_position;
+        }
+        return;
+    }
+    uint8_t tmp[MaxLen];
     // tmp本身目前已经是小端了,但我们抛弃默认的大端传输
-    write(tmp, i);
+    write(tmp, EncodeVarint(tmp, value));
+}
+
+template<class T, size_t MaxLen>
+T ByteArray::readVarint() {
+    size_t read_size = getReadSize();
+    if(SYLAR_LIKELY(read_size > 0)) {
+        size_t npos = m_position % m_baseSize;
+        size_t ncap = m_cur->size - npos;
+        const uint8_t* p = (const uint8_t*)m_cur->ptr + npos;
+        T result = 0;
+        size_t len = DecodeVarint<T, MaxLen>(p, p + (ncap < read_size ? ncap : read_size), result);
+        if(SYLAR_LIKELY(len)) {
+            forwardInNode(len);
+            return result;
+        }
+    }
+
+    // 跨越内存块或者数据不足,逐字节读取
+    T result = 0;
+    for(size_t i = 0; i < MaxLen; ++i) {
+        uint8_t b = readFuint8();
+        if(b < 0x80) {
+            result |= ((T)b) << (7 * i);
+            break;
+        } else {
+            result |= (((T)(b & 0x7f)) << (7 * i));
+        }
+    }
+    return result;
+}
+
+template<class T, size_t MaxLen>
+void ByteArray::writeVarintArray(const T* values, size_t count) {
+    if(count == 0) {
+        return;
+    }
+    checkWritable();
+    // 先算出总长度,一次扩容到位
+    size_t total = 0;
+    for(size_t i = 0; i < count; ++i) {
+        total += VarintSize(values[i]);
+    }
+    addCapacity(total);
+
+    size_t i = 0;
+    while(i < count) {
+        size_t npos = m_position % m_baseSize;
+        uint8_t* p = (uint8_t*)m_cur->ptr + npos;
+        size_t n = 0;
+        size_t len = EncodeVarintBlock<T, MaxLen>(p, (uint8_t*)m_cur->ptr + m_cur->size
+                                                 ,values + i, count - i, n);
+        i += n;
+        bool node_full = (npos + len == m_cur->size);
+        if(len) {
+            forwardInNode(len);
+        }
+        if(i < count && !node_full) {
+            // 跨越内存块的数据
+            uint8_t tmp[MaxLen];
+            write(tmp, EncodeVarint(tmp, values[i++]));
+        }
+    }
+    if(m_position > m_size) {
+        m_size = m_position;
+    }
+}
+
+template<class T, size_t MaxLen>
+void ByteArray::readVarintArray(T* values, size_t count) {
+    size_t i = 0;
+    while(i < count) {
+        size_t read_size = getReadSize();
+        if(read_size == 0) {
+            throw std::out_of_range("not enough len");
+        }
+        size_t npos = m_position % m_baseSize;
+        size_t ncap = m_cur->size - npos;
+        const uint8_t* p = (const uint8_t*)m_cur->ptr + npos;
+        size_t n = 0;
+        size_t len = DecodeVarintBlock<T, MaxLen>(p, p + (ncap < read_size ? ncap : read_size)
+                                                 ,values + i, count - i, n);
+        i += n;
+        if(len) {
+            forwardInNode(len);
+        }
+        if(i < count) {
+            // 跨越内存块的数据
+            values[i++] = readVarint<T, MaxLen>();
+        }
+    }
+}
+
+
+void ByteArray::writeInt32  (int32_t value) {
+    writeUint32(EncodeZigzag32(value));
+}
+
+void ByteArray::writeUint32 (uint32_t value) {
+    writeVarint<uint32_t, VARINT32_MAX_LEN>(value);
 }
 
 void ByteArray::writeInt64  (int64_t value) {
@@ -158,15 +503,15 @@ void ByteArray::writeInt64  (int64_t value) {
 }
 
 void ByteArray::writeUint64 (uint64_t value) {
-    uint8_t tmp[10];
-    uint8_t i = 0;
-    while(value >= 0x80) {
-        tmp[i++] = (value & 0x7F) | 0x80;
-        value >>= 7;
-    }
-    tmp[i++] = value;
-    // tmp本身目前已经是小端了,但我们抛弃默认的大端传输
-    write(tmp, i);
+    writeVarint<uint64_t, VARINT64_MAX_LEN>(value);
+}
+
+void ByteArray::writeUint32Array(const uint32_t* values, size_t count) {
+    writeVarintArray<uint32_t, VARINT32_MAX_LEN>(values, count);
+}
+
+void ByteArray::writeUint64Array(const uint64_t* values, size_t count) {
+    writeVarintArray<uint64_t, VARINT64_MAX_LEN>(values, count);
 }
 
 void ByteArray::writeFloat  (float value) {
@@ -256,17 +601,7 @@ int32_t  ByteArray::readInt32() {
 }
 
 uint32_t ByteArray::readUint32() {
-    uint32_t result = 0;
-    for(int i = 0; i < 32; i += 7) {
-        uint8_t b = readFuint8();
-        if(b < 0x80) {
-            result |= ((uint32_t)b) << i;
-            break;
-        } else {
-            result |= (((uint32_t)(b & 0x7f)) << i);
-        }
-    }
-    return result;
+    return readVarint<uint32_t, VARINT32_MAX_LEN>();
 }
 
 int64_t  ByteArray::readInt64() {
@@ -274,17 +609,15 @@ int64_t  ByteArray::readInt64() {
 }
 
 uint64_t ByteArray::readUint64() {
-    uint64_t result = 0;
-    for(int i = 0; i < 64; i += 7) {
-        uint8_t b = readFuint8();
-        if(b < 0x80) {
-            result |= ((uint64_t)b) << i;
-            break;
-        } else {
-            result |= (((uint64_t)(b & 0x7f)) << i);
-        }
-    }
-    return result;
+    return readVarint<uint64_t, VARINT64_MAX_LEN>();
+}
+
+void ByteArray::readUint32Array(uint32_t* values, size_t count) {
+    readVarintArray<uint32_t, VARINT32_MAX_LEN>(values, count);
+}
+
+void ByteArray::readUint64Array(uint64_t* values, size_t count) {
+    readVarintArray<uint64_t, VARINT64_MAX_LEN>(values, count);
 }
 
 float    ByteArray::readFloat() {
@@ -344,12 +677,37 @@ void ByteArray::clear() {
     }
     m_cur = m_root;
     m_root->next = NULL;
+    m_nodes.resize(1);
+}
+
+void ByteArray::compact() {
+    checkWritable();
+    size_t left = getReadSize();
+    if(m_position == 0) {
+        return;
+    }
+    // 目标位置总在源位置之前，从前往后按块搬运不会覆盖还没搬的数据
+    size_t src = m_position;
+    size_t dst = 0;
+    while(left > 0) {
+        size_t soff = src % m_baseSize;
+        size_t doff = dst % m_baseSize;
+        size_t n = std::min(left, std::min(m_baseSize - soff, m_baseSize - doff));
+        memmove(nodeAt(dst)->ptr + doff, nodeAt(src)->ptr + soff, n);
+        src += n;
+        dst += n;
+        left -= n;
+    }
+    m_size = dst;
+    m_position = 0;
+    m_cur = m_root;
 }
 
 void ByteArray::write(const void* buf, size_t size) {
     if(size == 0) {
         return;
     }
+    checkWritable();
     addCapacity(size);
 
     // m_cur Node的节点相关
@@ -415,14 +773,12 @@ void ByteArray::read(void* buf, size_t size, size_t position) const {
         throw std::out_of_range("not enough len");
     }
 
-    size_t npos = position % m_baseSize;
-    size_t count = position / m_baseSize;
-    // Node* cur = m_cur;
-    Node* cur = m_root;
-    while(count > 0) {
-        cur = cur->next;
-        --count;
+    if(size == 0) {
+        return;
     }
+
+    size_t npos = position % m_baseSize;
+    Node* cur = nodeAt(position);
     size_t bpos = 0;
     size_t ncap = cur->size - npos;
 
@@ -454,67 +810,108 @@ void ByteArray::setPosition(size_t v) {
         m_size = m_position;
     }
     // m_position 和 m_cur的对齐
-    m_cur = m_root;
-    while(v >= m_cur->size) {
-        v -= m_cur->size;
-        m_cur = m_cur->next;
-    }
-    // if(v == m_cur->size) {
-    //     m_cur = m_cur->next;
-    // }
+    m_cur = nodeAt(v);
 }
 
-bool ByteArray::writeToFile(const std::string& name) const {
-    std::ofstream ofs;
-    ofs.open(name, std::ios::trunc | std::ios::binary);
-    if(!ofs) {
-        SYLAR_LOG_ERROR(g_logger) << "writeToFile name=" << name
-            << " error , errno=" << errno << " errstr=" << strerror(errno);
-        return false;
-    }
+ByteArray::Node* ByteArray::nodeAt(size_t position) const {
+    size_t idx = position / m_baseSize;
+    return idx < m_nodes.size() ? m_nodes[idx] : nullptr;
+}
 
-    int64_t read_size = getReadSize();
-    int64_t pos = m_position;
-    Node* cur = m_cur;
+void ByteArray::writeAt(size_t position, const void* buf, size_t size) {
+    if(size == 0) {
+        return;
+    }
+    checkWritable();
+    if(position > m_size || size > (m_size - position)) {
+        throw std::out_of_range("writeAt out of range");
+    }
 
-    // 注意全部都没修改类成员，写入的时候是直接以m_baseSize单位写入
-    while(read_size > 0) {
-        int diff = pos % m_baseSize;
-        int64_t len = (read_size > (int64_t)m_baseSize ? m_baseSize : read_size) - diff;
-        ofs.write(cur->ptr + diff, len);
+    size_t npos = position % m_baseSize;
+    Node* cur = nodeAt(position);
+    size_t bpos = 0;
+    while(size > 0) {
+        size_t n = std::min(size, cur->size - npos);
+        memcpy(cur->ptr + npos, (const char*)buf + bpos, n);
+        bpos += n;
+        size -= n;
         cur = cur->next;
-        pos += len;
-        read_size -= len;
+        npos = 0;
     }
+}
 
-    // while(read_size > 0) {
-    //     int diff = pos % m_baseSize;
-    //     int64_t len =  (m_baseSize - diff) >= read_size ? read_size : (m_baseSize - diff);
-    //     ofs.write(cur->ptr + diff, len);
-    //     if(len == (m_baseSize - diff)) {
-    //         cur = cur->next;
-    //     }
-    //     pos += len;
-    //     read_size -= len;
-    // }
+void ByteArray::writeFuint16At(size_t position, uint16_t value) {
+    if(m_endian != SYLAR_BYTE_ORDER) {
+        value = byteswap(value);
+    }
+    writeAt(position, &value, sizeof(value));
+}
 
-    return true;
+void ByteArray::writeFuint32At(size_t position, uint32_t value) {
+    if(m_endian != SYLAR_BYTE_ORDER) {
+        value = byteswap(value);
+    }
+    writeAt(position, &value, sizeof(value));
+}
+
+void ByteArray::writeFuint64At(size_t position, uint64_t value) {
+    if(m_endian != SYLAR_BYTE_ORDER) {
+        value = byteswap(value);
+    }
+    writeAt(position, &value, sizeof(value));
+}
+
+bool ByteArray::writeToFile(const std::string& name, bool direct) const {
+    ByteArrayFileWriter writer;
+    if(!writer.open(name, false, direct)) {
+        return false;
+    }
+    return writer.write(*this) && writer.close();
 }
 
 bool ByteArray::readFromFile(const std::string& name) {
-    std::ifstream ifs;
-    ifs.open(name, std::ios::binary);
-    if(!ifs) {
+    int fd = ::open(name.c_str(), O_RDONLY);
+    if(fd == -1) {
         SYLAR_LOG_ERROR(g_logger) << "readFromFile name=" << name
             << " error, errno=" << errno << " errstr=" << strerror(errno);
         return false;
     }
+    struct stat st;
+    if(fstat(fd, &st)) {
+        SYLAR_LOG_ERROR(g_logger) << "readFromFile fstat name=" << name
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        ::close(fd);
+        return false;
+    }
 
-    std::shared_ptr<char> buff(new char[m_baseSize], [](char* ptr) { delete[] ptr;});
-    while(!ifs.eof()) {
-        ifs.read(buff.get(), m_baseSize);
-        write(buff.get(), ifs.gcount());
+    // 先按st_size一次扩容后直接readv到内存块中,不经过临时缓存;
+    // st_size不可信(/proc文件、管道为0,文件还在追加),之后按块继续读到EOF
+    uint64_t want = S_ISREG(st.st_mode) ? st.st_size : 0;
+    std::vector<iovec> iovs;
+    while(true) {
+        if(want == 0) {
+            want = m_baseSize;
+        }
+        // 每次最多IOV_MAX个内存块,避免大文件每轮都重新生成全部iovec
+        iovs.clear();
+        getWriteBuffers(iovs, std::min<uint64_t>(want, (uint64_t)(IOV_MAX - 1) * m_baseSize));
+        ssize_t rt = ::readv(fd, &iovs[0], std::min<size_t>(iovs.size(), IOV_MAX));
+        if(rt == -1 && errno == EINTR) {
+            continue;
+        }
+        if(rt < 0) {
+            SYLAR_LOG_ERROR(g_logger) << "readFromFile readv name=" << name
+                << " error, errno=" << errno << " errstr=" << strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        if(rt == 0) {
+            break;
+        }
+        setPosition(m_position + rt);
+        want = want > (uint64_t)rt ? want - rt : 0;
     }
+    ::close(fd);
     return true;
 }
 
@@ -531,10 +928,7 @@ void ByteArray::addCapacity(size_t size) {
     size = size - old_cap;
     // size_t count = ceil(1.0 * size / m_baseSize);
     size_t count = (size / m_baseSize) + ((size % m_baseSize) ? 1 : 0);
-    Node* tmp = m_root;
-    while(tmp->next) {
-        tmp = tmp->next;
-    }
+    Node* tmp = m_nodes.back();
 
     Node* first = NULL;
     for(size_t i = 0; i < count; ++i) {
@@ -543,6 +937,7 @@ void ByteArray::addCapacity(size_t size) {
             first = tmp->next;
         }
         tmp = tmp->next;
+        m_nodes.push_back(tmp);
         m_capacity += m_baseSize;
     }
 
@@ -614,18 +1009,13 @@ uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers
     if(position > m_size) {
         throw std::out_of_range("position out of size");
     }
-    if(len == 0) return 0;
     len = len > (m_size - position) ? (m_size - position) : len;
+    if(len == 0) return 0;
 
     uint64_t size = len;
 
     size_t npos = position % m_baseSize;
-    size_t count = position / m_baseSize;
-    Node* cur = m_root;
-    while(count > 0) {
-        cur = cur->next;
-        --count;
-    }
+    Node* cur = nodeAt(position);
     size_t ncap = cur->size - npos;
     struct iovec iov;
     while(len > 0) {
@@ -650,6 +1040,7 @@ uint64_t ByteArray::getWriteBuffers(std::vector<iovec>& buffers, uint64_t len) {
     if(len == 0) {
         return 0;
     }
+    checkWritable();
     addCapacity(len);
     uint64_t size = len;
 
@@ -676,4 +1067,150 @@ uint64_t ByteArray::getWriteBuffers(std::vector<iovec>& buffers, uint64_t len) {
     return size;
 }
 
+ByteArrayFileWriter::ByteArrayFileWriter(size_t buffer_size)
+    :m_fd(-1)
+    ,m_direct(false)
+    ,m_buffer(nullptr)
+    ,m_bufferSize((buffer_size + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE)
+    ,m_bufferUsed(0)
+    ,m_size(0) {
+    if(m_bufferSize == 0) {
+        m_bufferSize = ALIGN_SIZE;
+    }
+    void* ptr = nullptr;
+    if(posix_memalign(&ptr, ALIGN_SIZE, m_bufferSize)) {
+        throw std::bad_alloc();
+    }
+    m_buffer = (char*)ptr;
+}
+
+ByteArrayFileWriter::~ByteArrayFileWriter() {
+    close();
+    free(m_buffer);
+}
+
+bool ByteArrayFileWriter::open(const std::string& name, bool append, bool direct) {
+    close();
+    m_name = name;
+    m_size = 0;
+    m_bufferUsed = 0;
+    int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+    m_direct = false;
+    if(direct) {
+        m_fd = ::open(name.c_str(), flags | O_DIRECT, 0644);
+        if(m_fd != -1) {
+            m_direct = true;
+            struct stat st;
+            // 追加位置没对齐时O_DIRECT写不了
+            if(append && (fstat(m_fd, &st) || st.st_size % ALIGN_SIZE)) {
+                fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+                m_direct = false;
+            }
+        } else if(errno != EINVAL) {
+            SYLAR_LOG_ERROR(g_logger) << "ByteArrayFileWriter open name=" << name
+                << " error, errno=" << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        if(!m_direct) {
+            SYLAR_LOG_INFO(g_logger) << "ByteArrayFileWriter name=" << name
+                << " O_DIRECT not available, use buffered write";
+        }
+    }
+    if(m_fd == -1) {
+        m_fd = ::open(name.c_str(), flags, 0644);
+    }
+    if(m_fd == -1) {
+        SYLAR_LOG_ERROR(g_logger) << "ByteArrayFileWriter open name=" << name
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool ByteArrayFileWriter::writeAll(const char* buf, size_t len) {
+    while(len > 0) {
+        ssize_t rt = ::write(m_fd, buf, len);
+        if(rt == -1 && errno == EINTR) {
+            continue;
+        }
+        if(rt <= 0) {
+            SYLAR_LOG_ERROR(g_logger) << "ByteArrayFileWriter write name=" << m_name
+                << " error, errno=" << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        buf += rt;
+        len -= rt;
+    }
+    return true;
+}
+
+bool ByteArrayFileWriter::write(const void* buf, size_t len) {
+    if(m_fd == -1) {
+        return false;
+    }
+    const char* ptr = (const char*)buf;
+    m_size += len;
+    while(len > 0) {
+        if(m_bufferUsed == 0 && !m_direct && len >= m_bufferSize) {
+            // 大块数据直接写,省一次拷贝
+            return writeAll(ptr, len);
+        }
+        size_t n = std::min(len, m_bufferSize - m_bufferUsed);
+        memcpy(m_buffer + m_bufferUsed, ptr, n);
+        m_bufferUsed += n;
+        ptr += n;
+        len -= n;
+        if(m_bufferUsed == m_bufferSize) {
+            if(!writeAll(m_buffer, m_bufferUsed)) {
+                return false;
+            }
+            m_bufferUsed = 0;
+        }
+    }
+    return true;
+}
+
+bool ByteArrayFileWriter::write(const ByteArray& ba) {
+    std::vector<iovec> iovs;
+    ba.getReadBuffers(iovs);
+    for(auto& i : iovs) {
+        if(!write(i.iov_base, i.iov_len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ByteArrayFileWriter::flush() {
+    if(m_fd == -1) {
+        return false;
+    }
+    size_t len = m_direct ? m_bufferUsed / ALIGN_SIZE * ALIGN_SIZE : m_bufferUsed;
+    if(len == 0) {
+        return true;
+    }
+    if(!writeAll(m_buffer, len)) {
+        return false;
+    }
+    memmove(m_buffer, m_buffer + len, m_bufferUsed - len);
+    m_bufferUsed -= len;
+    return true;
+}
+
+bool ByteArrayFileWriter::close() {
+    if(m_fd == -1) {
+        return true;
+    }
+    bool rt = flush();
+    if(rt && m_bufferUsed) {
+        // 不足一个对齐块的尾部关掉O_DIRECT再写
+        fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+        rt = writeAll(m_buffer, m_bufferUsed);
+    }
+    m_bufferUsed = 0;
+    ::close(m_fd);
+    m_fd = -1;
+    return rt;
+}
+
 }
@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <vector>
+#include "noncopyable.h"
 
 namespace sylar {
 
@@ -60,6 +61,18 @@ public:
      */
     ~ByteArray();
 
+    /**
+     * @brief 以只读方式mmap文件的[offset, offset + length)区域,不拷贝数据
+     * @param[in] name 文件名
+     * @param[in] offset 区域起始位置
+     * @param[in] length 区域长度,超过文件大小时截断到文件末尾
+     * @return 成功返回只读的ByteArray(m_position = 0, m_size = 区域长度),失败返回nullptr
+     * @attention 只读ByteArray的写操作抛出 std::logic_error;
+     *            区域为空时返回普通的空ByteArray
+     */
+    static ByteArray::ptr MapFile(const std::string& name, uint64_t offset = 0
+                                  ,uint64_t length = ~0ull);
+
     /**
      * @brief 写入固定长度int8_t类型的数据
      * @post m_position += sizeof(value)
@@ -140,6 +153,24 @@ public:
      */
     void writeUint64 (uint64_t value);
 
+    /**
+     * @brief 批量写入无符号Varint32类型的数据
+     * @param[in] values 数据数组
+     * @param[in] count 数据个数
+     * @post m_position += 实际占用内存(count ~ 5 * count)
+     *       如果m_position > m_size 则 m_size = m_position
+     */
+    void writeUint32Array(const uint32_t* values, size_t count);
+
+    /**
+     * @brief 批量写入无符号Varint64类型的数据
+     * @param[in] values 数据数组
+     * @param[in] count 数据个数
+     * @post m_position += 实际占用内存(count ~ 10 * count)
+     *       如果m_position > m_size 则 m_size = m_position
+     */
+    void writeUint64Array(const uint64_t* values, size_t count);
+
     /**
      * @brief 写入float类型的数据
      * @post m_position += sizeof(value)
@@ -285,6 +316,24 @@ public:
      */
     uint64_t readUint64();
 
+    /**
+     * @brief 批量读取无符号Varint32类型的数据
+     * @param[out] values 数据数组,至少容纳count个元素
+     * @param[in] count 读取个数
+     * @post m_position += count个无符号Varint32实际占用内存
+     * @exception 如果数据不足count个 抛出 std::out_of_range(此前读出的数据已写入values)
+     */
+    void readUint32Array(uint32_t* values, size_t count);
+
+    /**
+     * @brief 批量读取无符号Varint64类型的数据
+     * @param[out] values 数据数组,至少容纳count个元素
+     * @param[in] count 读取个数
+     * @post m_position += count个无符号Varint64实际占用内存
+     * @exception 如果数据不足count个 抛出 std::out_of_range(此前读出的数据已写入values)
+     */
+    void readUint64Array(uint64_t* values, size_t count);
+
     /**
      * @brief 读取float类型的数据
      * @pre getReadSize() >= sizeof(float)
@@ -339,6 +388,13 @@ public:
      */
     void clear();
 
+    /**
+     * @brief 丢弃[0, m_position)的数据，剩余数据前移到开头
+     * @details 已经分配的内存块保留下来复用，适合作为连接的接收缓冲区反复使用
+     * @post m_position = 0, m_size = 原来的getReadSize()
+     */
+    void compact();
+
     /**
      * @brief 写入size长度的数据
      * @param[in] buf 内存缓存指针
@@ -365,6 +421,34 @@ public:
      */
     void read(void* buf, size_t size, size_t position) const;
 
+    /**
+     * @brief 在指定位置覆盖写入size长度的数据,用于回填长度字段
+     * @param[in] position 写入开始位置
+     * @param[in] buf 内存缓存指针
+     * @param[in] size 数据大小
+     * @post m_position, m_size 不变
+     * @exception 如果 position + size > m_size 则抛出 std::out_of_range
+     */
+    void writeAt(size_t position, const void* buf, size_t size);
+
+    /**
+     * @brief 在指定位置覆盖写入固定长度uint16_t类型的数据(按当前字节序)
+     * @exception 如果 position + 2 > m_size 则抛出 std::out_of_range
+     */
+    void writeFuint16At(size_t position, uint16_t value);
+
+    /**
+     * @brief 在指定位置覆盖写入固定长度uint32_t类型的数据(按当前字节序)
+     * @exception 如果 position + 4 > m_size 则抛出 std::out_of_range
+     */
+    void writeFuint32At(size_t position, uint32_t value);
+
+    /**
+     * @brief 在指定位置覆盖写入固定长度uint64_t类型的数据(按当前字节序)
+     * @exception 如果 position + 8 > m_size 则抛出 std::out_of_range
+     */
+    void writeFuint64At(size_t position, uint64_t value);
+
     /**
      * @brief 返回ByteArray当前位置
      */
@@ -378,17 +462,25 @@ public:
     void setPosition(size_t v);
 
     /**
-     * @brief 把ByteArray的数据写入到文件中
+     * @brief 把ByteArray的数据[m_position, m_size)写入到文件中
      * @param[in] name 文件名
+     * @param[in] direct 是否使用O_DIRECT写入
      */
-    bool writeToFile(const std::string& name) const;
+    bool writeToFile(const std::string& name, bool direct = false) const;
 
     /**
-     * @brief 从文件中读取数据
+     * @brief 从文件中读取数据,写入到m_position处
+     * @details 一直读到EOF,st_size为0的/proc文件、管道也能读全
      * @param[in] name 文件名
+     * @post m_position += 读到的大小, 如果m_position > m_size 则 m_size = m_position
      */
     bool readFromFile(const std::string& name);
 
+    /**
+     * @brief 是否是只读的(MapFile创建)
+     */
+    bool isReadOnly() const { return m_readonly;}
+
     /**
      * @brief 返回内存块的大小
      */
@@ -450,7 +542,20 @@ public:
      */
     size_t getSize() const { return m_size;}
 private:
-    
+    /**
+     * @brief 使用外部内存构造只读ByteArray(MapFile使用)
+     * @param[in] data 数据地址
+     * @param[in] size 数据大小
+     * @param[in] map_addr mmap返回的地址
+     * @param[in] map_len mmap的长度
+     */
+    ByteArray(char* data, size_t size, void* map_addr, size_t map_len);
+
+    /**
+     * @brief 只读时抛出 std::logic_error
+     */
+    void checkWritable() const;
+
     /**
      * @brief 扩容ByteArray,使其可以容纳size个数据(如果原本可以可以容纳,则不扩容)
      */
@@ -460,6 +565,41 @@ private:
      * @brief 获取当前的可写入容量
      */
     size_t getCapacity() const { return m_capacity - m_position;}
+
+    /**
+     * @brief 在当前内存块内前移len个字节,到达块尾时切换到下一个内存块
+     * @pre len <= 当前内存块剩余大小
+     */
+    void forwardInNode(size_t len);
+
+    /**
+     * @brief 写入一个Varint,当前内存块放得下时直接编码到块内
+     */
+    template<class T, size_t MaxLen>
+    void writeVarint(T value);
+
+    /**
+     * @brief 读取一个Varint,完整位于当前内存块时直接从块内解码
+     */
+    template<class T, size_t MaxLen>
+    T readVarint();
+
+    /**
+     * @brief 批量写入Varint,按内存块连续编码,只有跨块的数据走write()
+     */
+    template<class T, size_t MaxLen>
+    void writeVarintArray(const T* values, size_t count);
+
+    /**
+     * @brief 批量读取Varint,按内存块连续解码,只有跨块的数据走readVarint()
+     */
+    template<class T, size_t MaxLen>
+    void readVarintArray(T* values, size_t count);
+
+    /**
+     * @brief 返回position所在的内存块,position == 容量时返回nullptr
+     */
+    Node* nodeAt(size_t position) const;
 private:
     /// 内存块的大小
     size_t m_baseSize;
@@ -475,6 +615,99 @@ private:
     Node* m_root;
     /// 当前操作的内存块指针
     Node* m_cur;
+    /// 内存块索引,m_nodes[i]为第i个内存块,定位O(1)
+    std::vector<Node*> m_nodes;
+    /// 是否只读
+    bool m_readonly;
+    /// mmap的地址
+    void* m_mapAddr;
+    /// mmap的长度
+    size_t m_mapLen;
+};
+
+/**
+ * @brief 顺序写文件,把小块数据攒成按块对齐的大块后再写入,可选O_DIRECT
+ */
+class ByteArrayFileWriter : Noncopyable {
+public:
+    typedef std::shared_ptr<ByteArrayFileWriter> ptr;
+
+    /// O_DIRECT要求的对齐大小
+    static const size_t ALIGN_SIZE = 4096;
+
+    /**
+     * @brief 构造函数
+     * @param[in] buffer_size 缓存大小,向上对齐到ALIGN_SIZE
+     */
+    ByteArrayFileWriter(size_t buffer_size = 1024 * 1024);
+
+    /**
+     * @brief 析构函数,未关闭时自动close()
+     */
+    ~ByteArrayFileWriter();
+
+    /**
+     * @brief 打开文件
+     * @param[in] name 文件名
+     * @param[in] append true追加写入, false清空文件
+     * @param[in] direct 是否使用O_DIRECT,文件系统不支持或者追加位置未对齐时退化为普通写
+     */
+    bool open(const std::string& name, bool append = true, bool direct = false);
+
+    /**
+     * @brief 写入len长度的数据
+     */
+    bool write(const void* buf, size_t len);
+
+    /**
+     * @brief 写入ByteArray的数据[position, size),不改变ByteArray的position
+     */
+    bool write(const ByteArray& ba);
+
+    /**
+     * @brief 把缓存中完整的对齐块写入文件
+     */
+    bool flush();
+
+    /**
+     * @brief 写入剩余数据并关闭文件
+     */
+    bool close();
+
+    /**
+     * @brief 是否打开
+     */
+    bool isOpen() const { return m_fd != -1;}
+
+    /**
+     * @brief 是否使用O_DIRECT
+     */
+    bool isDirect() const { return m_direct;}
+
+    /**
+     * @brief 返回已写入的数据长度(包括缓存中的)
+     */
+    uint64_t getSize() const { return m_size;}
+private:
+    /**
+     * @brief 把[buf, buf + len)全部写入文件
+     */
+    bool writeAll(const char* buf, size_t len);
+private:
+    /// 文件名
+    std::string m_name;
+    /// 文件句柄
+    int m_fd;
+    /// 是否使用O_DIRECT
+    bool m_direct;
+    /// 对齐的缓存
+    char* m_buffer;
+    /// 缓存大小
+    size_t m_bufferSize;
+    /// 缓存中的数据大小
+    size_t m_bufferUsed;
+    /// 已写入的数据长度
+    uint64_t m_size;
 };
 
 }
@@ -0,0 +1,158 @@
+#include "channel.h"
+#include "macro.h"
+#include <algorithm>
+
+namespace sylar {
+
+/**
+ * @brief select等待时登记到各个通道上的唤醒器
+ */
+class ChannelWaker : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    ChannelWaker()
+        :m_fired(false)
+        ,m_waiters(m_mutex) {
+    }
+
+    /**
+     * @brief 通道状态变化时调用，调用方持有通道的m_mutex
+     */
+    void fire() {
+        FiberWaitQueue::WakeList wakes;
+        MutexType::Lock lock(m_mutex);
+        m_fired = true;
+        m_waiters.notifyAll(wakes);
+    }
+
+    /**
+     * @brief 重新尝试之前清掉标记，之后的变化都会再次触发
+     */
+    void reset() {
+        MutexType::Lock lock(m_mutex);
+        m_fired = false;
+    }
+
+    /**
+     * @brief 等待被触发
+     */
+    void wait(uint64_t timeout_ms) {
+        MutexType::Lock lock(m_mutex);
+        if(m_fired) {
+            return;
+        }
+        m_waiters.wait(lock, timeout_ms);
+    }
+private:
+    MutexType m_mutex;
+    bool m_fired;
+    FiberWaitQueue m_waiters;
+};
+
+ChannelBase::ChannelBase(size_t capacity)
+    :m_capacity(capacity)
+    ,m_closed(false)
+    ,m_sendWaiters(m_mutex)
+    ,m_recvWaiters(m_mutex) {
+}
+
+ChannelBase::~ChannelBase() {
+}
+
+void ChannelBase::close() {
+    FiberWaitQueue::WakeList wakes;
+    MutexType::Lock lock(m_mutex);
+    if(m_closed) {
+        return;
+    }
+    m_closed = true;
+    m_sendWaiters.notifyAll(wakes);
+    m_recvWaiters.notifyAll(wakes);
+    notifyWatchers();
+}
+
+uint64_t ChannelBase::Deadline(uint64_t timeout_ms) {
+    if(timeout_ms == ~0ull || timeout_ms == 0) {
+        return timeout_ms;
+    }
+    return GetCurrentMS() + timeout_ms;
+}
+
+bool ChannelBase::RemainMS(uint64_t deadline, uint64_t& wait_ms) {
+    if(deadline == ~0ull) {
+        wait_ms = ~0ull;
+        return true;
+    }
+    uint64_t now = GetCurrentMS();
+    if(deadline == 0 || now >= deadline) {
+        return false;
+    }
+    wait_ms = deadline - now;
+    return true;
+}
+
+void ChannelBase::doNotifyWatchers() {
+    for(auto& i : m_watchers) {
+        i->fire();
+    }
+}
+
+void ChannelBase::addWatcher(const std::shared_ptr<ChannelWaker>& waker) {
+    MutexType::Lock lock(m_mutex);
+    m_watchers.push_back(waker);
+}
+
+void ChannelBase::delWatcher(const std::shared_ptr<ChannelWaker>& waker) {
+    MutexType::Lock lock(m_mutex);
+    auto it = std::find(m_watchers.begin(), m_watchers.end(), waker);
+    if(it != m_watchers.end()) {
+        m_watchers.erase(it);
+    }
+}
+
+int ChannelSelect::tryOnce() {
+    // 轮转起点，避免总是前面的分支优先
+    static thread_local uint32_t s_start = 0;
+    size_t size = m_cases.size();
+    size_t start = s_start++;
+    for(size_t i = 0; i < size; ++i) {
+        size_t idx = (start + i) % size;
+        if(m_cases[idx].attempt() != ChannelBase::NOT_READY) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+int ChannelSelect::wait(uint64_t timeout_ms) {
+    SYLAR_ASSERT(!m_cases.empty());
+    int rt = tryOnce();
+    if(rt >= 0 || timeout_ms == 0) {
+        return rt;
+    }
+    uint64_t deadline = ChannelBase::Deadline(timeout_ms);
+    std::shared_ptr<ChannelWaker> waker(new ChannelWaker);
+    for(auto& i : m_cases) {
+        i.channel->addWatcher(waker);
+    }
+    while(true) {
+        // 先清标记再尝试，尝试之后的任何变化都能唤醒
+        waker->reset();
+        rt = tryOnce();
+        if(rt >= 0) {
+            break;
+        }
+        uint64_t wait_ms = ~0ull;
+        if(!ChannelBase::RemainMS(deadline, wait_ms)) {
+            break;
+        }
+        waker->wait(wait_ms);
+    }
+    for(auto& i : m_cases) {
+        i.channel->delWatcher(waker);
+    }
+    return rt;
+}
+
+}
@@ -0,0 +1,537 @@
+/**
+ * @file channel.h
+ * @brief 协程间传递消息的通道，类似golang的chan
+ * @details Channel<T>支持有界/无界容量，满或者空时只挂起当前协程；
+ *          ChannelSelect同时等待多个Channel(可带超时)；
+ *          SpscChannel<T>是单生产者单消费者的无锁环形队列
+ */
+#ifndef __SYLAR_CHANNEL_H__
+#define __SYLAR_CHANNEL_H__
+
+#include <deque>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <stdint.h>
+
+#include "noncopyable.h"
+#include "mutex.h"
+#include "fiber_sync.h"
+#include "util.h"
+
+namespace sylar {
+
+class ChannelSelect;
+class ChannelWaker;
+
+/**
+ * @brief Channel的公共部分(锁、等待队列、关闭状态、select的监听者)
+ */
+class ChannelBase : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 非阻塞操作/单次尝试的结果
+     */
+    enum Status {
+        /// 成功
+        OK = 0,
+        /// 满(send)或者空(recv)，或者等待超时
+        NOT_READY = 1,
+        /// 已关闭
+        CLOSED = 2
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量，0表示无界
+     */
+    ChannelBase(size_t capacity);
+
+    /**
+     * @brief 析构函数
+     */
+    virtual ~ChannelBase();
+
+    /**
+     * @brief 关闭通道
+     * @details 之后的send都失败，recv取完剩余的消息后失败，所有等待者都被唤醒
+     */
+    void close();
+
+    /**
+     * @brief 是否已关闭
+     */
+    bool isClosed() const { return m_closed;}
+
+    /**
+     * @brief 返回容量，0表示无界
+     */
+    size_t getCapacity() const { return m_capacity;}
+protected:
+    /**
+     * @brief 通道状态变化(有消息、有空位、关闭)，唤醒正在select的协程，调用方持有m_mutex
+     */
+    void notifyWatchers() {
+        if(!m_watchers.empty()) {
+            doNotifyWatchers();
+        }
+    }
+
+    /**
+     * @brief 计算剩余等待时间
+     * @param[in] deadline 截止时间(毫秒)，~0ull表示不超时
+     * @param[out] wait_ms 剩余等待时间
+     * @return 已经超时返回false
+     */
+    static bool RemainMS(uint64_t deadline, uint64_t& wait_ms);
+
+    /**
+     * @brief 根据超时时间计算截止时间
+     */
+    static uint64_t Deadline(uint64_t timeout_ms);
+private:
+    void doNotifyWatchers();
+    void addWatcher(const std::shared_ptr<ChannelWaker>& waker);
+    void delWatcher(const std::shared_ptr<ChannelWaker>& waker);
+    friend class ChannelSelect;
+protected:
+    MutexType m_mutex;
+    /// 容量，0表示无界
+    size_t m_capacity;
+    /// 是否已关闭
+    std::atomic<bool> m_closed;
+    /// 等待空位的发送者
+    FiberWaitQueue m_sendWaiters;
+    /// 等待消息的接收者
+    FiberWaitQueue m_recvWaiters;
+private:
+    /// 正在select这个通道的协程
+    std::vector<std::shared_ptr<ChannelWaker> > m_watchers;
+};
+
+/**
+ * @brief 多生产者多消费者通道
+ * @details 发送者满时挂起，接收者空时挂起，都只挂起协程不阻塞线程。
+ *          无界通道的send永远不会挂起，可以在普通线程里调用；
+ *          try*系列在任何线程都可以调用；
+ *          带超时的接口需要在IOManager中调用。
+ *          不支持golang容量为0的同步交接语义
+ */
+template<class T>
+class Channel : public ChannelBase {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量，0表示无界
+     */
+    Channel(size_t capacity = 0)
+        :ChannelBase(capacity) {
+    }
+
+    /**
+     * @brief 发送，满时挂起
+     * @return 通道已关闭返回false
+     */
+    bool send(const T& v) { return doSend(v, ~0ull) == OK;}
+    bool send(T&& v) { return doSend(std::move(v), ~0ull) == OK;}
+
+    /**
+     * @brief 带超时的发送
+     * @return 成功返回true，超时或者已关闭返回false
+     */
+    bool sendFor(const T& v, uint64_t timeout_ms) { return doSend(v, timeout_ms) == OK;}
+    bool sendFor(T&& v, uint64_t timeout_ms) { return doSend(std::move(v), timeout_ms) == OK;}
+
+    /**
+     * @brief 尝试发送，不等待
+     */
+    bool trySend(const T& v) { return doSend(v, 0) == OK;}
+    bool trySend(T&& v) { return doSend(std::move(v), 0) == OK;}
+
+    /**
+     * @brief 接收，空时挂起
+     * @return 通道已关闭并且没有剩余消息时返回false
+     */
+    bool recv(T& v) { return doRecv(v, ~0ull) == OK;}
+
+    /**
+     * @brief 带超时的接收
+     * @return 成功返回true，超时或者已关闭(并且取完)返回false
+     */
+    bool recvFor(T& v, uint64_t timeout_ms) { return doRecv(v, timeout_ms) == OK;}
+
+    /**
+     * @brief 尝试接收，不等待
+     */
+    bool tryRecv(T& v) { return doRecv(v, 0) == OK;}
+
+    /**
+     * @brief 当前消息数
+     */
+    size_t size() {
+        MutexType::Lock lock(m_mutex);
+        return m_queue.size();
+    }
+private:
+    bool isFull() const {
+        return m_capacity && m_queue.size() >= m_capacity;
+    }
+
+    template<class V>
+    Status doSend(V&& v, uint64_t timeout_ms) {
+        uint64_t deadline = Deadline(timeout_ms);
+        FiberWaitQueue::WakeList wakes;
+        MutexType::Lock lock(m_mutex);
+        while(true) {
+            if(m_closed) {
+                return CLOSED;
+            }
+            if(!isFull()) {
+                break;
+            }
+            uint64_t wait_ms = ~0ull;
+            if(!RemainMS(deadline, wait_ms)) {
+                return NOT_READY;
+            }
+            m_sendWaiters.wait(lock, wait_ms);
+            lock.lock();
+        }
+        m_queue.push_back(std::forward<V>(v));
+        m_recvWaiters.notifyOne(wakes);
+        notifyWatchers();
+        return OK;
+    }
+
+    Status doRecv(T& v, uint64_t timeout_ms) {
+        uint64_t deadline = Deadline(timeout_ms);
+        FiberWaitQueue::WakeList wakes;
+        MutexType::Lock lock(m_mutex);
+        while(true) {
+            if(!m_queue.empty()) {
+                break;
+            }
+            if(m_closed) {
+                return CLOSED;
+            }
+            uint64_t wait_ms = ~0ull;
+            if(!RemainMS(deadline, wait_ms)) {
+                return NOT_READY;
+            }
+            m_recvWaiters.wait(lock, wait_ms);
+            lock.lock();
+        }
+        v = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_sendWaiters.notifyOne(wakes);
+        notifyWatchers();
+        return OK;
+    }
+
+    friend class ChannelSelect;
+private:
+    std::deque<T> m_queue;
+};
+
+/**
+ * @brief 同时等待多个Channel，类似golang的select
+ * @details 先按轮转的起点依次尝试每个分支，都没就绪时在所有通道上登记，
+ *          任一通道状态变化就醒来重新尝试。
+ *          接收分支在通道关闭并取完后就绪(ok为false)，发送分支在通道关闭后就绪(ok为false)
+ * @code
+ *  int a; std::string b;
+ *  ChannelSelect sel;
+ *  sel.recv(*ch1, a).recv(*ch2, b);
+ *  switch(sel.wait(100)) {
+ *      case 0: ...; break;    // 收到a
+ *      case 1: ...; break;    // 收到b
+ *      default: ...; break;   // 超时
+ *  }
+ * @endcode
+ */
+class ChannelSelect : Noncopyable {
+public:
+    /**
+     * @brief 添加接收分支
+     * @param[in] ch 通道
+     * @param[out] v 收到的消息
+     * @param[out] ok 分支就绪时，收到消息为true，通道已关闭为false
+     */
+    template<class T>
+    ChannelSelect& recv(Channel<T>& ch, T& v, bool* ok = nullptr) {
+        Channel<T>* c = &ch;
+        T* pv = &v;
+        m_cases.push_back(Case(c, [c, pv, ok]() {
+            ChannelBase::Status s = c->doRecv(*pv, 0);
+            if(ok) {
+                *ok = s == ChannelBase::OK;
+            }
+            return s;
+        }));
+        return *this;
+    }
+
+    /**
+     * @brief 添加发送分支
+     * @param[in] ch 通道
+     * @param[in] v 要发送的消息，分支就绪前不会被修改
+     * @param[out] ok 分支就绪时，发送成功为true，通道已关闭为false
+     */
+    template<class T>
+    ChannelSelect& send(Channel<T>& ch, const T& v, bool* ok = nullptr) {
+        Channel<T>* c = &ch;
+        const T* pv = &v;
+        m_cases.push_back(Case(c, [c, pv, ok]() {
+            ChannelBase::Status s = c->doSend(*pv, 0);
+            if(ok) {
+                *ok = s == ChannelBase::OK;
+            }
+            return s;
+        }));
+        return *this;
+    }
+
+    /**
+     * @brief 等待任一分支就绪并执行它
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时，0表示只尝试一次
+     * @return 就绪分支的下标(按添加顺序)，超时返回-1
+     */
+    int wait(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 只尝试一次，相当于golang select的default分支
+     */
+    int tryWait() { return wait(0);}
+private:
+    /// 尝试一次，返回就绪分支的下标，没有返回-1
+    int tryOnce();
+private:
+    struct Case {
+        Case(ChannelBase* c, std::function<ChannelBase::Status()> t)
+            :channel(c)
+            ,attempt(t) {
+        }
+        ChannelBase* channel;
+        std::function<ChannelBase::Status()> attempt;
+    };
+    std::vector<Case> m_cases;
+};
+
+/**
+ * @brief 单生产者单消费者的无锁通道
+ * @details 固定容量(向上取2的幂)的环形队列，收发的快速路径只有原子读写。
+ *          满/空时才进入慢路径挂起协程，对端通过一个等待标记决定是否需要唤醒。
+ *          只能有一个协程发送、一个协程接收(可以在不同线程)，T需要可默认构造
+ */
+template<class T>
+class SpscChannel : Noncopyable {
+public:
+    typedef std::shared_ptr<SpscChannel> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量，向上取2的幂
+     */
+    SpscChannel(size_t capacity)
+        :m_head(0)
+        ,m_cachedTail(0)
+        ,m_tail(0)
+        ,m_cachedHead(0)
+        ,m_closed(false)
+        ,m_sendWaiting(false)
+        ,m_recvWaiting(false)
+        ,m_sendWaiters(m_mutex)
+        ,m_recvWaiters(m_mutex) {
+        size_t size = 2;
+        while(size < capacity) {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_buffer.resize(size);
+    }
+
+    /**
+     * @brief 尝试发送，满或者已关闭返回false
+     */
+    bool trySend(const T& v) { return doTrySend(v);}
+    bool trySend(T&& v) { return doTrySend(std::move(v));}
+
+    /**
+     * @brief 发送，满时挂起，已关闭返回false
+     */
+    bool send(const T& v) { return doSend(v, ~0ull);}
+    bool send(T&& v) { return doSend(std::move(v), ~0ull);}
+
+    /**
+     * @brief 带超时的发送
+     */
+    bool sendFor(const T& v, uint64_t timeout_ms) { return doSend(v, timeout_ms);}
+
+    /**
+     * @brief 尝试接收，空时返回false
+     */
+    bool tryRecv(T& v) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(head == m_cachedTail) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if(head == m_cachedTail) {
+                return false;
+            }
+        }
+        v = std::move(m_buffer[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        wakeup(m_sendWaiting, m_sendWaiters);
+        return true;
+    }
+
+    /**
+     * @brief 接收，空时挂起，已关闭并且取完返回false
+     */
+    bool recv(T& v) { return recvFor(v, ~0ull);}
+
+    /**
+     * @brief 带超时的接收
+     */
+    bool recvFor(T& v, uint64_t timeout_ms) {
+        uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+        while(true) {
+            if(tryRecv(v)) {
+                return true;
+            }
+            if(m_closed) {
+                // 关闭前发送的消息还要取完
+                return tryRecv(v);
+            }
+            if(!park(m_recvWaiting, m_recvWaiters, deadline
+                        ,[this]() { return m_tail.load() != m_head.load(std::memory_order_relaxed);})) {
+                return false;
+            }
+        }
+    }
+
+    /**
+     * @brief 关闭通道，唤醒两端
+     */
+    void close() {
+        FiberWaitQueue::WakeList wakes;
+        MutexType::Lock lock(m_mutex);
+        m_closed = true;
+        m_sendWaiters.notifyAll(wakes);
+        m_recvWaiters.notifyAll(wakes);
+    }
+
+    bool isClosed() const { return m_closed;}
+
+    /**
+     * @brief 返回实际容量
+     */
+    size_t getCapacity() const { return m_mask + 1;}
+private:
+    template<class V>
+    bool doTrySend(V&& v) {
+        if(m_closed) {
+            return false;
+        }
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail - m_cachedHead > m_mask) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if(tail - m_cachedHead > m_mask) {
+                return false;
+            }
+        }
+        m_buffer[tail & m_mask] = std::forward<V>(v);
+        m_tail.store(tail + 1, std::memory_order_release);
+        wakeup(m_recvWaiting, m_recvWaiters);
+        return true;
+    }
+
+    template<class V>
+    bool doSend(V&& v, uint64_t timeout_ms) {
+        uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+        while(true) {
+            if(m_closed) {
+                return false;
+            }
+            if(doTrySend(std::forward<V>(v))) {
+                return true;
+            }
+            if(!park(m_sendWaiting, m_sendWaiters, deadline
+                        ,[this]() { return m_tail.load(std::memory_order_relaxed) - m_head.load() <= m_mask;})) {
+                return false;
+            }
+        }
+    }
+
+    /**
+     * @brief 对端在等待时唤醒它
+     * @details 和park里的标记/检查构成Dekker式的配对，两边都有全屏障，不会丢唤醒
+     */
+    void wakeup(std::atomic<bool>& waiting, FiberWaitQueue& waiters) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiting.load(std::memory_order_relaxed)) {
+            FiberWaitQueue::WakeList wakes;
+            MutexType::Lock lock(m_mutex);
+            waiting = false;
+            waiters.notifyAll(wakes);
+        }
+    }
+
+    /**
+     * @brief 慢路径，标记等待后再检查一次，仍然不能继续就挂起
+     * @return 超时返回false，否则返回true(需要重试)
+     */
+    template<class Ready>
+    bool park(std::atomic<bool>& waiting, FiberWaitQueue& waiters, uint64_t deadline, Ready ready) {
+        MutexType::Lock lock(m_mutex);
+        waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(ready() || m_closed) {
+            waiting = false;
+            return true;
+        }
+        uint64_t wait_ms = ~0ull;
+        if(deadline != ~0ull) {
+            uint64_t now = GetCurrentMS();
+            if(now >= deadline) {
+                waiting = false;
+                return false;
+            }
+            wait_ms = deadline - now;
+        }
+        waiters.wait(lock, wait_ms);
+        return true;
+    }
+private:
+    // 消费者写、生产者读的下标和生产者写、消费者读的下标分开放在不同的缓存行
+    char m_pad0[64];
+    /// 下一个要读的位置(消费者写)
+    std::atomic<size_t> m_head;
+    /// 消费者缓存的m_tail，减少跨核读
+    size_t m_cachedTail;
+    char m_pad1[64];
+    /// 下一个要写的位置(生产者写)
+    std::atomic<size_t> m_tail;
+    /// 生产者缓存的m_head
+    size_t m_cachedHead;
+    char m_pad2[64];
+    size_t m_mask;
+    std::vector<T> m_buffer;
+    std::atomic<bool> m_closed;
+    /// 生产者是否在等待空位
+    std::atomic<bool> m_sendWaiting;
+    /// 消费者是否在等待消息
+    std::atomic<bool> m_recvWaiting;
+    MutexType m_mutex;
+    FiberWaitQueue m_sendWaiters;
+    FiberWaitQueue m_recvWaiters;
+};
+
+}
+
+#endif
@@ -2,6 +2,16 @@
 #include<map>
 #include<list>
 #include<utility>
+#include<vector>
+#include<unordered_map>
+#include<unistd.h>
+#include<errno.h>
+#include<string.h>
+#include<poll.h>
+#include<dirent.h>
+#include<sys/stat.h>
+#include<sys/inotify.h>
+#include<sys/eventfd.h>
 
 namespace sylar {
     // 这里的LookupBase和Lookup含义是不一样的，后者是侧重创造方面，前者才更偏向查找含义
@@ -11,56 +21,209 @@ namespace sylar {
         return it == GetDatas().end() ? nullptr:it->second;
     }
 
+    static bool IsValidName(const std::string& name) {
+        return name.find_first_not_of("abcdefghijklmnopqrstuvwxyz._0123456789")
+                == std::string::npos;
+    }
+
+    // 递归比较两个节点的内容，不生成字符串
+    static bool NodeEqual(const YAML::Node& a, const YAML::Node& b) {
+        if(a.Type() != b.Type()) {
+            return false;
+        }
+        switch(a.Type()) {
+            case YAML::NodeType::Scalar:
+                return a.Scalar() == b.Scalar();
+            case YAML::NodeType::Sequence: {
+                if(a.size() != b.size()) {
+                    return false;
+                }
+                for(auto ia = a.begin(), ib = b.begin(); ia != a.end(); ++ia, ++ib) {
+                    if(!NodeEqual(*ia, *ib)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            case YAML::NodeType::Map: {
+                if(a.size() != b.size()) {
+                    return false;
+                }
+                // yaml-cpp按key查找是线性的，先按位置比较，顺序不同时才查找
+                // 迭代器的->每次都构造一对Node，所以先解引用一次
+                for(auto ia = a.begin(), ib = b.begin(); ia != a.end(); ++ia, ++ib) {
+                    const YAML::detail::iterator_value va = *ia;
+                    const YAML::detail::iterator_value vb = *ib;
+                    if(!va.first.IsScalar() || !vb.first.IsScalar()) {
+                        return false;
+                    }
+                    if(va.first.Scalar() == vb.first.Scalar()) {
+                        if(!NodeEqual(va.second, vb.second)) {
+                            return false;
+                        }
+                        continue;
+                    }
+                    const YAML::Node other = b[va.first.Scalar()];
+                    if(!other.IsDefined() || !NodeEqual(va.second, other)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            default:
+                return true;
+        }
+    }
+
     /*
     A:
         a:10
         c:str
-    output的pair:("A.a", 10)，注意这个10是node
-    prefix真就是个前缀
+    "A"对应整个map节点，"A.a"对应10，prefix就是这样拼出来的配置名
 
-    ListAllMember的作用是进行平铺yaml的内容为一个map
+    只收集已经注册过的配置项，和prev相同的子树整个跳过
     */
-    static void ListAllMember(const std::string& prefix, const YAML::Node& node,
-                              std::list<std::pair<std::string, const YAML::Node>>& output) {
-        // prefix不符合定义
-        if(prefix.find_first_not_of("abcdefghijkmlnopkrstuvwxyz._0123456789") 
-                != std::string::npos) {
-            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "config invail name: " << prefix << " : " << node;
+    static void CollectChanged(const std::string& prefix, const YAML::Node& node, const YAML::Node* prev,
+                               const Config::ConfigVarMap& datas,
+                               std::vector<std::pair<ConfigVarBase::ptr, YAML::Node> >& output) {
+        if(prev && NodeEqual(node, *prev)) {
             return;
         }
-        output.push_back(std::make_pair(prefix, node));
+        if(!prefix.empty()) {
+            auto it = datas.find(prefix);
+            if(it != datas.end()) {
+                output.push_back(std::make_pair(it->second, node));
+            }
+        }
 
         // 注意：数组是没法A.a这样的，所以只用判断map
-        if(node.IsMap()) {
-            for(auto it = node.begin(); it != node.end(); ++it) {
-                ListAllMember(prefix.empty() ? it->first.as<std::string>():prefix + "." + it->first.as<std::string>(), it->second, output);
+        if(!node.IsMap()) {
+            return;
+        }
+        // 两次的key一般顺序相同，先按位置对应；对不上时再给prev建索引(yaml-cpp按key查找是线性的)
+        bool prev_map = prev && prev->IsMap();
+        bool indexed = false;
+        YAML::const_iterator pit;
+        if(prev_map) {
+            pit = prev->begin();
+        }
+        std::unordered_map<std::string, YAML::Node> prev_children;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            // 迭代器的->每次都构造一对Node，所以先解引用一次
+            const YAML::detail::iterator_value v = *it;
+            if(!v.first.IsScalar()) {
+                continue;
             }
+            std::string key = v.first.Scalar();
+            YAML::Node child_prev;
+            bool has_prev = false;
+            if(prev_map && !indexed && pit != prev->end()) {
+                const YAML::detail::iterator_value pv = *pit;
+                ++pit;
+                if(pv.first.IsScalar() && pv.first.Scalar() == key) {
+                    child_prev = pv.second;
+                    has_prev = true;
+                } else {
+                    for(auto i = prev->begin(); i != prev->end(); ++i) {
+                        const YAML::detail::iterator_value iv = *i;
+                        if(iv.first.IsScalar()) {
+                            prev_children.insert(std::make_pair(iv.first.Scalar(), iv.second));
+                        }
+                    }
+                    indexed = true;
+                }
+            }
+            if(indexed) {
+                auto i = prev_children.find(key);
+                if(i != prev_children.end()) {
+                    child_prev = i->second;
+                    has_prev = true;
+                }
+            }
+            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+            key = prefix.empty() ? key : prefix + "." + key;
+            if(!IsValidName(key)) {
+                // prefix不符合定义
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "config invail name: " << key << " : " << v.second;
+                continue;
+            }
+            CollectChanged(key, v.second, has_prev ? &child_prev : nullptr, datas, output);
         }
     }
 
-    void Config::LoadFromYaml(const YAML::Node& root) {
-        std::list<std::pair<std::string, const YAML::Node>> all_nodes;
-        ListAllMember("", root, all_nodes);
+    size_t Config::LoadFromYaml(const YAML::Node& root, const YAML::Node& prev) {
+        std::vector<std::pair<ConfigVarBase::ptr, YAML::Node> > changed;
+        {
+            RWMutexType::ReadLock lock(GetMutex());
+            CollectChanged("", root, prev.IsMap() ? &prev : nullptr, GetDatas(), changed);
+        }
 
-        for(auto& i : all_nodes) {
-            std::string key = i.first;
-            if(key.empty()) {
-                continue;
+        // 先全部更新，再统一通知，监听者看到的是一份完整的新配置
+        size_t count = 0;
+        std::vector<std::function<void()> > notifies;
+        for(auto& i : changed) {
+            if(i.first->loadYaml(i.second, notifies)) {
+                ++count;
             }
-            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-            ConfigVarBase::ptr var = LookupBase(key);
+        }
+        for(auto& i : notifies) {
+            i();
+        }
+        return count;
+    }
 
-            // 存在就更新旧值
-            if(var) {
-                if(i.second.IsScalar()) {
-                    var->fromString(i.second.Scalar());
-                } else {
-                    std::stringstream ss;
-                    ss << i.second;
-                    var->fromString(ss.str());
-                }
+    static Mutex& GetFileMutex() {
+        static Mutex s_mutex;
+        return s_mutex;
+    }
+
+    // 每个文件上一次成功加载的内容
+    struct FileState {
+        YAML::Node node;
+        // 加载完时的ConfigVarBase::GetChangeCount()，之后有变化就不能再只做差异
+        uint64_t changes = 0;
+    };
+
+    static std::map<std::string, FileState>& GetFileStates() {
+        static std::map<std::string, FileState> s_states;
+        return s_states;
+    }
+
+    bool Config::LoadFromFile(const std::string& file) {
+        YAML::Node root;
+        try {
+            root = YAML::LoadFile(file);
+        } catch(const std::exception& e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::LoadFromFile file=" << file
+                << " error: " << e.what();
+            return false;
+        }
+
+        YAML::Node prev;
+        {
+            Mutex::Lock lock(GetFileMutex());
+            auto it = GetFileStates().find(file);
+            // 上次加载之后配置被别处改过时不能跳过相同的节点，和当前值逐个比较
+            if(it != GetFileStates().end()
+                    && it->second.changes == ConfigVarBase::GetChangeCount()) {
+                prev = it->second.node;
             }
         }
+        uint64_t ts = GetCurrentUS();
+        uint64_t before = ConfigVarBase::GetChangeCount();
+        size_t count = LoadFromYaml(root, prev);
+        uint64_t after = ConfigVarBase::GetChangeCount();
+        {
+            Mutex::Lock lock(GetFileMutex());
+            FileState& state = GetFileStates()[file];
+            state.node = root;
+            // 变化次数正好是这次加载的，说明期间没有别的修改(包括监听者里的修改)；
+            // 否则记加载前的值，下次加载时和当前值逐个比较
+            state.changes = after == before + count ? after : before;
+        }
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Config::LoadFromFile file=" << file
+            << " changed=" << count << " used=" << (GetCurrentUS() - ts) << "us";
+        return true;
     }
 
     void Config::Visit(std::function<void(ConfigVarBase::ptr)> cb) {
@@ -70,4 +233,131 @@ namespace sylar {
             cb(it->second);
         }
     }
+
+    ConfigWatcher::ConfigWatcher(const std::string& path, uint32_t delay_ms)
+        :m_delay(delay_ms)
+        ,m_inotifyFd(-1)
+        ,m_eventFd(-1)
+        ,m_reloads(0) {
+        struct stat st;
+        if(stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            m_dir = path;
+        } else {
+            size_t pos = path.rfind('/');
+            m_dir = pos == std::string::npos ? "." : (pos ? path.substr(0, pos) : "/");
+            m_file = pos == std::string::npos ? path : path.substr(pos + 1);
+        }
+    }
+
+    ConfigWatcher::~ConfigWatcher() {
+        stop();
+    }
+
+    bool ConfigWatcher::isWatched(const std::string& name) const {
+        if(!m_file.empty()) {
+            return name == m_file;
+        }
+        size_t pos = name.rfind('.');
+        if(pos == std::string::npos) {
+            return false;
+        }
+        std::string ext = name.substr(pos);
+        return ext == ".yml" || ext == ".yaml";
+    }
+
+    bool ConfigWatcher::start() {
+        if(m_thread) {
+            return true;
+        }
+        std::vector<std::string> files;
+        DIR* dir = opendir(m_dir.c_str());
+        if(!dir) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigWatcher opendir(" << m_dir << ") errno="
+                << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        while(struct dirent* dp = readdir(dir)) {
+            if(isWatched(dp->d_name)) {
+                files.push_back(m_dir + "/" + dp->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(files.begin(), files.end());
+        for(auto& i : files) {
+            Config::LoadFromFile(i);
+        }
+
+        m_inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        m_eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(m_inotifyFd < 0 || m_eventFd < 0
+                || inotify_add_watch(m_inotifyFd, m_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigWatcher watch(" << m_dir << ") errno="
+                << errno << " errstr=" << strerror(errno);
+            stop();
+            return false;
+        }
+        m_thread.reset(new Thread(std::bind(&ConfigWatcher::run, this), "config_watch"));
+        return true;
+    }
+
+    void ConfigWatcher::stop() {
+        if(m_thread) {
+            uint64_t v = 1;
+            if(write(m_eventFd, &v, sizeof(v)) != sizeof(v)) {
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigWatcher stop errno=" << errno;
+            }
+            m_thread->join();
+            m_thread.reset();
+        }
+        if(m_inotifyFd >= 0) {
+            close(m_inotifyFd);
+            m_inotifyFd = -1;
+        }
+        if(m_eventFd >= 0) {
+            close(m_eventFd);
+            m_eventFd = -1;
+        }
+    }
+
+    void ConfigWatcher::run() {
+        std::set<std::string> pending;
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        while(true) {
+            struct pollfd fds[2];
+            fds[0].fd = m_inotifyFd;
+            fds[0].events = POLLIN;
+            fds[1].fd = m_eventFd;
+            fds[1].events = POLLIN;
+            int rt = poll(fds, 2, pending.empty() ? -1 : (int)m_delay);
+            if(rt < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigWatcher poll errno=" << errno
+                    << " errstr=" << strerror(errno);
+                return;
+            }
+            if(fds[1].revents) {
+                return;
+            }
+            if(rt == 0) {
+                // 已经安静了delay_ms，把攒下的文件一起重新加载
+                for(auto& i : pending) {
+                    if(Config::LoadFromFile(i)) {
+                        ++m_reloads;
+                    }
+                }
+                pending.clear();
+                continue;
+            }
+            ssize_t len = read(m_inotifyFd, buf, sizeof(buf));
+            for(char* ptr = buf; len > 0 && ptr < buf + len; ) {
+                const struct inotify_event* event = (const struct inotify_event*)ptr;
+                if(event->len && isWatched(event->name)) {
+                    pending.insert(m_dir + "/" + event->name);
+                }
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
 }
\ No newline at end of file
@@ -13,8 +13,12 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <functional>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
 #include "thread.h"
 #include "log.h"
+#include "macro.h"
 
 namespace sylar {
 
@@ -33,7 +37,22 @@ public:
     // 有纯虚函数是抽象类
     virtual std::string toString() = 0;
     virtual bool fromString(const std::string& val) = 0;
+    /*
+    直接从YAML节点更新值，不经过字符串，也不通知监听者
+    值有变化时返回true，并把通知监听者的函数追加到notifies，由调用方统一执行
+    */
+    virtual bool loadYaml(const YAML::Node& node, std::vector<std::function<void()> >& notifies) = 0;
     virtual std::string getTypeName() const = 0;
+
+    // 所有配置项值变化的总次数，LoadFromFile用它判断上次加载之后有没有别处改过配置
+    static uint64_t GetChangeCount() {
+        return ChangeCounter().load(std::memory_order_acquire);
+    }
+protected:
+    static std::atomic<uint64_t>& ChangeCounter() {
+        static std::atomic<uint64_t> s_count(0);
+        return s_count;
+    }
 protected:
     std::string m_name;  // 配置参数名称
     std::string m_description;  // 配置参数描述
@@ -249,6 +268,118 @@ public:
 };
 
 
+/*
+YAML节点直接转换成T，加载配置时用它代替"节点->字符串->YAML::Load->T"的往返
+默认版本标量取Scalar()交给LexicalCast，其他节点才退回到字符串
+自定义类型可以特化YamlCast来避免字符串往返
+*/
+template<class T>
+class YamlCast {
+public:
+    T operator() (const YAML::Node& node) {
+        if(node.IsScalar()) {
+            return LexicalCast<std::string, T>()(node.Scalar());
+        }
+        std::stringstream ss;
+        ss << node;
+        return LexicalCast<std::string, T>()(ss.str());
+    }
+};
+
+
+template<>
+class YamlCast<std::string> {
+public:
+    std::string operator() (const YAML::Node& node) {
+        if(node.IsScalar()) {
+            return node.Scalar();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+};
+
+
+template<class T>
+class YamlCast<std::vector<T>> {
+public:
+    std::vector<T> operator() (const YAML::Node& node) {
+        std::vector<T> vec;
+        vec.reserve(node.size());
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.push_back(YamlCast<T>()(*it));
+        }
+        return vec;
+    }
+};
+
+
+template<class T>
+class YamlCast<std::list<T>> {
+public:
+    std::list<T> operator() (const YAML::Node& node) {
+        std::list<T> vec;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.push_back(YamlCast<T>()(*it));
+        }
+        return vec;
+    }
+};
+
+
+template<class T>
+class YamlCast<std::set<T>> {
+public:
+    std::set<T> operator() (const YAML::Node& node) {
+        std::set<T> vec;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(YamlCast<T>()(*it));
+        }
+        return vec;
+    }
+};
+
+
+template<class T>
+class YamlCast<std::unordered_set<T>> {
+public:
+    std::unordered_set<T> operator() (const YAML::Node& node) {
+        std::unordered_set<T> vec;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(YamlCast<T>()(*it));
+        }
+        return vec;
+    }
+};
+
+
+template<class T>
+class YamlCast<std::map<std::string, T>> {
+public:
+    std::map<std::string, T> operator() (const YAML::Node& node) {
+        std::map<std::string, T> m;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            m.insert(std::make_pair(it->first.Scalar(), YamlCast<T>()(it->second)));
+        }
+        return m;
+    }
+};
+
+
+template<class T>
+class YamlCast<std::unordered_map<std::string, T>> {
+public:
+    std::unordered_map<std::string, T> operator() (const YAML::Node& node) {
+        std::unordered_map<std::string, T> m;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            m.insert(std::make_pair(it->first.Scalar(), YamlCast<T>()(it->second)));
+        }
+        return m;
+    }
+};
+
+
 // 针对复杂类型(如自定义类型)可以使用  序列化的方式进行字符串和类型间的转换
 // FromStr  T operator() (const std::string&)
 // ToStr std::string operator() (const T&)
@@ -259,23 +390,52 @@ class ConfigVar: public ConfigVarBase{
 public:
     typedef RWMutex RWMutexType;
     typedef std::shared_ptr<ConfigVar> ptr;
+    typedef std::shared_ptr<const T> ValuePtr;
     typedef std::function<void(const T& old_value, const T& new_value)> on_change_cb;
 
+    /*
+    每个线程自己持有的读取缓存，一般声明为static thread_local
+    get()只读一次版本号，版本没变就直接返回缓存的快照，不加锁、不拷贝
+    返回的引用在下一次get()之前有效(快照是不可变的，被替换后也由缓存持有)
+    */
+    class Cache {
+    public:
+        Cache(const typename ConfigVar::ptr& var)
+            :m_var(var)
+            ,m_version(0) {
+        }
+
+        const T& get() {
+            uint64_t version = m_var->getVersion();
+            if(SYLAR_UNLIKELY(version != m_version)) {
+                // 先读版本号再取快照，快照只会比版本号新，不会把旧值当成新版本缓存
+                m_value = m_var->getSnapshot();
+                m_version = version;
+            }
+            return *m_value;
+        }
+    private:
+        typename ConfigVar::ptr m_var;
+        uint64_t m_version;
+        ValuePtr m_value;
+    };
+
     ConfigVar(const std::string& name, const T& default_value,
               const std::string& description = "")
             :ConfigVarBase(name, description)
-            ,m_val(default_value) {}
+            ,m_val(std::make_shared<const T>(default_value))
+            ,m_version(1)
+            ,m_notifiedVersion(0) {}
     std::string toString() override {
         try
         {
             // return boost::lexical_cast<std::string>(m_val);
-            RWMutexType::ReadLock lock(m_mutex);
-            return ToStr()(m_val);
+            return ToStr()(*getSnapshot());
         } 
         catch(const std::exception& e) 
         {
             SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::toString exception" 
-            << e.what() << " convert " << typeid(m_val).name() << " to string.";
+            << e.what() << " convert " << typeid(T).name() << " to string.";
         }
         return "";
     }
@@ -289,29 +449,57 @@ public:
         catch(const std::exception& e)
         {
             SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::fromString exception" 
-            << e.what() << " convert: string to " << typeid(m_val).name();
+            << e.what() << " convert: string to " << typeid(T).name();
+        }
+        return false;
+    }
+
+    bool loadYaml(const YAML::Node& node, std::vector<std::function<void()> >& notifies) override {
+        try
+        {
+            // 自定义了FromStr的只能走字符串
+            return update(fromYaml(node, std::is_same<FromStr, LexicalCast<std::string, T> >()), notifies);
+        }
+        catch(const std::exception& e)
+        {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::loadYaml exception "
+            << e.what() << " convert: yaml to " << typeid(T).name() << " name=" << m_name;
         }
         return false;
     }
 
     std::string getTypeName() const {
-        return typeid(m_val).name();
+        return typeid(T).name();
     }
 
+    // 拷贝一份当前值，热路径请用getSnapshot()或者Cache
     const T getValue() const {
+        return *getSnapshot();
+    }
+
+    // 当前值的不可变快照，之后的setValue不影响已经取到的快照
+    ValuePtr getSnapshot() const {
         RWMutexType::ReadLock lock(m_mutex);
-        return m_val; 
+        return m_val;
+    }
+
+    // 每次setValue换上新快照后递增
+    uint64_t getVersion() const {
+        return m_version.load(std::memory_order_acquire);
     }
     
+    /*
+    新值做成新快照整体替换，旧快照由还在用的读者各自释放
+    回调在锁外执行，回调里可以再读写这个配置
+    并发setValue时回调按版本顺序串行执行，比已经通知过的版本旧的通知直接丢掉，
+    监听者最后收到的new_value就是最新的值；回调里不要等待别的线程修改配置
+    */
     void setValue(const T& v) {
-        RWMutexType::ReadLock lock_r(m_mutex);
-        if(v == m_val) return;  // T 类型变量不一定有 operator==();
-        for(auto& i : m_cbs) {
-            i.second(m_val, v);
+        std::vector<std::function<void()> > notifies;
+        update(v, notifies);
+        for(auto& i : notifies) {
+            i();
         }
-        lock_r.unlock(); // 或者使用{}括起来，lock解析函数调用
-        RWMutexType::WriteLock lock_w(m_mutex);
-        m_val = v;
     }
 
     uint64_t addListener(on_change_cb cb) {
@@ -337,9 +525,64 @@ public:
         RWMutexType::WriteLock lock(m_mutex);
         m_cbs.clear();
     }
+private:
+    // 换上新快照，值有变化时把通知监听者的函数追加到notifies
+    bool update(const T& v, std::vector<std::function<void()> >& notifies) {
+        ValuePtr new_val = std::make_shared<const T>(v);
+        ValuePtr old_val;
+        uint64_t version;
+        std::map<uint64_t, on_change_cb> cbs;
+        {
+            RWMutexType::WriteLock lock(m_mutex);
+            if(v == *m_val) return false;  // T 类型变量不一定有 operator==();
+            old_val = m_val;
+            m_val = new_val;
+            version = m_version.fetch_add(1, std::memory_order_release) + 1;
+            ChangeCounter().fetch_add(1, std::memory_order_release);
+            cbs = m_cbs;
+        }
+        if(!cbs.empty()) {
+            notifies.push_back([this, version, old_val, new_val, cbs]() {
+                notify(version, *old_val, *new_val, cbs);
+            });
+        }
+        return true;
+    }
+
+    // 串行执行回调，已经通知过更新的版本时丢掉这次旧的通知
+    void notify(uint64_t version, const T& old_value, const T& new_value
+                ,const std::map<uint64_t, on_change_cb>& cbs) {
+        // 可重入：回调里再setValue这个配置时嵌套通知
+        std::lock_guard<std::recursive_mutex> lock(m_notifyMutex);
+        for(auto& i : cbs) {
+            if(version < m_notifiedVersion) {
+                return;
+            }
+            m_notifiedVersion = version;
+            i.second(old_value, new_value);
+        }
+    }
+
+    T fromYaml(const YAML::Node& node, std::true_type) {
+        return YamlCast<T>()(node);
+    }
+
+    T fromYaml(const YAML::Node& node, std::false_type) {
+        if(node.IsScalar()) {
+            return FromStr()(node.Scalar());
+        }
+        std::stringstream ss;
+        ss << node;
+        return FromStr()(ss.str());
+    }
 private:
     mutable RWMutexType m_mutex;
-    T m_val;
+    // 当前值的快照，只整体替换，不原地修改
+    ValuePtr m_val;
+    std::atomic<uint64_t> m_version;
+    // 回调串行执行用的锁和已经通知过的最新版本
+    std::recursive_mutex m_notifyMutex;
+    uint64_t m_notifiedVersion;
     // 变更回调函数组，方便标识和比较function，所以使用map
     std::map<uint64_t, on_change_cb> m_cbs;
 };
@@ -371,7 +614,7 @@ public:
                     }
                 }
 
-                if(name.find_first_not_of("abcdefghijkmlnopkrstuvwxyz._0123456789")
+                if(name.find_first_not_of("abcdefghijklmnopqrstuvwxyz._0123456789")
                         != std::string::npos) {
                     // name中有奇怪的字符
                     SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Lookup name invaild " << name;
@@ -394,7 +637,19 @@ public:
         return std::dynamic_pointer_cast<ConfigVar<T>>(it->second);
     }
 
-    static void LoadFromYaml(const YAML::Node& root);
+    /*
+    把root里对应已注册配置项的节点转换后写入，全部写完后再统一通知监听者
+    prev是同一来源上一次加载的内容，和prev相同的节点直接跳过，不做转换
+    返回值发生变化的配置项个数
+    */
+    static size_t LoadFromYaml(const YAML::Node& root, const YAML::Node& prev = YAML::Node());
+    /*
+    加载yml文件，解析失败返回false
+    上次加载之后没有任何配置项被改过时，和该文件上一次加载的内容做差异，只更新变化的配置项；
+    期间有setValue或者别的文件改过配置，就和配置项的当前值逐个比较，文件里的值总会生效
+    注意：文件里删掉的配置项不会恢复默认值，保持删掉之前的值；要恢复就把默认值写回文件
+    */
+    static bool LoadFromFile(const std::string& file);
     static ConfigVarBase::ptr LookupBase(const std::string& name);
 
     static void Visit(std::function<void(ConfigVarBase::ptr)> cb);
@@ -410,6 +665,41 @@ private:
     }
 };
 
+
+/*
+配置文件监视器：用inotify监视目录(或单个文件)，文件写完或被替换后在后台线程重新加载
+一段时间内的多次改动合并成一次加载(等安静delay_ms毫秒)
+监视目录所在的inode，编辑器先写临时文件再rename的方式也能收到
+加载走Config::LoadFromFile：文件里删掉的配置项不会恢复默认值
+*/
+class ConfigWatcher {
+public:
+    typedef std::shared_ptr<ConfigWatcher> ptr;
+    // path是目录时监视其中的.yml/.yaml文件
+    ConfigWatcher(const std::string& path, uint32_t delay_ms = 100);
+    ~ConfigWatcher();
+
+    // 先加载一遍现有文件，再启动后台线程
+    bool start();
+    void stop();
+
+    // 后台重新加载过的文件次数
+    uint64_t getReloads() const { return m_reloads; }
+private:
+    void run();
+    bool isWatched(const std::string& name) const;
+private:
+    std::string m_dir;
+    // 只监视单个文件时的文件名，空表示整个目录
+    std::string m_file;
+    uint32_t m_delay;
+    int m_inotifyFd;
+    // 通知后台线程退出
+    int m_eventFd;
+    Thread::ptr m_thread;
+    std::atomic<uint64_t> m_reloads;
+};
+
 }
 
 #endif
\ No newline at end of file
@@ -75,12 +75,14 @@ FdManager::FdManager() {
 }
 
 FdCtx::ptr FdManager::get(int fd, bool auto_create) {
+    if(fd < 0) {
+        return nullptr;
+    }
     RWMutexType::ReadLock lock(m_mutex);
     if((int)m_datas.size() <= fd) {
         if(auto_create == false) {
             return nullptr;
         }
-        m_datas.resize(fd * 1.5);
     } else {
         if(m_datas[fd] || !auto_create) {
             return m_datas[fd];
@@ -88,11 +90,16 @@ FdCtx::ptr FdManager::get(int fd, bool auto_create) {
     }
     lock.unlock();
 
-    //size() > fd 下auto_create == true && !m_datas[fd] 情况
+    // auto_create == true && !m_datas[fd] 情况
+    // resize要在写锁里做，读锁下扩容会和其他线程的读冲突
     RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    m_datas[fd] = ctx;
-    return ctx;
+    if((int)m_datas.size() <= fd) {
+        m_datas.resize(fd * 1.5);
+    }
+    if(!m_datas[fd]) {
+        m_datas[fd].reset(new FdCtx(fd));
+    }
+    return m_datas[fd];
 }
 
 void FdManager::del(int fd) {
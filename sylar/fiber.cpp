@@ -56,7 +56,8 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
     ,m_cb(cb) 
     ,m_use_caller(use_caller) {
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
+    static thread_local ConfigVar<uint32_t>::Cache t_stack_size(g_fiber_stack_size);
+    m_stacksize = stacksize ? stacksize : t_stack_size.get();
 
     m_stack = StackAllocator::Alloc(m_stacksize);
     if(getcontext(&m_ctx)) {
@@ -186,10 +187,12 @@ void Fiber::YieldToReady() {
 void Fiber::YieldToHold() {
     Fiber::ptr cur = GetThis();
     SYLAR_ASSERT(cur->m_state == EXEC);
-    cur->m_state = HOLD;
     if(!cur->m_use_caller) {
+        // 状态先留在EXEC，调度器切回来以后再改成HOLD
+        // 否则被其他线程唤醒时，可能在上下文保存完之前就被切进去
         cur->swapOut();
     } else {
+        cur->m_state = HOLD;
         cur->back();
     }
 }
@@ -9,6 +9,7 @@
 #ifndef __SYLAR_FIBER_H__
 #define __SYLAR_FIBER_H__
 
+#include <atomic>
 #include <memory>
 #include <functional>
 #include <ucontext.h>
@@ -125,6 +126,8 @@ public:
 
     /**
      * @brief 将当前协程切换到后台,并设置为HOLD状态
+     * @details 调度器里的协程切出去之前一直是EXEC，由调度器切回来以后再改成HOLD，
+     *          这期间被其他线程schedule也不会在上下文保存完之前被切进去
      * @post getState() = HOLD
      */
     static void YieldToHold();
@@ -155,8 +158,8 @@ private:
     uint64_t m_id = 0;
     /// 协程运行栈大小
     uint32_t m_stacksize = 0;
-    /// 协程状态
-    State m_state = INIT;
+    /// 协程状态，调度器的多个线程会读，切出去以后才改成HOLD
+    std::atomic<State> m_state{INIT};
     /// 协程上下文
     ucontext_t m_ctx;
     /// 协程运行栈指针
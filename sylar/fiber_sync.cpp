@@ -0,0 +1,351 @@
+#include "fiber_sync.h"
+#include "macro.h"
+#include "scheduler.h"
+#include "iomanager.h"
+
+namespace sylar {
+
+struct FiberWaitQueue::Waiter {
+    enum State {
+        WAITING = 0,
+        NOTIFIED = 1,
+        TIMEOUT = 2
+    };
+
+    Waiter(Scheduler* s, Fiber::ptr f)
+        :scheduler(s)
+        ,fiber(f)
+        ,state(WAITING)
+        ,queued(false) {
+    }
+
+    Scheduler* scheduler;
+    Fiber::ptr fiber;
+    // 唤醒和超时谁先CAS成功谁负责重新调度
+    std::atomic<int> state;
+    // 是否还在队列里，由m_mutex保护
+    bool queued;
+    std::list<WaiterPtr>::iterator it;
+};
+
+FiberWaitQueue::WakeList::~WakeList() {
+    for(auto& i : m_fibers) {
+        i.first->schedule(i.second);
+    }
+}
+
+FiberWaitQueue::FiberWaitQueue(MutexType& mutex)
+    :m_mutex(mutex) {
+}
+
+FiberWaitQueue::~FiberWaitQueue() {
+    SYLAR_ASSERT(m_waiters.empty());
+}
+
+bool FiberWaitQueue::wait(MutexType::Lock& lock, uint64_t timeout_ms, bool front) {
+    SYLAR_ASSERT2(Scheduler::GetThis(), "fiber sync primitives must be used in a Scheduler");
+    WaiterPtr waiter(new Waiter(Scheduler::GetThis(), Fiber::GetThis()));
+    waiter->it = m_waiters.insert(front ? m_waiters.begin() : m_waiters.end(), waiter);
+    waiter->queued = true;
+
+    Timer::ptr timer;
+    if(timeout_ms != ~0ull) {
+        IOManager* iom = IOManager::GetThis();
+        SYLAR_ASSERT2(iom, "timed wait needs an IOManager");
+        std::weak_ptr<Waiter> weak(waiter);
+        timer = iom->addTimer(timeout_ms, [this, weak]() {
+            WaiterPtr w = weak.lock();
+            if(w) {
+                onTimeout(w);
+            }
+        });
+    }
+    lock.unlock();
+
+    Fiber::YieldToHold();
+    if(timer) {
+        timer->cancel();
+    }
+    return waiter->state == Waiter::NOTIFIED;
+}
+
+bool FiberWaitQueue::wake(const WaiterPtr& waiter, WakeList& wakes) {
+    int expect = Waiter::WAITING;
+    if(!waiter->state.compare_exchange_strong(expect, Waiter::NOTIFIED)) {
+        // 已经超时，由超时回调负责调度
+        return false;
+    }
+    wakes.push(waiter->scheduler, waiter->fiber);
+    return true;
+}
+
+bool FiberWaitQueue::notifyOne(WakeList& wakes) {
+    while(!m_waiters.empty()) {
+        WaiterPtr waiter = m_waiters.front();
+        m_waiters.pop_front();
+        waiter->queued = false;
+        if(wake(waiter, wakes)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t FiberWaitQueue::notifyAll(WakeList& wakes) {
+    size_t count = 0;
+    while(!m_waiters.empty()) {
+        WaiterPtr waiter = m_waiters.front();
+        m_waiters.pop_front();
+        waiter->queued = false;
+        if(wake(waiter, wakes)) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+void FiberWaitQueue::onTimeout(const WaiterPtr& waiter) {
+    int expect = Waiter::WAITING;
+    if(!waiter->state.compare_exchange_strong(expect, Waiter::TIMEOUT)) {
+        // 已经被唤醒，协程可能已经返回，不能再碰队列
+        return;
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        if(waiter->queued) {
+            m_waiters.erase(waiter->it);
+            waiter->queued = false;
+        }
+    }
+    waiter->scheduler->schedule(waiter->fiber);
+}
+
+FiberMutex::FiberMutex()
+    :m_locked(false)
+    ,m_woken(false)
+    ,m_waiters(m_mutex) {
+}
+
+bool FiberMutex::tryLock() {
+    MutexType::Lock lock(m_mutex);
+    if(m_locked) {
+        return false;
+    }
+    m_locked = true;
+    return true;
+}
+
+bool FiberMutex::lockFor(uint64_t timeout_ms) {
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    MutexType::Lock lock(m_mutex);
+    bool woken = false;
+    while(true) {
+        if(woken) {
+            m_woken = false;
+        }
+        if(!m_locked) {
+            m_locked = true;
+            return true;
+        }
+        uint64_t wait_ms = ~0ull;
+        if(deadline != ~0ull) {
+            uint64_t now = GetCurrentMS();
+            if(now >= deadline) {
+                return false;
+            }
+            wait_ms = deadline - now;
+        }
+        if(!m_waiters.wait(lock, wait_ms, woken)) {
+            return false;
+        }
+        woken = true;
+        lock.lock();
+    }
+}
+
+void FiberMutex::unlock() {
+    FiberWaitQueue::WakeList wakes;
+    MutexType::Lock lock(m_mutex);
+    SYLAR_ASSERT(m_locked);
+    m_locked = false;
+    if(!m_woken && m_waiters.notifyOne(wakes)) {
+        m_woken = true;
+    }
+}
+
+FiberCondition::FiberCondition()
+    :m_waiters(m_mutex) {
+}
+
+bool FiberCondition::waitFor(FiberMutex& mutex, uint64_t timeout_ms) {
+    bool rt;
+    {
+        MutexType::Lock lock(m_mutex);
+        // 先入队再释放mutex，中间的notify不会丢
+        mutex.unlock();
+        rt = m_waiters.wait(lock, timeout_ms);
+    }
+    mutex.lock();
+    return rt;
+}
+
+void FiberCondition::notifyOne() {
+    FiberWaitQueue::WakeList wakes;
+    MutexType::Lock lock(m_mutex);
+    m_waiters.notifyOne(wakes);
+}
+
+void FiberCondition::notifyAll() {
+    FiberWaitQueue::WakeList wakes;
+    MutexType::Lock lock(m_mutex);
+    m_waiters.notifyAll(wakes);
+}
+
+FiberRWLock::FiberRWLock()
+    :m_readers(0)
+    ,m_writer(false)
+    ,m_readWaiters(m_mutex)
+    ,m_writeWaiters(m_mutex) {
+}
+
+bool FiberRWLock::rdlockFor(uint64_t timeout_ms) {
+    MutexType::Lock lock(m_mutex);
+    if(!m_writer && m_writeWaiters.empty()) {
+        ++m_readers;
+        return true;
+    }
+    // 被唤醒时m_readers已经替我们加过
+    return m_readWaiters.wait(lock, timeout_ms);
+}
+
+bool FiberRWLock::wrlockFor(uint64_t timeout_ms) {
+    FiberWaitQueue::WakeList wakes;
+    MutexType::Lock lock(m_mutex);
+    if(!m_writer && m_readers == 0) {
+        m_writer = true;
+        return true;
+    }
+    if(m_writeWaiters.wait(lock, timeout_ms)) {
+        return true;
+    }
+    // 超时放弃后，排在它后面的读者不用再等，锁只被读者持有时直接放行
+    lock.lock();
+    if(!m_writer && m_writeWaiters.empty()) {
+        m_readers += m_readWaiters.notifyAll(wakes);
+    }
+    return false;
+}
+
+void FiberRWLock::unlock() {
+    FiberWaitQueue::WakeList wakes;
+    MutexType::Lock lock(m_mutex);
+    bool was_writer = m_writer;
+    if(m_writer) {
+        m_writer = false;
+    } else {
+        SYLAR_ASSERT(m_readers > 0);
+        if(--m_readers > 0) {
+            return;
+        }
+    }
+    // 写者释放时读者优先，最后一个读者释放时写者优先
+    if(was_writer) {
+        m_readers += m_readWaiters.notifyAll(wakes);
+        if(m_readers == 0 && m_writeWaiters.notifyOne(wakes)) {
+            m_writer = true;
+        }
+    } else {
+        if(m_writeWaiters.notifyOne(wakes)) {
+            m_writer = true;
+        } else {
+            m_readers += m_readWaiters.notifyAll(wakes);
+        }
+    }
+}
+
+FiberWaitGroup::FiberWaitGroup(int64_t count)
+    :m_count(count)
+    ,m_waiters(m_mutex) {
+}
+
+void FiberWaitGroup::add(int64_t delta) {
+    FiberWaitQueue::WakeList wakes;
+    MutexType::Lock lock(m_mutex);
+    m_count += delta;
+    SYLAR_ASSERT(m_count >= 0);
+    if(m_count == 0) {
+        m_waiters.notifyAll(wakes);
+    }
+}
+
+bool FiberWaitGroup::waitFor(uint64_t timeout_ms) {
+    MutexType::Lock lock(m_mutex);
+    if(m_count == 0) {
+        return true;
+    }
+    return m_waiters.wait(lock, timeout_ms);
+}
+
+FiberEvent::FiberEvent()
+    :m_set(false)
+    ,m_waiters(m_mutex) {
+}
+
+void FiberEvent::set() {
+    FiberWaitQueue::WakeList wakes;
+    MutexType::Lock lock(m_mutex);
+    if(m_set) {
+        return;
+    }
+    m_set = true;
+    m_waiters.notifyAll(wakes);
+}
+
+bool FiberEvent::waitFor(uint64_t timeout_ms) {
+    // 不在锁外检查m_set：set()写完m_set还要解锁，这时返回的话调用方可能已经销毁了对象
+    MutexType::Lock lock(m_mutex);
+    if(m_set) {
+        return true;
+    }
+    return m_waiters.wait(lock, timeout_ms);
+}
+
+
+FiberTimedSemaphore::FiberTimedSemaphore(size_t count)
+    :m_count(count)
+    ,m_waiters(m_mutex) {
+}
+
+bool FiberTimedSemaphore::waitFor(uint64_t timeout_ms) {
+    MutexType::Lock lock(m_mutex);
+    if(m_count > 0) {
+        --m_count;
+        return true;
+    }
+    if(timeout_ms == 0) {
+        return false;
+    }
+    // 被唤醒时名额已经转交过来了
+    return m_waiters.wait(lock, timeout_ms);
+}
+
+bool FiberTimedSemaphore::tryWait() {
+    MutexType::Lock lock(m_mutex);
+    if(m_count > 0) {
+        --m_count;
+        return true;
+    }
+    return false;
+}
+
+void FiberTimedSemaphore::notify(size_t count) {
+    FiberWaitQueue::WakeList wakes;
+    MutexType::Lock lock(m_mutex);
+    for(size_t i = 0; i < count; ++i) {
+        if(!m_waiters.notifyOne(wakes)) {
+            ++m_count;
+        }
+    }
+}
+
+}
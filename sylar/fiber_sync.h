@@ -0,0 +1,368 @@
+/**
+ * @file fiber_sync.h
+ * @brief 协程级别的同步原语
+ * @details 等待时只挂起当前协程，调度器线程继续执行其他协程，
+ *          Mutex/RWMutex等线程锁阻塞的是整个线程。
+ *          必须在Scheduler中使用，带超时的等待需要在IOManager中(用它的定时器)
+ */
+#ifndef __SYLAR_FIBER_SYNC_H__
+#define __SYLAR_FIBER_SYNC_H__
+
+#include <list>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+
+#include "noncopyable.h"
+#include "mutex.h"
+#include "fiber.h"
+
+namespace sylar {
+
+class Scheduler;
+
+/**
+ * @brief 协程等待队列，下面各个同步原语的公共部分
+ * @details 队列本身不加锁，由所属原语的m_mutex保护。
+ *          每个等待者被唤醒或者超时只会发生其中一个(原子状态CAS决定)，
+ *          抢到的一方负责把协程重新放回调度器。
+ *          notify在锁内决定唤醒谁，放回调度器推迟到WakeList析构(锁已经释放)，
+ *          被唤醒的协程可能马上返回并销毁所属原语，之后不会再访问它
+ */
+class FiberWaitQueue : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 已经决定唤醒的协程，析构时放回调度器
+     * @details 必须定义在持有m_mutex的Lock之前，先解锁再调度
+     */
+    class WakeList : Noncopyable {
+    public:
+        ~WakeList();
+
+        void push(Scheduler* scheduler, Fiber::ptr fiber) {
+            m_fibers.push_back(std::make_pair(scheduler, fiber));
+        }
+    private:
+        std::vector<std::pair<Scheduler*, Fiber::ptr> > m_fibers;
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] mutex 所属原语的锁，超时的定时器回调要用它把等待者移出队列
+     */
+    FiberWaitQueue(MutexType& mutex);
+
+    /**
+     * @brief 析构函数
+     */
+    ~FiberWaitQueue();
+
+    /**
+     * @brief 挂起当前协程直到被唤醒或者超时
+     * @param[in] lock 调用方已经持有的m_mutex，入队后释放，返回时不再持有
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @param[in] front 是否排到队首
+     * @return 被唤醒返回true，超时返回false
+     */
+    bool wait(MutexType::Lock& lock, uint64_t timeout_ms = ~0ull, bool front = false);
+
+    /**
+     * @brief 唤醒队首的一个等待者，调用方持有m_mutex
+     * @param[out] wakes 被唤醒的协程，wakes析构时才放回调度器
+     * @return 有协程被唤醒返回true
+     */
+    bool notifyOne(WakeList& wakes);
+
+    /**
+     * @brief 唤醒所有等待者，调用方持有m_mutex
+     * @param[out] wakes 被唤醒的协程，wakes析构时才放回调度器
+     * @return 被唤醒的协程数
+     */
+    size_t notifyAll(WakeList& wakes);
+
+    /**
+     * @brief 是否没有等待者，调用方持有m_mutex
+     */
+    bool empty() const { return m_waiters.empty();}
+private:
+    struct Waiter;
+    typedef std::shared_ptr<Waiter> WaiterPtr;
+
+    bool wake(const WaiterPtr& waiter, WakeList& wakes);
+    void onTimeout(const WaiterPtr& waiter);
+private:
+    /// 所属原语的锁
+    MutexType& m_mutex;
+    /// 等待者，先进先出
+    std::list<WaiterPtr> m_waiters;
+};
+
+/**
+ * @brief 协程互斥量
+ * @details unlock只唤醒一个等待者，被唤醒的还没运行时不再唤醒别的；
+ *          锁空闲时新来的可以直接拿(不用切换协程)，被唤醒却没抢到的排回队首
+ */
+class FiberMutex : Noncopyable {
+public:
+    /// 局部锁
+    typedef ScopedLockImpl<FiberMutex> Lock;
+    typedef Mutex MutexType;
+
+    FiberMutex();
+
+    /**
+     * @brief 加锁，拿不到时挂起当前协程
+     */
+    void lock() { lockFor(~0ull);}
+
+    /**
+     * @brief 尝试加锁，不等待
+     */
+    bool tryLock();
+
+    /**
+     * @brief 带超时的加锁
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @return 拿到锁返回true，超时返回false
+     */
+    bool lockFor(uint64_t timeout_ms);
+
+    /**
+     * @brief 解锁
+     */
+    void unlock();
+private:
+    MutexType m_mutex;
+    /// 是否被持有
+    bool m_locked;
+    /// 是否有被唤醒、还没来得及重新抢锁的等待者
+    bool m_woken;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程条件变量，配合FiberMutex使用
+ */
+class FiberCondition : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    FiberCondition();
+
+    /**
+     * @brief 释放mutex并挂起当前协程，被唤醒后重新加锁
+     * @param[in] mutex 调用方已经持有的FiberMutex
+     */
+    void wait(FiberMutex& mutex) { waitFor(mutex, ~0ull);}
+
+    /**
+     * @brief 等到pred()为true
+     */
+    template<class Pred>
+    void wait(FiberMutex& mutex, Pred pred) {
+        while(!pred()) {
+            wait(mutex);
+        }
+    }
+
+    /**
+     * @brief 带超时的等待，返回前总会重新持有mutex
+     * @return 被唤醒返回true，超时返回false
+     */
+    bool waitFor(FiberMutex& mutex, uint64_t timeout_ms);
+
+    /**
+     * @brief 唤醒一个等待者
+     */
+    void notifyOne();
+
+    /**
+     * @brief 唤醒所有等待者
+     */
+    void notifyAll();
+private:
+    MutexType m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程读写锁
+ * @details 有写者排队时新的读者也排队，避免写者饿死；
+ *          写者释放时优先放行排队的读者，避免读者饿死
+ */
+class FiberRWLock : Noncopyable {
+public:
+    /// 局部读锁
+    typedef ReadScopedLockImpl<FiberRWLock> ReadLock;
+    /// 局部写锁
+    typedef WriteScopedLockImpl<FiberRWLock> WriteLock;
+    typedef Mutex MutexType;
+
+    FiberRWLock();
+
+    /**
+     * @brief 上读锁
+     */
+    void rdlock() { rdlockFor(~0ull);}
+
+    /**
+     * @brief 上写锁
+     */
+    void wrlock() { wrlockFor(~0ull);}
+
+    /**
+     * @brief 带超时的读锁，超时返回false
+     */
+    bool rdlockFor(uint64_t timeout_ms);
+
+    /**
+     * @brief 带超时的写锁，超时返回false
+     */
+    bool wrlockFor(uint64_t timeout_ms);
+
+    /**
+     * @brief 解锁
+     */
+    void unlock();
+private:
+    MutexType m_mutex;
+    /// 持有读锁的协程数
+    uint32_t m_readers;
+    /// 是否有写者持有
+    bool m_writer;
+    FiberWaitQueue m_readWaiters;
+    FiberWaitQueue m_writeWaiters;
+};
+
+/**
+ * @brief 等待一组任务完成，类似golang的sync.WaitGroup
+ * @details wait返回后可以销毁对象，唤醒它的done()不会再访问对象；
+ *          但所有done()都必须在对象销毁之前调用
+ */
+class FiberWaitGroup : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    FiberWaitGroup(int64_t count = 0);
+
+    /**
+     * @brief 增加(或减少)计数，减到0时唤醒所有等待者
+     */
+    void add(int64_t delta = 1);
+
+    /**
+     * @brief 完成一个任务，相当于add(-1)
+     */
+    void done() { add(-1);}
+
+    /**
+     * @brief 等待计数归零
+     */
+    void wait() { waitFor(~0ull);}
+
+    /**
+     * @brief 带超时的等待，超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms);
+
+    int64_t getCount() const {
+        MutexType::Lock lock(m_mutex);
+        return m_count;
+    }
+private:
+    mutable MutexType m_mutex;
+    int64_t m_count;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 一次性事件，set之后所有的wait都立即返回
+ * @details wait返回后可以销毁对象，唤醒它的set()不会再访问对象；
+ *          但所有set()都必须在对象销毁之前调用
+ */
+class FiberEvent : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    FiberEvent();
+
+    /**
+     * @brief 触发事件，唤醒所有等待者
+     */
+    void set();
+
+    /**
+     * @brief 是否已经触发
+     */
+    bool isSet() const { return m_set;}
+
+    /**
+     * @brief 等待事件触发
+     */
+    void wait() { waitFor(~0ull);}
+
+    /**
+     * @brief 带超时的等待，超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms);
+private:
+    MutexType m_mutex;
+    std::atomic<bool> m_set;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 支持超时的计数信号量
+ * @details mutex.h里的FiberSemaphore不能超时，等待者也不能取消；
+ *          这里基于FiberWaitQueue，waitFor超时后等待者会被移出队列。
+ *          notify时有等待者就把名额直接交给队首的等待者，不会被后来的协程抢走
+ */
+class FiberTimedSemaphore : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 构造函数
+     * @param[in] count 初始名额
+     */
+    FiberTimedSemaphore(size_t count = 0);
+
+    /**
+     * @brief 获取一个名额
+     */
+    void wait() { waitFor(~0ull);}
+
+    /**
+     * @brief 带超时的获取，超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms);
+
+    /**
+     * @brief 不等待，没有名额时返回false
+     */
+    bool tryWait();
+
+    /**
+     * @brief 归还count个名额
+     */
+    void notify(size_t count = 1);
+
+    /**
+     * @brief 返回当前空闲的名额
+     */
+    size_t getCount() const {
+        MutexType::Lock lock(m_mutex);
+        return m_count;
+    }
+private:
+    mutable MutexType m_mutex;
+    size_t m_count;
+    FiberWaitQueue m_waiters;
+};
+
+}
+
+#endif
@@ -86,6 +86,15 @@ struct timer_info {
     int cancelled = 0;
 };
 
+/**
+ * @brief 设置errno
+ * @details 协程切换回来时可能已经换了线程，errno的地址是按线程算的，
+ *          编译器会沿用切换前算出来的地址，所以放到不内联的函数里重新取
+ */
+static void __attribute__((noinline)) set_errno(int v) {
+    errno = v;
+}
+
 //  读写函数的统一IO函数模板
 template<typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
@@ -111,8 +120,8 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
 
     // 下面是打开了的socket文件句柄并且!UserNonblock的逻辑
     uint64_t to = ctx->getTimeout(timeout_so);
-    // 超时条件
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    // 超时条件，只有需要等待并且设置了超时时才分配
+    std::shared_ptr<timer_info> tinfo;
 
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
@@ -124,9 +133,12 @@ retry:
     // 非阻塞读写，缓冲区被读完或者缓存区被写满
         sylar::IOManager* iom = sylar::IOManager::GetThis();
         sylar::Timer::ptr timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
 
         if(to != (uint64_t)-1) {
+            if(!tinfo) {
+                tinfo = std::make_shared<timer_info>();
+            }
+            std::weak_ptr<timer_info> winfo(tinfo);
             // 有超时时间，加入定时任务，超时触发之前加入的任务
             timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
                 // 在任务中使用winfo条件
@@ -147,7 +159,7 @@ retry:
         // if(SYLAR_UNLIKELY(rt)) {
         if(rt) {
             // 加任务失败
-            SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
+            SYLAR_LOG_RATE_LIMITED(g_logger, sylar::LogLevel::ERROR, 10, 10) << hook_fun_name << " addEvent("
                 << fd << ", " << event << ")";
             if(timer) {
                 timer->cancel();
@@ -160,9 +172,9 @@ retry:
             if(timer) {
                 timer->cancel();
             }
-            if(tinfo->cancelled) {
+            if(tinfo && tinfo->cancelled) {
                 // 通过超时被唤醒的
-                errno = tinfo->cancelled;
+                set_errno(tinfo->cancelled);
                 return -1;
             }
             // 任务加入成功且正常唤醒，说明有IO事件，从新开始
@@ -287,14 +299,14 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
             timer->cancel();
         }
         if(tinfo->cancelled) {
-            errno = tinfo->cancelled;
+            set_errno(tinfo->cancelled);
             return -1;
         }
     } else {
         if(timer) {
             timer->cancel();
         }
-        SYLAR_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
+        SYLAR_LOG_RATE_LIMITED(g_logger, sylar::LogLevel::ERROR, 10, 10) << "connect addEvent(" << fd << ", WRITE) error";
     }
 
     // WRITE event 执行成功 或者 事件没有加入成功
@@ -307,7 +319,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(!error) {
         return 0;
     } else {
-        errno = error;
+        set_errno(error);
         return -1;
     }
 }
@@ -0,0 +1,230 @@
+#include "http.h"
+#include <sstream>
+#include <time.h>
+
+namespace sylar {
+namespace http {
+
+HttpMethod CharsToHttpMethod(const char* m, size_t len) {
+#define XX(num, name, string) \
+    if(len == sizeof(#string) - 1 && memcmp(#string, m, len) == 0) { \
+        return HttpMethod::name; \
+    }
+    HTTP_METHOD_MAP(XX);
+#undef XX
+    return HttpMethod::INVALID_METHOD;
+}
+
+static const char* s_method_string[] = {
+#define XX(num, name, string) #string,
+    HTTP_METHOD_MAP(XX)
+#undef XX
+};
+
+const char* HttpMethodToString(const HttpMethod& m) {
+    uint32_t idx = (uint32_t)m;
+    if(idx >= (sizeof(s_method_string) / sizeof(s_method_string[0]))) {
+        return "<unknown>";
+    }
+    return s_method_string[idx];
+}
+
+const char* HttpStatusToString(const HttpStatus& s) {
+    switch(s) {
+#define XX(code, name, msg) \
+        case HttpStatus::name: \
+            return #msg;
+        HTTP_STATUS_MAP(XX);
+#undef XX
+        default:
+            return "<unknown>";
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, const StringRef& s) {
+    return os.write(s.data(), s.size());
+}
+
+HttpRequest::HttpRequest() {
+    m_headers.reserve(32);
+    reset();
+}
+
+void HttpRequest::reset() {
+    m_method = HttpMethod::GET;
+    m_version = 0x11;
+    m_close = false;
+    m_chunked = false;
+    m_contentLength = 0;
+    m_uri = StringRef();
+    m_path = StringRef();
+    m_query = StringRef();
+    m_fragment = StringRef();
+    m_body = StringRef();
+    m_headers.clear();
+}
+
+StringRef HttpRequest::getHeader(const StringRef& name) const {
+    for(auto& i : m_headers) {
+        if(i.name.iequals(name)) {
+            return i.value;
+        }
+    }
+    return StringRef();
+}
+
+bool HttpRequest::hasHeader(const StringRef& name) const {
+    for(auto& i : m_headers) {
+        if(i.name.iequals(name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::ostream& HttpRequest::dump(std::ostream& os) const {
+    os << HttpMethodToString(m_method) << " "
+       << m_uri
+       << " HTTP/" << ((uint32_t)(m_version >> 4))
+       << "." << ((uint32_t)(m_version & 0x0F))
+       << "\r\n";
+    for(auto& i : m_headers) {
+        os << i.name << ": " << i.value << "\r\n";
+    }
+    os << "\r\n" << m_body;
+    return os;
+}
+
+std::string HttpRequest::toString() const {
+    std::stringstream ss;
+    dump(ss);
+    return ss.str();
+}
+
+HttpResponse::HttpResponse() {
+    m_headers.reserve(256);
+    reset();
+}
+
+void HttpResponse::reset() {
+    m_status = HttpStatus::OK;
+    m_version = 0x11;
+    m_close = false;
+    m_headOnly = false;
+    m_headers.clear();
+    m_body = StringRef();
+}
+
+void HttpResponse::setHeader(const StringRef& name, const StringRef& value) {
+    m_headers.append(name.data(), name.size());
+    m_headers.append(": ", 2);
+    m_headers.append(value.data(), value.size());
+    m_headers.append("\r\n", 2);
+}
+
+StringRef HttpResponse::getHeader(const StringRef& name) const {
+    // m_headers里每一行都是setHeader写入的"name: value\r\n"
+    const char* p = m_headers.data();
+    const char* end = p + m_headers.size();
+    while(p < end) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if(!eol) {
+            break;
+        }
+        const char* colon = (const char*)memchr(p, ':', eol - p);
+        if(colon && StringRef(p, colon - p).iequals(name)) {
+            return StringRef(colon + 2, eol - 1 - (colon + 2));
+        }
+        p = eol + 1;
+    }
+    return StringRef();
+}
+
+void HttpResponse::setBody(const StringRef& v) {
+    m_bodyStore.assign(v.data(), v.size());
+    m_body = m_bodyStore;
+}
+
+/**
+ * @brief 当前时间的RFC1123格式，每个线程每秒只格式化一次
+ */
+static const char* HttpDate() {
+    static thread_local time_t s_last = 0;
+    static thread_local char s_date[64];
+    time_t now = time(0);
+    if(now != s_last) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(s_date, sizeof(s_date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        s_last = now;
+    }
+    return s_date;
+}
+
+/**
+ * @brief 无符号整数转十进制，返回长度
+ */
+static size_t FormatUint(char* buf, uint64_t v) {
+    char tmp[24];
+    size_t n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    for(size_t i = 0; i < n; ++i) {
+        buf[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+void HttpResponse::appendHead(std::string& out) const {
+    char buf[32];
+    out.append("HTTP/", 5);
+    out.push_back('0' + (m_version >> 4));
+    out.push_back('.');
+    out.push_back('0' + (m_version & 0x0F));
+    out.push_back(' ');
+    out.append(buf, FormatUint(buf, (uint32_t)m_status));
+    out.push_back(' ');
+    out.append(HttpStatusToString(m_status));
+    out.append("\r\n", 2);
+    out.append(m_headers);
+    out.append("Content-Length: ", 16);
+    out.append(buf, FormatUint(buf, m_body.size()));
+    out.append("\r\n", 2);
+    if(m_close) {
+        out.append("Connection: close\r\n", 19);
+    } else if(m_version == 0x10) {
+        out.append("Connection: keep-alive\r\n", 24);
+    }
+    out.append("Date: ", 6);
+    out.append(HttpDate());
+    out.append("\r\n\r\n", 4);
+}
+
+std::ostream& HttpResponse::dump(std::ostream& os) const {
+    std::string head;
+    appendHead(head);
+    os << head;
+    if(!m_headOnly) {
+        os << m_body;
+    }
+    return os;
+}
+
+std::string HttpResponse::toString() const {
+    std::stringstream ss;
+    dump(ss);
+    return ss.str();
+}
+
+std::ostream& operator<<(std::ostream& os, const HttpRequest& req) {
+    return req.dump(os);
+}
+
+std::ostream& operator<<(std::ostream& os, const HttpResponse& rsp) {
+    return rsp.dump(os);
+}
+
+}
+}
@@ -0,0 +1,323 @@
+/**
+ * @file http.h
+ * @brief HTTP定义结构体封装
+ * @details HttpRequest/HttpResponse由HttpSession持有并在连接上复用，
+ *          请求里的字符串都是指向接收缓冲区的StringRef，解析一个请求不分配内存
+ */
+#ifndef __SYLAR_HTTP_HTTP_H__
+#define __SYLAR_HTTP_HTTP_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <string.h>
+#include <stdint.h>
+
+namespace sylar {
+namespace http {
+
+/* Request Methods */
+#define HTTP_METHOD_MAP(XX)         \
+  XX(0,  DELETE,      DELETE)       \
+  XX(1,  GET,         GET)          \
+  XX(2,  HEAD,        HEAD)         \
+  XX(3,  POST,        POST)         \
+  XX(4,  PUT,         PUT)          \
+  /* pathological */                \
+  XX(5,  CONNECT,     CONNECT)      \
+  XX(6,  OPTIONS,     OPTIONS)      \
+  XX(7,  TRACE,       TRACE)        \
+  /* RFC-5789 */                    \
+  XX(8,  PATCH,       PATCH)        \
+
+/* Status Codes */
+#define HTTP_STATUS_MAP(XX)                                                 \
+  XX(100, CONTINUE,                        Continue)                        \
+  XX(101, SWITCHING_PROTOCOLS,             Switching Protocols)             \
+  XX(200, OK,                              OK)                              \
+  XX(201, CREATED,                         Created)                         \
+  XX(202, ACCEPTED,                        Accepted)                        \
+  XX(204, NO_CONTENT,                      No Content)                      \
+  XX(206, PARTIAL_CONTENT,                 Partial Content)                 \
+  XX(301, MOVED_PERMANENTLY,               Moved Permanently)               \
+  XX(302, FOUND,                           Found)                           \
+  XX(304, NOT_MODIFIED,                    Not Modified)                    \
+  XX(307, TEMPORARY_REDIRECT,              Temporary Redirect)              \
+  XX(400, BAD_REQUEST,                     Bad Request)                     \
+  XX(401, UNAUTHORIZED,                    Unauthorized)                    \
+  XX(403, FORBIDDEN,                       Forbidden)                       \
+  XX(404, NOT_FOUND,                       Not Found)                       \
+  XX(405, METHOD_NOT_ALLOWED,              Method Not Allowed)              \
+  XX(408, REQUEST_TIMEOUT,                 Request Timeout)                 \
+  XX(411, LENGTH_REQUIRED,                 Length Required)                 \
+  XX(413, PAYLOAD_TOO_LARGE,               Payload Too Large)               \
+  XX(414, URI_TOO_LONG,                    URI Too Long)                    \
+  XX(431, REQUEST_HEADER_FIELDS_TOO_LARGE, Request Header Fields Too Large) \
+  XX(500, INTERNAL_SERVER_ERROR,           Internal Server Error)           \
+  XX(501, NOT_IMPLEMENTED,                 Not Implemented)                 \
+  XX(502, BAD_GATEWAY,                     Bad Gateway)                     \
+  XX(503, SERVICE_UNAVAILABLE,             Service Unavailable)             \
+  XX(504, GATEWAY_TIMEOUT,                 Gateway Timeout)                 \
+  XX(505, HTTP_VERSION_NOT_SUPPORTED,      HTTP Version Not Supported)      \
+
+/**
+ * @brief HTTP方法枚举
+ */
+enum class HttpMethod {
+#define XX(num, name, string) name = num,
+    HTTP_METHOD_MAP(XX)
+#undef XX
+    INVALID_METHOD
+};
+
+/**
+ * @brief HTTP状态枚举
+ */
+enum class HttpStatus {
+#define XX(code, name, desc) name = code,
+    HTTP_STATUS_MAP(XX)
+#undef XX
+};
+
+/**
+ * @brief 将字符串方法名转成HTTP方法枚举
+ * @param[in] m HTTP方法
+ * @param[in] len 长度
+ */
+HttpMethod CharsToHttpMethod(const char* m, size_t len);
+
+/**
+ * @brief 将HTTP方法枚举转换成字符串
+ */
+const char* HttpMethodToString(const HttpMethod& m);
+
+/**
+ * @brief 将HTTP状态枚举转换成字符串
+ */
+const char* HttpStatusToString(const HttpStatus& s);
+
+/**
+ * @brief 指向外部内存的字符串片段，不拥有内存
+ */
+class StringRef {
+public:
+    StringRef()
+        :m_data(""), m_size(0) {
+    }
+
+    StringRef(const char* data, size_t size)
+        :m_data(data), m_size(size) {
+    }
+
+    StringRef(const char* str)
+        :m_data(str), m_size(strlen(str)) {
+    }
+
+    StringRef(const std::string& str)
+        :m_data(str.data()), m_size(str.size()) {
+    }
+
+    const char* data() const { return m_data;}
+    size_t size() const { return m_size;}
+    bool empty() const { return m_size == 0;}
+    char operator[](size_t i) const { return m_data[i];}
+
+    std::string toString() const { return std::string(m_data, m_size);}
+
+    /**
+     * @brief 忽略大小写比较
+     */
+    bool iequals(const StringRef& o) const {
+        return m_size == o.m_size && strncasecmp(m_data, o.m_data, m_size) == 0;
+    }
+
+    bool operator==(const StringRef& o) const {
+        return m_size == o.m_size && memcmp(m_data, o.m_data, m_size) == 0;
+    }
+
+    bool operator!=(const StringRef& o) const { return !(*this == o);}
+private:
+    const char* m_data;
+    size_t m_size;
+};
+
+std::ostream& operator<<(std::ostream& os, const StringRef& s);
+
+class HttpRequestParser;
+class HttpResponseParser;
+class HttpSession;
+class HttpConnection;
+
+/**
+ * @brief HTTP请求结构
+ * @details 字符串都指向HttpSession的接收缓冲区，只在处理这个请求期间有效
+ */
+class HttpRequest {
+public:
+    /**
+     * @brief 请求头
+     */
+    struct Header {
+        StringRef name;
+        StringRef value;
+    };
+
+    HttpRequest();
+
+    /**
+     * @brief 清空，保留已经分配的容量
+     */
+    void reset();
+
+    HttpMethod getMethod() const { return m_method;}
+
+    /**
+     * @brief 返回HTTP版本，0x11为HTTP/1.1
+     */
+    uint8_t getVersion() const { return m_version;}
+
+    /**
+     * @brief 返回完整的请求目标(path?query#fragment)
+     */
+    const StringRef& getUri() const { return m_uri;}
+    const StringRef& getPath() const { return m_path;}
+    const StringRef& getQuery() const { return m_query;}
+    const StringRef& getFragment() const { return m_fragment;}
+    const StringRef& getBody() const { return m_body;}
+    const std::vector<Header>& getHeaders() const { return m_headers;}
+
+    /**
+     * @brief 是否在响应后关闭连接
+     * @details HTTP/1.1默认保持连接，HTTP/1.0需要Connection: keep-alive
+     */
+    bool isClose() const { return m_close;}
+
+    /**
+     * @brief 返回Content-Length，没有时为0
+     */
+    uint64_t getContentLength() const { return m_contentLength;}
+
+    /**
+     * @brief 是否是Transfer-Encoding: chunked
+     */
+    bool isChunked() const { return m_chunked;}
+
+    /**
+     * @brief 查找请求头(忽略大小写)，不存在时返回空
+     */
+    StringRef getHeader(const StringRef& name) const;
+
+    /**
+     * @brief 是否有请求头
+     */
+    bool hasHeader(const StringRef& name) const;
+
+    std::ostream& dump(std::ostream& os) const;
+    std::string toString() const;
+private:
+    friend class HttpRequestParser;
+    friend class HttpSession;
+    HttpMethod m_method;
+    uint8_t m_version;
+    bool m_close;
+    bool m_chunked;
+    uint64_t m_contentLength;
+    StringRef m_uri;
+    StringRef m_path;
+    StringRef m_query;
+    StringRef m_fragment;
+    StringRef m_body;
+    std::vector<Header> m_headers;
+    /// body不在接收缓冲区的同一个内存块里时拷贝到这里
+    std::string m_bodyStore;
+};
+
+/**
+ * @brief HTTP响应结构
+ * @details 由HttpSession复用，头部直接拼在一个预留了容量的字符串里
+ */
+class HttpResponse {
+public:
+    typedef std::shared_ptr<HttpResponse> ptr;
+
+    HttpResponse();
+
+    /**
+     * @brief 清空，保留已经分配的容量
+     */
+    void reset();
+
+    HttpStatus getStatus() const { return m_status;}
+    void setStatus(HttpStatus v) { m_status = v;}
+
+    uint8_t getVersion() const { return m_version;}
+    void setVersion(uint8_t v) { m_version = v;}
+
+    bool isClose() const { return m_close;}
+    void setClose(bool v) { m_close = v;}
+
+    /**
+     * @brief 只发送头部(HEAD请求)，Content-Length仍然是body的长度
+     */
+    void setHeadOnly(bool v) { m_headOnly = v;}
+    bool isHeadOnly() const { return m_headOnly;}
+
+    /**
+     * @brief 添加响应头，Content-Length/Connection/Date由框架生成
+     */
+    void setHeader(const StringRef& name, const StringRef& value);
+
+    /**
+     * @brief 查找响应头(忽略大小写)，不存在时返回空
+     */
+    StringRef getHeader(const StringRef& name) const;
+
+    /**
+     * @brief 设置Content-Type
+     */
+    void setContentType(const StringRef& v) { setHeader("Content-Type", v);}
+
+    /**
+     * @brief 设置body(拷贝)
+     */
+    void setBody(const StringRef& v);
+
+    /**
+     * @brief 设置body(不拷贝)
+     * @details 数据必须在响应发出之前一直有效，一般用于静态数据
+     */
+    void setBodyRef(const StringRef& v) { m_body = v;}
+
+    /**
+     * @brief 返回body
+     */
+    const StringRef& getBody() const { return m_body;}
+
+    /**
+     * @brief 把状态行和响应头追加到out
+     */
+    void appendHead(std::string& out) const;
+
+    std::ostream& dump(std::ostream& os) const;
+    std::string toString() const;
+private:
+    friend class HttpResponseParser;
+    friend class HttpConnection;
+    HttpStatus m_status;
+    uint8_t m_version;
+    bool m_close;
+    bool m_headOnly;
+    /// 已经格式化好的响应头"name: value\r\n..."
+    std::string m_headers;
+    StringRef m_body;
+    std::string m_bodyStore;
+};
+
+std::ostream& operator<<(std::ostream& os, const HttpRequest& req);
+std::ostream& operator<<(std::ostream& os, const HttpResponse& rsp);
+
+}
+}
+
+#endif
@@ -0,0 +1,744 @@
+#include "http_connection.h"
+#include "../config.h"
+#include "../hook.h"
+#include "../log.h"
+#include "../util.h"
+#include <sstream>
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http_client_max_idle =
+    sylar::Config::Lookup("http.client.max_idle"
+                ,(uint32_t)16, "http client pool max idle connections per host");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http_client_max_total =
+    sylar::Config::Lookup("http.client.max_total"
+                ,(uint32_t)64, "http client pool max connections per host");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_client_max_idle_time =
+    sylar::Config::Lookup("http.client.max_idle_time"
+                ,(uint64_t)(30 * 1000), "http client pool max idle time ms");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_client_connect_timeout =
+    sylar::Config::Lookup("http.client.connect_timeout"
+                ,(uint64_t)(3 * 1000), "http client connect timeout ms");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_client_max_body_size =
+    sylar::Config::Lookup("http.client.max_body_size"
+                ,(uint64_t)(64 * 1024 * 1024), "http client max response body size");
+
+// 每个响应都要检查，按线程缓存，不每次拷贝配置值
+static uint64_t GetMaxBodySize() {
+    static thread_local ConfigVar<uint64_t>::Cache t_max_body_size(g_http_client_max_body_size);
+    return t_max_body_size.get();
+}
+
+/// 接收缓冲区初始大小
+static const size_t RECV_BUFFER_SIZE = 16 * 1024;
+
+#define RESULT(err, msg) \
+    std::make_shared<HttpResult>((int)HttpResult::Error::err, nullptr, msg)
+
+/**
+ * @brief 解析 http://host[:port][/path]
+ */
+static bool ParseUrl(const std::string& url, std::string& host
+                     ,uint16_t& port, std::string& path) {
+    static const char s_scheme[] = "http://";
+    if(url.compare(0, sizeof(s_scheme) - 1, s_scheme) != 0) {
+        return false;
+    }
+    size_t hb = sizeof(s_scheme) - 1;
+    size_t pb = url.find_first_of("/?#", hb);
+    std::string authority = url.substr(hb, pb == std::string::npos ? std::string::npos : pb - hb);
+    path = pb == std::string::npos ? "/" : url.substr(pb);
+    if(path[0] != '/') {
+        path = "/" + path;
+    }
+    size_t fragment = path.find('#');
+    if(fragment != std::string::npos) {
+        path.resize(fragment);
+    }
+    port = 80;
+    size_t colon = authority.rfind(':');
+    if(colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+        std::string p = authority.substr(colon + 1);
+        if(p.empty() || p.size() > 5 || p.find_first_not_of("0123456789") != std::string::npos
+                || atoi(p.c_str()) > 65535) {
+            return false;
+        }
+        port = atoi(p.c_str());
+        authority.resize(colon);
+    }
+    if(authority.size() > 2 && authority[0] == '[' && authority.back() == ']') {
+        authority = authority.substr(1, authority.size() - 2);
+    }
+    host = authority;
+    return !host.empty();
+}
+
+/**
+ * @brief 解析主机地址
+ */
+static Address::ptr ResolveAddress(const std::string& host, uint16_t port) {
+    IPAddress::ptr addr = Address::LookupAnyIPAddress(host);
+    if(!addr) {
+        return nullptr;
+    }
+    addr->setPort(port);
+    return addr;
+}
+
+void HttpClientRequest::appendTo(std::string& out, const std::string& host) const {
+    out.append(HttpMethodToString(method));
+    out.push_back(' ');
+    out.append(path.empty() ? "/" : path);
+    out.append(" HTTP/1.1\r\n", 11);
+    bool has_host = false;
+    bool has_conn = false;
+    for(auto& i : headers) {
+        StringRef name(i.first);
+        if(name.iequals("Content-Length")) {
+            continue;
+        }
+        if(name.iequals("Host")) {
+            has_host = true;
+        } else if(name.iequals("Connection")) {
+            has_conn = true;
+        }
+        out.append(i.first);
+        out.append(": ", 2);
+        out.append(i.second);
+        out.append("\r\n", 2);
+    }
+    if(!has_host) {
+        out.append("Host: ", 6);
+        out.append(host);
+        out.append("\r\n", 2);
+    }
+    if(close && !has_conn) {
+        out.append("Connection: close\r\n", 19);
+    }
+    if(!body.empty() || method == HttpMethod::POST
+            || method == HttpMethod::PUT || method == HttpMethod::PATCH) {
+        out.append("Content-Length: ", 16);
+        out.append(std::to_string(body.size()));
+        out.append("\r\n", 2);
+    }
+    out.append("\r\n", 2);
+    out.append(body);
+}
+
+std::string HttpResult::toString() const {
+    std::stringstream ss;
+    ss << "[HttpResult result=" << result
+       << " error=" << error
+       << " response=" << (response ? response->toString() : "nullptr")
+       << "]";
+    return ss.str();
+}
+
+HttpConnection::HttpConnection(Socket::ptr sock, const std::string& host)
+    :m_sock(sock)
+    ,m_host(host)
+    ,m_buf(RECV_BUFFER_SIZE)
+    ,m_begin(0)
+    ,m_end(0)
+    ,m_timeout(~0ull)
+    ,m_createTime(sylar::GetCurrentMS())
+    ,m_lastUsed(m_createTime)
+    ,m_requests(0)
+    ,m_close(false) {
+}
+
+HttpConnection::~HttpConnection() {
+    m_sock->close();
+}
+
+HttpResult::ptr HttpConnection::DoGet(const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    return DoRequest(HttpMethod::GET, url, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnection::DoPost(const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    return DoRequest(HttpMethod::POST, url, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnection::DoRequest(HttpMethod method
+                            , const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    std::string host;
+    uint16_t port = 0;
+    HttpClientRequest req(method);
+    if(!ParseUrl(url, host, port, req.path)) {
+        return RESULT(INVALID_URL, "invalid url: " + url);
+    }
+    Address::ptr addr = ResolveAddress(host, port);
+    if(!addr) {
+        return RESULT(INVALID_HOST, "invalid host: " + host);
+    }
+    Socket::ptr sock = Socket::CreateTCP(addr);
+    if(!sock) {
+        return RESULT(CREATE_SOCKET_ERROR, "create socket fail: " + addr->toString()
+                + " errno=" + std::to_string(errno)
+                + " errstr=" + std::string(strerror(errno)));
+    }
+    if(!sock->connect(addr, timeout_ms)) {
+        return RESULT(CONNECT_FAIL, "connect fail: " + addr->toString());
+    }
+    req.headers = headers;
+    req.body = body;
+    req.close = true;
+    HttpConnection conn(sock, port == 80 ? host : host + ":" + std::to_string(port));
+    return conn.request(req, timeout_ms);
+}
+
+void HttpConnection::setTimeout(uint64_t timeout_ms) {
+    if(timeout_ms == m_timeout) {
+        return;
+    }
+    m_timeout = timeout_ms;
+    m_sock->setRecvTimeout(timeout_ms);
+    m_sock->setSendTimeout(timeout_ms);
+}
+
+HttpResult::ptr HttpConnection::error(int err, const std::string& msg) {
+    m_close = true;
+    return std::make_shared<HttpResult>(err, nullptr, msg);
+}
+
+HttpResult::ptr HttpConnection::request(const HttpClientRequest& req, uint64_t timeout_ms) {
+    if(m_close) {
+        return error((int)HttpResult::Error::POOL_INVALID_CONNECTION, "connection closed");
+    }
+    setTimeout(timeout_ms);
+    m_out.clear();
+    req.appendTo(m_out, m_host);
+    HttpResult::ptr rt = sendOut();
+    if(rt) {
+        return rt;
+    }
+    return recvResponse(req.method == HttpMethod::HEAD);
+}
+
+std::vector<HttpResult::ptr> HttpConnection::pipeline(const std::vector<HttpClientRequest>& reqs
+                                                      ,uint64_t timeout_ms) {
+    std::vector<HttpResult::ptr> results;
+    results.reserve(reqs.size());
+    if(m_close) {
+        results.resize(reqs.size(), error((int)HttpResult::Error::POOL_INVALID_CONNECTION
+                    , "connection closed"));
+        return results;
+    }
+    setTimeout(timeout_ms);
+    m_out.clear();
+    for(auto& i : reqs) {
+        i.appendTo(m_out, m_host);
+    }
+    HttpResult::ptr rt = sendOut();
+    if(rt) {
+        results.resize(reqs.size(), rt);
+        return results;
+    }
+    for(auto& i : reqs) {
+        // 前面的响应要求关闭连接时，后面的请求不会有响应
+        if(m_close) {
+            rt = error((int)HttpResult::Error::RECV_CLOSE_BY_PEER, "closed by previous response");
+        } else {
+            rt = recvResponse(i.method == HttpMethod::HEAD);
+        }
+        if(rt->result) {
+            results.resize(reqs.size(), rt);
+            break;
+        }
+        results.push_back(rt);
+    }
+    return results;
+}
+
+HttpResult::ptr HttpConnection::sendOut() {
+    size_t offset = 0;
+    while(offset < m_out.size()) {
+        int rt = m_sock->send(&m_out[offset], m_out.size() - offset, MSG_NOSIGNAL);
+        if(rt == 0) {
+            return error((int)HttpResult::Error::SEND_CLOSE_BY_PEER
+                    , "send request closed by peer: " + m_sock->getRemoteAddress()->toString());
+        }
+        if(rt < 0) {
+            if(errno == ETIMEDOUT) {
+                return error((int)HttpResult::Error::TIMEOUT, "send request timeout");
+            }
+            return error((int)HttpResult::Error::SEND_SOCKET_ERROR
+                    , "send request socket error errno=" + std::to_string(errno)
+                    + " errstr=" + std::string(strerror(errno)));
+        }
+        offset += rt;
+    }
+    return nullptr;
+}
+
+int HttpConnection::fill() {
+    if(m_begin > 0) {
+        memmove(&m_buf[0], &m_buf[m_begin], m_end - m_begin);
+        m_end -= m_begin;
+        m_begin = 0;
+    }
+    if(m_end == m_buf.size()) {
+        m_buf.resize(m_buf.size() * 2);
+    }
+    int rt = m_sock->recv(&m_buf[m_end], m_buf.size() - m_end);
+    if(rt == 0) {
+        return (int)HttpResult::Error::RECV_CLOSE_BY_PEER;
+    }
+    if(rt < 0) {
+        return errno == ETIMEDOUT ? (int)HttpResult::Error::TIMEOUT
+                    : (int)HttpResult::Error::RECV_SOCKET_ERROR;
+    }
+    m_end += rt;
+    return 0;
+}
+
+int HttpConnection::readBody(std::string& out, uint64_t len) {
+    // 先检查长度再分配，服务端给的长度不可信
+    uint64_t max_size = GetMaxBodySize();
+    if(out.size() > max_size || len > max_size - out.size()) {
+        return (int)HttpResult::Error::PARSE_ERROR;
+    }
+    size_t n = std::min<uint64_t>(len, m_end - m_begin);
+    out.append(&m_buf[m_begin], n);
+    m_begin += n;
+    len -= n;
+    if(len == 0) {
+        return 0;
+    }
+    // 剩下的直接收到out里，不经过接收缓冲区
+    size_t offset = out.size();
+    out.resize(offset + len);
+    while(len > 0) {
+        int rt = m_sock->recv(&out[offset], len);
+        if(rt == 0) {
+            return (int)HttpResult::Error::RECV_CLOSE_BY_PEER;
+        }
+        if(rt < 0) {
+            return errno == ETIMEDOUT ? (int)HttpResult::Error::TIMEOUT
+                        : (int)HttpResult::Error::RECV_SOCKET_ERROR;
+        }
+        offset += rt;
+        len -= rt;
+    }
+    return 0;
+}
+
+int HttpConnection::readLine(std::string& line) {
+    while(true) {
+        const char* b = &m_buf[m_begin];
+        const char* p = (const char*)memchr(b, '\n', m_end - m_begin);
+        if(p) {
+            const char* e = (p > b && p[-1] == '\r') ? p - 1 : p;
+            line.assign(b, e - b);
+            m_begin += p + 1 - b;
+            return 0;
+        }
+        if(m_end - m_begin > 4096) {
+            return (int)HttpResult::Error::PARSE_ERROR;
+        }
+        int rt = fill();
+        if(rt) {
+            return rt;
+        }
+    }
+}
+
+int HttpConnection::readChunked(std::string& out) {
+    std::string line;
+    while(true) {
+        int rt = readLine(line);
+        if(rt) {
+            return rt;
+        }
+        // 忽略chunk-ext
+        char* end = nullptr;
+        uint64_t size = strtoull(line.c_str(), &end, 16);
+        if(end == line.c_str() || (*end && *end != ';' && *end != ' ' && *end != '\t')) {
+            return (int)HttpResult::Error::PARSE_ERROR;
+        }
+        if(size == 0) {
+            // trailer一直到空行
+            do {
+                rt = readLine(line);
+                if(rt) {
+                    return rt;
+                }
+            } while(!line.empty());
+            return 0;
+        }
+        rt = readBody(out, size);
+        if(rt) {
+            return rt;
+        }
+        rt = readLine(line);
+        if(rt) {
+            return rt;
+        }
+        if(!line.empty()) {
+            return (int)HttpResult::Error::PARSE_ERROR;
+        }
+    }
+}
+
+int HttpConnection::readUntilClose(std::string& out) {
+    out.append(&m_buf[m_begin], m_end - m_begin);
+    m_begin = m_end = 0;
+    uint64_t max_size = GetMaxBodySize();
+    while(true) {
+        size_t offset = out.size();
+        if(offset > max_size) {
+            return (int)HttpResult::Error::PARSE_ERROR;
+        }
+        out.resize(offset + RECV_BUFFER_SIZE);
+        int rt = m_sock->recv(&out[offset], RECV_BUFFER_SIZE);
+        if(rt <= 0) {
+            out.resize(offset);
+            if(rt == 0) {
+                return 0;
+            }
+            return errno == ETIMEDOUT ? (int)HttpResult::Error::TIMEOUT
+                        : (int)HttpResult::Error::RECV_SOCKET_ERROR;
+        }
+        out.resize(offset + rt);
+    }
+}
+
+HttpResult::ptr HttpConnection::recvResponse(bool head_only) {
+    HttpResponse::ptr rsp = std::make_shared<HttpResponse>();
+    HttpResponseParser parser(*rsp);
+    while(true) {
+        int rt = m_end > m_begin ? parser.execute(&m_buf[m_begin], m_end - m_begin) : 0;
+        if(rt > 0) {
+            m_begin += rt;
+            int code = (int)rsp->getStatus();
+            // 跳过100 Continue之类的中间响应
+            if(code >= 100 && code < 200 && code != 101) {
+                parser.reset();
+                continue;
+            }
+            break;
+        }
+        if(rt < 0) {
+            return error((int)HttpResult::Error::PARSE_ERROR, "parse response error");
+        }
+        int err = fill();
+        if(err) {
+            return error(err, "recv response head error=" + std::to_string(err)
+                    + " errno=" + std::to_string(errno));
+        }
+    }
+
+    int code = (int)rsp->getStatus();
+    int err = 0;
+    if(head_only || code == 204 || code == 304) {
+    } else if(parser.isChunked()) {
+        err = readChunked(rsp->m_bodyStore);
+    } else if(parser.hasContentLength()) {
+        err = readBody(rsp->m_bodyStore, parser.getContentLength());
+    } else {
+        // 没有长度的body读到连接关闭为止，连接不能再复用
+        rsp->setClose(true);
+        err = readUntilClose(rsp->m_bodyStore);
+    }
+    if(err) {
+        return error(err, "recv response body error=" + std::to_string(err)
+                + " errno=" + std::to_string(errno));
+    }
+    rsp->m_body = rsp->m_bodyStore;
+    if(rsp->isClose()) {
+        m_close = true;
+    }
+    ++m_requests;
+    m_lastUsed = sylar::GetCurrentMS();
+    return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
+}
+
+bool HttpConnection::isHealthy() {
+    if(m_close || !m_sock->isConnected() || m_end > m_begin) {
+        return false;
+    }
+    // 不经过hook，不会挂起协程
+    char c;
+    int rt = recv_f(m_sock->getSocket(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+HttpConnectionPool::ptr HttpConnectionPool::Create(const std::string& host
+                                                   ,uint16_t port
+                                                   ,uint32_t max_idle
+                                                   ,uint32_t max_total
+                                                   ,uint64_t max_idle_time
+                                                   ,uint64_t connect_timeout
+                                                   ,IOManager* iom) {
+    HttpConnectionPool::ptr pool(new HttpConnectionPool(host, port, max_idle
+                , max_total, max_idle_time, connect_timeout));
+    if(iom && max_idle_time) {
+        std::weak_ptr<HttpConnectionPool> weak(pool);
+        pool->m_timer = iom->addConditionTimer(std::max<uint64_t>(max_idle_time / 2, 10)
+                , [weak]() {
+            auto self = weak.lock();
+            if(self) {
+                self->evict();
+            }
+        }, weak, true);
+    }
+    return pool;
+}
+
+HttpConnectionPool::ptr HttpConnectionPool::Get(const std::string& host, uint16_t port) {
+    static Mutex s_mutex;
+    static std::map<std::string, HttpConnectionPool::ptr> s_pools;
+    std::string key = host + ":" + std::to_string(port);
+    Mutex::Lock lock(s_mutex);
+    auto& pool = s_pools[key];
+    if(!pool) {
+        pool = Create(host, port
+                , g_http_client_max_idle->getValue()
+                , g_http_client_max_total->getValue()
+                , g_http_client_max_idle_time->getValue()
+                , g_http_client_connect_timeout->getValue());
+    }
+    return pool;
+}
+
+HttpConnectionPool::HttpConnectionPool(const std::string& host
+                                       ,uint16_t port
+                                       ,uint32_t max_idle
+                                       ,uint32_t max_total
+                                       ,uint64_t max_idle_time
+                                       ,uint64_t connect_timeout)
+    :m_host(host)
+    ,m_port(port ? port : 80)
+    ,m_maxIdle(max_idle)
+    ,m_maxTotal(max_total ? max_total : 1)
+    ,m_maxIdleTime(max_idle_time)
+    ,m_connectTimeout(connect_timeout)
+    ,m_total(0)
+    ,m_closed(false) {
+}
+
+HttpConnectionPool::~HttpConnectionPool() {
+    if(m_timer) {
+        m_timer->cancel();
+    }
+}
+
+HttpResult::ptr HttpConnectionPool::doGet(const std::string& path
+                                          , uint64_t timeout_ms
+                                          , const std::map<std::string, std::string>& headers
+                                          , const std::string& body) {
+    return doRequest(HttpMethod::GET, path, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnectionPool::doPost(const std::string& path
+                                           , uint64_t timeout_ms
+                                           , const std::map<std::string, std::string>& headers
+                                           , const std::string& body) {
+    return doRequest(HttpMethod::POST, path, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnectionPool::doRequest(HttpMethod method
+                                              , const std::string& path
+                                              , uint64_t timeout_ms
+                                              , const std::map<std::string, std::string>& headers
+                                              , const std::string& body) {
+    HttpClientRequest req(method, path);
+    req.headers = headers;
+    req.body = body;
+    return request(req, timeout_ms);
+}
+
+/**
+ * @brief 是否可以安全重试
+ */
+static bool IsIdempotent(HttpMethod m) {
+    return m == HttpMethod::GET || m == HttpMethod::HEAD || m == HttpMethod::PUT
+        || m == HttpMethod::DELETE || m == HttpMethod::OPTIONS || m == HttpMethod::TRACE;
+}
+
+HttpResult::ptr HttpConnectionPool::request(const HttpClientRequest& req, uint64_t timeout_ms) {
+    for(int i = 0; i < 2; ++i) {
+        int err = 0;
+        HttpConnection::ptr conn = getConnection(timeout_ms, err);
+        if(!conn) {
+            return std::make_shared<HttpResult>(err, nullptr
+                    , "pool host:" + m_host + " port:" + std::to_string(m_port));
+        }
+        bool reused = conn->getRequestCount() > 0;
+        HttpResult::ptr rt = conn->request(req, timeout_ms);
+        release(conn, !rt->result);
+        // 服务器可能刚好关闭了空闲连接
+        if(i == 0 && reused && IsIdempotent(req.method)
+                && (rt->result == (int)HttpResult::Error::SEND_CLOSE_BY_PEER
+                    || rt->result == (int)HttpResult::Error::SEND_SOCKET_ERROR
+                    || rt->result == (int)HttpResult::Error::RECV_CLOSE_BY_PEER
+                    || rt->result == (int)HttpResult::Error::RECV_SOCKET_ERROR)) {
+            SYLAR_LOG_DEBUG(g_logger) << "retry on new connection: " << rt->error;
+            continue;
+        }
+        return rt;
+    }
+    return nullptr;
+}
+
+std::vector<HttpResult::ptr> HttpConnectionPool::pipeline(const std::vector<HttpClientRequest>& reqs
+                                                          ,uint64_t timeout_ms) {
+    int err = 0;
+    HttpConnection::ptr conn = getConnection(timeout_ms, err);
+    if(!conn) {
+        return std::vector<HttpResult::ptr>(reqs.size(), std::make_shared<HttpResult>(err
+                    , nullptr, "pool host:" + m_host + " port:" + std::to_string(m_port)));
+    }
+    std::vector<HttpResult::ptr> results = conn->pipeline(reqs, timeout_ms);
+    release(conn, !conn->isClose());
+    return results;
+}
+
+HttpConnection::ptr HttpConnectionPool::getConnection(uint64_t timeout_ms, int& err) {
+    uint64_t now = sylar::GetCurrentMS();
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : now + timeout_ms;
+    // 不可用的连接在锁外释放
+    std::vector<HttpConnection::ptr> dead;
+    {
+        MutexType::Lock lock(m_mutex);
+        while(true) {
+            if(m_closed) {
+                err = (int)HttpResult::Error::POOL_GET_CONNECTION;
+                return nullptr;
+            }
+            while(!m_idle.empty()) {
+                HttpConnection::ptr conn = m_idle.back();
+                m_idle.pop_back();
+                if(conn->isHealthy() && (!m_maxIdleTime
+                            || now - conn->getLastUsed() < m_maxIdleTime)) {
+                    return conn;
+                }
+                --m_total;
+                dead.push_back(conn);
+            }
+            if(m_total < m_maxTotal) {
+                ++m_total;
+                break;
+            }
+            now = sylar::GetCurrentMS();
+            if(now >= deadline || !m_cond.waitFor(m_mutex, deadline - now)) {
+                err = (int)HttpResult::Error::POOL_GET_CONNECTION;
+                return nullptr;
+            }
+        }
+    }
+    HttpConnection::ptr conn = connect(err);
+    if(!conn) {
+        MutexType::Lock lock(m_mutex);
+        --m_total;
+        m_cond.notifyOne();
+    }
+    return conn;
+}
+
+HttpConnection::ptr HttpConnectionPool::connect(int& err) {
+    Address::ptr addr;
+    {
+        MutexType::Lock lock(m_mutex);
+        addr = m_addr;
+    }
+    if(!addr) {
+        addr = ResolveAddress(m_host, m_port);
+        if(!addr) {
+            err = (int)HttpResult::Error::INVALID_HOST;
+            return nullptr;
+        }
+        MutexType::Lock lock(m_mutex);
+        m_addr = addr;
+    }
+    Socket::ptr sock = Socket::CreateTCP(addr);
+    if(!sock) {
+        err = (int)HttpResult::Error::CREATE_SOCKET_ERROR;
+        return nullptr;
+    }
+    if(!sock->connect(addr, m_connectTimeout)) {
+        SYLAR_LOG_DEBUG(g_logger) << "http pool connect " << *addr << " fail";
+        err = (int)HttpResult::Error::CONNECT_FAIL;
+        // 下次重新解析，地址可能变了
+        MutexType::Lock lock(m_mutex);
+        m_addr.reset();
+        return nullptr;
+    }
+    return std::make_shared<HttpConnection>(sock
+            , m_port == 80 ? m_host : m_host + ":" + std::to_string(m_port));
+}
+
+void HttpConnectionPool::release(HttpConnection::ptr conn, bool reuse) {
+    MutexType::Lock lock(m_mutex);
+    if(reuse && !m_closed && !conn->isClose() && m_idle.size() < m_maxIdle) {
+        m_idle.push_back(conn);
+    } else {
+        --m_total;
+    }
+    m_cond.notifyOne();
+    lock.unlock();
+    // 不复用的连接在锁外随conn析构关闭
+}
+
+size_t HttpConnectionPool::evict() {
+    std::vector<HttpConnection::ptr> dead;
+    uint64_t now = sylar::GetCurrentMS();
+    MutexType::Lock lock(m_mutex);
+    for(auto it = m_idle.begin(); it != m_idle.end();) {
+        if((m_maxIdleTime && now - (*it)->getLastUsed() >= m_maxIdleTime)
+                || !(*it)->isHealthy()) {
+            dead.push_back(*it);
+            it = m_idle.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_total -= dead.size();
+    if(!dead.empty()) {
+        m_cond.notifyAll();
+    }
+    lock.unlock();
+    return dead.size();
+}
+
+void HttpConnectionPool::close() {
+    std::list<HttpConnection::ptr> idle;
+    MutexType::Lock lock(m_mutex);
+    m_closed = true;
+    idle.swap(m_idle);
+    m_total -= idle.size();
+    if(m_timer) {
+        m_timer->cancel();
+        m_timer.reset();
+    }
+    m_cond.notifyAll();
+}
+
+size_t HttpConnectionPool::getIdleCount() {
+    MutexType::Lock lock(m_mutex);
+    return m_idle.size();
+}
+
+size_t HttpConnectionPool::getTotalCount() {
+    MutexType::Lock lock(m_mutex);
+    return m_total;
+}
+
+}
+}
@@ -0,0 +1,403 @@
+/**
+ * @file http_connection.h
+ * @brief HTTP客户端
+ * @details HttpConnection是一个到服务器的长连接，可以顺序发送请求，也可以流水线发送一批请求；
+ *          HttpConnectionPool按主机缓存空闲连接，限制空闲数和总数，
+ *          并用定时器定期淘汰空闲太久或者已经被对端关闭的连接
+ */
+#ifndef __SYLAR_HTTP_CONNECTION_H__
+#define __SYLAR_HTTP_CONNECTION_H__
+
+#include <map>
+#include <list>
+#include <vector>
+#include "http.h"
+#include "http_parser.h"
+#include "../socket.h"
+#include "../address.h"
+#include "../iomanager.h"
+#include "../fiber_sync.h"
+#include "../mutex.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief 客户端要发送的请求
+ */
+struct HttpClientRequest {
+    HttpClientRequest(HttpMethod m = HttpMethod::GET, const std::string& p = "/")
+        :method(m)
+        ,path(p) {
+    }
+
+    /**
+     * @brief 按HTTP/1.1格式追加到out
+     * @param[in] host 没有设置Host头时使用的主机名
+     */
+    void appendTo(std::string& out, const std::string& host) const;
+
+    /// 请求方法
+    HttpMethod method;
+    /// 请求目标 path?query
+    std::string path;
+    /// 请求头，Host/Content-Length由框架生成
+    std::map<std::string, std::string> headers;
+    /// 请求body
+    std::string body;
+    /// 是否要求服务器响应后关闭连接
+    bool close = false;
+};
+
+/**
+ * @brief HTTP响应结果
+ */
+struct HttpResult {
+    /// 智能指针类型定义
+    typedef std::shared_ptr<HttpResult> ptr;
+
+    /**
+     * @brief 错误码定义
+     */
+    enum class Error {
+        /// 正常
+        OK = 0,
+        /// 非法URL
+        INVALID_URL = 1,
+        /// 无法解析HOST
+        INVALID_HOST = 2,
+        /// 连接失败
+        CONNECT_FAIL = 3,
+        /// 连接被对端关闭
+        SEND_CLOSE_BY_PEER = 4,
+        /// send请求产生Socket错误
+        SEND_SOCKET_ERROR = 5,
+        /// 超时
+        TIMEOUT = 6,
+        /// 创建Socket失败
+        CREATE_SOCKET_ERROR = 7,
+        /// 从连接池中取连接失败
+        POOL_GET_CONNECTION = 8,
+        /// 无效的连接
+        POOL_INVALID_CONNECTION = 9,
+        /// 接收响应时连接被对端关闭
+        RECV_CLOSE_BY_PEER = 10,
+        /// 接收响应产生Socket错误
+        RECV_SOCKET_ERROR = 11,
+        /// 响应格式错误
+        PARSE_ERROR = 12,
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] _result 错误码
+     * @param[in] _response HTTP响应结构体
+     * @param[in] _error 错误描述
+     */
+    HttpResult(int _result
+               ,HttpResponse::ptr _response
+               ,const std::string& _error)
+        :result(_result)
+        ,response(_response)
+        ,error(_error) {}
+
+    /// 错误码
+    int result;
+    /// HTTP响应结构体
+    HttpResponse::ptr response;
+    /// 错误描述
+    std::string error;
+
+    std::string toString() const;
+};
+
+/**
+ * @brief HTTP客户端连接
+ */
+class HttpConnection {
+public:
+    /// HTTP客户端连接智能指针
+    typedef std::shared_ptr<HttpConnection> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] sock 已连接的Socket
+     * @param[in] host 请求默认的Host头
+     */
+    HttpConnection(Socket::ptr sock, const std::string& host);
+
+    /**
+     * @brief 析构函数，关闭连接
+     */
+    ~HttpConnection();
+
+    /**
+     * @brief 发送HTTP的GET请求(每次新建连接)
+     * @param[in] url 请求的url，只支持http://
+     * @param[in] timeout_ms 连接和每次读写的超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     */
+    static HttpResult::ptr DoGet(const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers = {}
+                            , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP的POST请求(每次新建连接)
+     */
+    static HttpResult::ptr DoPost(const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers = {}
+                            , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP请求(每次新建连接)
+     * @param[in] method 请求类型
+     */
+    static HttpResult::ptr DoRequest(HttpMethod method
+                            , const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers = {}
+                            , const std::string& body = "");
+
+    /**
+     * @brief 发送请求并接收响应
+     * @param[in] timeout_ms 每次读写的超时时间(毫秒)
+     */
+    HttpResult::ptr request(const HttpClientRequest& req, uint64_t timeout_ms);
+
+    /**
+     * @brief 流水线发送一批请求，再按顺序接收响应
+     * @details 请求一次性写出；某个响应失败时，它和后面的请求都返回同样的错误
+     * @return 和reqs一一对应的结果
+     */
+    std::vector<HttpResult::ptr> pipeline(const std::vector<HttpClientRequest>& reqs
+                                          ,uint64_t timeout_ms);
+
+    /**
+     * @brief 连接是否还能继续使用
+     * @details 服务器要求关闭或者出过错时返回false；
+     *          否则不阻塞地窥探一下socket，对端已经关闭或者有多余的数据时也返回false
+     */
+    bool isHealthy();
+
+    /**
+     * @brief 服务器是否要求关闭连接(或者连接出过错)
+     */
+    bool isClose() const { return m_close;}
+
+    /**
+     * @brief 已经完成的请求数
+     */
+    uint64_t getRequestCount() const { return m_requests;}
+    uint64_t getCreateTime() const { return m_createTime;}
+
+    /**
+     * @brief 最后一次完成请求的时间(毫秒)
+     */
+    uint64_t getLastUsed() const { return m_lastUsed;}
+
+    Socket::ptr getSocket() const { return m_sock;}
+private:
+    /**
+     * @brief 设置读写超时，和上次一样时不调用setsockopt
+     */
+    void setTimeout(uint64_t timeout_ms);
+
+    /**
+     * @brief 发送m_out
+     */
+    HttpResult::ptr sendOut();
+
+    /**
+     * @brief 接收一个响应
+     */
+    HttpResult::ptr recvResponse(bool head_only);
+
+    /**
+     * @brief 接收数据追加到m_buf
+     * @return 0成功，否则为HttpResult::Error
+     */
+    int fill();
+
+    /**
+     * @brief 读取len字节追加到out
+     * @details out超过http.client.max_body_size时返回PARSE_ERROR
+     */
+    int readBody(std::string& out, uint64_t len);
+
+    /**
+     * @brief 读取chunked编码的body追加到out
+     */
+    int readChunked(std::string& out);
+
+    /**
+     * @brief 读取一行(不含\r\n)
+     */
+    int readLine(std::string& line);
+
+    /**
+     * @brief 读取直到连接关闭
+     * @details 超过http.client.max_body_size时返回PARSE_ERROR
+     */
+    int readUntilClose(std::string& out);
+
+    /**
+     * @brief 出错时构造结果，连接之后不再复用
+     */
+    HttpResult::ptr error(int err, const std::string& msg);
+private:
+    Socket::ptr m_sock;
+    std::string m_host;
+    /// 发送缓冲区
+    std::string m_out;
+    /// 接收缓冲区，[m_begin, m_end)为未处理的数据
+    std::vector<char> m_buf;
+    size_t m_begin;
+    size_t m_end;
+    uint64_t m_timeout;
+    uint64_t m_createTime;
+    uint64_t m_lastUsed;
+    uint64_t m_requests;
+    bool m_close;
+};
+
+/**
+ * @brief HTTP连接池，一个池对应一个主机
+ */
+class HttpConnectionPool : public std::enable_shared_from_this<HttpConnectionPool> {
+public:
+    typedef std::shared_ptr<HttpConnectionPool> ptr;
+    typedef FiberMutex MutexType;
+
+    /**
+     * @brief 创建连接池
+     * @param[in] host 主机名(也用作Host头)
+     * @param[in] port 端口
+     * @param[in] max_idle 最多缓存的空闲连接数
+     * @param[in] max_total 最多同时存在的连接数，达到后取连接要等待
+     * @param[in] max_idle_time 空闲连接的最长保留时间(毫秒)，0表示不淘汰
+     * @param[in] connect_timeout 连接超时时间(毫秒)
+     * @param[in] iom 运行淘汰定时器的IOManager，nullptr时不启动定时器
+     */
+    static HttpConnectionPool::ptr Create(const std::string& host
+                                          ,uint16_t port
+                                          ,uint32_t max_idle
+                                          ,uint32_t max_total
+                                          ,uint64_t max_idle_time
+                                          ,uint64_t connect_timeout
+                                          ,IOManager* iom = IOManager::GetThis());
+
+    /**
+     * @brief 返回host:port共用的连接池，第一次使用时按http.client.*配置创建
+     */
+    static HttpConnectionPool::ptr Get(const std::string& host, uint16_t port);
+
+    ~HttpConnectionPool();
+
+    /**
+     * @brief 发送HTTP的GET请求
+     * @param[in] path 请求目标 path?query
+     * @param[in] timeout_ms 取连接和每次读写的超时时间(毫秒)
+     */
+    HttpResult::ptr doGet(const std::string& path
+                          , uint64_t timeout_ms
+                          , const std::map<std::string, std::string>& headers = {}
+                          , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP的POST请求
+     */
+    HttpResult::ptr doPost(const std::string& path
+                           , uint64_t timeout_ms
+                           , const std::map<std::string, std::string>& headers = {}
+                           , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP请求
+     */
+    HttpResult::ptr doRequest(HttpMethod method
+                              , const std::string& path
+                              , uint64_t timeout_ms
+                              , const std::map<std::string, std::string>& headers = {}
+                              , const std::string& body = "");
+
+    /**
+     * @brief 发送请求
+     * @details 复用的连接在还没收到响应时就失败(服务器关闭了空闲连接)，
+     *          幂等的请求会换一个新连接重试一次
+     */
+    HttpResult::ptr request(const HttpClientRequest& req, uint64_t timeout_ms);
+
+    /**
+     * @brief 在一个连接上流水线发送一批请求
+     */
+    std::vector<HttpResult::ptr> pipeline(const std::vector<HttpClientRequest>& reqs
+                                          ,uint64_t timeout_ms);
+
+    /**
+     * @brief 淘汰空闲太久或者已经不可用的空闲连接(定时器调用)
+     * @return 淘汰的连接数
+     */
+    size_t evict();
+
+    /**
+     * @brief 关闭连接池，关闭空闲连接，正在使用的连接归还时关闭
+     */
+    void close();
+
+    size_t getIdleCount();
+    size_t getTotalCount();
+    const std::string& getHost() const { return m_host;}
+    uint16_t getPort() const { return m_port;}
+private:
+    HttpConnectionPool(const std::string& host
+                       ,uint16_t port
+                       ,uint32_t max_idle
+                       ,uint32_t max_total
+                       ,uint64_t max_idle_time
+                       ,uint64_t connect_timeout);
+
+    /**
+     * @brief 取一个连接，优先用最近归还的空闲连接
+     * @param[out] err 失败时的错误码
+     */
+    HttpConnection::ptr getConnection(uint64_t timeout_ms, int& err);
+
+    /**
+     * @brief 归还连接
+     * @param[in] reuse 是否可以继续使用
+     */
+    void release(HttpConnection::ptr conn, bool reuse);
+
+    /**
+     * @brief 新建连接
+     */
+    HttpConnection::ptr connect(int& err);
+private:
+    std::string m_host;
+    uint16_t m_port;
+    uint32_t m_maxIdle;
+    uint32_t m_maxTotal;
+    uint64_t m_maxIdleTime;
+    uint64_t m_connectTimeout;
+
+    MutexType m_mutex;
+    /// 等待空闲名额
+    FiberCondition m_cond;
+    /// 空闲连接，尾部是最近归还的
+    std::list<HttpConnection::ptr> m_idle;
+    /// 空闲的和正在使用的连接总数
+    uint32_t m_total;
+    bool m_closed;
+    /// 解析好的地址，连接失败后重新解析
+    Address::ptr m_addr;
+    /// 淘汰定时器
+    Timer::ptr m_timer;
+};
+
+}
+}
+
+#endif
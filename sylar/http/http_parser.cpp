@@ -0,0 +1,461 @@
+#include "http_parser.h"
+#include "../config.h"
+#include "../macro.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace sylar {
+namespace http {
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_request_max_header_size =
+    sylar::Config::Lookup("http.request.max_header_size"
+                ,(uint64_t)(8 * 1024), "http request max header size");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_response_max_header_size =
+    sylar::Config::Lookup("http.response.max_header_size"
+                ,(uint64_t)(64 * 1024), "http response max header size");
+
+/// 请求头个数上限
+static const size_t MAX_HEADERS = 100;
+
+/**
+ * @brief 判断是否是非法的控制字符(\t \r \n之外的0x00-0x1f和0x7f)
+ */
+static inline bool IsBadCtl(unsigned char c) {
+    return (c < 0x20 && c != '\t' && c != '\r' && c != '\n') || c == 0x7f;
+}
+
+/**
+ * @brief 查找行尾的'\n'，同时检查行内是否有非法控制字符
+ * @param[out] bad 行内有非法控制字符时置为true
+ * @return '\n'的位置，没找到返回nullptr
+ */
+static const char* FindLineEnd(const char* p, const char* end, bool& bad) {
+#ifdef __SSE2__
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i c1f = _mm_set1_epi8(0x1f);
+    while(end - p >= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)p);
+        __m128i is_lf = _mm_cmpeq_epi8(x, lf);
+        // 无符号 <= 0x1f 或者 == 0x7f
+        __m128i ctl = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, c1f), x)
+                                   ,_mm_cmpeq_epi8(x, del));
+        __m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, tab)
+                                               ,_mm_cmpeq_epi8(x, cr)), is_lf);
+        int bad_mask = _mm_movemask_epi8(_mm_andnot_si128(ok, ctl));
+        int lf_mask = _mm_movemask_epi8(is_lf);
+        if(lf_mask) {
+            int idx = __builtin_ctz(lf_mask);
+            if(bad_mask & ((1 << idx) - 1)) {
+                bad = true;
+            }
+            return p + idx;
+        }
+        if(bad_mask) {
+            bad = true;
+            return p;
+        }
+        p += 16;
+    }
+#endif
+    for(; p < end; ++p) {
+        if(*p == '\n') {
+            return p;
+        }
+        if(IsBadCtl(*p)) {
+            bad = true;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+static inline bool IsSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+/**
+ * @brief 拆分一行"name: value"，value去掉两边的空白
+ * @return 格式是否正确(不支持续行，字段名和冒号之间不能有空白)
+ */
+static bool SplitHeader(const char* b, const char* e, const char*& colon
+                        ,const char*& vb, const char*& ve) {
+    if(IsSpace(*b)) {
+        return false;
+    }
+    colon = (const char*)memchr(b, ':', e - b);
+    if(!colon || colon == b || IsSpace(colon[-1])) {
+        return false;
+    }
+    vb = colon + 1;
+    while(vb < e && IsSpace(*vb)) {
+        ++vb;
+    }
+    ve = e;
+    while(ve > vb && IsSpace(ve[-1])) {
+        --ve;
+    }
+    return true;
+}
+
+/**
+ * @brief 解析Content-Length的值
+ */
+static bool ParseContentLength(const StringRef& val, uint64_t& len) {
+    if(val.empty() || val.size() > 18) {
+        return false;
+    }
+    len = 0;
+    for(size_t i = 0; i < val.size(); ++i) {
+        if(val[i] < '0' || val[i] > '9') {
+            return false;
+        }
+        len = len * 10 + (val[i] - '0');
+    }
+    return true;
+}
+
+/**
+ * @brief Transfer-Encoding的最后一个编码是否是chunked
+ * @details 按逗号分隔取最后一个非空的编码比较，xchunked这种不算
+ */
+static bool IsChunked(const StringRef& val) {
+    const char* b = val.data();
+    const char* e = val.data() + val.size();
+    while(e > b) {
+        while(e > b && (e[-1] == ' ' || e[-1] == '\t')) {
+            --e;
+        }
+        const char* tb = e;
+        while(tb > b && tb[-1] != ',') {
+            --tb;
+        }
+        while(tb < e && (*tb == ' ' || *tb == '\t')) {
+            ++tb;
+        }
+        if(tb != e) {
+            return StringRef(tb, e - tb).iequals("chunked");
+        }
+        // 空元素跳过(RFC 7230 7)
+        e = tb > b ? tb - 1 : b;
+    }
+    return false;
+}
+
+HttpRequestParser::HttpRequestParser(HttpRequest& request)
+    :m_request(request)
+    ,m_maxHeaderSize(g_http_request_max_header_size->getValue()) {
+    m_headers.reserve(32);
+    reset();
+}
+
+void HttpRequestParser::reset() {
+    m_state = REQUEST_LINE;
+    m_error = HttpStatus::OK;
+    m_lineBegin = 0;
+    m_scan = 0;
+    m_uri = m_path = m_query = m_fragment = MakeSpan(0, 0);
+    m_headers.clear();
+    m_connClose = false;
+    m_connKeepalive = false;
+    m_hasContentLength = false;
+    m_hasTransferEncoding = false;
+    m_request.reset();
+}
+
+int HttpRequestParser::error(HttpStatus s) {
+    m_state = ERROR;
+    m_error = s;
+    return -1;
+}
+
+int HttpRequestParser::execute(const char* data, size_t len) {
+    if(m_state == DONE || m_state == ERROR) {
+        return m_state == DONE ? (int)m_lineBegin : -1;
+    }
+    while(true) {
+        bool bad = false;
+        const char* p = FindLineEnd(data + m_scan, data + len, bad);
+        if(bad) {
+            return error(HttpStatus::BAD_REQUEST);
+        }
+        if(!p) {
+            m_scan = len;
+            if(len >= m_maxHeaderSize) {
+                return error(m_state == REQUEST_LINE ? HttpStatus::URI_TOO_LONG
+                                : HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE);
+            }
+            return 0;
+        }
+        size_t eol = p - data;
+        size_t end = eol;
+        if(end > m_lineBegin && data[end - 1] == '\r') {
+            --end;
+        }
+        // 行内不允许单独的\r
+        if(end > m_lineBegin && memchr(data + m_lineBegin, '\r', end - m_lineBegin)) {
+            return error(HttpStatus::BAD_REQUEST);
+        }
+
+        if(m_state == REQUEST_LINE) {
+            // 请求行之前的空行忽略(RFC 7230 3.5)
+            if(end != m_lineBegin) {
+                if(!parseRequestLine(data, m_lineBegin, end)) {
+                    return -1;
+                }
+                m_state = HEADER;
+            }
+        } else if(end == m_lineBegin) {
+            // 最后的编码不是chunked时无法确定body长度，只能400后关闭(RFC 7230 3.3.3)
+            if(m_hasTransferEncoding && !m_request.m_chunked) {
+                return error(HttpStatus::BAD_REQUEST);
+            }
+            m_lineBegin = m_scan = eol + 1;
+            finish(data);
+            m_state = DONE;
+            return (int)m_lineBegin;
+        } else if(!parseHeader(data, m_lineBegin, end)) {
+            return -1;
+        }
+        m_lineBegin = m_scan = eol + 1;
+        if(m_lineBegin >= m_maxHeaderSize) {
+            return error(HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE);
+        }
+    }
+}
+
+bool HttpRequestParser::parseRequestLine(const char* data, size_t begin, size_t end) {
+    const char* b = data + begin;
+    const char* e = data + end;
+    const char* sp1 = (const char*)memchr(b, ' ', e - b);
+    const char* sp2 = (const char*)memrchr(b, ' ', e - b);
+    if(!sp1 || sp1 == sp2 || sp1 == b || sp2 == sp1 + 1) {
+        error(HttpStatus::BAD_REQUEST);
+        return false;
+    }
+    m_request.m_method = CharsToHttpMethod(b, sp1 - b);
+    if(m_request.m_method == HttpMethod::INVALID_METHOD) {
+        error(HttpStatus::NOT_IMPLEMENTED);
+        return false;
+    }
+
+    const char* v = sp2 + 1;
+    if(e - v != 8 || memcmp(v, "HTTP/", 5) != 0 || v[6] != '.'
+            || v[5] < '0' || v[5] > '9' || v[7] < '0' || v[7] > '9') {
+        error(HttpStatus::BAD_REQUEST);
+        return false;
+    }
+    if(v[5] != '1' || (v[7] != '0' && v[7] != '1')) {
+        error(HttpStatus::HTTP_VERSION_NOT_SUPPORTED);
+        return false;
+    }
+    m_request.m_version = 0x10 | (v[7] - '0');
+
+    size_t ub = sp1 + 1 - data;
+    size_t ue = sp2 - data;
+    m_uri = MakeSpan(ub, ue);
+    size_t pe = ue;
+    const char* hash = (const char*)memchr(data + ub, '#', ue - ub);
+    if(hash) {
+        pe = hash - data;
+        m_fragment = MakeSpan(pe + 1, ue);
+    }
+    const char* q = (const char*)memchr(data + ub, '?', pe - ub);
+    if(q) {
+        m_query = MakeSpan(q + 1 - data, pe);
+        pe = q - data;
+    }
+    m_path = MakeSpan(ub, pe);
+    return true;
+}
+
+bool HttpRequestParser::parseHeader(const char* data, size_t begin, size_t end) {
+    const char* colon = nullptr;
+    const char* vb = nullptr;
+    const char* ve = nullptr;
+    if(!SplitHeader(data + begin, data + end, colon, vb, ve)) {
+        error(HttpStatus::BAD_REQUEST);
+        return false;
+    }
+    if(m_headers.size() >= MAX_HEADERS) {
+        error(HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE);
+        return false;
+    }
+    Span name = MakeSpan(begin, colon - data);
+    Span value = MakeSpan(vb - data, ve - data);
+    m_headers.push_back(std::make_pair(name, value));
+
+    // 框架关心的几个头
+    StringRef n = ToRef(data, name);
+    StringRef val = ToRef(data, value);
+    if(n.iequals("Content-Length")) {
+        uint64_t len = 0;
+        if(!ParseContentLength(val, len)
+                || (m_hasContentLength && len != m_request.m_contentLength)) {
+            error(HttpStatus::BAD_REQUEST);
+            return false;
+        }
+        m_hasContentLength = true;
+        m_request.m_contentLength = len;
+    } else if(n.iequals("Transfer-Encoding")) {
+        // 多个Transfer-Encoding头按顺序拼接，以最后一个为准
+        m_hasTransferEncoding = true;
+        m_request.m_chunked = IsChunked(val);
+    } else if(n.iequals("Connection")) {
+        if(val.iequals("close")) {
+            m_connClose = true;
+        } else if(val.iequals("keep-alive")) {
+            m_connKeepalive = true;
+        }
+    }
+    return true;
+}
+
+void HttpRequestParser::finish(const char* data) {
+    m_request.m_uri = ToRef(data, m_uri);
+    m_request.m_path = ToRef(data, m_path);
+    m_request.m_query = ToRef(data, m_query);
+    m_request.m_fragment = ToRef(data, m_fragment);
+    m_request.m_headers.clear();
+    for(auto& i : m_headers) {
+        HttpRequest::Header h;
+        h.name = ToRef(data, i.first);
+        h.value = ToRef(data, i.second);
+        m_request.m_headers.push_back(h);
+    }
+    if(m_request.m_version == 0x10) {
+        m_request.m_close = !m_connKeepalive;
+    } else {
+        m_request.m_close = m_connClose;
+    }
+}
+
+HttpResponseParser::HttpResponseParser(HttpResponse& response)
+    :m_response(response)
+    ,m_maxHeaderSize(g_http_response_max_header_size->getValue()) {
+    reset();
+}
+
+void HttpResponseParser::reset() {
+    m_state = STATUS_LINE;
+    m_lineBegin = 0;
+    m_scan = 0;
+    m_contentLength = 0;
+    m_hasContentLength = false;
+    m_chunked = false;
+    m_connClose = false;
+    m_connKeepalive = false;
+    m_response.reset();
+}
+
+int HttpResponseParser::error() {
+    m_state = ERROR;
+    return -1;
+}
+
+int HttpResponseParser::execute(const char* data, size_t len) {
+    if(m_state == DONE || m_state == ERROR) {
+        return m_state == DONE ? (int)m_lineBegin : -1;
+    }
+    while(true) {
+        bool bad = false;
+        const char* p = FindLineEnd(data + m_scan, data + len, bad);
+        if(bad) {
+            return error();
+        }
+        if(!p) {
+            m_scan = len;
+            if(len >= m_maxHeaderSize) {
+                return error();
+            }
+            return 0;
+        }
+        size_t eol = p - data;
+        size_t end = eol;
+        if(end > m_lineBegin && data[end - 1] == '\r') {
+            --end;
+        }
+        const char* b = data + m_lineBegin;
+        const char* e = data + end;
+        if(m_state == STATUS_LINE) {
+            if(!parseStatusLine(b, e)) {
+                return error();
+            }
+            m_state = HEADER;
+        } else if(b == e) {
+            m_lineBegin = m_scan = eol + 1;
+            if(m_response.m_version == 0x10) {
+                m_response.m_close = !m_connKeepalive;
+            } else {
+                m_response.m_close = m_connClose;
+            }
+            // 没有长度时是否读到连接关闭由调用方决定，HEAD和204/304没有body
+            m_state = DONE;
+            return (int)m_lineBegin;
+        } else if(!parseHeader(b, e)) {
+            return error();
+        }
+        m_lineBegin = m_scan = eol + 1;
+        if(m_lineBegin >= m_maxHeaderSize) {
+            return error();
+        }
+    }
+}
+
+bool HttpResponseParser::parseStatusLine(const char* b, const char* e) {
+    // HTTP/1.1 200 OK
+    if(e - b < 12 || memcmp(b, "HTTP/1.", 7) != 0
+            || (b[7] != '0' && b[7] != '1') || b[8] != ' '
+            || (e - b > 12 && b[12] != ' ')) {
+        return false;
+    }
+    int code = 0;
+    for(int i = 9; i < 12; ++i) {
+        if(b[i] < '0' || b[i] > '9') {
+            return false;
+        }
+        code = code * 10 + (b[i] - '0');
+    }
+    m_response.m_version = 0x10 | (b[7] - '0');
+    m_response.m_status = (HttpStatus)code;
+    return true;
+}
+
+bool HttpResponseParser::parseHeader(const char* b, const char* e) {
+    const char* colon = nullptr;
+    const char* vb = nullptr;
+    const char* ve = nullptr;
+    if(!SplitHeader(b, e, colon, vb, ve)) {
+        return false;
+    }
+    StringRef n(b, colon - b);
+    StringRef val(vb, ve - vb);
+    if(n.iequals("Content-Length")) {
+        uint64_t len = 0;
+        if(!ParseContentLength(val, len)
+                || (m_hasContentLength && len != m_contentLength)) {
+            return false;
+        }
+        m_hasContentLength = true;
+        m_contentLength = len;
+    } else if(n.iequals("Transfer-Encoding")) {
+        // 最后的编码不是chunked时body读到连接关闭为止
+        m_chunked = IsChunked(val);
+    } else if(n.iequals("Connection")) {
+        if(val.iequals("close")) {
+            m_connClose = true;
+        } else if(val.iequals("keep-alive")) {
+            m_connKeepalive = true;
+        }
+    } else {
+        m_response.setHeader(n, val);
+    }
+    return true;
+}
+
+}
+}
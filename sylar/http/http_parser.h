@@ -0,0 +1,193 @@
+/**
+ * @file http_parser.h
+ * @brief HTTP/1.x请求/响应解析器
+ * @details 手写的增量状态机，按行推进：数据不完整时记住当前行的起点和已经扫描到的位置，
+ *          下次只扫描新到的数据。已经解析的字段只记偏移，请求头完整时才转成指针，
+ *          所以两次调用之间数据可以整体搬移(接收缓冲区compact)。
+ *          找行尾时用SSE2一次检查16个字节，同时检查非法的控制字符
+ */
+#ifndef __SYLAR_HTTP_PARSER_H__
+#define __SYLAR_HTTP_PARSER_H__
+
+#include "http.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief HTTP请求解析类
+ */
+class HttpRequestParser {
+public:
+    /**
+     * @brief 解析状态
+     */
+    enum State {
+        /// 请求行
+        REQUEST_LINE = 0,
+        /// 请求头
+        HEADER = 1,
+        /// 解析完成
+        DONE = 2,
+        /// 出错
+        ERROR = 3
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] request 解析结果写到这里
+     */
+    HttpRequestParser(HttpRequest& request);
+
+    /**
+     * @brief 重置，准备解析下一个请求
+     */
+    void reset();
+
+    /**
+     * @brief 解析请求行和请求头
+     * @param[in] data 请求开始的地址，增量调用时之前的内容不能变(可以整体搬移)
+     * @param[in] len 当前可用的数据长度
+     * @return >0: 解析完成，返回请求头的长度(含结尾空行)
+     *         0: 需要更多数据
+     *         -1: 出错，getError()返回应答的状态码
+     */
+    int execute(const char* data, size_t len);
+
+    /**
+     * @brief 是否解析完成
+     */
+    bool isFinished() const { return m_state == DONE;}
+
+    /**
+     * @brief 是否出错
+     */
+    bool hasError() const { return m_state == ERROR;}
+
+    /**
+     * @brief 出错时应答的状态码
+     */
+    HttpStatus getError() const { return m_error;}
+
+    /**
+     * @brief 设置请求头的最大长度，超过返回431(请求行超过返回414)
+     */
+    void setMaxHeaderSize(size_t v) { m_maxHeaderSize = v;}
+    size_t getMaxHeaderSize() const { return m_maxHeaderSize;}
+private:
+    /**
+     * @brief 偏移表示的字符串片段
+     */
+    struct Span {
+        uint32_t off;
+        uint32_t len;
+    };
+
+    int error(HttpStatus s);
+    bool parseRequestLine(const char* data, size_t begin, size_t end);
+    bool parseHeader(const char* data, size_t begin, size_t end);
+    void finish(const char* data);
+    static Span MakeSpan(size_t begin, size_t end) {
+        Span s = {(uint32_t)begin, (uint32_t)(end - begin)};
+        return s;
+    }
+    static StringRef ToRef(const char* data, const Span& s) {
+        return StringRef(data + s.off, s.len);
+    }
+private:
+    HttpRequest& m_request;
+    State m_state;
+    HttpStatus m_error;
+    /// 当前行的起点
+    size_t m_lineBegin;
+    /// 找行尾时下次从这里继续扫描
+    size_t m_scan;
+    size_t m_maxHeaderSize;
+    Span m_uri;
+    Span m_path;
+    Span m_query;
+    Span m_fragment;
+    std::vector<std::pair<Span, Span> > m_headers;
+    /// 是否有Connection: close
+    bool m_connClose;
+    /// 是否有Connection: keep-alive
+    bool m_connKeepalive;
+    bool m_hasContentLength;
+    /// 是否有Transfer-Encoding
+    bool m_hasTransferEncoding;
+};
+
+/**
+ * @brief HTTP响应解析类(客户端使用)
+ * @details 和请求解析一样按行增量推进，响应头在解析时直接拷贝进HttpResponse，
+ *          body由调用方根据getContentLength()/isChunked()读取
+ */
+class HttpResponseParser {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] response 解析结果写到这里
+     */
+    HttpResponseParser(HttpResponse& response);
+
+    /**
+     * @brief 重置，准备解析下一个响应
+     */
+    void reset();
+
+    /**
+     * @brief 解析状态行和响应头
+     * @param[in] data 响应开始的地址，增量调用时之前的内容不能变(可以整体搬移)
+     * @param[in] len 当前可用的数据长度
+     * @return >0: 解析完成，返回响应头的长度(含结尾空行)
+     *         0: 需要更多数据
+     *         -1: 格式错误
+     */
+    int execute(const char* data, size_t len);
+
+    bool isFinished() const { return m_state == DONE;}
+    bool hasError() const { return m_state == ERROR;}
+
+    /**
+     * @brief 是否有Content-Length
+     */
+    bool hasContentLength() const { return m_hasContentLength;}
+
+    /**
+     * @brief 返回Content-Length
+     */
+    uint64_t getContentLength() const { return m_contentLength;}
+
+    /**
+     * @brief 是否是Transfer-Encoding: chunked
+     */
+    bool isChunked() const { return m_chunked;}
+
+    void setMaxHeaderSize(size_t v) { m_maxHeaderSize = v;}
+private:
+    enum State {
+        STATUS_LINE = 0,
+        HEADER = 1,
+        DONE = 2,
+        ERROR = 3
+    };
+    int error();
+    bool parseStatusLine(const char* b, const char* e);
+    bool parseHeader(const char* b, const char* e);
+private:
+    HttpResponse& m_response;
+    State m_state;
+    size_t m_lineBegin;
+    size_t m_scan;
+    size_t m_maxHeaderSize;
+    uint64_t m_contentLength;
+    bool m_hasContentLength;
+    bool m_chunked;
+    bool m_connClose;
+    bool m_connKeepalive;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include "http_server.h"
+#include "../log.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+HttpServer::HttpServer(bool keepalive
+               ,sylar::IOManager* io_worker
+               ,sylar::IOManager* accept_worker)
+    :TcpServer(io_worker, accept_worker)
+    ,m_isKeepalive(keepalive) {
+    m_dispatch.reset(new ServletDispatch);
+    m_serverHeader = m_name;
+}
+
+void HttpServer::setName(const std::string& v) {
+    TcpServer::setName(v);
+    m_serverHeader = v;
+    m_dispatch->setDefault(std::make_shared<NotFoundServlet>(v));
+}
+
+void HttpServer::handleClient(Socket::ptr client) {
+    SYLAR_LOG_DEBUG(g_logger) << "handleClient " << *client;
+    HttpSession session(client);
+    while(true) {
+        HttpRequest* req = session.recvRequest();
+        if(!req) {
+            SYLAR_LOG_DEBUG(g_logger) << "recv http request fail, errno="
+                << errno << " errstr=" << strerror(errno)
+                << " client:" << *client << " keep_alive=" << m_isKeepalive;
+            break;
+        }
+
+        HttpResponse& rsp = session.getResponse();
+        rsp.setClose(req->isClose() || !m_isKeepalive || m_isStop);
+        rsp.setHeadOnly(req->getMethod() == HttpMethod::HEAD);
+        rsp.setHeader("Server", m_serverHeader);
+        m_dispatch->handle(*req, rsp, session);
+        if(!session.sendResponse(rsp) || rsp.isClose()) {
+            break;
+        }
+    }
+    session.close();
+}
+
+}
+}
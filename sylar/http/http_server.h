@@ -0,0 +1,58 @@
+/**
+ * @file http_server.h
+ * @brief HTTP服务器封装
+ */
+#ifndef __SYLAR_HTTP_SERVER_H__
+#define __SYLAR_HTTP_SERVER_H__
+
+#include "../tcp_server.h"
+#include "http_session.h"
+#include "servlet.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief HTTP服务器类
+ */
+class HttpServer : public TcpServer {
+public:
+    /// 智能指针类型
+    typedef std::shared_ptr<HttpServer> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] keepalive 是否支持长连接，false时每个响应后都关闭连接
+     * @param[in] io_worker 工作调度器
+     * @param[in] accept_worker 接收连接调度器
+     */
+    HttpServer(bool keepalive = false
+               ,sylar::IOManager* io_worker = sylar::IOManager::GetThis()
+               ,sylar::IOManager* accept_worker = sylar::IOManager::GetThis());
+
+    /**
+     * @brief 获取ServletDispatch
+     */
+    ServletDispatch::ptr getServletDispatch() const { return m_dispatch;}
+
+    /**
+     * @brief 设置ServletDispatch
+     */
+    void setServletDispatch(ServletDispatch::ptr v) { m_dispatch = v;}
+
+    virtual void setName(const std::string& v) override;
+protected:
+    virtual void handleClient(Socket::ptr client) override;
+private:
+    /// 是否支持长连接
+    bool m_isKeepalive;
+    /// Servlet分发器
+    ServletDispatch::ptr m_dispatch;
+    /// Server响应头
+    std::string m_serverHeader;
+};
+
+}
+}
+
+#endif
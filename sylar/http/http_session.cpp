@@ -0,0 +1,222 @@
+#include "http_session.h"
+#include "../config.h"
+#include "../log.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_request_buffer_size =
+    sylar::Config::Lookup("http.request.buffer_size"
+                ,(uint64_t)(16 * 1024), "http request buffer size");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_request_max_body_size =
+    sylar::Config::Lookup("http.request.max_body_size"
+                ,(uint64_t)(64 * 1024 * 1024), "http request max body size");
+
+/// 不超过这个大小的body拷贝进发送缓冲区，和头部一起发
+static const size_t SMALL_BODY_SIZE = 4096;
+/// 发送缓冲区超过这个大小时不再等待流水线请求，立即发送
+static const size_t MAX_PENDING_OUTPUT = 64 * 1024;
+
+HttpSession::HttpSession(Socket::ptr sock, size_t buffer_size)
+    :m_sock(sock)
+    ,m_buf(buffer_size ? buffer_size : g_http_request_buffer_size->getValue())
+    ,m_parser(m_request) {
+    // 请求头必须放得下一个内存块
+    m_parser.setMaxHeaderSize(std::min(m_parser.getMaxHeaderSize(), m_buf.getBaseSize()));
+    m_out.reserve(MAX_PENDING_OUTPUT);
+    m_iovs.reserve(16);
+}
+
+HttpRequest* HttpSession::recvRequest() {
+    m_parser.reset();
+    m_response.reset();
+    size_t base = m_buf.getBaseSize();
+    if(m_buf.getReadSize() == 0) {
+        // 上一个请求用到了多个内存块(大body)时释放掉多余的
+        if(m_buf.getSize() > base) {
+            m_buf.clear();
+        } else {
+            m_buf.compact();
+        }
+    }
+
+    while(true) {
+        const char* data = nullptr;
+        size_t avail = 0;
+        if(m_buf.getReadSize()) {
+            m_iovs.clear();
+            m_buf.getReadBuffers(m_iovs, m_buf.getReadSize());
+            data = (const char*)m_iovs[0].iov_base;
+            avail = m_iovs[0].iov_len;
+        }
+        int rt = avail ? m_parser.execute(data, avail) : 0;
+        if(rt > 0) {
+            m_buf.setPosition(m_buf.getPosition() + rt);
+            break;
+        }
+        if(rt < 0) {
+            SYLAR_LOG_DEBUG(g_logger) << "http parse error status="
+                << (int)m_parser.getError() << " " << *m_sock;
+            sendError(m_parser.getError());
+            return nullptr;
+        }
+        size_t pos = m_buf.getPosition();
+        if(avail && (avail < m_buf.getReadSize() || (pos + avail) % base == 0)) {
+            // 请求头到了内存块末尾，把未处理的数据搬到缓冲区开头再继续；
+            // 解析器只记偏移，搬移后可以接着解析
+            m_buf.compact();
+            continue;
+        }
+        if(!fillBuffer(0)) {
+            return nullptr;
+        }
+    }
+
+    m_response.setVersion(m_request.getVersion());
+    m_response.setClose(m_request.isClose());
+    if(!readBody()) {
+        return nullptr;
+    }
+    return &m_request;
+}
+
+bool HttpSession::readBody() {
+    if(m_request.isChunked()) {
+        sendError(HttpStatus::NOT_IMPLEMENTED);
+        return false;
+    }
+    uint64_t len = m_request.getContentLength();
+    if(len == 0) {
+        return true;
+    }
+    static thread_local ConfigVar<uint64_t>::Cache t_max_body_size(g_http_request_max_body_size);
+    if(len > t_max_body_size.get()) {
+        sendError(HttpStatus::PAYLOAD_TOO_LARGE);
+        return false;
+    }
+    while(m_buf.getReadSize() < len) {
+        if(!fillBuffer(len - m_buf.getReadSize())) {
+            return false;
+        }
+    }
+    // 追加数据不会移动已有的内存块，请求头里的指针仍然有效
+    m_iovs.clear();
+    m_buf.getReadBuffers(m_iovs, len);
+    if(m_iovs.size() == 1) {
+        m_request.m_body = StringRef((const char*)m_iovs[0].iov_base, len);
+        m_buf.setPosition(m_buf.getPosition() + len);
+    } else {
+        m_request.m_bodyStore.resize(len);
+        m_buf.read(&m_request.m_bodyStore[0], len);
+        m_request.m_body = m_request.m_bodyStore;
+    }
+    return true;
+}
+
+bool HttpSession::fillBuffer(size_t len) {
+    // 阻塞读之前先把攒着的响应发出去，否则流水线的客户端可能在等响应
+    if(!m_out.empty() && !flush()) {
+        return false;
+    }
+    size_t base = m_buf.getBaseSize();
+    // 至少把当前内存块剩余的空间读满
+    len = std::max(len, base - m_buf.getSize() % base);
+    size_t pos = m_buf.getPosition();
+    m_buf.setPosition(m_buf.getSize());
+    m_iovs.clear();
+    m_buf.getWriteBuffers(m_iovs, len);
+    int rt = m_sock->recv(&m_iovs[0], m_iovs.size());
+    if(rt > 0) {
+        m_buf.setPosition(m_buf.getSize() + rt);
+    }
+    m_buf.setPosition(pos);
+    if(rt <= 0) {
+        if(rt < 0) {
+            SYLAR_LOG_DEBUG(g_logger) << "http recv rt=" << rt << " errno=" << errno
+                << " errstr=" << strerror(errno) << " " << *m_sock;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool HttpSession::sendResponse(const HttpResponse& rsp) {
+    rsp.appendHead(m_out);
+    const StringRef& body = rsp.getBody();
+    if(!rsp.isHeadOnly() && !body.empty()) {
+        if(body.size() <= SMALL_BODY_SIZE) {
+            m_out.append(body.data(), body.size());
+        } else {
+            iovec iov[2];
+            iov[0].iov_base = &m_out[0];
+            iov[0].iov_len = m_out.size();
+            iov[1].iov_base = (void*)body.data();
+            iov[1].iov_len = body.size();
+            bool ok = sendAll(iov, 2);
+            m_out.clear();
+            return ok;
+        }
+    }
+    // 缓冲区里还有流水线请求时先不发，和后面的响应合并
+    if(rsp.isClose() || m_buf.getReadSize() == 0
+            || m_out.size() >= MAX_PENDING_OUTPUT) {
+        return flush();
+    }
+    return true;
+}
+
+bool HttpSession::flush() {
+    if(m_out.empty()) {
+        return true;
+    }
+    iovec iov;
+    iov.iov_base = &m_out[0];
+    iov.iov_len = m_out.size();
+    bool ok = sendAll(&iov, 1);
+    m_out.clear();
+    return ok;
+}
+
+bool HttpSession::sendAll(iovec* iov, size_t cnt) {
+    while(cnt > 0) {
+        // 对端已经关闭时返回EPIPE，不产生SIGPIPE
+        int rt = m_sock->send(iov, cnt, MSG_NOSIGNAL);
+        if(rt <= 0) {
+            SYLAR_LOG_DEBUG(g_logger) << "http send rt=" << rt << " errno=" << errno
+                << " errstr=" << strerror(errno) << " " << *m_sock;
+            return false;
+        }
+        size_t n = rt;
+        while(cnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if(cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+void HttpSession::sendError(HttpStatus status) {
+    m_response.reset();
+    m_response.setStatus(status);
+    m_response.setClose(true);
+    m_response.setContentType("text/plain");
+    m_response.setBodyRef(HttpStatusToString(status));
+    sendResponse(m_response);
+    close();
+}
+
+void HttpSession::close() {
+    flush();
+    m_sock->close();
+}
+
+}
+}
@@ -0,0 +1,102 @@
+/**
+ * @file http_session.h
+ * @brief HTTP服务端连接
+ * @details 一个连接上的请求/响应/解析器/收发缓冲区都在HttpSession里复用。
+ *          请求头必须完整地落在接收缓冲区的一个内存块内，解析结果直接指向缓冲区；
+ *          流水线(pipelining)的请求在缓冲区里排队，响应攒在一起，
+ *          等缓冲区里没有待处理的请求时再一次性发出
+ */
+#ifndef __SYLAR_HTTP_SESSION_H__
+#define __SYLAR_HTTP_SESSION_H__
+
+#include "http.h"
+#include "http_parser.h"
+#include "../socket.h"
+#include "../bytearray.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief HTTP服务端连接
+ */
+class HttpSession {
+public:
+    typedef std::shared_ptr<HttpSession> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] sock 已连接的Socket
+     * @param[in] buffer_size 接收缓冲区内存块大小，0时使用配置http.request.buffer_size
+     */
+    HttpSession(Socket::ptr sock, size_t buffer_size = 0);
+
+    /**
+     * @brief 接收一个请求
+     * @return 成功返回请求，在下一次recvRequest之前有效；
+     *         连接关闭或者出错返回nullptr(请求格式错误时已经回复了错误响应)
+     */
+    HttpRequest* recvRequest();
+
+    /**
+     * @brief 返回与当前请求配套的响应对象(已经reset并设置好版本和是否关闭)
+     */
+    HttpResponse& getResponse() { return m_response;}
+
+    /**
+     * @brief 发送响应
+     * @details 小响应先放在发送缓冲区里，接收缓冲区里还有流水线请求时不立即发送
+     * @return 是否成功
+     */
+    bool sendResponse(const HttpResponse& rsp);
+
+    /**
+     * @brief 发出发送缓冲区里的全部数据
+     */
+    bool flush();
+
+    /**
+     * @brief 关闭连接
+     */
+    void close();
+
+    Socket::ptr getSocket() const { return m_sock;}
+private:
+    /**
+     * @brief 从Socket接收数据追加到缓冲区末尾
+     * @param[in] len 至少准备的空间，实际读到的数据可能更少
+     * @return 是否读到数据
+     */
+    bool fillBuffer(size_t len);
+
+    /**
+     * @brief 读取请求body
+     */
+    bool readBody();
+
+    /**
+     * @brief 回复错误响应并关闭连接
+     */
+    void sendError(HttpStatus status);
+
+    /**
+     * @brief 循环发送直到全部发出
+     */
+    bool sendAll(iovec* iov, size_t cnt);
+private:
+    Socket::ptr m_sock;
+    /// 接收缓冲区，[position, size)为还没处理的数据
+    ByteArray m_buf;
+    HttpRequest m_request;
+    HttpResponse m_response;
+    HttpRequestParser m_parser;
+    /// 发送缓冲区
+    std::string m_out;
+    /// 复用的iovec数组
+    std::vector<iovec> m_iovs;
+};
+
+}
+}
+
+#endif
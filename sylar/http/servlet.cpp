@@ -0,0 +1,133 @@
+#include "servlet.h"
+#include <fnmatch.h>
+
+namespace sylar {
+namespace http {
+
+FunctionServlet::FunctionServlet(callback cb)
+    :Servlet("FunctionServlet")
+    ,m_cb(cb) {
+}
+
+int32_t FunctionServlet::handle(HttpRequest& request
+               , HttpResponse& response
+               , HttpSession& session) {
+    return m_cb(request, response, session);
+}
+
+ServletDispatch::ServletDispatch()
+    :Servlet("ServletDispatch") {
+    m_default.reset(new NotFoundServlet("sylar/1.0"));
+}
+
+int32_t ServletDispatch::handle(HttpRequest& request
+               , HttpResponse& response
+               , HttpSession& session) {
+    auto slt = getMatchedServlet(request.getPath());
+    if(slt) {
+        slt->handle(request, response, session);
+    }
+    return 0;
+}
+
+void ServletDispatch::addServlet(const std::string& uri, Servlet::ptr slt) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_datas[uri] = slt;
+}
+
+void ServletDispatch::addServlet(const std::string& uri
+                        ,FunctionServlet::callback cb) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_datas[uri] = std::make_shared<FunctionServlet>(cb);
+}
+
+void ServletDispatch::addGlobServlet(const std::string& uri
+                                    ,Servlet::ptr slt) {
+    RWMutexType::WriteLock lock(m_mutex);
+    for(auto it = m_globs.begin();
+            it != m_globs.end(); ++it) {
+        if(it->first == uri) {
+            m_globs.erase(it);
+            break;
+        }
+    }
+    m_globs.push_back(std::make_pair(uri, slt));
+}
+
+void ServletDispatch::addGlobServlet(const std::string& uri
+                                ,FunctionServlet::callback cb) {
+    return addGlobServlet(uri, std::make_shared<FunctionServlet>(cb));
+}
+
+void ServletDispatch::delServlet(const std::string& uri) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_datas.erase(uri);
+}
+
+void ServletDispatch::delGlobServlet(const std::string& uri) {
+    RWMutexType::WriteLock lock(m_mutex);
+    for(auto it = m_globs.begin();
+            it != m_globs.end(); ++it) {
+        if(it->first == uri) {
+            m_globs.erase(it);
+            break;
+        }
+    }
+}
+
+Servlet::ptr ServletDispatch::getServlet(const std::string& uri) {
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_datas.find(uri);
+    return it == m_datas.end() ? nullptr : it->second;
+}
+
+Servlet::ptr ServletDispatch::getGlobServlet(const std::string& uri) {
+    RWMutexType::ReadLock lock(m_mutex);
+    for(auto it = m_globs.begin();
+            it != m_globs.end(); ++it) {
+        if(it->first == uri) {
+            return it->second;
+        }
+    }
+    return nullptr;
+}
+
+Servlet::ptr ServletDispatch::getMatchedServlet(const StringRef& uri) {
+    // 查找用的key每个线程复用一个，容量够了之后不再分配
+    static thread_local std::string s_key;
+    s_key.assign(uri.data(), uri.size());
+    RWMutexType::ReadLock lock(m_mutex);
+    auto mit = m_datas.find(s_key);
+    if(mit != m_datas.end()) {
+        return mit->second;
+    }
+    for(auto it = m_globs.begin();
+            it != m_globs.end(); ++it) {
+        if(!fnmatch(it->first.c_str(), s_key.c_str(), 0)) {
+            return it->second;
+        }
+    }
+    return m_default;
+}
+
+NotFoundServlet::NotFoundServlet(const std::string& name)
+    :Servlet("NotFoundServlet")
+    ,m_name(name) {
+    m_content = "<html><head><title>404 Not Found"
+        "</title></head><body><center><h1>404 Not Found</h1></center>"
+        "<hr><center>" + name + "</center></body></html>";
+
+}
+
+int32_t NotFoundServlet::handle(HttpRequest& request
+                   , HttpResponse& response
+                   , HttpSession& session) {
+    response.setStatus(HttpStatus::NOT_FOUND);
+    response.setHeader("Server", m_name);
+    response.setContentType("text/html");
+    response.setBodyRef(m_content);
+    return 0;
+}
+
+}
+}
@@ -123,7 +123,7 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
 
     int rt = epoll_ctl(m_epfd, op, fd, &epevent);
     if(rt == -1) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        SYLAR_LOG_RATE_LIMITED(g_logger, LogLevel::ERROR, 10, 10) << "epoll_ctl(" << m_epfd << ", "
             << op << "," << fd << "," << epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return -1;
@@ -167,7 +167,7 @@ bool IOManager::delEvent(int fd, Event event) {
     epevent.data.ptr = fd_ctx;
     int rt = epoll_ctl(m_epfd, op, fd, &epevent);
     if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        SYLAR_LOG_RATE_LIMITED(g_logger, LogLevel::ERROR, 10, 10) << "epoll_ctl(" << m_epfd << ", "
             << op << "," << fd << "," << epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -203,7 +203,7 @@ bool IOManager::cancelEvent(int fd, Event event) {
     epevent.data.ptr = fd_ctx;
     int rt = epoll_ctl(m_epfd, op, fd, &epevent);
     if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        SYLAR_LOG_RATE_LIMITED(g_logger, LogLevel::ERROR, 10, 10) << "epoll_ctl(" << m_epfd << ", "
             << op << "," << fd << "," << epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -236,7 +236,7 @@ bool IOManager::cancelAll(int fd) {
     epevent.data.ptr = fd_ctx;
     int rt = epoll_ctl(m_epfd, op, fd, &epevent);
     if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        SYLAR_LOG_RATE_LIMITED(g_logger, LogLevel::ERROR, 10, 10) << "epoll_ctl(" << m_epfd << ", "
             << op << "," << fd << "," << epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -292,6 +292,8 @@ void IOManager::idle() {
         if(stopping(next_timeout)) {
             // 真正的结束
             SYLAR_LOG_INFO(g_logger) << "name=" << getName() << " idle stoppig exit";
+            // 其他线程可能在最后一个任务结束前就进了epoll_wait，叫醒它们一起退出
+            tickle();
             break;
         }
 
@@ -312,11 +314,11 @@ void IOManager::idle() {
             } else {
                 // 另外两种错误
                 if(errno == EBADE) {
-                    SYLAR_LOG_INFO(g_logger) << "epfd 无效";
+                    SYLAR_LOG_EVERY_MS(g_logger, LogLevel::INFO, 1000) << "epfd 无效";
                 } else if(errno == EINVAL) {
-                    SYLAR_LOG_INFO(g_logger) << "epfd 无效 或者 maxevents <= 0";
+                    SYLAR_LOG_EVERY_MS(g_logger, LogLevel::INFO, 1000) << "epfd 无效 或者 maxevents <= 0";
                 } else if(errno == EFAULT) {
-                    SYLAR_LOG_INFO(g_logger) << "events内存无权限访问";
+                    SYLAR_LOG_EVERY_MS(g_logger, LogLevel::INFO, 1000) << "events内存无权限访问";
                 }
             }
         }while(true);
@@ -360,7 +362,9 @@ void IOManager::idle() {
                 // fd_ctx和等待得到的事件没有交集
                 continue;
             }
-            
+            // ERR/HUP会同时置上读写，只处理真正注册过的
+            real_events &= fd_ctx->events;
+
             // 响应real_events所以需要处理到fd_ctx->events相关状态
             int left_events = (fd_ctx->events & ~real_events);
             int op = left_events ? EPOLL_CTL_MOD:EPOLL_CTL_DEL;
@@ -369,7 +373,7 @@ void IOManager::idle() {
             // 这里使用的fd_ctx->fd哦
             int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
             if(rt2) {
-                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                SYLAR_LOG_RATE_LIMITED(g_logger, LogLevel::ERROR, 10, 10) << "epoll_ctl(" << m_epfd << ", "
                     << op << "," << fd_ctx->fd << "," << event.events << "):"
                     << rt << " (" << errno << ") (" << strerror(errno) << ")";
                 continue;
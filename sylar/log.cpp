@@ -6,11 +6,25 @@
 #include<tuple>
 #include<time.h>
 #include<string.h>
+#include<stdlib.h>
+#include<sched.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<dirent.h>
+#include<sys/stat.h>
+#include<zlib.h>
+#include<deque>
+#include<algorithm>
 #include "config.h"
+#include "macro.h"
+#include "bytearray.h"
+#include "scheduler.h"
+#include "fiber_sync.h"
 
 namespace sylar {
 
-LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
+LogEvent::LogEvent(const std::shared_ptr<Logger>& logger, LogLevel::Level level,
                    const char * file, int32_t line, uint32_t elapse,
                    pid_t thread_id, uint32_t fiber_id, uint64_t time,
                    const std::string& thread_name)
@@ -20,6 +34,8 @@ LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
 ,m_threadId(thread_id)
 ,m_fiberId(fiber_id)
 ,m_time(time)
+,m_buf(m_content)
+,m_ss(&m_buf)
 ,m_logger(logger)
 ,m_level(level)
 ,m_threadName(thread_name)
@@ -33,6 +49,57 @@ LogEvent::~LogEvent() {
 }
 
 
+LogEvent::ptr LogEvent::Create(const std::shared_ptr<Logger>& logger, LogLevel::Level level,
+                               const char * file, int32_t line, uint32_t elapse,
+                               pid_t thread_id, uint32_t fiber_id, uint64_t time,
+                               const std::string& thread_name) {
+    static thread_local LogEvent::ptr t_event;
+    // 只有缓存自己持有时才能复用，日志里嵌套打日志时会走到new
+    if(t_event && t_event.use_count() == 1) {
+        t_event->reset(logger, level, file, line, elapse, thread_id, fiber_id, time, thread_name);
+        return t_event;
+    }
+    LogEvent::ptr event(new LogEvent(logger, level, file, line, elapse,
+                                     thread_id, fiber_id, time, thread_name));
+    if(!t_event) {
+        t_event = event;
+    }
+    return event;
+}
+
+
+void LogEvent::reset(const std::shared_ptr<Logger>& logger, LogLevel::Level level,
+                     const char * file, int32_t line, uint32_t elapse,
+                     pid_t thread_id, uint32_t fiber_id, uint64_t time,
+                     const std::string& thread_name) {
+    m_file = file;
+    m_line = line;
+    m_elapse = elapse;
+    m_threadId = thread_id;
+    m_fiberId = fiber_id;
+    m_time = time;
+    m_content.clear();
+    m_rendered = false;
+    m_fmt = nullptr;
+    m_args.clear();
+    // 上一条日志可能改过流的格式(std::hex等)
+    m_ss.clear();
+    m_ss.flags(std::ios_base::skipws | std::ios_base::dec);
+    m_ss.precision(6);
+    m_ss.width(0);
+    m_ss.fill(' ');
+    // 同一个logger连续打日志时不改引用计数
+    if(m_logger != logger) {
+        m_logger = logger;
+    }
+    m_level = level;
+    // 同一线程的线程名基本不变，相同时跳过拷贝
+    if(m_threadName != thread_name) {
+        m_threadName = thread_name;
+    }
+}
+
+
 // 接受LogLevel::Level，通过宏函数转换为const char * 类型
 const char * LogLevel::ToString(LogLevel::Level level) {
     switch (level)
@@ -78,20 +145,320 @@ void LogEvent::format(const char * fmt, ...) {
 }
 
 
-// 将va_list al通过格式化形成的字符串传入stringstream m_ss
+// 将va_list al通过格式化形成的字符串追加到out
+static void AppendVFormat(std::string& out, const char * fmt, va_list al) {
+    char buf[512];
+    va_list ap;
+    va_copy(ap, al);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if(len < 0) {
+        return;
+    }
+    if((size_t)len < sizeof(buf)) {
+        out.append(buf, len);
+        return;
+    }
+    // 栈上放不下时直接格式化到out里
+    size_t old = out.size();
+    out.resize(old + len + 1);
+    vsnprintf(&out[old], len + 1, fmt, al);
+    out.resize(old + len);
+}
+
+
+static void AppendFormat(std::string& out, const char * fmt, ...) {
+    va_list al;
+    va_start(al, fmt);
+    AppendVFormat(out, fmt, al);
+    va_end(al);
+}
+
+
+// 将va_list al通过格式化形成的字符串追加到日志内容
 void LogEvent::format(const char * fmt, va_list al) {
-    char * buf = nullptr;
-    // vasprintf专门负责va_list类型的sprintf
-    int len = vasprintf(&buf, fmt, al);
-    if(len != -1) {
-        m_ss << std::string(buf, len);
-        free(buf);
+    getSs();
+    AppendVFormat(m_content, fmt, al);
+}
+
+
+void LogEvent::render() const {
+    LogArgs::Render(m_content, m_fmt, m_args.data(), m_args.size());
+    m_rendered = true;
+}
+
+
+namespace {
+
+// 顺序读取LogArgs编码的参数
+class LogArgsReader {
+public:
+    struct Arg {
+        LogArgs::Type type;
+        size_t size;        // INT/UINT: 参数的sizeof，老格式没有时为8
+        uint64_t u;         // INT(已解码zigzag)/UINT/POINTER
+        double d;
+        const char * str;
+        size_t len;
+    };
+
+    LogArgsReader(const char * data, size_t len)
+        :m_cur((const uint8_t *)data)
+        ,m_end((const uint8_t *)data + len) {
+    }
+
+    // 没有参数或数据损坏时返回false
+    bool next(Arg& arg) {
+        if(m_cur >= m_end) {
+            return false;
+        }
+        arg.type = (LogArgs::Type)(*m_cur & 0x0f);
+        arg.size = *m_cur >> 4;
+        if(arg.size == 0 || arg.size > 8) {
+            arg.size = 8;
+        }
+        ++m_cur;
+        switch(arg.type) {
+        case LogArgs::INT:
+            if(!readVarint(arg.u)) {
+                return false;
+            }
+            arg.u = (arg.u >> 1) ^ -(arg.u & 1);
+            return true;
+        case LogArgs::UINT:
+        case LogArgs::POINTER:
+            return readVarint(arg.u);
+        case LogArgs::DOUBLE:
+            {
+                if(m_end - m_cur < 8) {
+                    return false;
+                }
+                uint64_t bits = 0;
+                for(int i = 0; i < 8; ++i) {
+                    bits |= (uint64_t)m_cur[i] << (i * 8);
+                }
+                memcpy(&arg.d, &bits, sizeof(bits));
+                m_cur += 8;
+                return true;
+            }
+        case LogArgs::STRING:
+            {
+                uint64_t len;
+                if(!readVarint(len) || len > (uint64_t)(m_end - m_cur)) {
+                    return false;
+                }
+                arg.str = (const char *)m_cur;
+                arg.len = len;
+                m_cur += len;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 按需要的类型取值
+    int64_t asInt(const Arg& arg) const {
+        return arg.type == LogArgs::DOUBLE ? (int64_t)arg.d : (int64_t)arg.u;
+    }
+    double asDouble(const Arg& arg) const {
+        switch(arg.type) {
+        case LogArgs::DOUBLE:
+            return arg.d;
+        case LogArgs::INT:
+            return (double)(int64_t)arg.u;
+        default:
+            return (double)arg.u;
+        }
+    }
+private:
+    bool readVarint(uint64_t& v) {
+        v = 0;
+        for(int shift = 0; shift < 64 && m_cur < m_end; shift += 7) {
+            uint8_t b = *m_cur++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if(!(b & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    const uint8_t * m_cur;
+    const uint8_t * m_end;
+};
+
+}
+
+
+/*
+逐个解析fmt里的 %[flags][width][.precision][length]conversion
+width/precision是*时从参数里取；长度修饰符丢弃，按64位整数/double重新生成，
+整数先截断到修饰符的宽度(没有修饰符时是参数宽度，不足int按int)再按有无符号扩展
+*/
+void LogArgs::Render(std::string& out, const char * fmt, const char * args, size_t len) {
+    LogArgsReader reader(args, len);
+    LogArgsReader::Arg arg;
+    const char * p = fmt;
+    while(*p) {
+        const char * pct = strchr(p, '%');
+        if(!pct) {
+            out.append(p);
+            break;
+        }
+        out.append(p, pct - p);
+        if(pct[1] == '%') {
+            out.push_back('%');
+            p = pct + 2;
+            continue;
+        }
+
+        char spec[64] = "%";
+        size_t n = 1;
+        int precision = -1;
+        bool ok = true;
+        const char * q = pct + 1;
+        while(*q && strchr("-+ #0", *q) && n < 8) {
+            spec[n++] = *q++;
+        }
+        if(*q == '*') {
+            ++q;
+            ok = reader.next(arg);
+            if(ok) {
+                n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)reader.asInt(arg));
+            }
+        } else {
+            while(isdigit(*q) && n < 16) {
+                spec[n++] = *q++;
+            }
+        }
+        if(*q == '.') {
+            ++q;
+            if(*q == '*') {
+                ++q;
+                ok = ok && reader.next(arg);
+                precision = ok ? (int)reader.asInt(arg) : 0;
+            } else {
+                precision = 0;
+                while(isdigit(*q)) {
+                    precision = precision * 10 + (*q++ - '0');
+                }
+            }
+        }
+        // 长度修饰符对应的整数宽度，0表示没有
+        size_t width = 0;
+        while(*q && strchr("hlLqjzt", *q)) {
+            switch(*q) {
+            case 'h':
+                width = width == sizeof(short) ? sizeof(char) : sizeof(short);
+                break;
+            case 'l':
+                width = width == sizeof(long) ? sizeof(long long) : sizeof(long);
+                break;
+            case 'q':
+            case 'j':
+                width = sizeof(long long);
+                break;
+            case 'z':
+            case 't':
+                width = sizeof(size_t);
+                break;
+            default:
+                break;
+            }
+            ++q;
+        }
+        char conv = *q;
+        if(!conv) {
+            // 不完整的转换说明原样输出
+            out.append(pct);
+            break;
+        }
+        ++q;
+        p = q;
+        if(conv == 'n') {
+            ok = ok && reader.next(arg);
+            continue;
+        }
+        if(!ok || !strchr("diouxXcsfFeEgGaAp", conv) || !reader.next(arg)) {
+            out.append(pct, q - pct);
+            continue;
+        }
+        if(arg.type == STRING) {
+            // 字符串参数一律按%s输出
+            size_t slen = precision >= 0 && (size_t)precision < arg.len ? precision : arg.len;
+            memcpy(spec + n, ".*s", 4);
+            AppendFormat(out, spec, (int)slen, arg.str);
+            continue;
+        }
+        if(conv == 's') {
+            // 非字符串参数用%s时，按参数自然的格式输出
+            width = 0;
+            switch(arg.type) {
+            case INT:
+                conv = 'd';
+                break;
+            case DOUBLE:
+                conv = 'g';
+                break;
+            case POINTER:
+                conv = 'p';
+                break;
+            default:
+                conv = 'u';
+                break;
+            }
+        }
+        if(precision >= 0) {
+            n += snprintf(spec + n, sizeof(spec) - n, ".%d", precision);
+        }
+        switch(conv) {
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            {
+                if(width == 0) {
+                    width = arg.type == DOUBLE || arg.size < sizeof(int) ? sizeof(int) : arg.size;
+                }
+                uint64_t v = (uint64_t)reader.asInt(arg);
+                if(width < 8) {
+                    unsigned bits = width * 8;
+                    v &= (1ull << bits) - 1;
+                    if((conv == 'd' || conv == 'i') && (v >> (bits - 1))) {
+                        v |= ~0ull << bits;
+                    }
+                }
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = 0;
+                AppendFormat(out, spec, (long long)v);
+            }
+            break;
+        case 'c':
+            spec[n++] = conv;
+            spec[n] = 0;
+            AppendFormat(out, spec, (int)reader.asInt(arg));
+            break;
+        case 'p':
+            spec[n++] = conv;
+            spec[n] = 0;
+            AppendFormat(out, spec, (void *)(uintptr_t)arg.u);
+            break;
+        default:
+            spec[n++] = conv;
+            spec[n] = 0;
+            AppendFormat(out, spec, reader.asDouble(arg));
+            break;
+        }
     }
 }
 
 
 LogEventWrap::LogEventWrap(LogEvent::ptr e)
-:m_event(e)
+:m_event(std::move(e))
 {
 
 }
@@ -102,360 +469,1774 @@ LogEventWrap::~LogEventWrap() {
 }
 
 
-std::stringstream& LogEventWrap::getSs() {
+std::ostream& LogEventWrap::getSs() {
     return m_event->getSs();
 }
 
 
-class MessageFormatItem: public LogFormatter::FormatItem{
+static uint64_t MonotonicUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+static sylar::ConfigVar<uint32_t>::ptr g_log_limit_summary_interval =
+    sylar::Config::Lookup("log.limit_summary_interval", (uint32_t)1000
+            ,"interval(ms) to report messages suppressed by SYLAR_LOG_LIMIT after a flood stops");
+
+/*
+限流器的后台汇总：每隔log.limit_summary_interval扫描一次登记的调用点，
+两次扫描之间没有新的抑制说明刷屏已经停了，把还没报告的条数单独输出一条；
+还在刷屏的调用点不输出，条数仍由下一条放行的日志带出
+对象创建后不析构，进程退出时由atexit停止线程
+*/
+class LogLimitReporter {
 public:
-    MessageFormatItem(const std::string& fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getContent();
+    static LogLimitReporter* GetInstance() {
+        static LogLimitReporter* s_reporter = Create();
+        return s_reporter;
     }
-};
 
+    void add(LogLimiter* limiter) {
+        Mutex::Lock lock(m_mutex);
+        m_limiters.push_back(limiter);
+    }
 
-class LevelFormatItem: public LogFormatter::FormatItem{
-public:
-    LevelFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << LogLevel::ToString(level);
+    // 调用点的静态限流器在进程退出时析构，析构前先摘掉
+    void del(LogLimiter* limiter) {
+        Mutex::Lock lock(m_mutex);
+        auto it = std::find(m_limiters.begin(), m_limiters.end(), limiter);
+        if(it != m_limiters.end()) {
+            m_limiters.erase(it);
+        }
     }
-};
+private:
+    struct Summary {
+        Logger::ptr logger;
+        LogLevel::Level level;
+        const char* file;
+        int32_t line;
+        uint64_t count;
+    };
 
+    LogLimitReporter()
+        :m_stopping(false) {
+    }
 
-class ElapseFormatItem: public LogFormatter::FormatItem{
-public:
-    ElapseFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getElapse();
-    }  
-};
+    static LogLimitReporter* Create() {
+        LogLimitReporter* reporter = new LogLimitReporter;
+        reporter->m_thread.reset(new Thread(std::bind(&LogLimitReporter::run, reporter), "log_limit"));
+        atexit([](){ LogLimitReporter::GetInstance()->stop(); });
+        return reporter;
+    }
 
+    void stop() {
+        m_stopping = true;
+        m_thread->join();
+    }
 
-class LoggerNameFormatItem: public LogFormatter::FormatItem{
-public:
-    LoggerNameFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLogger()->getName();
+    void run() {
+        uint64_t last = MonotonicUS();
+        while(!m_stopping) {
+            // 分小段睡，退出时不用等满一个间隔
+            usleep(10 * 1000);
+            uint64_t now = MonotonicUS();
+            if(now - last < g_log_limit_summary_interval->getValue() * 1000ull) {
+                continue;
+            }
+            last = now;
+            scan();
+        }
+    }
+
+    void scan() {
+        std::vector<Summary> summaries;
+        {
+            Mutex::Lock lock(m_mutex);
+            for(auto i : m_limiters) {
+                uint64_t total = i->m_suppressed.load(std::memory_order_relaxed);
+                bool quiet = total == i->m_lastSeen;
+                i->m_lastSeen = total;
+                if(!quiet) {
+                    continue;
+                }
+                Logger::ptr logger = i->m_logger.lock();
+                if(!logger) {
+                    continue;
+                }
+                uint64_t count = i->claim(total);
+                if(count) {
+                    summaries.push_back({logger, i->m_level, i->m_file, i->m_line, count});
+                }
+            }
+        }
+        // 在锁外打日志，appender里再走到新的限流调用点也不会死锁
+        for(auto& i : summaries) {
+            if(i.logger->getLevel() <= i.level) {
+                LogEventWrap(LogEvent::Create(i.logger, i.level, i.file, i.line, 0
+                        ,GetThreadId(), GetFiberId(), time(0), Thread::GetName()))
+                    .getSs() << "suppressed " << i.count << " messages";
+            }
+        }
     }
+private:
+    Mutex m_mutex;
+    std::vector<LogLimiter*> m_limiters;
+    std::atomic<bool> m_stopping;
+    Thread::ptr m_thread;
 };
 
 
-class ThreadIdFormatItem: public LogFormatter::FormatItem{
-public:
-    ThreadIdFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadId();
+LogLimiter::LogLimiter(Type type, uint64_t a, uint64_t b
+                       ,std::shared_ptr<Logger> logger, LogLevel::Level level
+                       ,const char* file, int32_t line)
+    :m_type(type)
+    ,m_interval(0)
+    ,m_tolerance(0)
+    ,m_next(0)
+    ,m_suppressed(0)
+    ,m_reported(0)
+    ,m_logger(logger)
+    ,m_level(level)
+    ,m_file(file)
+    ,m_line(line)
+    ,m_registered(false)
+    ,m_lastSeen(0) {
+    switch(type) {
+        case EVERY_N:
+            m_interval = a ? a : 1;
+            break;
+        case EVERY_MS:
+            m_interval = a * 1000;
+            break;
+        case RATE:
+            m_interval = 1000000 / (a ? a : 1);
+            m_tolerance = (b ? b - 1 : 0) * m_interval;
+            break;
     }
-};
+    if(logger) {
+        LogLimitReporter::GetInstance()->add(this);
+        m_registered = true;
+    }
+}
 
 
-class FiberIdFormatItem: public LogFormatter::FormatItem{
-public:
-    FiberIdFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFiberId();
+LogLimiter::~LogLimiter() {
+    if(m_registered) {
+        LogLimitReporter::GetInstance()->del(this);
     }
-};
+}
 
 
-class ThreadNameFormatItem: public LogFormatter::FormatItem{
-public:
-    ThreadNameFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadName();
+bool LogLimiter::allow() {
+    if(m_type == EVERY_N) {
+        return m_next.fetch_add(1, std::memory_order_relaxed) % m_interval == 0;
     }
-};
+    uint64_t now = MonotonicUS();
+    uint64_t next = m_next.load(std::memory_order_relaxed);
+    if(m_type == EVERY_MS) {
+        return now >= next && m_next.compare_exchange_strong(next, now + m_interval
+                                    ,std::memory_order_relaxed);
+    }
+    // GCRA: 理论到达时间最多领先当前时间m_tolerance
+    do {
+        uint64_t base = next > now ? next : now;
+        if(base - now > m_tolerance) {
+            return false;
+        }
+        if(m_next.compare_exchange_weak(next, base + m_interval
+                    ,std::memory_order_relaxed)) {
+            return true;
+        }
+    } while(true);
+}
 
 
-class NewLineFormatItem: public LogFormatter::FormatItem{
-public:
-    NewLineFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << std::endl;
+uint64_t LogLimiter::claim(uint64_t total) {
+    // 放行的日志和后台汇总可能同时认领，CAS保证每一条只报告一次
+    uint64_t reported = m_reported.load(std::memory_order_relaxed);
+    while(reported < total) {
+        if(m_reported.compare_exchange_weak(reported, total, std::memory_order_relaxed)) {
+            return total - reported;
+        }
     }
-};
+    return 0;
+}
+
+
+LogLimiter::Pass LogLimiter::check() {
+    Pass pass;
+    pass.ok = allow();
+    if(pass.ok) {
+        pass.suppressed = claim(m_suppressed.load(std::memory_order_relaxed));
+    } else {
+        pass.suppressed = 0;
+        m_suppressed.fetch_add(1, std::memory_order_relaxed);
+    }
+    return pass;
+}
+
+
+uint64_t LogLimiter::getTotalSuppressed() const {
+    return m_suppressed.load(std::memory_order_relaxed);
+}
+
+
+std::ostream& operator<<(std::ostream& os, const LogLimiter::Pass& pass) {
+    if(pass.suppressed) {
+        os << "[suppressed " << pass.suppressed << "] ";
+    }
+    return os;
+}
+
 
+namespace {
 
-class DateTimeFormatItem: public LogFormatter::FormatItem{
+/*
+格式化时先拼在栈上的缓冲区里，最后一次追加到out
+避免每个字段一次std::string::append(函数调用+容量检查)
+*/
+class LogFormatWriter {
 public:
-    DateTimeFormatItem(const std::string & format = "%Y-%m-%d %H:%M:%S"): m_format(format) { }
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        time_t now_time = event->getTime();
-        struct tm * tp = localtime(&now_time);
-        char buf[80];
-        strftime(buf, sizeof(buf), m_format.c_str(), tp);
-        os << buf;
+    LogFormatWriter(std::string& out)
+        :m_out(out)
+        ,m_pos(m_buf) {
+    }
+
+    ~LogFormatWriter() {
+        flush();
+    }
+
+    void append(const char * str, size_t len) {
+        if(SYLAR_LIKELY(len <= (size_t)(m_buf + sizeof(m_buf) - m_pos))) {
+            memcpy(m_pos, str, len);
+            m_pos += len;
+        } else {
+            appendSlow(str, len);
+        }
+    }
+
+    void append(const std::string& str) {
+        append(str.data(), str.size());
+    }
+
+    // 整数直接转成字符，不走iostream
+    void appendUint(uint64_t v) {
+        char buf[20];
+        char * p = buf + sizeof(buf);
+        do {
+            *--p = '0' + v % 10;
+            v /= 10;
+        } while(v);
+        append(p, buf + sizeof(buf) - p);
+    }
+
+    void appendInt(int64_t v) {
+        if(v < 0) {
+            append("-", 1);
+            appendUint(-(uint64_t)v);
+        } else {
+            appendUint(v);
+        }
+    }
+
+    void flush() {
+        m_out.append(m_buf, m_pos - m_buf);
+        m_pos = m_buf;
+    }
+private:
+    void appendSlow(const char * str, size_t len) __attribute__((noinline)) {
+        flush();
+        m_out.append(str, len);
     }
 private:
-    std::string m_format;
+    std::string& m_out;
+    char * m_pos;
+    char m_buf[512];
 };
 
+}
+
 
-class FilenameFormatItem: public LogFormatter::FormatItem{
-public:
-    FilenameFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFile();
+// 每个线程一个格式化缓冲区，复用容量
+static std::string& GetFormatBuffer() {
+    static thread_local std::string t_buf;
+    t_buf.clear();
+    return t_buf;
+}
+
+
+Logger::Logger(const std::string& name)
+:m_name(name)
+,m_level(LogLevel::DEBUG)
+,m_appenders(nullptr)
+{
+    // 这里就是给m_formatter设定一个默认值
+    m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+    // m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%n%f:%l%n%m%n"));
+    if(name == "root") {
+        // root logger 的appnder加的就是logger默认的fmt，所以算入appnder的fmt
+        this->addAppender(LogAppender::ptr(new StdoutLogAppender));
     }
-};
+}
+
+
+Logger::~Logger() {
+    // 打日志的线程持有logger的引用，这里不会再有读者
+    if(AppenderSnapshot* appenders = m_appenders.load()) {
+        appenders->unref();
+    }
+}
+
+
+std::string Logger::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["name"] = m_name;
+    if(getLevel() != LogLevel::UNKNOWN) {
+        node["level"] = LogLevel::ToString(getLevel());
+    }
+    if(m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+    // 持有m_mutex时列表不会被替换
+    if(AppenderSnapshot* appenders = m_appenders.load()) {
+        for(auto& i : appenders->appenders) {
+            node["appenders"].push_back(YAML::Load(i->toYamlString()));
+        }
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+
+void Logger::setFormatter(LogFormatter::ptr val) {
+    MutexType::Lock lock(m_mutex);
+    m_formatter = val;
+
+    // 让fmt影响已经存在的appenders，但仅限该appender先天就使用的logger的fmt的情况
+    if(AppenderSnapshot* appenders = m_appenders.load()) {
+        for(auto& i : appenders->appenders) {
+            MutexType::Lock ll(i->m_mutex);
+            if(!i->m_hasFormatter) {
+                i->m_formatter = m_formatter;
+            }
+        }
+    }
+}
+
+
+void Logger::setFormatter(const std::string& val) {
+    sylar::LogFormatter::ptr new_val(new sylar::LogFormatter(val));
+    if(new_val->isError()) {
+        std::cout << "Logger setFormatter name=" << m_name
+                  << " value=" << val << " invaild formatter"
+                  << std::endl;
+        return; 
+    }
+    // m_formatter = new_val;
+    setFormatter(new_val);
+}
+
+
+LogFormatter::ptr Logger::getFormatter() {
+    return m_formatter;
+}
+
 
+Logger::AppenderSnapshot* Logger::setAppenders(AppenderSnapshot* appenders) {
+    return m_appenders.exchange(appenders);
+}
+
+
+void Logger::RetireAppenders(AppenderSnapshot* old) {
+    // 换下时还有appender在用的快照，等下次换下时再看
+    static Mutex s_mutex;
+    static std::vector<AppenderSnapshot*> s_retired;
+    if(old) {
+        // 宽限期过后，读到旧快照的线程都已经登记了hazard槽或者加上了引用
+        Rcu::Synchronize();
+    }
+    std::vector<AppenderSnapshot*> frees;
+    {
+        Mutex::Lock lock(s_mutex);
+        if(old) {
+            s_retired.push_back(old);
+        }
+        // 槽可能被挂起的协程占着(可能就在本线程)，不能等
+        for(auto it = s_retired.begin(); it != s_retired.end();) {
+            if(Rcu::IsProtected(*it)) {
+                ++it;
+            } else {
+                frees.push_back(*it);
+                it = s_retired.erase(it);
+            }
+        }
+    }
+    // appender析构可能打日志，不能持有s_mutex
+    for(auto& i : frees) {
+        i->unref();
+    }
+}
+
+
+void Logger::addAppender(LogAppender::ptr appender){
+    AppenderSnapshot* old = nullptr;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (!appender->getFormatter()) {
+            MutexType::Lock ll(appender->m_mutex);
+            // 因为是logger给的，所以不算入appender本身所有
+            appender->m_formatter = m_formatter;
+        }
+        AppenderSnapshot* cur = m_appenders.load();
+        AppenderSnapshot* appenders = new AppenderSnapshot;
+        if(cur) {
+            appenders->appenders = cur->appenders;
+        }
+        appenders->appenders.push_back(appender);
+        old = setAppenders(appenders);
+    }
+    RetireAppenders(old);
+}
+
+
+void Logger::delAppender(LogAppender::ptr appender){
+    AppenderSnapshot* old = nullptr;
+    {
+        MutexType::Lock lock(m_mutex);
+        AppenderSnapshot* cur = m_appenders.load();
+        if(!cur) {
+            return;
+        }
+        const AppenderList& list = cur->appenders;
+        auto it = std::find(list.begin(), list.end(), appender);
+        if(it == list.end()) {
+            return;
+        }
+        AppenderSnapshot* appenders = nullptr;
+        if(list.size() > 1) {
+            appenders = new AppenderSnapshot;
+            appenders->appenders = list;
+            appenders->appenders.erase(appenders->appenders.begin() + (it - list.begin()));
+        }
+        old = setAppenders(appenders);
+    }
+    RetireAppenders(old);
+}
+
+
+void Logger::clearAppenders() {
+    AppenderSnapshot* old = nullptr;
+    {
+        MutexType::Lock lock(m_mutex);
+        old = setAppenders(nullptr);
+    }
+    RetireAppenders(old);
+}
+
+
+void Logger::log(LogLevel::Level level, const LogEvent::ptr& event){
+    if(level >= getLevel()) {
+        AppenderSnapshot* appenders = nullptr;
+        std::atomic<const void*>* hazard = nullptr;
+        {
+            // 读临界区只包住取快照，appender可能切换协程(比如走hook的socket)，
+            // 协程换了线程再离开临界区会弄乱两个线程的读者记录
+            RcuReadLock lock;
+            appenders = m_appenders.load(std::memory_order_acquire);
+            if(appenders) {
+                // 槽是本线程的，不改共享计数；appender里嵌套打日志把槽用完了才加引用
+                hazard = Rcu::Protect(appenders);
+                if(!hazard) {
+                    appenders->ref();
+                }
+            }
+        }
+        if(appenders) {
+            // this本身有设置appender
+            const Logger::ptr& logger = event->getLogger();
+            for(auto& i : appenders->appenders) {
+                i->log(logger, level, event);
+            }
+            // 协程可能已经换了线程，清的还是登记时的槽
+            if(hazard) {
+                Rcu::Unprotect(hazard);
+            } else {
+                appenders->unref();
+            }
+        } else if(m_root) {
+            // 使用默认的m_root的
+            m_root->log(level, event);
+        }
+        // 或者不输出日志
+    }
+}
+
+
+void Logger::debug(LogEvent::ptr event){
+    log(LogLevel::DEBUG, event);
+}
+
+
+void Logger::info(LogEvent::ptr event){
+    log(LogLevel::INFO, event);
+}
+
+
+void Logger::warn(LogEvent::ptr event){
+    log(LogLevel::WARN, event);
+}
+
+
+void Logger::error(LogEvent::ptr event){
+    log(LogLevel::ERROR, event);
+}
+
+
+void Logger::fatal(LogEvent::ptr event){
+    log(LogLevel::FATAL, event);
+}
+
+
+// 新设置的fmt直接生效
+void LogAppender::setFormatter(LogFormatter::ptr val) {
+    MutexType::Lock lock(m_mutex);
+    m_formatter = val;
+    m_hasFormatter = m_formatter ? true:false;
+}
+
+
+// 新设置的fmt直接生效
+void LogAppender::setFormatter(const std::string& fmt) {
+    sylar::LogFormatter::ptr new_val(new sylar::LogFormatter(fmt));
+    if(new_val->isError()) {
+        std::cout << "LoggerAppender setFormatter, value=" 
+                  << fmt << " invaild formatter" << std::endl;
+        m_hasFormatter = false;
+        return; 
+    }
+    setFormatter(new_val);
+}
+
+
+LogFormatter::ptr LogAppender::getFormatter() {
+    MutexType::Lock lock(m_mutex);
+    return m_formatter;
+}
+
+
+/*
+rollFile生成的归档文件名: 日志文件名.YYYYmmdd-HHMMSS[.NNNN][.gz]
+时间是滚动的时间，同一秒滚动多次时序号取已有的最大序号加一(没有序号的算0)，
+(时间, 序号)越大越新，按数值比较，不依赖文件名的字典序
+*/
+struct LogArchive {
+    uint64_t time;      // YYYYmmddHHMMSS
+    uint64_t seq;
+    std::string name;   // 目录下的文件名
+
+    bool operator<(const LogArchive& rhs) const {
+        return time != rhs.time ? time < rhs.time : seq < rhs.seq;
+    }
+};
+
+// 解析归档后缀，同目录下别的文件(比如server.log.err及其归档)不能算进来
+static bool ParseArchiveSuffix(const std::string& str, uint64_t& time, uint64_t& seq) {
+    size_t len = str.size();
+    if(len > 3 && str.compare(len - 3, 3, ".gz") == 0) {
+        len -= 3;
+    }
+    if(len < 15 || str[8] != '-') {
+        return false;
+    }
+    time = 0;
+    for(size_t i = 0; i < 15; ++i) {
+        if(i == 8) {
+            continue;
+        }
+        if(!isdigit((unsigned char)str[i])) {
+            return false;
+        }
+        time = time * 10 + (str[i] - '0');
+    }
+    seq = 0;
+    if(len == 15) {
+        return true;
+    }
+    // 序号至少4位，超过9999时会更长
+    if(str[15] != '.' || len < 20 || len > 16 + 18) {
+        return false;
+    }
+    for(size_t i = 16; i < len; ++i) {
+        if(!isdigit((unsigned char)str[i])) {
+            return false;
+        }
+        seq = seq * 10 + (str[i] - '0');
+    }
+    return true;
+}
+
+// 列出filename的所有归档，按从旧到新排序
+static std::vector<LogArchive> ListArchives(const std::string& filename) {
+    std::vector<LogArchive> files;
+    size_t pos = filename.rfind('/');
+    std::string dir = pos == std::string::npos ? "." : filename.substr(0, pos + 1);
+    std::string prefix = (pos == std::string::npos ? filename : filename.substr(pos + 1)) + ".";
+    DIR* d = opendir(dir.c_str());
+    if(!d) {
+        return files;
+    }
+    while(struct dirent* dp = readdir(d)) {
+        std::string name = dp->d_name;
+        LogArchive archive;
+        if(name.compare(0, prefix.size(), prefix)
+                || !ParseArchiveSuffix(name.substr(prefix.size()), archive.time, archive.seq)) {
+            continue;
+        }
+        archive.name = (pos == std::string::npos ? "" : dir) + name;
+        files.push_back(archive);
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+
+/*
+滚动出来的日志文件的后台处理：压缩成.gz，按保留数量删除最旧的
+单独一个线程，和打日志的线程、异步日志线程都不抢时间
+*/
+class LogArchiver {
+public:
+    struct Task {
+        std::string filename;   // 正在写的日志文件，滚动文件以它加'.'开头
+        std::string archive;    // 刚滚动出来的文件
+        bool compress;
+        uint32_t maxFiles;
+    };
+
+    static LogArchiver* GetInstance() {
+        static LogArchiver* s_archiver = Create();
+        return s_archiver;
+    }
+
+    void push(const Task& task) {
+        {
+            Mutex::Lock lock(m_mutex);
+            m_tasks.push_back(task);
+            ++m_pending;
+        }
+        m_sem.notify();
+    }
+
+    // 等待已提交的任务完成
+    void wait() {
+        while(m_pending && !m_stopped) {
+            usleep(1000);
+        }
+    }
+
+    void stop() {
+        m_stopping = true;
+        m_sem.notify();
+        m_thread->join();
+        m_stopped = true;
+    }
+private:
+    LogArchiver()
+        :m_pending(0)
+        ,m_stopping(false)
+        ,m_stopped(false) {
+    }
+
+    static LogArchiver* Create() {
+        LogArchiver* archiver = new LogArchiver;
+        archiver->m_thread.reset(new Thread(std::bind(&LogArchiver::run, archiver), "log_archive"));
+        atexit([](){ LogArchiver::GetInstance()->stop(); });
+        return archiver;
+    }
+
+    void run() {
+        while(true) {
+            m_sem.wait();
+            Task task;
+            {
+                Mutex::Lock lock(m_mutex);
+                if(m_tasks.empty()) {
+                    if(m_stopping) {
+                        break;
+                    }
+                    continue;
+                }
+                task = m_tasks.front();
+                m_tasks.pop_front();
+            }
+            if(task.compress) {
+                Compress(task.archive);
+            }
+            if(task.maxFiles) {
+                Retain(task.filename, task.maxFiles);
+            }
+            --m_pending;
+        }
+    }
+
+    // 先写到.gz.tmp，完成后再改名，避免留下不完整的.gz
+    static bool Compress(const std::string& file) {
+        std::string gz = file + ".gz";
+        std::string tmp = gz + ".tmp";
+        std::ifstream ifs(file, std::ios::binary);
+        if(!ifs) {
+            return false;
+        }
+        gzFile out = gzopen(tmp.c_str(), "wb6");
+        if(!out) {
+            std::cout << "LogArchiver gzopen " << tmp << " failed" << std::endl;
+            return false;
+        }
+        std::vector<char> buf(128 * 1024);
+        bool ok = true;
+        while(ifs) {
+            ifs.read(&buf[0], buf.size());
+            std::streamsize n = ifs.gcount();
+            if(n > 0 && gzwrite(out, &buf[0], n) != n) {
+                ok = false;
+                break;
+            }
+        }
+        if(gzclose(out) != Z_OK) {
+            ok = false;
+        }
+        if(!ok || rename(tmp.c_str(), gz.c_str())) {
+            std::cout << "LogArchiver compress " << file << " failed" << std::endl;
+            unlink(tmp.c_str());
+            return false;
+        }
+        unlink(file.c_str());
+        return true;
+    }
+
+    // 只保留最新的max_files个归档
+    static void Retain(const std::string& filename, uint32_t max_files) {
+        std::vector<LogArchive> files = ListArchives(filename);
+        if(files.size() <= max_files) {
+            return;
+        }
+        for(size_t i = 0; i < files.size() - max_files; ++i) {
+            unlink(files[i].name.c_str());
+        }
+    }
+private:
+    Mutex m_mutex;
+    std::deque<Task> m_tasks;
+    Thread::ptr m_thread;
+    Semaphore m_sem;
+    std::atomic<uint32_t> m_pending;
+    std::atomic<bool> m_stopping;
+    std::atomic<bool> m_stopped;
+};
+
+
+const char * FileLogAppender::ToString(RollPeriod period) {
+    switch(period) {
+    case HOUR:
+        return "HOUR";
+    case DAY:
+        return "DAY";
+    default:
+        return "NONE";
+    }
+}
+
+
+FileLogAppender::RollPeriod FileLogAppender::FromString(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(), ::toupper);
+    if(str == "HOUR") {
+        return HOUR;
+    }
+    if(str == "DAY") {
+        return DAY;
+    }
+    return NONE;
+}
+
+
+void FileLogAppender::WaitArchived() {
+    LogArchiver::GetInstance()->wait();
+}
+
+
+// 按本地时间计算所在的周期
+static uint64_t GetRollPeriodId(FileLogAppender::RollPeriod period, time_t t) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    int64_t local = t + tm.tm_gmtoff;
+    return period == FileLogAppender::HOUR ? local / 3600 : local / 86400;
+}
+
+
+FileLogAppender::FileLogAppender(const std::string& filename):
+m_filename(filename)
+{
+    reopen();
+}
+
+
+void FileLogAppender::log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level >= m_level) {
+        MutexType::Lock lock(m_mutex);
+        // 每秒检查一次是否到了滚动周期，没到就重新打开文件，避免文件被删除后，代码无法感知导致的问题
+        uint64_t now = time(0);
+        if(now != m_lastTime) {
+            if(m_rollPeriod != NONE && GetRollPeriodId(m_rollPeriod, now) != m_periodId) {
+                rollFile();
+            } else {
+                openFile();
+            }
+            m_lastTime = now;
+        }
+        std::string& buf = GetFormatBuffer();
+        m_formatter->format(buf, logger, level, event);
+        m_filestream.write(buf.data(), buf.size());
+        m_size += buf.size();
+        if(m_maxSize && m_size >= m_maxSize) {
+            rollFile();
+        }
+    }
+}
+
+
+std::string FileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "FileLogAppender";
+    node["file"] = m_filename;
+    if(m_level != LogLevel::UNKNOWN) node["level"] = LogLevel::ToString(m_level);
+    if(m_formatter && m_hasFormatter) node["formatter"] = m_formatter->getPattern();
+    if(m_maxSize) node["max_size"] = m_maxSize;
+    if(m_rollPeriod != NONE) node["roll"] = ToString(m_rollPeriod);
+    if(m_maxFiles) node["max_files"] = m_maxFiles;
+    if(m_compress) node["compress"] = true;
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+
+void FileLogAppender::flush() {
+    MutexType::Lock lock(m_mutex);
+    m_filestream.flush();
+}
+
+
+bool FileLogAppender::reopen() {
+    MutexType::Lock lock(m_mutex);
+    return openFile();
+}
+
+
+bool FileLogAppender::roll() {
+    MutexType::Lock lock(m_mutex);
+    return rollFile();
+}
+
+
+void FileLogAppender::setRollPeriod(RollPeriod v) {
+    MutexType::Lock lock(m_mutex);
+    m_rollPeriod = v;
+    m_periodId = GetRollPeriodId(v, m_openTime);
+}
+
+
+bool FileLogAppender::openFile() {
+    if (m_filestream.is_open()) {
+        m_filestream.close();
+    }
+    m_filestream.open(m_filename, std::ios::app);
+    struct stat st;
+    if(stat(m_filename.c_str(), &st) == 0) {
+        m_size = st.st_size;
+    } else {
+        m_size = 0;
+    }
+    if(!m_openTime || !m_size) {
+        m_openTime = time(0);
+    }
+    return !!m_filestream; //双感叹号!!作用就是非0值转成1，而0值还是0.
+}
+
+
+bool FileLogAppender::rollFile() {
+    m_filestream.close();
+    uint64_t now = time(0);
+    if(m_size) {
+        time_t roll_time = now;
+        struct tm tm;
+        localtime_r(&roll_time, &tm);
+        char buf[32];
+        strftime(buf, sizeof(buf), ".%Y%m%d-%H%M%S", &tm);
+        std::string archive = m_filename + buf;
+        // 同一秒已经有归档时取最大序号加一，不能复用被清理掉的空位，
+        // 否则新归档排在旧的前面，会被当成最旧的删掉
+        uint64_t t = (tm.tm_year + 1900) * 10000000000ull + (tm.tm_mon + 1) * 100000000ull
+            + tm.tm_mday * 1000000ull + tm.tm_hour * 10000 + tm.tm_min * 100 + tm.tm_sec;
+        std::vector<LogArchive> files = ListArchives(m_filename);
+        if(!files.empty() && files.back().time == t) {
+            char seq[32];
+            snprintf(seq, sizeof(seq), ".%04llu", (unsigned long long)files.back().seq + 1);
+            archive += seq;
+        }
+        if(rename(m_filename.c_str(), archive.c_str()) == 0) {
+            if(m_compress || m_maxFiles) {
+                LogArchiver::GetInstance()->push({m_filename, archive, m_compress, m_maxFiles});
+            }
+        } else {
+            std::cout << "FileLogAppender roll " << m_filename << " to " << archive
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+        }
+    }
+    m_openTime = now;
+    if(m_rollPeriod != NONE) {
+        m_periodId = GetRollPeriodId(m_rollPeriod, now);
+    }
+    return openFile();
+}
+
+
+void StdoutLogAppender::log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if (level >= m_level) {
+        MutexType::Lock lock(m_mutex);
+        std::string& buf = GetFormatBuffer();
+        m_formatter->format(buf, logger, level, event);
+        std::cout.write(buf.data(), buf.size());
+    }
+}
+
+
+std::string StdoutLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "StdoutLogAppender";
+    if(m_level != LogLevel::UNKNOWN) node["level"] = LogLevel::ToString(m_level);
+    if(m_formatter && m_hasFormatter) node["formatter"] = m_formatter->getPattern();
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+
+void StdoutLogAppender::flush() {
+    MutexType::Lock lock(m_mutex);
+    std::cout.flush();
+}
+
+
+static sylar::ConfigVar<uint32_t>::ptr g_log_async_buffer_size =
+    sylar::Config::Lookup("log.async_buffer_size", (uint32_t)(1024 * 1024), "per thread async log ring buffer size");
+
+// 环形缓冲区中每条记录的头部，size含头部且按8字节对齐
+struct LogRecordHead {
+    enum Type {
+        PAD = 0,    // 尾部放不下时的填充，消费者直接跳过
+        EVENT = 1
+    };
+    uint32_t size;
+    uint32_t type;
+};
+
+// 一条异步日志记录，后面紧跟线程名和日志内容
+// appender由LogAsyncWriter的登记保证在记录取走之前不会释放，只存裸指针
+struct AsyncLogRecord {
+    LogRecordHead head;
+    AsyncLogAppender* appender;
+    Logger::ptr logger;
+    const char * file;
+    int32_t line;
+    uint32_t elapse;
+    pid_t threadId;
+    uint32_t fiberId;
+    uint64_t time;
+    LogLevel::Level level;
+    uint32_t threadNameLen;
+    uint32_t contentLen;
+};
+
+
+/*
+单生产者单消费者的字节环形缓冲区，每个写日志的线程一个
+生产者reserve()拿到连续空间写好记录后commit()，消费者front()/pop()按顺序取
+*/
+class LogRingBuffer {
+public:
+    LogRingBuffer(size_t capacity)
+        :m_capacity(capacity)
+        ,m_head(0)
+        ,m_reserved(0)
+        ,m_tailCache(0)
+        ,m_tail(0) {
+        m_data = (char*)malloc(m_capacity);
+    }
+
+    ~LogRingBuffer() {
+        // 进程退出时可能还有没消费的记录
+        while(char* p = front()) {
+            AsyncLogRecord* rec = (AsyncLogRecord*)p;
+            uint32_t size = rec->head.size;
+            rec->~AsyncLogRecord();
+            pop(size);
+        }
+        free(m_data);
+    }
+
+    size_t getCapacity() const { return m_capacity; }
+
+    // 生产者: 申请len字节的连续空间，空间不足返回nullptr
+    char* reserve(size_t len) {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        size_t pos = head & (m_capacity - 1);
+        size_t contiguous = m_capacity - pos;
+        size_t total = len <= contiguous ? len : contiguous + len;
+        if(total > m_capacity - (head - m_tailCache)) {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if(total > m_capacity - (head - m_tailCache)) {
+                return nullptr;
+            }
+        }
+        if(len > contiguous) {
+            LogRecordHead pad = {(uint32_t)contiguous, LogRecordHead::PAD};
+            memcpy(m_data + pos, &pad, sizeof(pad));
+            pos = 0;
+        }
+        m_reserved = total;
+        return m_data + pos;
+    }
+
+    // 生产者: 发布reserve()的空间
+    void commit() {
+        m_head.store(m_head.load(std::memory_order_relaxed) + m_reserved);
+    }
+
+    // 消费者: 下一条记录，没有返回nullptr
+    char* front() {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        while(tail != head) {
+            char* p = m_data + (tail & (m_capacity - 1));
+            LogRecordHead h;
+            memcpy(&h, p, sizeof(h));
+            if(h.type == LogRecordHead::EVENT) {
+                return p;
+            }
+            tail += h.size;
+            m_tail.store(tail, std::memory_order_release);
+        }
+        return nullptr;
+    }
+
+    // 消费者: 释放front()返回的记录
+    void pop(size_t len) {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    bool empty() const {
+        return m_head.load() == m_tail.load(std::memory_order_relaxed);
+    }
+
+    // 已提交的写位置，只增不减
+    uint64_t getWritePos() const { return m_head.load(std::memory_order_acquire); }
+    // 已消费的读位置，只增不减
+    uint64_t getReadPos() const { return m_tail.load(std::memory_order_acquire); }
+private:
+    char * m_data;
+    size_t m_capacity;
+    // 生产者写的字段和消费者写的字段分开cache line
+    char m_pad0[64];
+    std::atomic<uint64_t> m_head;
+    size_t m_reserved;
+    uint64_t m_tailCache;
+    char m_pad1[64];
+    std::atomic<uint64_t> m_tail;
+    char m_pad2[64];
+};
+
+
+/*
+异步日志的后台线程，所有AsyncLogAppender共用
+对象创建后不析构，进程退出时由atexit停止线程并写完剩余日志，
+之后再打的异步日志直接同步输出
+AsyncLogAppender第一次提交时登记到这里(持有一个引用)，记录里只存裸指针；
+只剩登记的引用时不会再有新记录，等各缓冲区读过当时的写位置后再释放
+BLOCK策略缓冲区满时，协程里挂起当前协程(线程继续跑别的协程)，等后台线程取走一批后唤醒；
+不在协程里时让出线程
+*/
+class LogAsyncWriter {
+public:
+    static LogAsyncWriter* GetInstance() {
+        static LogAsyncWriter* s_writer = Create();
+        return s_writer;
+    }
+
+    // 登记appender，之后提交的记录可以只存裸指针
+    void registerAppender(AsyncLogAppender* appender) {
+        Mutex::Lock lock(m_mutex);
+        if(!appender->m_registered) {
+            m_newAppenders.push_back(appender->shared_from_this());
+            appender->m_registered = true;
+            m_hasNew = true;
+        }
+    }
+
+    // 写入本线程的环形缓冲区，block为true时缓冲区满会等待
+    bool push(AsyncLogAppender* appender, const Logger::ptr& logger,
+              LogLevel::Level level, const LogEvent::ptr& event, bool block) {
+        if(m_stopping) {
+            return false;
+        }
+        if(!appender->m_registered.load(std::memory_order_acquire)) {
+            registerAppender(appender);
+        }
+        const std::string& name = event->getThreadName();
+        const std::string& content = event->getContent();
+        LogRingBuffer* ring = nullptr;
+        size_t name_len = 0;
+        size_t content_len = 0;
+        size_t len = 0;
+        char* p = nullptr;
+        while(true) {
+            // 协程挂起后可能在别的线程恢复，每次都重新取当前线程的缓冲区，
+            // 不能往原来线程的缓冲区里写(单生产者)
+            ring = getRing();
+            // 超长的线程名和日志截断，保证一条记录不超过缓冲区的1/4
+            // 先比较再相减，无符号数不能减成负数
+            size_t quarter = ring->getCapacity() / 4;
+            size_t limit = quarter > sizeof(AsyncLogRecord) ? quarter - sizeof(AsyncLogRecord) : 0;
+            // 线程名最多占一半，给内容留出空间
+            name_len = std::min(name.size(), limit / 2);
+            content_len = std::min(content.size(), limit - name_len);
+            len = sizeof(AsyncLogRecord) + name_len + content_len;
+            len = (len + 7) & ~(size_t)7;
+
+            p = ring->reserve(len);
+            if(p) {
+                break;
+            }
+            if(!block || !waitSpace(len)) {
+                return false;
+            }
+        }
+        AsyncLogRecord* rec = new (p) AsyncLogRecord();
+        rec->head.size = len;
+        rec->head.type = LogRecordHead::EVENT;
+        rec->appender = appender;
+        rec->logger = logger;
+        rec->file = event->getFile();
+        rec->line = event->getLine();
+        rec->elapse = event->getElapse();
+        rec->threadId = event->getThreadId();
+        rec->fiberId = event->getFiberId();
+        rec->time = event->getTime();
+        rec->level = level;
+        rec->threadNameLen = name_len;
+        rec->contentLen = content_len;
+        memcpy(p + sizeof(AsyncLogRecord), name.c_str(), name_len);
+        memcpy(p + sizeof(AsyncLogRecord) + name_len, content.c_str(), content_len);
+        ring->commit();
+        notify();
+        return true;
+    }
+
+    // 等待调用前提交的日志被后台线程写完
+    void flush() {
+        // 记下每个缓冲区当前的写位置，读位置越过它说明之前提交的都已取走
+        // 不依赖后台线程空转，别的线程一直打日志也能返回
+        std::vector<std::pair<std::shared_ptr<LogRingBuffer>, uint64_t> > marks;
+        {
+            Mutex::Lock lock(m_mutex);
+            for(auto& i : m_allRings) {
+                std::shared_ptr<LogRingBuffer> ring = i.lock();
+                if(ring) {
+                    marks.push_back(std::make_pair(ring, ring->getWritePos()));
+                }
+            }
+        }
+        for(auto& i : marks) {
+            while(!m_stopped && i.first->getReadPos() < i.second) {
+                notify(true);
+                usleep(100);
+            }
+        }
+        // 取走之后还要等所在这一轮统一flush完
+        uint64_t round = m_round;
+        while(!m_stopped && m_round < round + 1) {
+            notify(true);
+            usleep(100);
+        }
+    }
+
+    bool isStopping() const { return m_stopping; }
+
+    void stop() {
+        m_stopping = true;
+        notify(true);
+        if(m_thread) {
+            m_thread->join();
+        }
+        m_stopped = true;
+        wakeBlocked();
+    }
+private:
+    // 登记的AsyncLogAppender，marks非空表示只剩登记的引用，等各缓冲区读过marks后释放
+    struct Registration {
+        AsyncLogAppender::ptr appender;
+        std::vector<std::pair<std::shared_ptr<LogRingBuffer>, uint64_t> > marks;
+    };
+
+    LogAsyncWriter()
+        :m_blockQueue(m_blockMutex)
+        ,m_blocked(0)
+        ,m_sleeping(false)
+        ,m_stopping(false)
+        ,m_stopped(false)
+        ,m_hasNew(false)
+        ,m_round(0) {
+    }
+
+    // 缓冲区满时等一轮，返回后调用方重新取缓冲区再reserve；停止时返回false
+    bool waitSpace(size_t len) {
+        bool in_fiber = Scheduler::GetThis() && Fiber::GetFiberId() != 0
+            && Fiber::GetThis().get() != Scheduler::GetMainFiber();
+        if(m_stopping) {
+            return false;
+        }
+        if(!in_fiber) {
+            notify();
+            sched_yield();
+            return true;
+        }
+        // 先登记再检查，后台线程取走一批后加锁唤醒，不会漏掉
+        ++m_blocked;
+        FiberWaitQueue::MutexType::Lock lock(m_blockMutex);
+        // 挂起前检查的也是当前线程的缓冲区，缓冲区指针不跨过wait保存
+        if(!m_stopping && !getRing()->reserve(len)) {
+            notify(true);
+            m_blockQueue.wait(lock);
+        } else {
+            lock.unlock();
+        }
+        --m_blocked;
+        return !m_stopping;
+    }
+
+    // 唤醒缓冲区满时挂起的协程
+    void wakeBlocked() {
+        if(!m_blocked) {
+            return;
+        }
+        FiberWaitQueue::WakeList wakes;
+        FiberWaitQueue::MutexType::Lock lock(m_blockMutex);
+        m_blockQueue.notifyAll(wakes);
+        lock.unlock();
+    }
+
+    static LogAsyncWriter* Create() {
+        LogAsyncWriter* writer = new LogAsyncWriter;
+        writer->m_thread.reset(new Thread(std::bind(&LogAsyncWriter::run, writer), "log_async"));
+        atexit([](){ LogAsyncWriter::GetInstance()->stop(); });
+        return writer;
+    }
+
+    LogRingBuffer* getRing() {
+        static thread_local std::shared_ptr<LogRingBuffer> t_ring;
+        if(!t_ring) {
+            uint32_t size = 4096;
+            while(size < g_log_async_buffer_size->getValue()) {
+                size <<= 1;
+            }
+            t_ring.reset(new LogRingBuffer(size));
+            Mutex::Lock lock(m_mutex);
+            m_newRings.push_back(t_ring);
+            // 顺带清掉已经释放的缓冲区
+            m_allRings.erase(std::remove_if(m_allRings.begin(), m_allRings.end()
+                        ,[](const std::weak_ptr<LogRingBuffer>& r){ return r.expired(); })
+                    ,m_allRings.end());
+            m_allRings.push_back(t_ring);
+            m_hasNew = true;
+        }
+        return t_ring.get();
+    }
+
+    // 后台线程在睡眠时才需要唤醒
+    void notify(bool force = false) {
+        if((force || m_sleeping.load()) && m_sleeping.exchange(false)) {
+            m_sem.notify();
+        }
+    }
+
+    // 单个缓冲区一次最多取的条数，避免一个线程占住后台线程
+    static const size_t DRAIN_BATCH = 1024;
+
+    size_t drain(LogRingBuffer* ring, std::vector<LogAppender::ptr>& touched) {
+        size_t count = 0;
+        while(count < DRAIN_BATCH) {
+            char* p = ring->front();
+            if(!p) {
+                break;
+            }
+            AsyncLogRecord* rec = (AsyncLogRecord*)p;
+            const char* name = p + sizeof(AsyncLogRecord);
+            AsyncLogAppender* appender = rec->appender;
+            LogEvent::ptr event = LogEvent::Create(rec->logger, rec->level, rec->file, rec->line
+                        ,rec->elapse, rec->threadId, rec->fiberId, rec->time
+                        ,std::string(name, rec->threadNameLen));
+            event->getSs().write(name + rec->threadNameLen, rec->contentLen);
+            appender->output(rec->logger, rec->level, event);
+            if(std::find(touched.begin(), touched.end(), appender->m_appender) == touched.end()) {
+                touched.push_back(appender->m_appender);
+            }
+            uint32_t size = rec->head.size;
+            rec->~AsyncLogRecord();
+            ring->pop(size);
+            ++count;
+        }
+        return count;
+    }
+
+    void mergeNew(std::vector<std::shared_ptr<LogRingBuffer> >& rings) {
+        rings.insert(rings.end(), m_newRings.begin(), m_newRings.end());
+        m_newRings.clear();
+        for(auto& i : m_newAppenders) {
+            m_appenders.push_back(Registration());
+            m_appenders.back().appender = i;
+        }
+        m_newAppenders.clear();
+        m_hasNew = false;
+    }
+
+    // 释放只剩登记引用、并且记录都已取走的appender
+    void retireAppenders(std::vector<std::shared_ptr<LogRingBuffer> >& rings) {
+        bool orphan = false;
+        for(auto& i : m_appenders) {
+            if(i.marks.empty() && i.appender.use_count() == 1) {
+                orphan = true;
+                break;
+            }
+        }
+        if(orphan) {
+            // 持锁检查：提交过记录的线程，缓冲区一定已经在rings里
+            Mutex::Lock lock(m_mutex);
+            mergeNew(rings);
+            for(auto& i : m_appenders) {
+                if(i.marks.empty() && i.appender.use_count() == 1) {
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    for(auto& r : rings) {
+                        i.marks.push_back(std::make_pair(r, r->getWritePos()));
+                    }
+                    if(i.marks.empty()) {
+                        i.marks.push_back(std::make_pair(std::shared_ptr<LogRingBuffer>(), 0));
+                    }
+                }
+            }
+        }
+        for(auto it = m_appenders.begin(); it != m_appenders.end();) {
+            bool done = !it->marks.empty();
+            for(auto& m : it->marks) {
+                if(m.first && m.first->getReadPos() < m.second) {
+                    done = false;
+                    break;
+                }
+            }
+            if(done) {
+                it = m_appenders.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void run() {
+        std::vector<std::shared_ptr<LogRingBuffer> > rings;
+        std::vector<LogAppender::ptr> touched;
+        while(true) {
+            if(m_hasNew) {
+                Mutex::Lock lock(m_mutex);
+                mergeNew(rings);
+            }
+            size_t count = 0;
+            for(auto& i : rings) {
+                count += drain(i.get(), touched);
+            }
+            if(count) {
+                wakeBlocked();
+            }
+            // 一批写完统一flush
+            for(auto& i : touched) {
+                i->flush();
+            }
+            touched.clear();
+            ++m_round;
+            retireAppenders(rings);
+            // 线程已退出且已取空的缓冲区
+            for(auto it = rings.begin(); it != rings.end();) {
+                if(it->use_count() == 1 && (*it)->empty()) {
+                    it = rings.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if(count) {
+                continue;
+            }
+            if(m_stopping && !m_hasNew) {
+                break;
+            }
 
-class LineFormatItem: public LogFormatter::FormatItem{
-public:
-    LineFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLine();
+            m_sleeping = true;
+            bool idle = !m_hasNew && !m_stopping;
+            for(auto& i : rings) {
+                if(!i->empty()) {
+                    idle = false;
+                    break;
+                }
+            }
+            if(idle) {
+                m_sem.wait();
+            }
+            m_sleeping = false;
+        }
     }
+private:
+    Mutex m_mutex;
+    std::vector<std::shared_ptr<LogRingBuffer> > m_newRings;
+    std::vector<AsyncLogAppender::ptr> m_newAppenders;
+    // 只有后台线程访问
+    std::list<Registration> m_appenders;
+    // 缓冲区满时挂起的协程
+    FiberWaitQueue::MutexType m_blockMutex;
+    FiberWaitQueue m_blockQueue;
+    std::atomic<uint32_t> m_blocked;
+    // 所有线程的缓冲区，flush时用来取写位置
+    std::vector<std::weak_ptr<LogRingBuffer> > m_allRings;
+    Thread::ptr m_thread;
+    Semaphore m_sem;
+    std::atomic<bool> m_sleeping;
+    std::atomic<bool> m_stopping;
+    std::atomic<bool> m_stopped;
+    std::atomic<bool> m_hasNew;
+    // 后台线程完成的轮数，每轮取完都会flush
+    std::atomic<uint64_t> m_round;
 };
 
 
-class StringFormatItem: public LogFormatter::FormatItem{
-public:
-    // 这个的str是一定要的
-    StringFormatItem(const std::string & str):m_string(str) {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << m_string;
+const char * AsyncLogAppender::ToString(OverflowPolicy policy) {
+    switch(policy) {
+    #define XX(name) \
+        case AsyncLogAppender::name: \
+            return #name;
+    XX(BLOCK)
+    XX(DROP)
+    XX(COUNT)
+    #undef XX
+    default:
+        return "BLOCK";
     }
-private:
-    std::string m_string;
-};
+}
 
 
-class TabFormatItem: public LogFormatter::FormatItem{
-public:
-    TabFormatItem(const std::string & fmt = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << "\t";
-    }
-};
+AsyncLogAppender::OverflowPolicy AsyncLogAppender::FromString(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(), ::toupper);
+#define XX(name) \
+    if(str == #name) return name;
+    XX(BLOCK)
+    XX(DROP)
+    XX(COUNT)
+#undef XX
+    return BLOCK;
+}
 
 
-Logger::Logger(const std::string& name)
-:m_name(name)
-,m_level(LogLevel::DEBUG)
+AsyncLogAppender::AsyncLogAppender(LogAppender::ptr appender, OverflowPolicy policy)
+:m_appender(appender)
+,m_policy(policy)
+,m_registered(false)
+,m_dropped(0)
+,m_unreported(0)
 {
-    // 这里就是给m_formatter设定一个默认值
-    m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
-    // m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%n%f:%l%n%m%n"));
-    if(name == "root" && m_appenders.empty()) {
-        // root logger 的appnder加的就是logger默认的fmt，所以算入appnder的fmt
-        this->addAppender(LogAppender::ptr(new StdoutLogAppender));
-    }
+    // 先把后台线程拉起来
+    LogAsyncWriter::GetInstance();
 }
 
 
-std::string Logger::toYamlString() {
-    MutexType::Lock lock(m_mutex);
-    YAML::Node node;
-    node["name"] = m_name;
-    if(m_level != LogLevel::UNKNOWN) {
-        node["level"] = LogLevel::ToString(m_level);
-    }
-    if(m_formatter) {
-        node["formatter"] = m_formatter->getPattern();
+void AsyncLogAppender::log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if(level < m_level) {
+        return;
     }
-    for(auto& i : m_appenders) {
-        node["appenders"].push_back(YAML::Load(i->toYamlString()));
+    LogAsyncWriter* writer = LogAsyncWriter::GetInstance();
+    if(writer->push(this, logger, level, event, m_policy == BLOCK)) {
+        if(m_policy == COUNT && m_unreported.load(std::memory_order_relaxed)) {
+            uint64_t n = m_unreported.exchange(0);
+            if(n) {
+                LogEvent::ptr e(new LogEvent(logger, LogLevel::WARN, __FILE__, __LINE__, 0
+                            ,event->getThreadId(), event->getFiberId(), time(0), event->getThreadName()));
+                e->getSs() << "AsyncLogAppender dropped " << n << " log events";
+                writer->push(this, logger, LogLevel::WARN, e, false);
+            }
+        }
+    } else if(writer->isStopping()) {
+        // 后台线程已停止，直接同步输出
+        output(logger, level, event);
+    } else {
+        ++m_dropped;
+        if(m_policy == COUNT) {
+            ++m_unreported;
+        }
     }
-    std::stringstream ss;
-    ss << node;
-    return ss.str();
 }
 
 
-void Logger::setFormatter(LogFormatter::ptr val) {
-    MutexType::Lock lock(m_mutex);
-    m_formatter = val;
-
-    // 让fmt影响已经存在的appenders，但仅限该appender先天就使用的logger的fmt的情况
-    for(auto& i : m_appenders) {
-        MutexType::Lock ll(i->m_mutex);
-        if(!i->m_hasFormatter) {
-            i->m_formatter = m_formatter;
+void AsyncLogAppender::output(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    LogFormatter::ptr fmt = getFormatter();
+    {
+        // 被包装的Appender没有自己的fmt时，使用logger给AsyncLogAppender的fmt
+        MutexType::Lock lock(m_appender->m_mutex);
+        if(!m_appender->m_hasFormatter) {
+            m_appender->m_formatter = fmt;
         }
     }
+    m_appender->log(logger, level, event);
 }
 
 
-void Logger::setFormatter(const std::string& val) {
-    sylar::LogFormatter::ptr new_val(new sylar::LogFormatter(val));
-    if(new_val->isError()) {
-        std::cout << "Logger setFormatter name=" << m_name
-                  << " value=" << val << " invaild formatter"
-                  << std::endl;
-        return; 
-    }
-    // m_formatter = new_val;
-    setFormatter(new_val);
+void AsyncLogAppender::flush() {
+    LogAsyncWriter::GetInstance()->flush();
 }
 
 
-LogFormatter::ptr Logger::getFormatter() {
-    return m_formatter;
-}
+const char BinaryLogAppender::MAGIC[4] = {'S', 'Y', 'L', 'B'};
+// 攒够这么多字节再写文件
+static const size_t s_binary_log_buffer_size = 64 * 1024;
 
 
-void Logger::addAppender(LogAppender::ptr appender){
-    MutexType::Lock lock(m_mutex);
-    if (!appender->getFormatter()) {
-        MutexType::Lock ll(appender->m_mutex);
-        // 因为是logger给的，所以不算入appender本身所有
-        appender->m_formatter = m_formatter;
-    }
-    m_appenders.push_back(appender);
+BinaryLogAppender::BinaryLogAppender(const std::string& filename)
+    :m_filename(filename) {
+    m_buf.reserve(s_binary_log_buffer_size * 2);
+    reopen();
 }
 
 
-void Logger::delAppender(LogAppender::ptr appender){
+BinaryLogAppender::~BinaryLogAppender() {
     MutexType::Lock lock(m_mutex);
-    for(auto it = m_appenders.begin(); it != m_appenders.end();
-        ++it) {
-            if(*it == appender) {
-                m_appenders.erase(it);
-                break;
-            }
-        }
+    writeOut();
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
 }
 
 
-void Logger::clearAppenders() {
+/*
+EVENT记录: type level varint(time elapse threadId fiberId logger threadName file line fmt)
+fmt为0时后面是varint长度 + 日志内容，否则是varint长度 + LogArgs编码的参数
+*/
+void BinaryLogAppender::log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    if(level < m_level) {
+        return;
+    }
     MutexType::Lock lock(m_mutex);
-    m_appenders.clear();
-}
-
-
-void Logger::log(LogLevel::Level level, LogEvent::ptr event){
-    if(level >= m_level) {
-        auto self = shared_from_this();
-        MutexType::Lock lock(m_mutex);
-        if(!m_appenders.empty()) {
-            // this本身有设置appender
-            for(auto& i:m_appenders) {
-                i->log(self, level, event);
-            }
-        } else if(m_root) {
-            // 使用默认的m_root的
-            m_root->log(level, event);
-        }
-        // 或者不输出日志
+    // 先写字典记录，再写引用它们的日志
+    uint32_t logger_id = getId(event->getLogger()->getName());
+    uint32_t thread_name_id = getId(event->getThreadName());
+    uint32_t file_id = getId(event->getFile() ? event->getFile() : "");
+    uint32_t fmt_id = event->getFmt() ? getId(event->getFmt()) : 0;
+
+    m_buf.push_back((char)EVENT);
+    m_buf.push_back((char)level);
+    LogArgs::AppendVarint(m_buf, event->getTime());
+    LogArgs::AppendVarint(m_buf, event->getElapse());
+    LogArgs::AppendVarint(m_buf, (uint32_t)event->getThreadId());
+    LogArgs::AppendVarint(m_buf, event->getFiberId());
+    LogArgs::AppendVarint(m_buf, logger_id);
+    LogArgs::AppendVarint(m_buf, thread_name_id);
+    LogArgs::AppendVarint(m_buf, file_id);
+    LogArgs::AppendVarint(m_buf, (uint32_t)event->getLine());
+    LogArgs::AppendVarint(m_buf, fmt_id);
+    const std::string& data = fmt_id ? event->getArgs() : event->getContent();
+    LogArgs::AppendVarint(m_buf, data.size());
+    m_buf.append(data);
+
+    if(m_buf.size() >= s_binary_log_buffer_size || event->getTime() != m_lastTime) {
+        writeOut();
+        m_lastTime = event->getTime();
     }
 }
 
 
-void Logger::debug(LogEvent::ptr event){
-    log(LogLevel::DEBUG, event);
-}
-
-
-void Logger::info(LogEvent::ptr event){
-    log(LogLevel::INFO, event);
-}
-
-
-void Logger::warn(LogEvent::ptr event){
-    log(LogLevel::WARN, event);
-}
-
-
-void Logger::error(LogEvent::ptr event){
-    log(LogLevel::ERROR, event);
+std::string BinaryLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "BinaryLogAppender";
+    node["file"] = m_filename;
+    if(m_level != LogLevel::UNKNOWN) node["level"] = LogLevel::ToString(m_level);
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
 }
 
 
-void Logger::fatal(LogEvent::ptr event){
-    log(LogLevel::FATAL, event);
+void BinaryLogAppender::flush() {
+    MutexType::Lock lock(m_mutex);
+    writeOut();
 }
 
 
-// 新设置的fmt直接生效
-void LogAppender::setFormatter(LogFormatter::ptr val) {
+bool BinaryLogAppender::reopen() {
     MutexType::Lock lock(m_mutex);
-    m_formatter = val;
-    m_hasFormatter = m_formatter ? true:false;
+    writeOut();
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+    m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    // 新的一段从文件头开始，字典重新编号
+    m_literalIds.clear();
+    m_stringIds.clear();
+    m_lastId = 0;
+    m_buf.append(MAGIC, sizeof(MAGIC));
+    m_buf.push_back((char)VERSION);
+    return m_fd >= 0;
 }
 
 
-// 新设置的fmt直接生效
-void LogAppender::setFormatter(const std::string& fmt) {
-    sylar::LogFormatter::ptr new_val(new sylar::LogFormatter(fmt));
-    if(new_val->isError()) {
-        std::cout << "LoggerAppender setFormatter, value=" 
-                  << fmt << " invaild formatter" << std::endl;
-        m_hasFormatter = false;
-        return; 
+uint32_t BinaryLogAppender::getId(const char * str) {
+    auto it = m_literalIds.find(str);
+    if(it != m_literalIds.end()) {
+        return it->second;
     }
-    setFormatter(new_val);
+    uint32_t id = addString(str, strlen(str));
+    m_literalIds[str] = id;
+    return id;
 }
 
 
-LogFormatter::ptr LogAppender::getFormatter() {
-    MutexType::Lock lock(m_mutex);
-    return m_formatter;
+uint32_t BinaryLogAppender::getId(const std::string& str) {
+    auto it = m_stringIds.find(str);
+    if(it != m_stringIds.end()) {
+        return it->second;
+    }
+    uint32_t id = addString(str.data(), str.size());
+    m_stringIds[str] = id;
+    return id;
 }
 
 
-FileLogAppender::FileLogAppender(const std::string& filename):
-m_filename(filename)
-{
-    reopen();
+uint32_t BinaryLogAppender::addString(const char * str, size_t len) {
+    uint32_t id = ++m_lastId;
+    m_buf.push_back((char)STRING);
+    LogArgs::AppendVarint(m_buf, id);
+    LogArgs::AppendVarint(m_buf, len);
+    m_buf.append(str, len);
+    return id;
 }
 
 
-void FileLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        // 每隔段时间重新打开文件，避免文件被删除后，代码无法感知导致的问题
-        uint64_t now = time(0);
-        if(now != m_lastTime) {
-            reopen();
-            // 即使出现条件竞争，对重新打开文件这个操作影响不大
-            m_lastTime = now;
+void BinaryLogAppender::writeOut() {
+    size_t offset = 0;
+    while(m_fd >= 0 && offset < m_buf.size()) {
+        ssize_t rt = write(m_fd, m_buf.data() + offset, m_buf.size() - offset);
+        if(rt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            std::cout << "BinaryLogAppender write " << m_filename << " errno=" << errno
+                      << " errstr=" << strerror(errno) << std::endl;
+            break;
         }
-        MutexType::Lock lock(m_mutex);
-        m_filestream << m_formatter->format(logger, level, event);
+        offset += rt;
     }
+    m_buf.clear();
 }
 
 
-std::string FileLogAppender::toYamlString() {
-    MutexType::Lock lock(m_mutex);
-    YAML::Node node;
-    node["type"] = "FileLogAppender";
-    node["file"] = m_filename;
-    if(m_level != LogLevel::UNKNOWN) node["level"] = LogLevel::ToString(m_level);
-    if(m_formatter && m_hasFormatter) node["formatter"] = m_formatter->getPattern();
-    std::stringstream ss;
-    ss << node;
-    return ss.str();
+BinaryLogReader::BinaryLogReader(const std::string& filename) {
+    m_ba = ByteArray::MapFile(filename);
 }
 
 
-bool FileLogAppender::reopen() {
-    MutexType::Lock lock(m_mutex);
-    if (m_filestream.is_open()) {
-        m_filestream.close();
+LogEvent::ptr BinaryLogReader::next() {
+    if(!m_ba || m_error) {
+        return nullptr;
     }
-    m_filestream.open(m_filename, std::ios::app);
-    return !!m_filestream; //双感叹号!!作用就是非0值转成1，而0值还是0.
-}
-
-
-void StdoutLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        MutexType::Lock lock(m_mutex);
-        std::cout << m_formatter->format(logger, level, event);
+    // 写到一半的记录(进程崩溃)读的时候会抛std::out_of_range
+    try {
+        while(m_ba->getReadSize() > 0) {
+            uint8_t type = m_ba->readFuint8();
+            if(type == (uint8_t)BinaryLogAppender::MAGIC[0]) {
+                char magic[sizeof(BinaryLogAppender::MAGIC)];
+                magic[0] = type;
+                m_ba->read(magic + 1, sizeof(magic) - 1);
+                uint8_t version = m_ba->readFuint8();
+                if(memcmp(magic, BinaryLogAppender::MAGIC, sizeof(magic))
+                        || version == 0 || version > BinaryLogAppender::VERSION) {
+                    break;
+                }
+                m_strings.clear();
+            } else if(type == BinaryLogAppender::STRING) {
+                uint32_t id = m_ba->readUint32();
+                m_strings[id] = m_ba->readStringVint();
+            } else if(type == BinaryLogAppender::EVENT) {
+                LogLevel::Level level = (LogLevel::Level)m_ba->readFuint8();
+                uint64_t time = m_ba->readUint64();
+                uint32_t elapse = m_ba->readUint32();
+                pid_t thread_id = m_ba->readUint32();
+                uint32_t fiber_id = m_ba->readUint32();
+                uint32_t logger_id = m_ba->readUint32();
+                uint32_t thread_name_id = m_ba->readUint32();
+                uint32_t file_id = m_ba->readUint32();
+                int32_t line = m_ba->readUint32();
+                uint32_t fmt_id = m_ba->readUint32();
+                std::string data = m_ba->readStringVint();
+
+                auto logger_it = m_strings.find(logger_id);
+                auto thread_name_it = m_strings.find(thread_name_id);
+                auto file_it = m_strings.find(file_id);
+                auto fmt_it = m_strings.find(fmt_id);
+                if(logger_it == m_strings.end() || thread_name_it == m_strings.end()
+                        || file_it == m_strings.end()
+                        || (fmt_id && fmt_it == m_strings.end())) {
+                    break;
+                }
+                Logger::ptr& logger = m_loggers[logger_it->second];
+                if(!logger) {
+                    logger.reset(new Logger(logger_it->second));
+                }
+                LogEvent::ptr event(new LogEvent(logger, level, file_it->second.c_str(), line
+                            ,elapse, thread_id, fiber_id, time, thread_name_it->second));
+                if(fmt_id) {
+                    std::string content;
+                    LogArgs::Render(content, fmt_it->second.c_str(), data.data(), data.size());
+                    event->getSs() << content;
+                } else {
+                    event->getSs() << data;
+                }
+                return event;
+            } else {
+                break;
+            }
+        }
+        if(m_ba->getReadSize() == 0) {
+            return nullptr;
+        }
+    } catch(std::out_of_range& e) {
     }
+    m_error = true;
+    return nullptr;
 }
 
 
-std::string StdoutLogAppender::toYamlString() {
-    MutexType::Lock lock(m_mutex);
-    YAML::Node node;
-    node["type"] = "StdoutLogAppender";
-    if(m_level != LogLevel::UNKNOWN) node["level"] = LogLevel::ToString(m_level);
-    if(m_formatter && m_hasFormatter) node["formatter"] = m_formatter->getPattern();
+std::string AsyncLogAppender::toYamlString() {
+    YAML::Node node = YAML::Load(m_appender->toYamlString());
+    node["async"] = true;
+    node["overflow"] = ToString(m_policy);
     std::stringstream ss;
     ss << node;
     return ss.str();
@@ -474,11 +2255,111 @@ params: logger指针, level, event指针
 return：将日志格式化的string返回
 */
 std::string LogFormatter::format(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
-    for (auto & i: m_items) {
-        i->format(ss, logger, level, event);
+    std::string str;
+    format(str, logger, level, event);
+    return str;
+}
+
+
+void LogFormatter::format(std::string& out, const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    LogFormatWriter w(out);
+    for (auto & op: m_ops) {
+        switch(op.type) {
+        case Op::LITERAL:
+            w.append(op.str);
+            break;
+        case Op::MESSAGE:
+            w.append(event->getContent());
+            break;
+        case Op::LEVEL:
+            {
+                const char * str = LogLevel::ToString(level);
+                w.append(str, strlen(str));
+            }
+            break;
+        case Op::ELAPSE:
+            w.appendUint(event->getElapse());
+            break;
+        case Op::LOGGER_NAME:
+            w.append(event->getLogger()->getName());
+            break;
+        case Op::THREAD_ID:
+            w.appendInt(event->getThreadId());
+            break;
+        case Op::FIBER_ID:
+            w.appendUint(event->getFiberId());
+            break;
+        case Op::THREAD_NAME:
+            w.append(event->getThreadName());
+            break;
+        case Op::DATETIME:
+            w.append(GetTime(op, event->getTime()));
+            break;
+        case Op::FILENAME:
+            w.append(event->getFile(), strlen(event->getFile()));
+            break;
+        case Op::LINE:
+            w.appendInt(event->getLine());
+            break;
+        }
     }
-    return ss.str();
+}
+
+
+const std::string& LogFormatter::GetTime(const Op& op, time_t t) {
+    struct Cache {
+        uint64_t id = 0;
+        time_t time = -1;
+        std::string str;
+    };
+    static const size_t CACHE_SIZE = 4;
+    static thread_local Cache t_cache[CACHE_SIZE];
+    static thread_local uint32_t t_next = 0;
+
+    Cache* slot = nullptr;
+    for(size_t i = 0; i < CACHE_SIZE; ++i) {
+        if(t_cache[i].id == op.id) {
+            slot = &t_cache[i];
+            break;
+        }
+    }
+    if(!slot) {
+        slot = &t_cache[t_next++ % CACHE_SIZE];
+        slot->id = op.id;
+        slot->time = -1;
+    }
+    if(slot->time != t) {
+        struct tm tm;
+        localtime_r(&t, &tm);
+        char buf[80];
+        size_t len = strftime(buf, sizeof(buf), op.str.c_str(), &tm);
+        slot->str.assign(buf, len);
+        slot->str.append(op.suffix);
+        slot->time = t;
+    }
+    return slot->str;
+}
+
+
+void LogFormatter::addLiteral(const std::string& str) {
+    if(str.empty()) {
+        return;
+    }
+    if(!m_ops.empty()) {
+        Op& last = m_ops.back();
+        if(last.type == Op::LITERAL) {
+            last.str.append(str);
+            return;
+        }
+        if(last.type == Op::DATETIME) {
+            last.suffix.append(str);
+            return;
+        }
+    }
+    Op op;
+    op.type = Op::LITERAL;
+    op.str = str;
+    m_ops.push_back(op);
 }
 
 
@@ -569,63 +2450,90 @@ void LogFormatter::init()
         vec.push_back(std::make_tuple(nstr, "", 0));
     }
 
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string& str)>> m_format_items = 
-    {
-#define XX(str, C) \
-    {#str, [](const std::string& fmt) {return fmt != "" ? FormatItem::ptr(new C(fmt)):FormatItem::ptr(new C()); }},
-        
-    XX(m, MessageFormatItem)        //m:消息
-    XX(p, LevelFormatItem)          //p:日志级别
-    XX(r, ElapseFormatItem)         //r:累计毫秒数
-    XX(c, LoggerNameFormatItem)     //c:日志名称
-    XX(t, ThreadIdFormatItem)       //t:线程id
-    XX(n, NewLineFormatItem)        //n:换行
-    XX(d, DateTimeFormatItem)       //d:时间
-    XX(f, FilenameFormatItem)       //f:文件名
-    XX(l, LineFormatItem)           //l:行号
-    XX(T, TabFormatItem)            //T:Tab
-    XX(F, FiberIdFormatItem)        //F:协程id
-    XX(N, ThreadNameFormatItem)     //N:线程名称
+    static std::map<std::string, Op::Type> s_format_ops = {
+#define XX(str, type) \
+        {#str, Op::type},
+    XX(m, MESSAGE)          //m:消息
+    XX(p, LEVEL)            //p:日志级别
+    XX(r, ELAPSE)           //r:累计毫秒数
+    XX(c, LOGGER_NAME)      //c:日志名称
+    XX(t, THREAD_ID)        //t:线程id
+    XX(d, DATETIME)         //d:时间
+    XX(f, FILENAME)         //f:文件名
+    XX(l, LINE)             //l:行号
+    XX(F, FIBER_ID)         //F:协程id
+    XX(N, THREAD_NAME)      //N:线程名称
 #undef XX
     };
+    static std::atomic<uint64_t> s_op_id(0);
+
     for(auto& i : vec) {
         if(std::get<2>(i) == 0) {
-            m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
-        } else if (std::get<2>(i) == 1) {
-            // %xx  %xx{yy} 两种情况
-            auto it = m_format_items.find(std::get<0>(i)); // 也有可能是不存在的it
-            if(it == m_format_items.end()) {
-                m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format  %" + std::get<0>(i) + ">>")));
-                m_error = true;
-            } else {
-                m_items.push_back(it->second(std::get<1>(i)));
-            }
+            addLiteral(std::get<0>(i));
+            continue;
         }
-        
-        // std::cout << "{" << std::get<0>(i) << "} - {" << std::get<1>(i) << "} - {" << std::get<2>(i)  << "}" << std::endl;
+        // %xx  %xx{yy} 两种情况
+        const std::string& key = std::get<0>(i);
+        if(key == "n") {
+            addLiteral("\n");          //n:换行
+            continue;
+        }
+        if(key == "T") {
+            addLiteral("\t");          //T:Tab
+            continue;
+        }
+        auto it = s_format_ops.find(key); // 也有可能是不存在的it
+        if(it == s_format_ops.end()) {
+            addLiteral("<<error_format  %" + key + ">>");
+            m_error = true;
+            continue;
+        }
+        Op op;
+        op.type = it->second;
+        if(op.type == Op::DATETIME) {
+            op.str = std::get<1>(i).empty() ? "%Y-%m-%d %H:%M:%S" : std::get<1>(i);
+            op.id = ++s_op_id;
+        }
+        m_ops.push_back(op);
     }
 }
 
 
-LoggerManager::LoggerManager() {
+LoggerManager::LoggerManager()
+    :m_loggers(new LoggerMap) {
     m_root.reset(new Logger);
     // m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
-    m_loggers[m_root->m_name] = m_root;
+    (*m_loggers)[m_root->m_name] = m_root;
     init();
 }
 
 
 Logger::ptr LoggerManager::getLogger(const std::string& name) {
     if(name == "") return m_root;
+    {
+        RcuReadLock rlock;
+        LoggerMap* loggers = m_loggers.load(std::memory_order_acquire);
+        auto it = loggers->find(name);
+        if(it != loggers->end()) {
+            return it->second;
+        }
+    }
     MutexType::Lock lock(m_mutex);
-    auto it = m_loggers.find(name);
-    if(it != m_loggers.end()) {
+    LoggerMap* old = m_loggers.load();
+    auto it = old->find(name);
+    if(it != old->end()) {
         return it->second;
     }
     // 自己创建一个
     Logger::ptr logger(new Logger(name));
     logger->m_root = m_root;  // 添加了一个默认logger, 备用的
-    m_loggers[name] = logger;
+    LoggerMap* loggers = new LoggerMap(*old);
+    (*loggers)[name] = logger;
+    m_loggers.store(loggers, std::memory_order_release);
+    // 先解锁再等宽限期，别的线程创建logger不用跟着等
+    lock.unlock();
+    Rcu::Synchronize();
+    delete old;
     return logger;
 }
 
@@ -633,7 +2541,7 @@ Logger::ptr LoggerManager::getLogger(const std::string& name) {
 std::string LoggerManager::toYamlString() {
     MutexType::Lock lock(m_mutex);
     YAML::Node node;
-    for(auto& i : m_loggers ) {
+    for(auto& i : *m_loggers ) {
         node.push_back(YAML::Load(i.second->toYamlString()));
     }
     std::stringstream ss;
@@ -643,19 +2551,48 @@ std::string LoggerManager::toYamlString() {
 
 
 struct LogAppenderDefine {
-    int type = 0; // 1 File, 2 Stdout
+    int type = 0; // 1 File, 2 Stdout, 3 Binary
     LogLevel::Level level = LogLevel::UNKNOWN;
     std::string formatter;
     std::string file;
+    bool async = false;  // 是否用AsyncLogAppender包装
+    AsyncLogAppender::OverflowPolicy overflow = AsyncLogAppender::BLOCK;
+    // FileLogAppender滚动相关
+    uint64_t max_size = 0;
+    FileLogAppender::RollPeriod roll = FileLogAppender::NONE;
+    uint32_t max_files = 0;
+    bool compress = false;
 
     bool operator==(const LogAppenderDefine& oth) const {
         return type == oth.type
         && level == oth.level
         && formatter == oth.formatter
-        && file == oth.file;
+        && file == oth.file
+        && async == oth.async
+        && overflow == oth.overflow
+        && max_size == oth.max_size
+        && roll == oth.roll
+        && max_files == oth.max_files
+        && compress == oth.compress;
     }
 };
 
+// 文件大小，支持K/M/G后缀
+static uint64_t ParseLogSize(const std::string& str) {
+    char * end = nullptr;
+    uint64_t v = strtoull(str.c_str(), &end, 10);
+    switch(toupper(*end)) {
+    case 'K':
+        return v << 10;
+    case 'M':
+        return v << 20;
+    case 'G':
+        return v << 30;
+    default:
+        return v;
+    }
+}
+
 struct LogDefine {
     std::string name;
     LogLevel::Level level = LogLevel::UNKNOWN;
@@ -675,10 +2612,9 @@ struct LogDefine {
 };
 
 template<>
-class LexicalCast<std::string, LogDefine> {
+class YamlCast<LogDefine> {
 public:
-    LogDefine operator() (const std::string& v) {
-        YAML::Node node = YAML::Load(v);
+    LogDefine operator() (const YAML::Node& node) {
         LogDefine ld;
         // 因为是从yml中取出很可能遇不到,所以IsDefined并且还要是对应类型
         if(!node["name"].IsDefined() || !node["name"].IsScalar()) {
@@ -710,8 +2646,20 @@ public:
                         continue;
                     }
                     lad.file = a["file"].as<std::string>();
+                    if(a["max_size"].IsDefined()) lad.max_size = ParseLogSize(a["max_size"].as<std::string>());
+                    if(a["roll"].IsDefined()) lad.roll = FileLogAppender::FromString(a["roll"].as<std::string>());
+                    if(a["max_files"].IsDefined()) lad.max_files = a["max_files"].as<uint32_t>();
+                    if(a["compress"].IsDefined()) lad.compress = a["compress"].as<bool>();
                 } else if(type == "StdoutLogAppender") {
                     lad.type = 2;
+                } else if(type == "BinaryLogAppender") {
+                    lad.type = 3;
+                    if(!a["file"].IsDefined()) {
+                        std::cout << "log config error: binaryappender file is null, " << a
+                                  << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
                 } else {
                     std::cout << "log config error: appender type is invaild, " << a
                               << std::endl;
@@ -719,6 +2667,8 @@ public:
                 }
                 if(a["level"].IsDefined()) lad.level = LogLevel::FromString(a["level"].as<std::string>().c_str());
                 if(a["formatter"].IsDefined()) lad.formatter = a["formatter"].as<std::string>();
+                if(a["async"].IsDefined()) lad.async = a["async"].as<bool>();
+                if(a["overflow"].IsDefined()) lad.overflow = AsyncLogAppender::FromString(a["overflow"].as<std::string>());
                 ld.appenders.push_back(lad);
             }
         }
@@ -728,6 +2678,15 @@ public:
 }; 
 
 
+template<>
+class LexicalCast<std::string, LogDefine> {
+public:
+    LogDefine operator() (const std::string& v) {
+        return YamlCast<LogDefine>()(YAML::Load(v));
+    }
+};
+
+
 template<>
 class LexicalCast<LogDefine, std::string> {
 public:
@@ -742,11 +2701,22 @@ public:
             if(it.type == 1) {
                 na["type"] = "FileLogAppender";
                 na["file"] = it.file;
+                if(it.max_size) na["max_size"] = it.max_size;
+                if(it.roll != FileLogAppender::NONE) na["roll"] = FileLogAppender::ToString(it.roll);
+                if(it.max_files) na["max_files"] = it.max_files;
+                if(it.compress) na["compress"] = true;
             } else if(it.type == 2) {
                 na["type"] = "StdoutLogAppender";
+            } else if(it.type == 3) {
+                na["type"] = "BinaryLogAppender";
+                na["file"] = it.file;
             }
             na["level"] = LogLevel::ToString(it.level);
             na["formatter"] = it.formatter;
+            if(it.async) {
+                na["async"] = true;
+                na["overflow"] = AsyncLogAppender::ToString(it.overflow);
+            }
             node["appenders"].push_back(na);
         }
         std::stringstream ss;
@@ -780,13 +2750,24 @@ struct LogIniter {
                 for(auto& a: i.appenders) {
                     sylar::LogAppender::ptr ap;
                     if(a.type == 1) {
-                        ap.reset(new FileLogAppender(a.file));
+                        FileLogAppender::ptr file(new FileLogAppender(a.file));
+                        file->setMaxSize(a.max_size);
+                        file->setRollPeriod(a.roll);
+                        file->setMaxFiles(a.max_files);
+                        file->setCompress(a.compress);
+                        ap = file;
                     } else if(a.type == 2) {
                         ap.reset(new StdoutLogAppender);
+                    } else if(a.type == 3) {
+                        ap.reset(new BinaryLogAppender(a.file));
                     }
                     ap->setLevel(a.level);
                     // 如果ap没有fmt，那么使用logger本身默认的fmt
                     if(!a.formatter.empty()) ap->setFormatter(a.formatter);
+                    if(a.async) {
+                        ap.reset(new AsyncLogAppender(ap, a.overflow));
+                        ap->setLevel(a.level);
+                    }
                     logger->addAppender(ap);
                 }
             }
@@ -10,9 +10,14 @@
 #include<vector>
 #include<cstdarg>
 #include<map>
+#include<atomic>
+#include<type_traits>
+#include<unordered_map>
+#include<string.h>
 #include "singleton.h"
 #include "util.h"
 #include "thread.h"
+#include "rcu.h"
 
 /*
 params: 接受logger指针和level, 构造默认LogEvent以及LogEventWrap
@@ -23,9 +28,9 @@ return: LogEventWrap管理的LogEvent的stringstream m_ss
 */
 #define SYLAR_LOG_LEVEL(logger, level) \
     if(logger->getLevel() <= level) \
-        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level,\
+        sylar::LogEventWrap(sylar::LogEvent::Create(logger, level,\
                             __FILE__, __LINE__, 0, sylar::GetThreadId(),\
-                            sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getSs()
+                            sylar::GetFiberId(), time(0), sylar::Thread::GetName())).getSs()
 
 #define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::DEBUG)
 #define SYLAR_LOG_INFO(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::INFO)
@@ -39,14 +44,16 @@ params: 接受logger指针和level, fmt, 以及不定参数，构造默认LogEve
 return: LogEventWrap管理的LogEvent的format方法(fmt, 不定参数)
 
 目的：通过logger把(不定参数+fmt)形成的字符串输出为level级别的日志
-原理：(不定参数+fmt)形成的字符串写入LogEvent的stringstream m_ss中，LogEventWrap对象析构时
-将调用传入LogEvent的logger对象的log方法打印LogEvent的信息
+原理：fmt和编码后的参数记录在LogEvent中，需要文本时才格式化(BinaryLogAppender直接写参数)，
+LogEventWrap对象析构时将调用传入LogEvent的logger对象的log方法打印LogEvent的信息
+注意：fmt必须是字符串字面量，BinaryLogAppender按地址给fmt编号；
+宏里写成"" fmt，传入运行时的字符串编译不过
 */
 #define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...) \
     if(logger->getLevel() <= level) \
-        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, \
+        sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, \
                             __FILE__, __LINE__, 0, sylar::GetThreadId(),\
-                            sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+                            sylar::GetFiberId(), time(0), sylar::Thread::GetName())).getEvent()->formatArgs("" fmt, __VA_ARGS__)
 
 #define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_INFO(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::INFO, fmt, __VA_ARGS__)
@@ -54,6 +61,35 @@ return: LogEventWrap管理的LogEvent的format方法(fmt, 不定参数)
 #define SYLAR_LOG_FMT_ERROR(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::ERROR, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_FATAL(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::FATAL, fmt, __VA_ARGS__)
 
+/*
+params: logger, level, 以及限流参数
+return: 同SYLAR_LOG_LEVEL，被放行的日志前面带上"[suppressed N] "
+
+目的：故障时同一处代码在循环里刷屏(比如epoll_ctl失败)，限制每个调用点的输出频率
+原理：每个调用点一个静态的LogLimiter，判断只用原子操作；被丢弃的条数累计下来，
+由下一条放行的日志带出；刷屏停止后还没带出的条数由后台线程定期扫描，
+以该调用点的文件行号输出一条"suppressed N messages"(间隔见log.limit_summary_interval)
+注意：限流参数和logger只在该调用点第一次执行时生效
+*/
+#define SYLAR_LOG_LIMIT(logger, level, type, a, b) \
+    if(logger->getLevel() <= level) \
+        if(sylar::LogLimiter::Pass sylar_log_pass = [&]() -> sylar::LogLimiter& { \
+                    static sylar::LogLimiter s_limiter(type, a, b, logger, level, __FILE__, __LINE__); \
+                    return s_limiter; }().check()) \
+            sylar::LogEventWrap(sylar::LogEvent::Create(logger, level,\
+                            __FILE__, __LINE__, 0, sylar::GetThreadId(),\
+                            sylar::GetFiberId(), time(0), sylar::Thread::GetName())).getSs() << sylar_log_pass
+
+// 每n次输出一次(第1, n+1, 2n+1...次)
+#define SYLAR_LOG_EVERY_N(logger, level, n) \
+    SYLAR_LOG_LIMIT(logger, level, sylar::LogLimiter::EVERY_N, n, 0)
+// 每ms毫秒最多输出一次
+#define SYLAR_LOG_EVERY_MS(logger, level, ms) \
+    SYLAR_LOG_LIMIT(logger, level, sylar::LogLimiter::EVERY_MS, ms, 0)
+// 令牌桶：平均每秒rate条，最多连续burst条
+#define SYLAR_LOG_RATE_LIMITED(logger, level, rate, burst) \
+    SYLAR_LOG_LIMIT(logger, level, sylar::LogLimiter::RATE, rate, burst)
+
 // 创建受管理的logger
 #define SYLAR_LOG_ROOT() sylar::LoggerMgr::GetInstance().getRoot()
 #define SYLAR_LOG_NAME(name) sylar::LoggerMgr::GetInstance().getLogger(name)
@@ -63,6 +99,8 @@ namespace sylar {
 // 前置类声明
 class Logger;
 class LoggerManager;
+class LogAsyncWriter;
+class ByteArray;
 
 
 //日志级别：辅助类，可以默认构造
@@ -82,30 +120,195 @@ public:
 };
 
 
+// 日志内容的输出缓冲：直接追加到std::string，事件复用时容量保留，不再分配
+class LogStreamBuf : public std::streambuf {
+public:
+    LogStreamBuf(std::string& buf): m_buf(buf) {}
+protected:
+    int_type overflow(int_type c) override {
+        if(c != traits_type::eof()) {
+            m_buf.push_back((char)c);
+        }
+        return c;
+    }
+    std::streamsize xsputn(const char * s, std::streamsize n) override {
+        m_buf.append(s, n);
+        return n;
+    }
+private:
+    std::string& m_buf;
+};
+
+
+/*
+SYLAR_LOG_FMT_*的参数编码：每个参数1字节类型 + 值，整数用varint(有符号先zigzag)
+整数的类型字节高4位是参数的sizeof，Render按它(或者长度修饰符)截断，和printf的输出一致
+LogEvent只保存fmt和编码后的参数，需要文本时才用Render按fmt还原；BinaryLogAppender原样写进文件
+*/
+class LogArgs {
+public:
+    enum Type {
+        INT = 1,        // 有符号整数(含char/enum)，zigzag varint
+        UINT = 2,       // 无符号整数(含bool)，varint
+        DOUBLE = 3,     // 浮点数，8字节小端
+        STRING = 4,     // 字符串，varint长度 + 内容
+        POINTER = 5     // 指针，varint
+    };
+
+    static void Append(std::string& out) {}
+    template<class T, class... Args>
+    static void Append(std::string& out, const T& v, const Args&... args) {
+        Put(out, v);
+        Append(out, args...);
+    }
+
+    // 按printf的规则把fmt和编码后的参数还原成文本，追加到out
+    // 整数按长度修饰符(h/l/ll...)的宽度输出，没有修饰符时按参数宽度(不足int的按int)，
+    // 参数不足时转换说明原样输出
+    static void Render(std::string& out, const char * fmt, const char * args, size_t len);
+
+    static void AppendVarint(std::string& out, uint64_t v) {
+        char buf[10];
+        size_t n = 0;
+        while(v >= 0x80) {
+            buf[n++] = (char)(v | 0x80);
+            v >>= 7;
+        }
+        buf[n++] = (char)v;
+        out.append(buf, n);
+    }
+private:
+    static void PutTyped(std::string& out, Type type, uint64_t v, size_t size = 0) {
+        out.push_back((char)(type | (size << 4)));
+        AppendVarint(out, v);
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    Put(std::string& out, T v) {
+        PutTyped(out, INT, ((uint64_t)(int64_t)v << 1) ^ (uint64_t)((int64_t)v >> 63)
+                 ,sizeof(T) < 8 ? sizeof(T) : 8);
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+    Put(std::string& out, T v) {
+        PutTyped(out, UINT, v, sizeof(T) < 8 ? sizeof(T) : 8);
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_enum<T>::value>::type
+    Put(std::string& out, T v) {
+        Put(out, (typename std::underlying_type<T>::type)v);
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+    Put(std::string& out, T v) {
+        double d = v;
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        char buf[9];
+        buf[0] = DOUBLE;
+        for(int i = 0; i < 8; ++i) {
+            buf[i + 1] = (char)(bits >> (i * 8));
+        }
+        out.append(buf, sizeof(buf));
+    }
+
+    static void Put(std::string& out, const char * v) {
+        if(!v) {
+            v = "(null)";
+        }
+        size_t len = strlen(v);
+        PutTyped(out, STRING, len);
+        out.append(v, len);
+    }
+
+    static void Put(std::string& out, char * v) {
+        Put(out, (const char *)v);
+    }
+
+    static void Put(std::string& out, const std::string& v) {
+        PutTyped(out, STRING, v.size());
+        out.append(v);
+    }
+
+    template<class T>
+    static void Put(std::string& out, T * v) {
+        PutTyped(out, POINTER, (uintptr_t)v);
+    }
+};
+
+
 // 日志事件：LogEvent主要负责保存和返回日志信息，构造参数众多，无默认参数
 class LogEvent {
 public:
     typedef std::shared_ptr<LogEvent> ptr; 
-    LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
+    LogEvent(const std::shared_ptr<Logger>& logger, LogLevel::Level level,
             const char * file, int32_t line, uint32_t elapse,
             pid_t thread_id, uint32_t fiber_id, uint64_t time,
             const std::string& thread_name);
     ~LogEvent();
+    // 优先复用本线程缓存的LogEvent(没有被其他地方持有时)，避免每条日志new一次
+    static LogEvent::ptr Create(const std::shared_ptr<Logger>& logger, LogLevel::Level level,
+            const char * file, int32_t line, uint32_t elapse,
+            pid_t thread_id, uint32_t fiber_id, uint64_t time,
+            const std::string& thread_name);
     const char * getFile() const { return m_file; }
     int32_t getLine() const { return m_line; }
     uint32_t getElapse() const { return m_elapse; }
     pid_t getThreadId() const { return m_threadId; }
     uint32_t getFiberId() const { return m_fiberId; }
     uint64_t getTime() const { return m_time; }
-    const std::string getContent() const { return m_ss.str(); }
-    std::shared_ptr<Logger> getLogger() const { return m_logger; }
+    // formatArgs记录的参数在第一次取内容时才格式化
+    const std::string& getContent() const {
+        if(m_fmt && !m_rendered) {
+            render();
+        }
+        return m_content;
+    }
+    const std::shared_ptr<Logger>& getLogger() const { return m_logger; }
     LogLevel::Level getLevel() const { return m_level; }
-    std::string getThreadName() const { return m_threadName; }
-
-    std::stringstream& getSs() { return m_ss; }
+    const std::string& getThreadName() const { return m_threadName; }
+
+    std::ostream& getSs() {
+        if(m_fmt) {
+            // 流式内容要接在fmt的结果后面，先落成文本
+            getContent();
+            m_fmt = nullptr;
+        }
+        return m_ss;
+    }
     // m_ss进行格式化
     void format(const char * fmt, ...);
     void format(const char *fmt, va_list al);
+
+    // 只记录fmt(字符串字面量)和编码后的参数，不做格式化
+    template<class... Args>
+    void formatArgs(const char * fmt, const Args&... args) {
+        if(m_fmt || !m_content.empty()) {
+            // 已经有内容时没法只用一个fmt描述，直接格式化成文本
+            getSs();
+            std::string args_buf;
+            LogArgs::Append(args_buf, args...);
+            LogArgs::Render(m_content, fmt, args_buf.data(), args_buf.size());
+            return;
+        }
+        m_fmt = fmt;
+        LogArgs::Append(m_args, args...);
+    }
+    // formatArgs记录的fmt，没有时(流式日志或内容已落成文本)返回nullptr
+    const char * getFmt() const { return m_fmt; }
+    // formatArgs记录的编码后的参数
+    const std::string& getArgs() const { return m_args; }
+private:
+    void render() const;
+    // 复用时重置所有字段，日志内容清空但保留容量
+    void reset(const std::shared_ptr<Logger>& logger, LogLevel::Level level,
+            const char * file, int32_t line, uint32_t elapse,
+            pid_t thread_id, uint32_t fiber_id, uint64_t time,
+            const std::string& thread_name);
 private:
     const char * m_file = nullptr;      //文件名
     int32_t m_line = 0;                 //符号
@@ -113,7 +316,12 @@ private:
     pid_t m_threadId;                   //线程id
     uint32_t m_fiberId = 0;             //协程id
     uint64_t m_time = 0;                //时间戳
-    std::stringstream m_ss;             //日志内容
+    mutable std::string m_content;      //日志内容
+    mutable bool m_rendered = false;    //m_fmt是否已格式化进m_content
+    const char * m_fmt = nullptr;       //formatArgs记录的fmt
+    std::string m_args;                 //formatArgs记录的编码后的参数
+    LogStreamBuf m_buf;                 //写入m_content的streambuf
+    std::ostream m_ss;                  //日志内容输出流
     std::shared_ptr<Logger> m_logger;   //打印日志的logger指针
     LogLevel::Level m_level;            //日志level
     std::string m_threadName;           //线程名称
@@ -129,13 +337,75 @@ public:
     LogEventWrap(LogEvent::ptr e);
     ~LogEventWrap();
     LogEvent::ptr getEvent() const { return m_event; }
-    std::stringstream& getSs();
+    std::ostream& getSs();
 private:
     LogEvent::ptr m_event;
 };
 
 
-//日志格式器: 必须传入符合规则的pattern并对其解析(init()函数)，最后保存在m_items对象中
+/*
+日志限流器：每个SYLAR_LOG_EVERY_N/EVERY_MS/RATE_LIMITED调用点一个
+check()无锁，多个线程同时走到同一个调用点也只放行该放行的条数
+RATE用GCRA实现令牌桶：只维护一个"理论到达时间"m_next，一次CAS完成取令牌
+带logger构造的限流器登记到后台线程，两次扫描之间没有新的抑制时，把还没报告的条数单独输出
+*/
+class LogLimiter {
+public:
+    enum Type {
+        EVERY_N = 1,
+        EVERY_MS = 2,
+        RATE = 3
+    };
+
+    // check()的结果，放行时带上此前被抑制的条数
+    struct Pass {
+        bool ok;
+        uint64_t suppressed;
+        explicit operator bool() const { return ok; }
+    };
+
+    // logger为空时不登记，抑制的条数只随放行的日志带出
+    LogLimiter(Type type, uint64_t a, uint64_t b = 0
+               ,std::shared_ptr<Logger> logger = nullptr
+               ,LogLevel::Level level = LogLevel::UNKNOWN
+               ,const char* file = nullptr, int32_t line = 0);
+    ~LogLimiter();
+    Pass check();
+
+    Type getType() const { return m_type; }
+    // 累计被抑制的条数
+    uint64_t getTotalSuppressed() const;
+private:
+    bool allow();
+    // 认领[m_reported, total)这一段还没报告的条数
+    uint64_t claim(uint64_t total);
+    friend class LogLimitReporter;
+private:
+    Type m_type;
+    // EVERY_N: n; EVERY_MS: 间隔(us); RATE: 每条的间隔(us)
+    uint64_t m_interval;
+    // RATE: 允许提前的量(us) = (burst - 1) * m_interval
+    uint64_t m_tolerance;
+    // EVERY_N: 调用计数; EVERY_MS/RATE: 下一次放行的时间(us)
+    std::atomic<uint64_t> m_next;
+    // 累计被抑制的条数，只增不减
+    std::atomic<uint64_t> m_suppressed;
+    // 已经报告过的抑制条数(随放行的日志或者后台汇总)
+    std::atomic<uint64_t> m_reported;
+    // 以下只在登记时设置，由后台线程读取
+    std::weak_ptr<Logger> m_logger;
+    LogLevel::Level m_level;
+    const char* m_file;
+    int32_t m_line;
+    bool m_registered;
+    // 上一次扫描时看到的m_suppressed，只有后台线程访问
+    uint64_t m_lastSeen;
+};
+
+std::ostream& operator<<(std::ostream& os, const LogLimiter::Pass& pass);
+
+
+//日志格式器: 必须传入符合规则的pattern并对其解析(init()函数)，最后编译成m_ops指令序列
 //formatter生成后不会修改，只可能被覆盖，所以不需要加锁
 class LogFormatter {
 public:
@@ -144,34 +414,59 @@ public:
     // 返回字符串类型的pattern，即日志格式
     std::string getPattern() { return m_pattern; }
     std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
-public:
-    class FormatItem {
-    public:
-        typedef std::shared_ptr<FormatItem> ptr;
-        FormatItem(const std::string& fmt = ""){};
-        virtual ~FormatItem() {}
-        virtual void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
-    };
+    // 格式化结果追加到out末尾，不经过iostream，out复用时不分配内存
+    void format(std::string& out, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event);
     void init();
 
     bool isError() const { return m_error; }
+private:
+    /*
+    pattern编译后的一条指令，format时在一个switch循环里顺序执行，没有虚函数调用
+    相邻的字面量(包括%T %n)合并成一条；%d后面紧跟的字面量并入suffix，和时间一起按秒缓存
+    */
+    struct Op {
+        enum Type {
+            LITERAL,        //字面量
+            MESSAGE,        //m:消息
+            LEVEL,          //p:日志级别
+            ELAPSE,         //r:累计毫秒数
+            LOGGER_NAME,    //c:日志名称
+            THREAD_ID,      //t:线程id
+            FIBER_ID,       //F:协程id
+            THREAD_NAME,    //N:线程名称
+            DATETIME,       //d:时间
+            FILENAME,       //f:文件名
+            LINE            //l:行号
+        };
+        Type type;
+        std::string str;        // LITERAL: 字面量；DATETIME: strftime格式
+        std::string suffix;     // DATETIME: 紧跟的字面量
+        uint64_t id = 0;        // DATETIME: 线程缓存的key，每条指令唯一
+    };
+    // op对应的时间字符串(含suffix)，同一秒内直接返回本线程缓存的结果
+    static const std::string& GetTime(const Op& op, time_t t);
+    void addLiteral(const std::string& str);
 private:    
     std::string m_pattern;
-    std::vector<FormatItem::ptr> m_items;
+    std::vector<Op> m_ops;
     bool m_error = false; // 默认无错
 };
 
 //日志输出目的地
 class  LogAppender {
 friend class Logger;
+friend class AsyncLogAppender;
 public:
     typedef std::shared_ptr<LogAppender> ptr;
     typedef Spinlock MutexType;
     virtual ~LogAppender() {}
     LogAppender(){ m_level = LogLevel::DEBUG; }
 
-    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+    // logger是打印这条日志的logger(即event->getLogger())，只传引用，避免每条日志改引用计数
+    virtual void log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) = 0;
     virtual std::string toYamlString() = 0;
+    // 把缓冲中的日志写到目的地
+    virtual void flush() {}
 
     void setFormatter(LogFormatter::ptr val);
     void setFormatter(const std::string& fmt);
@@ -186,15 +481,36 @@ protected:
     LogFormatter::ptr m_formatter;
 };
 
-//日志器 
+/*
+日志器
+appender列表只在配置变化时修改，修改时整体复制一份再替换(RCU)，
+打日志时只在RCU读临界区里取当前快照并登记到本线程的hazard槽，出了临界区再遍历，
+appender里切换协程也不会把协程带出读临界区；级别是原子变量
+*/
 class Logger: public std::enable_shared_from_this<Logger> {
 friend class LoggerManager;
 public:
     typedef std::shared_ptr<Logger> ptr;
     typedef Spinlock MutexType;
+    typedef std::vector<LogAppender::ptr> AppenderList;
+
+    // appender列表的只读快照，发布出去的那份算一个引用；
+    // 打日志只在hazard槽用完时才加引用
+    struct AppenderSnapshot {
+        AppenderSnapshot() : refs(1) {}
+        void ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+        void unref() {
+            if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+        std::atomic<uint32_t> refs;
+        AppenderList appenders;
+    };
 
     Logger(const std::string& name = "root");
-    void log(LogLevel::Level level, LogEvent::ptr event);
+    ~Logger();
+    void log(LogLevel::Level level, const LogEvent::ptr& event);
     
     void debug(LogEvent::ptr event);
     void info(LogEvent::ptr event);
@@ -205,19 +521,25 @@ public:
     void addAppender(LogAppender::ptr appender);
     void delAppender(LogAppender::ptr appender);
     void clearAppenders();
-    LogLevel::Level getLevel() const { return m_level; }
-    void setLevel(LogLevel::Level val) { m_level = val; }
+    LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+    void setLevel(LogLevel::Level val) { m_level.store(val, std::memory_order_relaxed); }
     const std::string & getName() const { return m_name; }
     // 设置logger本身的默认formatter
     void setFormatter(LogFormatter::ptr val);
     void setFormatter(const std::string& val);
     LogFormatter::ptr getFormatter();
     std::string toYamlString();
+private:
+    // 发布新的appender列表(nullptr表示没有)，返回旧列表；需要持有m_mutex
+    AppenderSnapshot* setAppenders(AppenderSnapshot* appenders);
+    // 等读者都登记完后放掉发布的那份，还有hazard槽指着的留到以后再放；
+    // 宽限期可能很长，不能持有m_mutex
+    static void RetireAppenders(AppenderSnapshot* old);
 private:
     std::string m_name;                         //日志名称
-    LogLevel::Level m_level;                    //日志级别
-    MutexType m_mutex;
-    std::list<LogAppender::ptr>  m_appenders;   //Appender集合
+    std::atomic<LogLevel::Level> m_level;       //日志级别
+    MutexType m_mutex;                          //修改appender列表、formatter时加锁
+    std::atomic<AppenderSnapshot*> m_appenders; //Appender集合，只读快照
     LogFormatter::ptr m_formatter;              //不使用Appender的默认情况
     Logger::ptr m_root;                         // 备用logger
 };
@@ -228,41 +550,192 @@ class StdoutLogAppender : public LogAppender {
 friend class Logger;
 public:
     typedef std::shared_ptr<StdoutLogAppender> ptr;
-    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    void log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) override;
     std::string toYamlString() override;
+    void flush() override;
 private:
 };
 
-// 输出到文件的Appender
+/*
+输出到文件的Appender
+支持按大小、按时间滚动：当前文件改名为 文件名.YYYYmmdd-HHMMSS(滚动的时间)[.序号]后重新打开
+滚动出来的文件由后台线程压缩成.gz，并只保留最新的max_files个，打日志的线程只做改名
+*/
 class FileLogAppender : public LogAppender {
 friend class Logger;
 public:
     typedef std::shared_ptr<FileLogAppender> ptr;
+    // 按时间滚动的周期
+    enum RollPeriod {
+        NONE = 0,
+        HOUR = 1,
+        DAY = 2
+    };
+    static const char * ToString(RollPeriod period);
+    static RollPeriod FromString(std::string str);
+    // 等待已滚动文件的压缩和清理完成
+    static void WaitArchived();
+
     FileLogAppender(const std::string& filename);
-    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    void log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) override;
     std::string toYamlString() override;
+    void flush() override;
 
     //重新打开文件，文件打开成功返回true
     bool reopen();
+    //立即滚动当前文件，文件重新打开成功返回true
+    bool roll();
+
+    // 单个文件超过这么多字节时滚动，0表示不按大小滚动
+    void setMaxSize(uint64_t v) { m_maxSize = v; }
+    uint64_t getMaxSize() const { return m_maxSize; }
+    void setRollPeriod(RollPeriod v);
+    RollPeriod getRollPeriod() const { return m_rollPeriod; }
+    // 最多保留的滚动文件数，0表示不清理
+    void setMaxFiles(uint32_t v) { m_maxFiles = v; }
+    uint32_t getMaxFiles() const { return m_maxFiles; }
+    // 滚动出来的文件是否压缩
+    void setCompress(bool v) { m_compress = v; }
+    bool getCompress() const { return m_compress; }
+private:
+    // 以下需要持有m_mutex
+    bool openFile();
+    bool rollFile();
 private:
     std::string m_filename;
     std::ofstream m_filestream;
     uint64_t m_lastTime = 0;  // 没隔几秒重新打开文件
+    uint64_t m_size = 0;      // 当前文件大小
+    uint64_t m_openTime = 0;  // 当前这段日志开始的时间
+    uint64_t m_periodId = 0;  // 当前所在的滚动周期
+    uint64_t m_maxSize = 0;
+    RollPeriod m_rollPeriod = NONE;
+    uint32_t m_maxFiles = 0;
+    bool m_compress = false;
+};
+
+
+/*
+异步输出的Appender: 包装一个普通Appender
+工作线程只把日志记录拷贝进本线程的无锁环形缓冲区(单生产者单消费者)，
+后台线程统一取出、格式化、交给被包装的Appender批量写出并flush
+*/
+class AsyncLogAppender : public LogAppender, public std::enable_shared_from_this<AsyncLogAppender> {
+friend class LogAsyncWriter;
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+    // 缓冲区满时的处理策略
+    enum OverflowPolicy {
+        BLOCK = 0,  // 等待后台线程腾出空间
+        DROP = 1,   // 直接丢弃，只计数
+        COUNT = 2   // 丢弃并计数，恢复后补写一条丢弃数量的日志
+    };
+    static const char * ToString(OverflowPolicy policy);
+    static OverflowPolicy FromString(std::string str);
+
+    AsyncLogAppender(LogAppender::ptr appender, OverflowPolicy policy = BLOCK);
+    void log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) override;
+    std::string toYamlString() override;
+    // 等待已提交的日志全部写出
+    void flush() override;
+
+    LogAppender::ptr getAppender() const { return m_appender; }
+    OverflowPolicy getPolicy() const { return m_policy; }
+    // 因缓冲区满而丢弃的日志条数
+    uint64_t getDropped() const { return m_dropped; }
+private:
+    // 后台线程调用，交给被包装的Appender输出
+    void output(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event);
+private:
+    LogAppender::ptr m_appender;
+    OverflowPolicy m_policy;
+    // 是否已登记到后台线程；环形缓冲区里只存裸指针，由登记的引用保证存活
+    std::atomic<bool> m_registered;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_unreported;  // COUNT策略下还没补写的丢弃数
+};
+
+
+/*
+二进制日志Appender(参考NanoLog): 运行时不做任何字符串格式化
+SYLAR_LOG_FMT_*的日志只写fmt编号和编码后的参数，流式日志写整条内容
+fmt、文件名、logger名、线程名第一次出现时写一条字典记录，之后只写编号
+用sylar_logcat(BinaryLogReader)还原成LogFormatter的文本
+每次打开文件先写一个文件头，字典从文件头开始重新编号，所以可以追加写
+*/
+class BinaryLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<BinaryLogAppender> ptr;
+    // 记录类型，文件头以MAGIC的第一个字节开头
+    enum RecordType {
+        STRING = 1,     // 字典: varint编号 + varint长度 + 内容
+        EVENT = 2       // 日志: 级别、时间、编号等 + 参数或内容
+    };
+    static const char MAGIC[4];
+    // 2: 整数参数的类型字节带上sizeof；1的文件仍然可以读
+    static const uint8_t VERSION = 2;
+
+    BinaryLogAppender(const std::string& filename);
+    ~BinaryLogAppender();
+    void log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent::ptr& event) override;
+    std::string toYamlString() override;
+    void flush() override;
+    bool reopen();
+private:
+    // 字面量(fmt, 文件名)按地址编号
+    uint32_t getId(const char * str);
+    // logger名、线程名按内容编号
+    uint32_t getId(const std::string& str);
+    uint32_t addString(const char * str, size_t len);
+    // 把m_buf写到文件，需要持有m_mutex
+    void writeOut();
+private:
+    std::string m_filename;
+    int m_fd = -1;
+    std::string m_buf;
+    uint64_t m_lastTime = 0;    // 每秒至少写出一次
+    uint32_t m_lastId = 0;
+    std::unordered_map<const char *, uint32_t> m_literalIds;
+    std::unordered_map<std::string, uint32_t> m_stringIds;
+};
+
+
+/*
+读取BinaryLogAppender写出的文件，逐条还原成LogEvent
+同名logger还原成同一个(不注册到LoggerMgr的)Logger对象
+*/
+class BinaryLogReader {
+public:
+    typedef std::shared_ptr<BinaryLogReader> ptr;
+    BinaryLogReader(const std::string& filename);
+    // 文件是否打开成功
+    bool isValid() const { return !!m_ba; }
+    // 读下一条日志，结束时返回nullptr；返回的LogEvent在下一次调用前有效
+    LogEvent::ptr next();
+    // 是否因为数据截断或格式错误提前结束
+    bool isError() const { return m_error; }
+private:
+    std::shared_ptr<ByteArray> m_ba;
+    std::map<uint32_t, std::string> m_strings;
+    std::map<std::string, Logger::ptr> m_loggers;
+    bool m_error = false;
 };
 
 
 // LoggerManager注意是单例
+// logger表和Logger的appender列表一样用RCU发布，查找已有的logger不加锁
 class LoggerManager {
 public:
     typedef Spinlock MutexType;
+    typedef std::map<std::string, Logger::ptr> LoggerMap;
     LoggerManager();
     Logger::ptr getRoot() const { return m_root; }
     Logger::ptr getLogger(const std::string& name);
     std::string toYamlString();
     void init();
 private:
-    MutexType m_mutex;
-    std::map<std::string, Logger::ptr> m_loggers;
+    MutexType m_mutex;                      //新建logger时加锁
+    std::atomic<LoggerMap*> m_loggers;      //只读快照
     Logger::ptr m_root;
 };
 
@@ -0,0 +1,101 @@
+#include "rcu.h"
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+#include "mutex.h"
+#include "macro.h"
+
+namespace sylar {
+
+thread_local Rcu::Reader* Rcu::t_reader = nullptr;
+// 从1开始，保证临界区内的读者period不为0
+std::atomic<uint64_t> Rcu::s_period(1);
+
+namespace {
+
+struct RcuRegistry {
+    Mutex mutex;
+    // 所有读者记录，只增不减
+    std::vector<Rcu::Reader*> readers;
+    // 线程已经退出、可以复用的读者记录
+    std::vector<Rcu::Reader*> idle;
+};
+
+RcuRegistry& GetRegistry() {
+    // 不析构，其他全局对象析构时可能还会用到
+    static RcuRegistry* s_registry = new RcuRegistry;
+    return *s_registry;
+}
+
+}
+
+// pthread key的析构在C++ thread_local析构之后执行，它们里面仍然可以进入读临界区
+void Rcu::OnThreadExit(void* arg) {
+    Reader* reader = (Reader*)arg;
+    // 先清掉再放回，排在后面的pthread key析构里再打日志会重新登记一个读者
+    if(t_reader == reader) {
+        t_reader = nullptr;
+    }
+    RcuRegistry& registry = GetRegistry();
+    Mutex::Lock lock(registry.mutex);
+    registry.idle.push_back(reader);
+}
+
+Rcu::Reader* Rcu::Register() {
+    static pthread_key_t s_key = []() {
+        pthread_key_t key;
+        pthread_key_create(&key, &Rcu::OnThreadExit);
+        return key;
+    }();
+    Reader* reader = nullptr;
+    RcuRegistry& registry = GetRegistry();
+    {
+        Mutex::Lock lock(registry.mutex);
+        if(!registry.idle.empty()) {
+            reader = registry.idle.back();
+            registry.idle.pop_back();
+        } else {
+            reader = new Reader;
+            registry.readers.push_back(reader);
+        }
+    }
+    pthread_setspecific(s_key, reader);
+    t_reader = reader;
+    return reader;
+}
+
+void Rcu::Synchronize() {
+    // 在读临界区里等待会等到自己
+    SYLAR_ASSERT2(!t_reader || !t_reader->nesting, "Rcu::Synchronize in read-side critical section");
+    // 新指针的发布先于宽限期推进
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    RcuRegistry& registry = GetRegistry();
+    Mutex::Lock lock(registry.mutex);
+    uint64_t period = s_period.fetch_add(1) + 1;
+    for(auto& i : registry.readers) {
+        while(true) {
+            uint64_t p = i->period.load(std::memory_order_acquire);
+            // 已离开临界区，或者是在推进之后才进入的(只可能读到新指针)
+            if(p == 0 || p >= period) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+bool Rcu::IsProtected(const void* p) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    RcuRegistry& registry = GetRegistry();
+    Mutex::Lock lock(registry.mutex);
+    for(auto& i : registry.readers) {
+        for(auto& h : i->hazards) {
+            if(h.load(std::memory_order_acquire) == p) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,126 @@
+#ifndef __SYLAR_RCU_H__
+#define __SYLAR_RCU_H__
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 用户态RCU，用于读多写极少的数据(appender列表、logger表等)
+ * @details 读者在RcuReadLock范围内读取发布出来的指针，不加锁，不改引用计数；
+ *          写者用原子操作换上新指针后调用Synchronize()，返回时已经没有读者还在使用旧指针，
+ *          可以直接释放。读者在线程第一次进入读临界区时登记，线程退出时回收；
+ *          读到的指针要在离开临界区之后继续用(期间可能切换协程)时，在临界区内用Protect登记到
+ *          本线程的hazard槽，用完Unprotect；写者Synchronize之后再用IsProtected确认没有槽指着它
+ * @attention 读临界区内不能调用Synchronize()，也不能切换协程
+ */
+class Rcu {
+public:
+    /// 每个读者记录的hazard槽数
+    static const size_t HAZARDS = 4;
+
+    /// 每个线程一个读者记录
+    struct Reader {
+        Reader() : period(0) {
+            for(auto& i : hazards) {
+                i.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        /// 进入读临界区时的宽限期编号，0表示不在临界区
+        std::atomic<uint64_t> period;
+        /// 嵌套深度，只有本线程访问
+        uint32_t nesting = 0;
+        /// 离开临界区后仍在使用的指针，协程可能换到别的线程后再清掉
+        std::atomic<const void*> hazards[HAZARDS];
+    };
+
+    /**
+     * @brief 进入读临界区，可以嵌套
+     */
+    static void ReadLock() {
+        Reader* r = t_reader;
+        if(__builtin_expect(!r, 0)) {
+            r = Register();
+        }
+        if(r->nesting++ == 0) {
+            r->period.store(s_period.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            // 保证登记的宽限期先于之后读取指针被写者看到
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    /**
+     * @brief 离开读临界区
+     */
+    static void ReadUnlock() {
+        Reader* r = t_reader;
+        if(--r->nesting == 0) {
+            r->period.store(0, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief 等待调用前已经进入读临界区的读者全部离开
+     * @pre 新指针已经发布
+     */
+    static void Synchronize();
+
+    /**
+     * @brief 把临界区内读到的指针登记到本线程空闲的hazard槽
+     * @pre 在读临界区内
+     * @return 登记的槽，没有空闲槽时返回nullptr(调用方自己想办法，比如加引用)
+     */
+    static std::atomic<const void*>* Protect(const void* p) {
+        for(auto& i : t_reader->hazards) {
+            // 非空的槽只会被持有它的一方清空，这里只写空槽
+            if(!i.load(std::memory_order_relaxed)) {
+                // 离开临界区时的release保证Synchronize之后能看到
+                i.store(p, std::memory_order_relaxed);
+                return &i;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 清掉Protect返回的槽，可以在别的线程调用(协程换了线程)
+     */
+    static void Unprotect(std::atomic<const void*>* slot) {
+        slot->store(nullptr, std::memory_order_release);
+    }
+
+    /**
+     * @brief 是否还有hazard槽指着p
+     * @pre p已经换下并且Synchronize过，之后不会再有新的槽登记它
+     */
+    static bool IsProtected(const void* p);
+private:
+    static Reader* Register();
+    // 线程退出时把读者放回空闲列表(槽可能还被换了线程的协程占着，不能释放)，
+    // 之后再进入读临界区会重新登记
+    static void OnThreadExit(void* arg);
+private:
+    static thread_local Reader* t_reader;
+    static std::atomic<uint64_t> s_period;
+};
+
+/**
+ * @brief RCU读临界区的局部锁
+ */
+class RcuReadLock : Noncopyable {
+public:
+    RcuReadLock() {
+        Rcu::ReadLock();
+    }
+
+    ~RcuReadLock() {
+        Rcu::ReadUnlock();
+    }
+};
+
+}
+
+#endif
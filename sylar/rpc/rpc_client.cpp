@@ -0,0 +1,149 @@
+#include "rpc_client.h"
+#include "../macro.h"
+#include "../log.h"
+
+namespace sylar {
+namespace rpc {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+RpcClient::ptr RpcClient::Connect(Address::ptr addr, uint64_t timeout_ms, IOManager* iom) {
+    Socket::ptr sock = Socket::CreateTCP(addr);
+    if(!sock->connect(addr, timeout_ms)) {
+        SYLAR_LOG_DEBUG(g_logger) << "rpc connect " << *addr << " fail";
+        return nullptr;
+    }
+    return Create(sock, iom);
+}
+
+RpcClient::ptr RpcClient::Create(Socket::ptr sock, IOManager* iom) {
+    SYLAR_ASSERT2(iom, "RpcClient needs an IOManager");
+    RpcClient::ptr client(new RpcClient(sock, iom));
+    iom->schedule(std::bind(&RpcClient::recvLoop, client));
+    return client;
+}
+
+RpcClient::RpcClient(Socket::ptr sock, IOManager* iom)
+    :m_session(new RpcSession(sock))
+    ,m_iom(iom)
+    ,m_sn(0)
+    ,m_closed(false) {
+}
+
+RpcClient::~RpcClient() {
+    SYLAR_ASSERT(m_calls.empty());
+}
+
+int RpcClient::call(const std::string& method, const std::string& req
+                    ,std::string& rsp, uint64_t timeout_ms) {
+    SYLAR_ASSERT2(Scheduler::GetThis(), "RpcClient::call must be called in a Scheduler");
+    Call call;
+    call.status = (int)RpcStatus::OK;
+    call.rsp = &rsp;
+
+    uint32_t id = 0;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_closed) {
+            return (int)RpcStatus::CLOSED;
+        }
+        // id回绕后跳过还在等待的请求
+        do {
+            id = ++m_sn;
+        } while(id == 0 || m_calls.count(id));
+        m_calls[id] = &call;
+    }
+
+    Timer::ptr timer;
+    if(timeout_ms != ~0ull) {
+        std::weak_ptr<RpcClient> weak(shared_from_this());
+        timer = m_iom->addTimer(timeout_ms, [weak, id]() {
+            RpcClient::ptr self = weak.lock();
+            if(self) {
+                self->onTimeout(id);
+            }
+        });
+    }
+
+    uint32_t remain = timeout_ms > 0xffffffffull ? 0 : timeout_ms;
+    if(!m_session->sendRequest(id, method, remain, req)) {
+        if(take(id)) {
+            if(timer) {
+                timer->cancel();
+            }
+            return (int)RpcStatus::SEND_ERROR;
+        }
+        // 已经被超时或者连接关闭取走了，等它触发事件
+    }
+
+    call.done.wait();
+    if(timer) {
+        timer->cancel();
+    }
+    return call.status;
+}
+
+RpcClient::Call* RpcClient::take(uint32_t id) {
+    MutexType::Lock lock(m_mutex);
+    auto it = m_calls.find(id);
+    if(it == m_calls.end()) {
+        return nullptr;
+    }
+    Call* call = it->second;
+    m_calls.erase(it);
+    return call;
+}
+
+void RpcClient::Wake(Call* call, int status) {
+    call->status = status;
+    // set之后调用协程随时可能返回，call所在的栈就失效了
+    call->done.set();
+}
+
+void RpcClient::onTimeout(uint32_t id) {
+    Call* call = take(id);
+    if(call) {
+        Wake(call, (int)RpcStatus::TIMEOUT);
+    }
+}
+
+void RpcClient::recvLoop() {
+    RpcMessage msg;
+    while(m_session->recvMessage(msg)) {
+        if(msg.type != RpcMessage::RESPONSE) {
+            SYLAR_LOG_ERROR(g_logger) << "rpc client recv unexpected type="
+                << (int)msg.type << " " << *getSocket();
+            break;
+        }
+        Call* call = take(msg.id);
+        if(!call) {
+            // 已经超时的调用
+            continue;
+        }
+        call->rsp->swap(msg.body);
+        Wake(call, msg.status);
+    }
+
+    std::unordered_map<uint32_t, Call*> calls;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_closed = true;
+        calls.swap(m_calls);
+    }
+    m_session->shutdown();
+    for(auto& i : calls) {
+        Wake(i.second, (int)RpcStatus::CLOSED);
+    }
+}
+
+void RpcClient::close() {
+    m_session->shutdown();
+}
+
+size_t RpcClient::getPendingCount() {
+    MutexType::Lock lock(m_mutex);
+    return m_calls.size();
+}
+
+}
+}
@@ -0,0 +1,147 @@
+/**
+ * @file rpc_client.h
+ * @brief RPC客户端
+ * @details 一个RpcClient是一条连接，多个协程可以同时在上面调用，
+ *          请求用id区分，一个接收协程把响应交给等待它的调用协程；
+ *          每次调用的超时由IOManager的定时器负责
+ */
+#ifndef __SYLAR_RPC_CLIENT_H__
+#define __SYLAR_RPC_CLIENT_H__
+
+#include <atomic>
+#include <type_traits>
+#include <unordered_map>
+#include "../iomanager.h"
+#include "../fiber_sync.h"
+#include "../address.h"
+#include "../serialize.h"
+#include "rpc_protocol.h"
+
+namespace sylar {
+namespace rpc {
+
+/**
+ * @brief RPC客户端连接
+ */
+class RpcClient : public std::enable_shared_from_this<RpcClient> {
+public:
+    typedef std::shared_ptr<RpcClient> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 连接服务器
+     * @param[in] addr 服务器地址
+     * @param[in] timeout_ms 连接超时时间(毫秒)
+     * @param[in] iom 运行接收协程和超时定时器的IOManager
+     * @return 连接失败返回nullptr
+     */
+    static RpcClient::ptr Connect(Address::ptr addr, uint64_t timeout_ms
+                                  ,IOManager* iom = IOManager::GetThis());
+
+    /**
+     * @brief 在已连接的Socket上创建客户端并启动接收协程
+     */
+    static RpcClient::ptr Create(Socket::ptr sock, IOManager* iom = IOManager::GetThis());
+
+    ~RpcClient();
+
+    /**
+     * @brief 调用方法，挂起当前协程直到收到响应、超时或者连接关闭
+     * @param[in] method 方法名
+     * @param[in] req 请求数据
+     * @param[out] rsp 响应数据
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时
+     * @return 调用结果，RpcStatus或者方法自己的错误码
+     */
+    int call(const std::string& method, const std::string& req
+             ,std::string& rsp, uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 调用用serialize.h编解码请求和响应的方法
+     * @details 能转换成std::string的请求(包括字符串字面量)走上面的原始接口
+     */
+    template<class Req, class Rsp>
+    typename std::enable_if<!std::is_convertible<const Req&, std::string>::value, int>::type
+    call(const std::string& method, const Req& req
+             ,Rsp& rsp, uint64_t timeout_ms = ~0ull) {
+        ByteArray ba(256);
+        Serialize(ba, req);
+        std::string data(ba.getSize(), '\0');
+        ba.read(&data[0], data.size(), 0);
+        std::string out;
+        int rt = call(method, data, out, timeout_ms);
+        if(rt != (int)RpcStatus::OK) {
+            return rt;
+        }
+        ba.clear();
+        ba.write(out.c_str(), out.size());
+        ba.setPosition(0);
+        try {
+            Deserialize(ba, rsp);
+        } catch(std::exception&) {
+            return (int)RpcStatus::BAD_RESPONSE;
+        }
+        return rt;
+    }
+
+    /**
+     * @brief 关闭连接，等待中的调用返回CLOSED
+     * @details 接收协程持有RpcClient，不再使用时必须调用close
+     */
+    void close();
+
+    bool isClosed() const { return m_closed;}
+
+    /**
+     * @brief 等待响应的调用数
+     */
+    size_t getPendingCount();
+
+    Socket::ptr getSocket() const { return m_session->getSocket();}
+private:
+    /**
+     * @brief 一次调用，在调用协程的栈上
+     * @details 用事件唤醒而不是直接调度调用协程：发送请求时协程可能挂在hook的writev上，
+     *          这时被调度会打乱IO事件，set只在协程等到事件上之后才会唤醒它
+     */
+    struct Call {
+        int status;
+        std::string* rsp;
+        FiberEvent done;
+    };
+
+    RpcClient(Socket::ptr sock, IOManager* iom);
+
+    /**
+     * @brief 接收协程，把响应交给调用协程
+     */
+    void recvLoop();
+
+    /**
+     * @brief 取出等待中的调用，取到的一方负责唤醒它
+     */
+    Call* take(uint32_t id);
+
+    /**
+     * @brief 设置结果并触发call的事件，之后不能再访问call
+     */
+    static void Wake(Call* call, int status);
+
+    /**
+     * @brief 超时定时器回调
+     */
+    void onTimeout(uint32_t id);
+private:
+    RpcSession::ptr m_session;
+    IOManager* m_iom;
+    MutexType m_mutex;
+    /// 请求id -> 等待响应的调用
+    std::unordered_map<uint32_t, Call*> m_calls;
+    uint32_t m_sn;
+    std::atomic<bool> m_closed;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,276 @@
+#include "rpc_protocol.h"
+#include "../config.h"
+#include "../log.h"
+
+namespace sylar {
+namespace rpc {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<uint32_t>::ptr g_rpc_max_frame_size =
+    sylar::Config::Lookup("rpc.max_frame_size"
+                ,(uint32_t)(16 * 1024 * 1024), "rpc max frame size");
+
+// 每个帧收发都要检查，按线程缓存，不每次拷贝配置值
+static uint32_t GetMaxFrameSize() {
+    static thread_local sylar::ConfigVar<uint32_t>::Cache t_max_frame_size(g_rpc_max_frame_size);
+    return t_max_frame_size.get();
+}
+
+/// 接收缓冲区内存块大小
+static const size_t RECV_BUFFER_SIZE = 16 * 1024;
+/// 发送缓冲区内存块大小
+static const size_t SEND_BUFFER_SIZE = 64 * 1024;
+
+const char* RpcStatusToString(int status) {
+    switch((RpcStatus)status) {
+#define XX(name) \
+        case RpcStatus::name: \
+            return #name;
+        XX(OK);
+        XX(NOT_FOUND);
+        XX(TIMEOUT);
+        XX(CLOSED);
+        XX(SEND_ERROR);
+        XX(BAD_REQUEST);
+        XX(BAD_RESPONSE);
+        XX(HANDLER_ERROR);
+#undef XX
+        default:
+            return "<user error>";
+    }
+}
+
+/**
+ * @brief Varint编码后的字节数
+ */
+static size_t VarintSize(uint64_t v) {
+    size_t n = 1;
+    while(v >= 0x80) {
+        v >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+RpcSession::RpcSession(Socket::ptr sock)
+    :m_sock(sock)
+    ,m_recv(RECV_BUFFER_SIZE)
+    ,m_pending(new ByteArray(SEND_BUFFER_SIZE))
+    ,m_sending(new ByteArray(SEND_BUFFER_SIZE))
+    ,m_flushing(false)
+    ,m_sendError(false) {
+    m_recvIovs.reserve(4);
+    m_sendIovs.reserve(16);
+}
+
+bool RpcSession::recvMessage(RpcMessage& msg) {
+    while(true) {
+        size_t avail = m_recv.getReadSize();
+        size_t need = 1;
+        if(avail > 0) {
+            // 先窥探长度前缀，整帧到齐之后才开始解码
+            uint8_t head[5];
+            size_t n = std::min(avail, sizeof(head));
+            m_recv.read(head, n, m_recv.getPosition());
+            uint64_t len = 0;
+            size_t hlen = 0;
+            for(size_t i = 0; i < n; ++i) {
+                len |= (uint64_t)(head[i] & 0x7f) << (7 * i);
+                if(!(head[i] & 0x80)) {
+                    hlen = i + 1;
+                    break;
+                }
+            }
+            if(hlen == 0 && n == sizeof(head)) {
+                SYLAR_LOG_ERROR(g_logger) << "rpc invalid frame length " << *m_sock;
+                return false;
+            }
+            if(hlen) {
+                if(len == 0 || len > GetMaxFrameSize()) {
+                    SYLAR_LOG_ERROR(g_logger) << "rpc invalid frame length=" << len
+                        << " " << *m_sock;
+                    return false;
+                }
+                if(avail >= hlen + len) {
+                    size_t begin = m_recv.getPosition() + hlen;
+                    size_t end = begin + len;
+                    m_recv.setPosition(begin);
+                    try {
+                        msg.type = m_recv.readFuint8();
+                        msg.id = m_recv.readUint32();
+                        if(msg.type == RpcMessage::REQUEST) {
+                            // 不用readStringVint，先检查长度再分配
+                            uint64_t mlen = m_recv.readUint64();
+                            if(mlen > end - std::min(end, m_recv.getPosition())) {
+                                throw std::out_of_range("method length");
+                            }
+                            msg.method.resize(mlen);
+                            m_recv.read(&msg.method[0], mlen);
+                            msg.timeout = m_recv.readUint32();
+                            msg.status = 0;
+                        } else if(msg.type == RpcMessage::RESPONSE) {
+                            msg.status = m_recv.readUint32();
+                            msg.timeout = 0;
+                            msg.method.clear();
+                        } else {
+                            throw std::out_of_range("type");
+                        }
+                        if(m_recv.getPosition() > end) {
+                            throw std::out_of_range("header");
+                        }
+                    } catch(std::out_of_range& e) {
+                        SYLAR_LOG_ERROR(g_logger) << "rpc invalid frame: " << e.what()
+                            << " " << *m_sock;
+                        return false;
+                    }
+                    size_t blen = end - m_recv.getPosition();
+                    msg.body.resize(blen);
+                    if(blen) {
+                        m_recv.read(&msg.body[0], blen);
+                    }
+                    return true;
+                }
+                need = hlen + len - avail;
+            }
+        }
+        if(!fill(need)) {
+            return false;
+        }
+    }
+}
+
+bool RpcSession::fill(size_t need) {
+    size_t base = m_recv.getBaseSize();
+    if(m_recv.getReadSize() == 0) {
+        // 上一帧用到了多个内存块(大body)时释放掉多余的
+        if(m_recv.getSize() > base) {
+            m_recv.clear();
+        } else {
+            m_recv.compact();
+        }
+    } else if(m_recv.getPosition() >= base) {
+        // 把不完整的帧搬到缓冲区开头，已经处理过的内存块可以复用
+        m_recv.compact();
+    }
+    // 至少把当前内存块剩余的空间读满
+    size_t len = std::max(need, base - m_recv.getSize() % base);
+    size_t pos = m_recv.getPosition();
+    m_recv.setPosition(m_recv.getSize());
+    m_recvIovs.clear();
+    m_recv.getWriteBuffers(m_recvIovs, len);
+    int rt = m_sock->recv(&m_recvIovs[0], m_recvIovs.size());
+    if(rt > 0) {
+        m_recv.setPosition(m_recv.getSize() + rt);
+    }
+    m_recv.setPosition(pos);
+    if(rt <= 0) {
+        if(rt < 0) {
+            SYLAR_LOG_DEBUG(g_logger) << "rpc recv rt=" << rt << " errno=" << errno
+                << " errstr=" << strerror(errno) << " " << *m_sock;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool RpcSession::sendRequest(uint32_t id, const std::string& method
+                             ,uint32_t timeout_ms, const std::string& body) {
+    uint64_t len = 1 + VarintSize(id) + VarintSize(method.size()) + method.size()
+                    + VarintSize(timeout_ms) + body.size();
+    if(len > GetMaxFrameSize()) {
+        SYLAR_LOG_ERROR(g_logger) << "rpc request too large method=" << method
+            << " size=" << len;
+        return false;
+    }
+    MutexType::Lock lock(m_sendMutex);
+    if(m_sendError) {
+        return false;
+    }
+    ByteArray& ba = *m_pending;
+    ba.writeUint32(len);
+    ba.writeFuint8(RpcMessage::REQUEST);
+    ba.writeUint32(id);
+    ba.writeStringVint(method);
+    ba.writeUint32(timeout_ms);
+    ba.write(body.c_str(), body.size());
+    if(m_flushing) {
+        return true;
+    }
+    return flush(lock);
+}
+
+bool RpcSession::sendResponse(uint32_t id, uint32_t status, const std::string& body) {
+    uint64_t len = 1 + VarintSize(id) + VarintSize(status) + body.size();
+    if(len > GetMaxFrameSize()) {
+        SYLAR_LOG_ERROR(g_logger) << "rpc response too large id=" << id
+            << " size=" << len;
+        // 让调用方尽快拿到错误，而不是等到超时
+        return sendResponse(id, (uint32_t)RpcStatus::HANDLER_ERROR, "");
+    }
+    MutexType::Lock lock(m_sendMutex);
+    if(m_sendError) {
+        return false;
+    }
+    ByteArray& ba = *m_pending;
+    ba.writeUint32(len);
+    ba.writeFuint8(RpcMessage::RESPONSE);
+    ba.writeUint32(id);
+    ba.writeUint32(status);
+    ba.write(body.c_str(), body.size());
+    if(m_flushing) {
+        return true;
+    }
+    return flush(lock);
+}
+
+bool RpcSession::flush(MutexType::Lock& lock) {
+    m_flushing = true;
+    while(!m_sendError && m_pending->getSize() > 0) {
+        m_pending.swap(m_sending);
+        lock.unlock();
+
+        m_sendIovs.clear();
+        m_sending->getReadBuffers(m_sendIovs, m_sending->getSize(), 0);
+        iovec* iov = &m_sendIovs[0];
+        size_t cnt = m_sendIovs.size();
+        bool ok = true;
+        while(cnt > 0) {
+            // 对端已经关闭时返回EPIPE，不产生SIGPIPE
+            int rt = m_sock->send(iov, cnt, MSG_NOSIGNAL);
+            if(rt <= 0) {
+                SYLAR_LOG_DEBUG(g_logger) << "rpc send rt=" << rt << " errno=" << errno
+                    << " errstr=" << strerror(errno) << " " << *m_sock;
+                ok = false;
+                break;
+            }
+            size_t n = rt;
+            while(cnt > 0 && n >= iov->iov_len) {
+                n -= iov->iov_len;
+                ++iov;
+                --cnt;
+            }
+            if(cnt > 0) {
+                iov->iov_base = (char*)iov->iov_base + n;
+                iov->iov_len -= n;
+            }
+        }
+        m_sending->clear();
+
+        lock.lock();
+        if(!ok) {
+            m_sendError = true;
+        }
+    }
+    m_flushing = false;
+    return !m_sendError;
+}
+
+void RpcSession::shutdown() {
+    if(m_sock->isConnected()) {
+        ::shutdown(m_sock->getSocket(), SHUT_RDWR);
+    }
+}
+
+}
+}
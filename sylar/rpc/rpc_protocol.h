@@ -0,0 +1,157 @@
+/**
+ * @file rpc_protocol.h
+ * @brief 长度前缀的二进制RPC协议
+ * @details 一个连接上可以同时有多个未完成的请求，响应用请求id对应回请求。
+ *          帧格式(整数都是ByteArray的Varint编码):
+ *          <pre>
+ *          uint32  len         后面的字节数
+ *          uint8   type        1请求 2响应
+ *          uint32  id          请求id
+ *          请求:  string method (writeStringVint)
+ *                 uint32 timeout_ms  调用方的剩余超时时间，0表示不限
+ *          响应:  uint32 status      RpcStatus或者方法自己的错误码
+ *          bytes   body        帧的剩余部分
+ *          </pre>
+ */
+#ifndef __SYLAR_RPC_PROTOCOL_H__
+#define __SYLAR_RPC_PROTOCOL_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "../bytearray.h"
+#include "../socket.h"
+#include "../mutex.h"
+
+namespace sylar {
+namespace rpc {
+
+/**
+ * @brief 框架定义的调用结果，方法自己的错误码建议从100开始
+ */
+enum class RpcStatus {
+    /// 成功
+    OK = 0,
+    /// 方法不存在
+    NOT_FOUND = 1,
+    /// 超时
+    TIMEOUT = 2,
+    /// 连接已经关闭
+    CLOSED = 3,
+    /// 发送请求失败
+    SEND_ERROR = 4,
+    /// 请求无法解码
+    BAD_REQUEST = 5,
+    /// 响应无法解码
+    BAD_RESPONSE = 6,
+    /// 方法抛出了异常
+    HANDLER_ERROR = 7,
+};
+
+/**
+ * @brief 调用结果的描述
+ */
+const char* RpcStatusToString(int status);
+
+/**
+ * @brief 收到的一帧消息
+ */
+struct RpcMessage {
+    typedef std::shared_ptr<RpcMessage> ptr;
+
+    enum Type {
+        REQUEST = 1,
+        RESPONSE = 2,
+    };
+
+    /// 消息类型
+    uint8_t type = 0;
+    /// 请求id
+    uint32_t id = 0;
+    /// 响应的调用结果
+    uint32_t status = 0;
+    /// 请求的剩余超时时间(毫秒)，0表示不限
+    uint32_t timeout = 0;
+    /// 请求的方法名
+    std::string method;
+    /// 请求/响应的数据
+    std::string body;
+};
+
+/**
+ * @brief 一个RPC连接上的收发
+ * @details recvMessage只能由一个协程调用；sendRequest/sendResponse可以被多个协程同时调用，
+ *          正在发送时后来的消息先攒在缓冲区里，由正在发送的协程一起发出去(合并成一次writev)
+ */
+class RpcSession {
+public:
+    typedef std::shared_ptr<RpcSession> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 构造函数
+     * @param[in] sock 已连接的Socket
+     */
+    RpcSession(Socket::ptr sock);
+
+    /**
+     * @brief 接收一条消息
+     * @return 连接关闭、出错或者帧格式错误时返回false
+     */
+    bool recvMessage(RpcMessage& msg);
+
+    /**
+     * @brief 发送请求
+     * @return 连接已经出错时返回false
+     */
+    bool sendRequest(uint32_t id, const std::string& method
+                     ,uint32_t timeout_ms, const std::string& body);
+
+    /**
+     * @brief 发送响应
+     */
+    bool sendResponse(uint32_t id, uint32_t status, const std::string& body);
+
+    /**
+     * @brief 关闭连接的读写，阻塞在recvMessage的协程会返回false
+     * @details 只做shutdown，fd在Socket析构时才关闭，
+     *          这样别的协程还在发送时不会写到被复用的fd上
+     */
+    void shutdown();
+
+    Socket::ptr getSocket() const { return m_sock;}
+private:
+    /**
+     * @brief 把缓冲区里的消息发出去，同一时间只有一个协程在发
+     * @param[in] lock 调用方持有的m_sendMutex
+     */
+    bool flush(MutexType::Lock& lock);
+
+    /**
+     * @brief 接收数据追加到m_recv
+     * @param[in] need 还需要的字节数
+     */
+    bool fill(size_t need);
+private:
+    Socket::ptr m_sock;
+    /// 接收缓冲区
+    ByteArray m_recv;
+    std::vector<iovec> m_recvIovs;
+
+    MutexType m_sendMutex;
+    /// 等待发送的消息
+    ByteArray::ptr m_pending;
+    /// 正在发送的消息
+    ByteArray::ptr m_sending;
+    std::vector<iovec> m_sendIovs;
+    /// 是否有协程正在发送
+    bool m_flushing;
+    /// 发送出过错
+    bool m_sendError;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include "rpc_server.h"
+#include "../config.h"
+#include "../fiber_sync.h"
+#include "../log.h"
+
+namespace sylar {
+namespace rpc {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<uint32_t>::ptr g_rpc_server_max_inflight =
+    sylar::Config::Lookup("rpc.server.max_inflight"
+                ,(uint32_t)1024, "rpc server max inflight requests per connection");
+
+RpcServer::RpcServer(sylar::IOManager* io_worker
+                     ,sylar::IOManager* accept_worker)
+    :TcpServer(io_worker, accept_worker) {
+}
+
+void RpcServer::registerMethod(const std::string& name, Method method) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_methods[name] = method;
+}
+
+void RpcServer::delMethod(const std::string& name) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_methods.erase(name);
+}
+
+RpcServer::Method RpcServer::getMethod(const std::string& name) {
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_methods.find(name);
+    return it == m_methods.end() ? nullptr : it->second;
+}
+
+void RpcServer::handleClient(Socket::ptr client) {
+    SYLAR_LOG_DEBUG(g_logger) << "handleClient " << *client;
+    RpcSession::ptr session(new RpcSession(client));
+    // 限制一个连接上同时执行的请求数，满了之后不再读新请求，由TCP把压力传回客户端
+    std::shared_ptr<FiberTimedSemaphore> inflight(
+            new FiberTimedSemaphore(g_rpc_server_max_inflight->getValue()));
+    // 返回后连接会被关闭，fd可能被复用，必须等执行中的请求都发完响应
+    std::shared_ptr<FiberWaitGroup> running(new FiberWaitGroup);
+    IOManager* iom = IOManager::GetThis();
+    while(!m_isStop) {
+        RpcMessage::ptr req(new RpcMessage);
+        if(!session->recvMessage(*req)) {
+            break;
+        }
+        if(req->type != RpcMessage::REQUEST) {
+            SYLAR_LOG_ERROR(g_logger) << "rpc server recv unexpected type="
+                << (int)req->type << " " << *client;
+            break;
+        }
+        uint64_t now = sylar::GetCurrentMS();
+        inflight->wait();
+        running->add(1);
+        iom->schedule([this, session, req, now, inflight, running]() {
+            handleRequest(session, req, now);
+            inflight->notify();
+            running->done();
+        });
+    }
+    running->wait();
+}
+
+void RpcServer::handleRequest(RpcSession::ptr session, RpcMessage::ptr req, uint64_t recv_time) {
+    std::string rsp;
+    int status = (int)RpcStatus::OK;
+    if(req->timeout && sylar::GetCurrentMS() - recv_time >= req->timeout) {
+        // 调用方已经放弃了，不再执行
+        status = (int)RpcStatus::TIMEOUT;
+    } else {
+        Method method = getMethod(req->method);
+        if(!method) {
+            status = (int)RpcStatus::NOT_FOUND;
+        } else {
+            try {
+                status = method(req->body, rsp);
+            } catch(std::exception& e) {
+                SYLAR_LOG_ERROR(g_logger) << "rpc method " << req->method
+                    << " exception: " << e.what();
+                status = (int)RpcStatus::HANDLER_ERROR;
+            }
+            if(status != (int)RpcStatus::OK) {
+                rsp.clear();
+            }
+        }
+    }
+    session->sendResponse(req->id, status, rsp);
+}
+
+}
+}
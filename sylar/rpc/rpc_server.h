@@ -0,0 +1,102 @@
+/**
+ * @file rpc_server.h
+ * @brief RPC服务器
+ * @details 每个连接一个协程负责读请求，每个请求在自己的协程里执行，
+ *          先完成的请求先响应，一个慢请求不会挡住同一连接上的其他请求
+ */
+#ifndef __SYLAR_RPC_SERVER_H__
+#define __SYLAR_RPC_SERVER_H__
+
+#include <functional>
+#include <unordered_map>
+#include "../tcp_server.h"
+#include "../serialize.h"
+#include "rpc_protocol.h"
+
+namespace sylar {
+namespace rpc {
+
+/**
+ * @brief RPC服务器
+ */
+class RpcServer : public TcpServer {
+public:
+    typedef std::shared_ptr<RpcServer> ptr;
+    typedef RWMutex RWMutexType;
+
+    /**
+     * @brief RPC方法
+     * @param[in] req 请求数据
+     * @param[out] rsp 响应数据
+     * @return 调用结果，0表示成功，方法自己的错误码建议从100开始
+     */
+    typedef std::function<int(const std::string& req, std::string& rsp)> Method;
+
+    /**
+     * @brief 构造函数
+     * @param[in] io_worker 处理连接和请求的调度器
+     * @param[in] accept_worker 接收连接调度器
+     */
+    RpcServer(sylar::IOManager* io_worker = sylar::IOManager::GetThis()
+              ,sylar::IOManager* accept_worker = sylar::IOManager::GetThis());
+
+    /**
+     * @brief 注册方法，同名的方法会被替换
+     */
+    void registerMethod(const std::string& name, Method method);
+
+    /**
+     * @brief 注册用serialize.h编解码请求和响应的方法
+     * @details 请求解码失败时返回BAD_REQUEST
+     */
+    template<class Req, class Rsp>
+    void registerMethod(const std::string& name, std::function<int(const Req&, Rsp&)> cb) {
+        registerMethod(name, [cb](const std::string& data, std::string& out) {
+            Req req;
+            Rsp rsp;
+            ByteArray ba(data.size() + 64);
+            ba.write(data.c_str(), data.size());
+            ba.setPosition(0);
+            try {
+                Deserialize(ba, req);
+            } catch(std::exception&) {
+                return (int)RpcStatus::BAD_REQUEST;
+            }
+            int rt = cb(req, rsp);
+            if(rt == 0) {
+                ba.clear();
+                Serialize(ba, rsp);
+                out.resize(ba.getSize());
+                ba.read(&out[0], out.size(), 0);
+            }
+            return rt;
+        });
+    }
+
+    /**
+     * @brief 删除方法
+     */
+    void delMethod(const std::string& name);
+
+    /**
+     * @brief 查找方法，不存在时返回nullptr
+     */
+    Method getMethod(const std::string& name);
+protected:
+    virtual void handleClient(Socket::ptr client) override;
+
+    /**
+     * @brief 执行一个请求并发送响应，在请求自己的协程里执行
+     * @param[in] recv_time 收到请求的时间(毫秒)，排队超过请求的超时时间时不再执行
+     */
+    void handleRequest(RpcSession::ptr session, RpcMessage::ptr req, uint64_t recv_time);
+private:
+    RWMutexType m_mutex;
+    /// 方法名 -> 方法
+    std::unordered_map<std::string, Method> m_methods;
+};
+
+}
+}
+
+#endif
@@ -167,7 +167,8 @@ void Scheduler::run() {
                 }
 
                 SYLAR_ASSERT(it->fiber || it->cb);
-                // 协程存在且已经在运行了
+                // 协程存在且已经在运行了(刚被唤醒，还没切出去)
+                // 不用tickle重试：切出它的线程改成HOLD以后会回到这里重新扫描
                 if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
                     ++it;
                     continue;
@@ -197,6 +198,7 @@ void Scheduler::run() {
                 schedule(ft.fiber);
             } else if(ft.fiber->getState() != Fiber::TERM
                     && ft.fiber->getState() != Fiber::EXCEPT) {
+                // 上下文已经保存，其他线程从这时起可以切进去
                 ft.fiber->m_state = Fiber::HOLD;
             }
             ft.reset();
@@ -0,0 +1,509 @@
+/**
+ * @file serialize.h
+ * @brief 基于ByteArray的编译期结构体序列化
+ * @details 用SYLAR_SERIALIZE(Struct, field1, field2...)声明结构体的字段后,
+ *          sylar::Serialize / sylar::Deserialize 会在编译期展开成针对该结构体的编解码代码.
+ *          编码格式: 先是所有定长字段(整数/浮点/bool/枚举/全部由定长字段组成的结构体)按声明顺序
+ *          紧凑排列,然后是变长字段(std::string/std::vector/std::map/含变长字段的结构体)按声明顺序排列.
+ *          定长部分的大小在编译期算出,编码时一次写入,解码时只做一次长度检查.
+ *          定长字段按ByteArray当前字节序写入,与writeFint32等保持一致;
+ *          字符串与容器长度使用Varint(writeStringVint/writeUint64).
+ */
+#ifndef __SYLAR_SERIALIZE_H__
+#define __SYLAR_SERIALIZE_H__
+
+#include <string.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <type_traits>
+#include "bytearray.h"
+#include "endian.h"
+
+namespace sylar {
+
+/**
+ * @brief 结构体的字段描述,由SYLAR_SERIALIZE特化
+ */
+template<class T>
+struct Schema {
+    static const bool DEFINED = false;
+};
+
+/**
+ * @brief 类型的编解码器
+ * @details 每个特化提供:
+ *          FIXED 是否定长; SIZE 定长时的字节数,变长为0;
+ *          encode(ByteArray&, const T&) / decode(ByteArray&, T&);
+ *          定长类型另外提供 encodeFixed(char*, const T&, bool) / decodeFixed(const char*, T&, bool)
+ *          直接读写定长缓冲区,最后一个参数表示是否需要转换字节序.
+ *          不支持的类型在编译期报错
+ */
+template<class T, class Enable = void>
+struct Serializer;
+
+/**
+ * @brief 是否需要做字节序转换
+ */
+inline bool SerializeNeedSwap(const ByteArray& ba) {
+    return ba.isLittleEndian() != (SYLAR_BYTE_ORDER == SYLAR_LITTLE_ENDIAN);
+}
+
+/**
+ * @brief 定长字节的拷贝与字节序转换
+ */
+template<size_t N>
+struct SerializeBytes {
+    static void store(char* p, const void* v, bool) {
+        memcpy(p, v, N);
+    }
+    static void load(const char* p, void* v, bool) {
+        memcpy(v, p, N);
+    }
+};
+
+#define XX(len, type) \
+template<> \
+struct SerializeBytes<len> { \
+    static void store(char* p, const void* v, bool swap) { \
+        type tmp; \
+        memcpy(&tmp, v, len); \
+        if(swap) { \
+            tmp = byteswap(tmp); \
+        } \
+        memcpy(p, &tmp, len); \
+    } \
+    static void load(const char* p, void* v, bool swap) { \
+        type tmp; \
+        memcpy(&tmp, p, len); \
+        if(swap) { \
+            tmp = byteswap(tmp); \
+        } \
+        memcpy(v, &tmp, len); \
+    } \
+};
+
+XX(2, uint16_t)
+XX(4, uint32_t)
+XX(8, uint64_t)
+#undef XX
+
+/**
+ * @brief 定长类型的公共实现, Derived需提供SIZE/encodeFixed/decodeFixed
+ */
+template<class T, class Derived>
+struct FixedSerializer {
+    static const bool FIXED = true;
+
+    static void encode(ByteArray& ba, const T& v) {
+        char buf[Derived::SIZE];
+        Derived::encodeFixed(buf, v, SerializeNeedSwap(ba));
+        ba.write(buf, Derived::SIZE);
+    }
+
+    static void decode(ByteArray& ba, T& v) {
+        char buf[Derived::SIZE];
+        ba.read(buf, Derived::SIZE);
+        Derived::decodeFixed(buf, v, SerializeNeedSwap(ba));
+    }
+};
+
+/**
+ * @brief 整数/浮点数/枚举, 按内存表示定长编码
+ */
+template<class T>
+struct Serializer<T, typename std::enable_if<std::is_arithmetic<T>::value
+                                            || std::is_enum<T>::value>::type>
+    : public FixedSerializer<T, Serializer<T> > {
+    static const size_t SIZE = sizeof(T);
+
+    static void encodeFixed(char* p, const T& v, bool swap) {
+        SerializeBytes<sizeof(T)>::store(p, &v, swap);
+    }
+
+    static void decodeFixed(const char* p, T& v, bool swap) {
+        SerializeBytes<sizeof(T)>::load(p, &v, swap);
+    }
+};
+
+/**
+ * @brief bool, 1字节0/1
+ * @details 不能把收到的字节直接拷进bool(0/1以外的值是未定义行为), 非0都当作true
+ */
+template<>
+struct Serializer<bool> : public FixedSerializer<bool, Serializer<bool> > {
+    static const size_t SIZE = 1;
+
+    static void encodeFixed(char* p, const bool& v, bool) {
+        *p = v ? 1 : 0;
+    }
+
+    static void decodeFixed(const char* p, bool& v, bool) {
+        v = *(const uint8_t*)p != 0;
+    }
+};
+
+/**
+ * @brief std::string, Varint长度 + 内容
+ */
+template<>
+struct Serializer<std::string> {
+    static const bool FIXED = false;
+    static const size_t SIZE = 0;
+
+    static void encode(ByteArray& ba, const std::string& v) {
+        ba.writeStringVint(v);
+    }
+
+    static void decode(ByteArray& ba, std::string& v) {
+        uint64_t len = ba.readUint64();
+        if(len > ba.getReadSize()) {
+            throw std::out_of_range("not enough len");
+        }
+        v.resize(len);
+        if(len) {
+            ba.read(&v[0], len);
+        }
+    }
+};
+
+/**
+ * @brief 容器元素的批量编解码, 定长元素攒到栈上缓冲区后整块读写
+ */
+template<class T, bool Fixed = Serializer<T>::FIXED>
+struct SerializeElements {
+    template<class Iter>
+    static void encode(ByteArray& ba, Iter it, size_t count) {
+        for(size_t i = 0; i < count; ++i, ++it) {
+            Serializer<T>::encode(ba, *it);
+        }
+    }
+
+    static void decode(ByteArray& ba, T* out, size_t count) {
+        // 每个变长元素至少占1字节,先挡住伪造的超大数量
+        if(count > ba.getReadSize()) {
+            throw std::out_of_range("not enough len");
+        }
+        for(size_t i = 0; i < count; ++i) {
+            Serializer<T>::decode(ba, out[i]);
+        }
+    }
+};
+
+template<class T>
+struct SerializeElements<T, true> {
+    static const size_t BUFFER_SIZE = 4096;
+    static const size_t BATCH = BUFFER_SIZE / Serializer<T>::SIZE
+                                    ? BUFFER_SIZE / Serializer<T>::SIZE : 1;
+
+    template<class Iter>
+    static void encode(ByteArray& ba, Iter it, size_t count) {
+        char buf[BATCH * Serializer<T>::SIZE];
+        bool swap = SerializeNeedSwap(ba);
+        while(count > 0) {
+            size_t n = count < BATCH ? count : (size_t)BATCH;
+            for(size_t i = 0; i < n; ++i, ++it) {
+                Serializer<T>::encodeFixed(buf + i * Serializer<T>::SIZE, *it, swap);
+            }
+            ba.write(buf, n * Serializer<T>::SIZE);
+            count -= n;
+        }
+    }
+
+    static void decode(ByteArray& ba, T* out, size_t count) {
+        if(count > ba.getReadSize() / Serializer<T>::SIZE) {
+            throw std::out_of_range("not enough len");
+        }
+        char buf[BATCH * Serializer<T>::SIZE];
+        bool swap = SerializeNeedSwap(ba);
+        while(count > 0) {
+            size_t n = count < BATCH ? count : (size_t)BATCH;
+            ba.read(buf, n * Serializer<T>::SIZE);
+            for(size_t i = 0; i < n; ++i) {
+                Serializer<T>::decodeFixed(buf + i * Serializer<T>::SIZE, *out++, swap);
+            }
+            count -= n;
+        }
+    }
+};
+
+/**
+ * @brief std::vector, Varint数量 + 元素
+ */
+template<class T>
+struct Serializer<std::vector<T> > {
+    static const bool FIXED = false;
+    static const size_t SIZE = 0;
+
+    static void encode(ByteArray& ba, const std::vector<T>& v) {
+        ba.writeUint64(v.size());
+        SerializeElements<T>::encode(ba, v.begin(), v.size());
+    }
+
+    static void decode(ByteArray& ba, std::vector<T>& v) {
+        uint64_t count = ba.readUint64();
+        if(count > ba.getReadSize()) {
+            throw std::out_of_range("not enough len");
+        }
+        v.resize(count);
+        if(count) {
+            SerializeElements<T>::decode(ba, &v[0], count);
+        }
+    }
+};
+
+/**
+ * @brief std::map, Varint数量 + (key, value)
+ */
+template<class K, class V>
+struct Serializer<std::map<K, V> > {
+    static const bool FIXED = false;
+    static const size_t SIZE = 0;
+
+    static void encode(ByteArray& ba, const std::map<K, V>& v) {
+        ba.writeUint64(v.size());
+        for(auto& i : v) {
+            Serializer<K>::encode(ba, i.first);
+            Serializer<V>::encode(ba, i.second);
+        }
+    }
+
+    static void decode(ByteArray& ba, std::map<K, V>& v) {
+        uint64_t count = ba.readUint64();
+        if(count > ba.getReadSize()) {
+            throw std::out_of_range("not enough len");
+        }
+        v.clear();
+        for(uint64_t i = 0; i < count; ++i) {
+            K key;
+            Serializer<K>::decode(ba, key);
+            Serializer<V>::decode(ba, v[key]);
+        }
+    }
+};
+
+/**
+ * @brief 按字段访问时把定长字段写入/读出定长缓冲区
+ */
+struct SerializeFixedWriter {
+    char* ptr;
+    bool swap;
+
+    template<class F>
+    void operator()(const F& f) {
+        put(f, std::integral_constant<bool, Serializer<F>::FIXED>());
+    }
+
+    template<class F>
+    void put(const F& f, std::true_type) {
+        Serializer<F>::encodeFixed(ptr, f, swap);
+        ptr += Serializer<F>::SIZE;
+    }
+
+    template<class F>
+    void put(const F&, std::false_type) {}
+};
+
+struct SerializeFixedReader {
+    const char* ptr;
+    bool swap;
+
+    template<class F>
+    void operator()(F& f) {
+        get(f, std::integral_constant<bool, Serializer<F>::FIXED>());
+    }
+
+    template<class F>
+    void get(F& f, std::true_type) {
+        Serializer<F>::decodeFixed(ptr, f, swap);
+        ptr += Serializer<F>::SIZE;
+    }
+
+    template<class F>
+    void get(F&, std::false_type) {}
+};
+
+/**
+ * @brief 按字段访问时编解码变长字段
+ */
+struct SerializeVarWriter {
+    ByteArray& ba;
+
+    template<class F>
+    void operator()(const F& f) {
+        put(f, std::integral_constant<bool, Serializer<F>::FIXED>());
+    }
+
+    template<class F>
+    void put(const F&, std::true_type) {}
+
+    template<class F>
+    void put(const F& f, std::false_type) {
+        Serializer<F>::encode(ba, f);
+    }
+};
+
+struct SerializeVarReader {
+    ByteArray& ba;
+
+    template<class F>
+    void operator()(F& f) {
+        get(f, std::integral_constant<bool, Serializer<F>::FIXED>());
+    }
+
+    template<class F>
+    void get(F&, std::true_type) {}
+
+    template<class F>
+    void get(F& f, std::false_type) {
+        Serializer<F>::decode(ba, f);
+    }
+};
+
+/**
+ * @brief SYLAR_SERIALIZE声明过的结构体
+ */
+template<class T, bool Fixed = Schema<T>::VAR_COUNT == 0>
+struct SchemaSerializer {
+    static const bool FIXED = false;
+    static const size_t SIZE = 0;
+    /// 定长部分的大小
+    static const size_t FIXED_SIZE = Schema<T>::FIXED_SIZE;
+
+    static void encode(ByteArray& ba, const T& v) {
+        bool swap = SerializeNeedSwap(ba);
+        char buf[FIXED_SIZE ? FIXED_SIZE : 1];
+        SerializeFixedWriter fw = {buf, swap};
+        Schema<T>::visit(fw, v);
+        ba.write(buf, FIXED_SIZE);
+        SerializeVarWriter vw = {ba};
+        Schema<T>::visit(vw, v);
+    }
+
+    static void decode(ByteArray& ba, T& v) {
+        bool swap = SerializeNeedSwap(ba);
+        char buf[FIXED_SIZE ? FIXED_SIZE : 1];
+        ba.read(buf, FIXED_SIZE);
+        SerializeFixedReader fr = {buf, swap};
+        Schema<T>::visit(fr, v);
+        SerializeVarReader vr = {ba};
+        Schema<T>::visit(vr, v);
+    }
+};
+
+/**
+ * @brief 全部字段定长的结构体本身也是定长的,嵌套时直接展开到外层的定长部分
+ */
+template<class T>
+struct SchemaSerializer<T, true> : public FixedSerializer<T, SchemaSerializer<T, true> > {
+    static const size_t SIZE = Schema<T>::FIXED_SIZE;
+
+    static void encodeFixed(char* p, const T& v, bool swap) {
+        SerializeFixedWriter fw = {p, swap};
+        Schema<T>::visit(fw, v);
+    }
+
+    static void decodeFixed(const char* p, T& v, bool swap) {
+        SerializeFixedReader fr = {p, swap};
+        Schema<T>::visit(fr, v);
+    }
+};
+
+template<class T>
+struct Serializer<T, typename std::enable_if<Schema<T>::DEFINED>::type>
+    : public SchemaSerializer<T> {
+};
+
+/**
+ * @brief 把v编码写入ba
+ * @post ba.getPosition() 后移编码长度
+ */
+template<class T>
+void Serialize(ByteArray& ba, const T& v) {
+    Serializer<T>::encode(ba, v);
+}
+
+/**
+ * @brief 从ba解码到v
+ * @exception 数据不足时抛出 std::out_of_range
+ */
+template<class T>
+void Deserialize(ByteArray& ba, T& v) {
+    Serializer<T>::decode(ba, v);
+}
+
+}
+
+/// @cond
+#define SYLAR_SERIALIZE_NARG(...) \
+    SYLAR_SERIALIZE_NARG_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define SYLAR_SERIALIZE_NARG_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define SYLAR_SERIALIZE_CAT(a, b) SYLAR_SERIALIZE_CAT_(a, b)
+#define SYLAR_SERIALIZE_CAT_(a, b) a##b
+#define SYLAR_SERIALIZE_FOR_EACH(M, S, ...) \
+    SYLAR_SERIALIZE_CAT(SYLAR_SERIALIZE_EACH_, SYLAR_SERIALIZE_NARG(__VA_ARGS__))(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_1(M, S, f) M(S, f)
+#define SYLAR_SERIALIZE_EACH_2(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_1(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_3(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_2(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_4(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_3(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_5(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_4(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_6(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_5(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_7(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_6(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_8(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_7(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_9(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_8(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_10(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_9(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_11(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_10(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_12(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_11(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_13(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_12(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_14(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_13(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_15(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_14(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_16(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_15(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_17(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_16(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_18(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_17(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_19(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_18(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_20(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_19(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_21(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_20(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_22(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_21(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_23(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_22(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_24(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_23(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_25(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_24(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_26(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_25(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_27(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_26(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_28(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_27(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_29(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_28(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_30(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_29(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_31(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_30(M, S, __VA_ARGS__)
+#define SYLAR_SERIALIZE_EACH_32(M, S, f, ...) M(S, f) SYLAR_SERIALIZE_EACH_31(M, S, __VA_ARGS__)
+
+#define SYLAR_SERIALIZE_VISIT(S, f) v(s.f);
+#define SYLAR_SERIALIZE_FIELD_SIZE(S, f) + ::sylar::Serializer<decltype(S::f)>::SIZE
+#define SYLAR_SERIALIZE_VAR_COUNT(S, f) + (::sylar::Serializer<decltype(S::f)>::FIXED ? 0 : 1)
+/// @endcond
+
+/**
+ * @brief 声明结构体参与序列化的字段(最多32个)
+ * @details 需在全局命名空间使用, Struct写全名, 字段需可公开访问. 例:
+ *          SYLAR_SERIALIZE(ns::Foo, id, name, tags)
+ */
+#define SYLAR_SERIALIZE(Struct, ...) \
+namespace sylar { \
+template<> \
+struct Schema<Struct> { \
+    static const bool DEFINED = true; \
+    static const size_t FIXED_SIZE = 0 \
+        SYLAR_SERIALIZE_FOR_EACH(SYLAR_SERIALIZE_FIELD_SIZE, Struct, __VA_ARGS__); \
+    static const size_t VAR_COUNT = 0 \
+        SYLAR_SERIALIZE_FOR_EACH(SYLAR_SERIALIZE_VAR_COUNT, Struct, __VA_ARGS__); \
+    template<class V> \
+    static void visit(V& v, const Struct& s) { \
+        SYLAR_SERIALIZE_FOR_EACH(SYLAR_SERIALIZE_VISIT, Struct, __VA_ARGS__) \
+    } \
+    template<class V> \
+    static void visit(V& v, Struct& s) { \
+        SYLAR_SERIALIZE_FOR_EACH(SYLAR_SERIALIZE_VISIT, Struct, __VA_ARGS__) \
+    } \
+}; \
+}
+
+#endif
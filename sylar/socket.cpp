@@ -4,13 +4,29 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
+#include "mutex.h"
 #include <limits.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sstream>
+#include <map>
+#include <unordered_map>
 
 namespace sylar {
 
 // static把g_logger限制在本文件中
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+/**
+ * 协程切换回来时可能换了线程，errno放到不内联的函数里设置(同hook.cpp)
+ */
+static void __attribute__((noinline)) set_errno(int v) {
+    errno = v;
+}
+
 Socket::ptr Socket::CreateTCP(sylar::Address::ptr address) {
     Socket::ptr sock(new Socket(address->getFamily(), TCP, 0));
     return sock;
@@ -120,6 +136,11 @@ Socket::ptr Socket::accept() {
     Socket::ptr cli_sock(new Socket(m_family, m_type, m_protocol));
     int newsock = ::accept(m_sock, nullptr, nullptr);
     if(newsock == -1) {
+        if(m_sock == -1) {
+            // 等待期间被其他协程close(停止服务)，不算错误
+            SYLAR_LOG_DEBUG(g_logger) << "accept on closed socket";
+            return nullptr;
+        }
         SYLAR_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno="
             << errno << " errstr=" << strerror(errno);
         return nullptr;
@@ -329,6 +350,188 @@ int Socket::recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags
     return -1;
 }
 
+bool Socket::waitEvent(uint32_t event, uint64_t timeout_ms) {
+    IOManager* iom = IOManager::GetThis();
+    if(!iom) {
+        pollfd pfd;
+        pfd.fd = m_sock;
+        pfd.events = event == IOManager::READ ? POLLIN : POLLOUT;
+        pfd.revents = 0;
+        int rt = ::poll(&pfd, 1, timeout_ms == (uint64_t)-1 ? -1 : (int)timeout_ms);
+        if(rt == 0) {
+            set_errno(ETIMEDOUT);
+        }
+        return rt > 0;
+    }
+
+    int fd = m_sock;
+    std::shared_ptr<int> cancelled;
+    Timer::ptr timer;
+    if(timeout_ms != (uint64_t)-1) {
+        cancelled.reset(new int(0));
+        std::weak_ptr<int> wcancelled(cancelled);
+        timer = iom->addConditionTimer(timeout_ms, [wcancelled, fd, iom, event]() {
+            auto t = wcancelled.lock();
+            if(!t || *t) {
+                return;
+            }
+            *t = ETIMEDOUT;
+            iom->cancelEvent(fd, (IOManager::Event)event);
+        }, wcancelled);
+    }
+    if(iom->addEvent(fd, (IOManager::Event)event)) {
+        SYLAR_LOG_ERROR(g_logger) << "Socket addEvent(" << fd << ", "
+            << event << ") error";
+        if(timer) {
+            timer->cancel();
+        }
+        return false;
+    }
+    Fiber::YieldToHold();
+    if(timer) {
+        timer->cancel();
+    }
+    if(cancelled && *cancelled) {
+        set_errno(*cancelled);
+        return false;
+    }
+    return true;
+}
+
+int64_t Socket::sendFile(int fd, off_t offset, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    uint64_t timeout_ms = getSendTimeout();
+    int64_t total = 0;
+    while(length > 0) {
+        // 单次sendfile最多传0x7ffff000字节
+        ssize_t n = ::sendfile(m_sock, fd, &offset, std::min(length, (size_t)0x7ffff000));
+        if(n > 0) {
+            total += n;
+            length -= n;
+            continue;
+        }
+        if(n == 0) {
+            // 文件读到结尾
+            break;
+        }
+        if(errno == EINTR) {
+            continue;
+        }
+        if(errno == EAGAIN) {
+            if(waitEvent(IOManager::WRITE, timeout_ms)) {
+                continue;
+            }
+        } else {
+            SYLAR_LOG_ERROR(g_logger) << "sendfile(" << m_sock << ", " << fd
+                << ", " << offset << ") errno=" << errno << " errstr=" << strerror(errno);
+        }
+        return total > 0 ? total : -1;
+    }
+    return total;
+}
+
+int64_t Socket::splice(Socket::ptr from, size_t length) {
+    if(!isConnected() || !from->isConnected()) {
+        return -1;
+    }
+    if(dynamic_cast<SSLSocket*>(this) || dynamic_cast<SSLSocket*>(from.get())) {
+        // SSL的数据要在用户态加解密，只能拷贝
+        std::vector<char> buf(64 * 1024);
+        int64_t total = 0;
+        while((size_t)total < length) {
+            int n = from->recv(&buf[0], std::min(length - total, buf.size()));
+            if(n <= 0) {
+                return total > 0 ? total : n;
+            }
+            for(int off = 0; off < n;) {
+                int rt = send(&buf[off], n - off, MSG_NOSIGNAL);
+                if(rt <= 0) {
+                    // 读出的数据没发完，from里的流已经缺了一段
+                    return -1;
+                }
+                off += rt;
+                total += rt;
+            }
+        }
+        return total;
+    }
+
+    int pfd[2];
+    if(pipe2(pfd, O_NONBLOCK | O_CLOEXEC)) {
+        SYLAR_LOG_ERROR(g_logger) << "pipe2 errno=" << errno << " errstr=" << strerror(errno);
+        return -1;
+    }
+    // 管道默认64K，调大可以减少splice次数，失败了就用默认大小
+    int pipe_size = fcntl(pfd[1], F_SETPIPE_SZ, 1024 * 1024);
+    if(pipe_size <= 0) {
+        pipe_size = 64 * 1024;
+    }
+    uint64_t recv_timeout = from->getRecvTimeout();
+    uint64_t send_timeout = getSendTimeout();
+    int64_t total = 0;
+    size_t in_pipe = 0;
+    bool error = false;
+    while(true) {
+        if(in_pipe == 0) {
+            if((size_t)total >= length) {
+                break;
+            }
+            ssize_t n = ::splice(from->m_sock, nullptr, pfd[1], nullptr
+                            ,std::min(length - total, (size_t)pipe_size)
+                            ,SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(n > 0) {
+                in_pipe = n;
+            } else if(n == 0) {
+                // from的对端关闭
+                break;
+            } else if(errno == EINTR) {
+                continue;
+            } else if(errno == EAGAIN) {
+                if(!from->waitEvent(IOManager::READ, recv_timeout)) {
+                    error = true;
+                    break;
+                }
+                continue;
+            } else {
+                SYLAR_LOG_ERROR(g_logger) << "splice(" << from->m_sock << ", pipe) errno="
+                    << errno << " errstr=" << strerror(errno);
+                error = true;
+                break;
+            }
+        }
+        ssize_t n = ::splice(pfd[0], nullptr, m_sock, nullptr, in_pipe
+                        ,SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n > 0) {
+            in_pipe -= n;
+            total += n;
+        } else if(n < 0 && errno == EINTR) {
+            continue;
+        } else if(n < 0 && errno == EAGAIN) {
+            if(!waitEvent(IOManager::WRITE, send_timeout)) {
+                error = true;
+                break;
+            }
+        } else {
+            SYLAR_LOG_ERROR(g_logger) << "splice(pipe, " << m_sock << ") errno="
+                << errno << " errstr=" << strerror(errno);
+            error = true;
+            break;
+        }
+    }
+    // 保留出错时的errno
+    int err = errno;
+    ::close(pfd[0]);
+    ::close(pfd[1]);
+    // 管道里剩下的已经从from读出，关掉管道就丢了，不能当成正常的短转发
+    if(error && (total == 0 || in_pipe != 0)) {
+        errno = err;
+        return -1;
+    }
+    return total;
+}
+
 Address::ptr Socket::getRemoteAddress() {
     if(m_remoteAddress) {
         return m_remoteAddress;
@@ -434,6 +637,17 @@ std::string Socket::toString() const {
     return ss.str();
 }
 
+bool Socket::setReusePort(bool v) {
+    if(!isValid()) {
+        newSock();
+        if(SYLAR_UNLIKELY(!isValid())) {
+            return false;
+        }
+    }
+    int val = v ? 1 : 0;
+    return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 bool Socket::cancelRead() {
     return IOManager::GetThis()->cancelEvent(m_sock, sylar::IOManager::READ);
 }
@@ -482,10 +696,233 @@ struct _SSLInit {
 
 static _SSLInit s_init;
 
+static sylar::ConfigVar<uint32_t>::ptr g_ssl_session_cache_size =
+    sylar::Config::Lookup("ssl.session_cache_size", (uint32_t)20480, "ssl session cache size");
+
+static sylar::ConfigVar<uint32_t>::ptr g_ssl_session_timeout =
+    sylar::Config::Lookup("ssl.session_timeout", (uint32_t)300, "ssl session timeout(s)");
+
+static sylar::ConfigVar<uint32_t>::ptr g_ssl_handshake_timeout =
+    sylar::Config::Lookup("ssl.handshake_timeout", (uint32_t)10000, "ssl handshake timeout(ms)");
+
+static sylar::ConfigVar<bool>::ptr g_ssl_ktls =
+    sylar::Config::Lookup("ssl.ktls", true, "enable kernel tls offload");
+
+/**
+ * 让OpenSSL在握手完成后打开kTLS(setsockopt TCP_ULP "tls")，
+ * 内核或加密套件不支持时OpenSSL照常在用户态加密
+ */
+static void enable_ktls(SSL_CTX* ctx) {
+#ifdef SSL_OP_ENABLE_KTLS
+    if(g_ssl_ktls->getValue()) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+}
+
+/**
+ * 客户端会话缓存，远端地址 -> 最近一次拿到的会话
+ */
+struct _SSLSessionCache {
+    ~_SSLSessionCache() {
+        clear();
+    }
+
+    /// 返回的会话已经加了引用计数，用完要SSL_SESSION_free
+    SSL_SESSION* get(const std::string& key) {
+        Mutex::Lock lock(mutex);
+        auto it = sessions.find(key);
+        if(it == sessions.end()) {
+            return nullptr;
+        }
+        SSL_SESSION_up_ref(it->second);
+        return it->second;
+    }
+
+    /// 接管session的引用计数
+    void put(const std::string& key, SSL_SESSION* session) {
+        Mutex::Lock lock(mutex);
+        auto it = sessions.find(key);
+        if(it != sessions.end()) {
+            SSL_SESSION_free(it->second);
+            it->second = session;
+            return;
+        }
+        if(sessions.size() >= g_ssl_session_cache_size->getValue()
+                && !sessions.empty()) {
+            // 满了随便丢一个，只影响那个地址下次多一次完整握手
+            SSL_SESSION_free(sessions.begin()->second);
+            sessions.erase(sessions.begin());
+        }
+        sessions[key] = session;
+    }
+
+    void clear() {
+        Mutex::Lock lock(mutex);
+        for(auto& i : sessions) {
+            SSL_SESSION_free(i.second);
+        }
+        sessions.clear();
+    }
+
+    size_t size() {
+        Mutex::Lock lock(mutex);
+        return sessions.size();
+    }
+
+    Mutex mutex;
+    std::unordered_map<std::string, SSL_SESSION*> sessions;
+};
+
+static _SSLSessionCache& GetSessionCache() {
+    static _SSLSessionCache s_cache;
+    return s_cache;
+}
+
+/**
+ * 服务端上下文，证书文件+私钥文件 -> SSL_CTX
+ * stamp记录创建时两个文件的inode/大小/修改时间，证书轮换(覆盖或者rename)后
+ * 下一次loadCertificates会重新加载，已经建立的连接继续用旧的SSL_CTX
+ */
+struct _SSLServerContexts {
+    struct Entry {
+        std::string stamp;
+        std::shared_ptr<SSL_CTX> ctx;
+    };
+    Mutex mutex;
+    std::map<std::string, Entry> ctxs;
+};
+
+static bool file_stamp(const std::string& path, std::string& stamp) {
+    struct stat st;
+    if(::stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << st.st_dev << ':' << st.st_ino << ':' << st.st_size << ':'
+       << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec << ';';
+    stamp += ss.str();
+    return true;
+}
+
+static _SSLServerContexts& GetServerContexts() {
+    static _SSLServerContexts s_ctxs;
+    return s_ctxs;
+}
+
 }
 
 SSLSocket::SSLSocket(int family, int type, int protocol)
-    :Socket(family, type, protocol) {
+    :Socket(family, type, protocol)
+    ,m_sessionReuse(true) {
+}
+
+SSLSocket::~SSLSocket() {
+    close();
+}
+
+std::shared_ptr<SSL_CTX> SSLSocket::GetClientContext() {
+    static std::shared_ptr<SSL_CTX> s_ctx = []() {
+        std::shared_ptr<SSL_CTX> ctx(SSL_CTX_new(SSLv23_client_method()), SSL_CTX_free);
+        // 会话存在自己的缓存里，按远端地址查找
+        SSL_CTX_set_session_cache_mode(ctx.get(), SSL_SESS_CACHE_CLIENT
+                | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx.get(), &SSLSocket::OnNewSession);
+        // 一次read尽量多读几条记录，不用先读5字节头再读记录体
+        SSL_CTX_set_read_ahead(ctx.get(), 1);
+        enable_ktls(ctx.get());
+        return ctx;
+    }();
+    return s_ctx;
+}
+
+int SSLSocket::OnNewSession(SSL* ssl, SSL_SESSION* session) {
+    SSLSocket* sock = (SSLSocket*)SSL_get_app_data(ssl);
+    if(!sock || sock->m_sessionKey.empty()) {
+        return 0;
+    }
+    GetSessionCache().put(sock->m_sessionKey, session);
+    return 1;
+}
+
+void SSLSocket::ClearSessionCache() {
+    GetSessionCache().clear();
+}
+
+size_t SSLSocket::GetSessionCacheSize() {
+    return GetSessionCache().size();
+}
+
+bool SSLSocket::isSessionReused() const {
+    return m_ssl && SSL_session_reused(m_ssl.get());
+}
+
+void SSLSocket::newSSL() {
+    m_ssl.reset(SSL_new(m_ctx.get()),  SSL_free);
+    SSL_set_fd(m_ssl.get(), m_sock);
+    // 让OpenSSL直接看到EAGAIN，等待由doSSL负责，
+    // 不在BIO的read/write里切协程(OpenSSL的错误队列是按线程的)
+    FdCtx::ptr ctx = FdMgr::GetInstance().get(m_sock);
+    if(ctx) {
+        ctx->setUserNonblock(true);
+    }
+}
+
+template<class Op>
+int SSLSocket::doSSL(Op op, uint64_t timeout_ms) {
+    uint64_t deadline = timeout_ms == (uint64_t)-1 ? (uint64_t)-1
+                        : GetCurrentMS() + timeout_ms;
+    while(true) {
+        ERR_clear_error();
+        int rt = op(m_ssl.get());
+        if(rt > 0) {
+            return rt;
+        }
+        uint32_t event = 0;
+        int err = SSL_get_error(m_ssl.get(), rt);
+        if(err == SSL_ERROR_WANT_READ) {
+            event = IOManager::READ;
+        } else if(err == SSL_ERROR_WANT_WRITE) {
+            event = IOManager::WRITE;
+        } else if(err == SSL_ERROR_ZERO_RETURN) {
+            // 对端发了close_notify，正常关闭
+            return 0;
+        } else {
+            // 没收到close_notify就断开(数据可能被截断)也是错误，
+            // OpenSSL 3报SSL_R_UNEXPECTED_EOF_WHILE_READING，1.1.1报errno为0的SSL_ERROR_SYSCALL
+            bool eof = err == SSL_ERROR_SYSCALL && errno == 0;
+#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+            eof = eof || (err == SSL_ERROR_SSL
+                    && ERR_GET_REASON(ERR_peek_error()) == SSL_R_UNEXPECTED_EOF_WHILE_READING);
+#endif
+            if(eof) {
+                set_errno(ECONNRESET);
+            } else if(err != SSL_ERROR_SYSCALL) {
+                set_errno(EPROTO);
+            }
+            return -1;
+        }
+        uint64_t to = (uint64_t)-1;
+        if(deadline != (uint64_t)-1) {
+            uint64_t now = GetCurrentMS();
+            if(now >= deadline) {
+                set_errno(ETIMEDOUT);
+                return -1;
+            }
+            to = deadline - now;
+        }
+        if(!waitEvent(event, to)) {
+            return -1;
+        }
+    }
+}
+
+uint64_t SSLSocket::getIOTimeout(int type) {
+    uint64_t to = type == SO_RCVTIMEO ? getRecvTimeout() : getSendTimeout();
+    if(!SSL_is_init_finished(m_ssl.get())) {
+        to = std::min(to, (uint64_t)g_ssl_handshake_timeout->getValue());
+    }
+    return to;
 }
 
 Socket::ptr SSLSocket::accept() {
@@ -510,10 +947,21 @@ bool SSLSocket::bind(const Address::ptr addr) {
 bool SSLSocket::connect(const Address::ptr addr, uint64_t timeout_ms) {
     bool v = Socket::connect(addr, timeout_ms);
     if(v) {
-        m_ctx.reset(SSL_CTX_new(SSLv23_client_method()), SSL_CTX_free);
-        m_ssl.reset(SSL_new(m_ctx.get()),  SSL_free);
-        SSL_set_fd(m_ssl.get(), m_sock);
-        v = (SSL_connect(m_ssl.get()) == 1);
+        m_ctx = GetClientContext();
+        newSSL();
+        SSL_set_app_data(m_ssl.get(), this);
+        if(m_sessionReuse) {
+            m_sessionKey = addr->toString();
+            SSL_SESSION* session = GetSessionCache().get(m_sessionKey);
+            if(session) {
+                SSL_set_session(m_ssl.get(), session);
+                SSL_SESSION_free(session);
+            }
+        }
+        if(timeout_ms == (uint64_t)-1) {
+            timeout_ms = g_ssl_handshake_timeout->getValue();
+        }
+        v = (doSSL(SSL_connect, timeout_ms) == 1);
     }
     return v;
 }
@@ -523,12 +971,26 @@ bool SSLSocket::listen(int backlog) {
 }
 
 bool SSLSocket::close() {
+    // close会被调用多次(session、server、析构各一次)，只在fd还没关时发一次close_notify；
+    // 再次SSL_shutdown会去读对端的close_notify，BIO里的fd号可能已经属于别的连接
+    if(m_ssl && m_sock != -1 && SSL_is_init_finished(m_ssl.get())
+            && !(SSL_get_shutdown(m_ssl.get()) & SSL_SENT_SHUTDOWN)) {
+        // 发一次close_notify，不等对端回应；发送缓冲区满或者对端已经关闭时直接放弃。
+        // 调用过SSL_shutdown的会话在SSL_free时不会被当成坏会话，还能复用
+        ERR_clear_error();
+        SSL_shutdown(m_ssl.get());
+        ERR_clear_error();
+        // 之后别处再调用SSL_shutdown也不做IO
+        SSL_set_quiet_shutdown(m_ssl.get(), 1);
+    }
     return Socket::close();
 }
 
 int SSLSocket::send(const void* buffer, size_t length, int flags) {
     if(m_ssl) {
-        return SSL_write(m_ssl.get(), buffer, length);
+        return doSSL([buffer, length](SSL* ssl) {
+            return SSL_write(ssl, buffer, length);
+        }, getIOTimeout(SO_SNDTIMEO));
     }
     return -1;
 }
@@ -537,16 +999,122 @@ int SSLSocket::send(const iovec* buffers, size_t length, int flags) {
     if(!m_ssl) {
         return -1;
     }
+    // 每次SSL_write至少产生一条记录，小块数据先拼成16K的整条记录再写
+    static const size_t s_record_size = SSL3_RT_MAX_PLAIN_LENGTH;
     int total = 0;
+    size_t used = 0;
+    int rt = 0;
+    uint64_t timeout_ms = getIOTimeout(SO_SNDTIMEO);
+    auto write_all = [this, &total, &rt, timeout_ms](const void* data, size_t len) {
+        rt = doSSL([data, len](SSL* ssl) {
+            return SSL_write(ssl, data, len);
+        }, timeout_ms);
+        if(rt <= 0) {
+            return false;
+        }
+        total += rt;
+        return true;
+    };
     for(size_t i = 0; i < length; ++i) {
-        int tmp = SSL_write(m_ssl.get(), buffers[i].iov_base, buffers[i].iov_len);
-        if(tmp <= 0) {
-            return tmp;
+        const char* ptr = (const char*)buffers[i].iov_base;
+        size_t left = buffers[i].iov_len;
+        while(left > 0) {
+            if(used == 0 && left >= s_record_size) {
+                // 整条记录直接写，不多拷贝一次
+                size_t n = left - left % s_record_size;
+                if(!write_all(ptr, n)) {
+                    return total > 0 ? total : rt;
+                }
+                ptr += n;
+                left -= n;
+                continue;
+            }
+            if(m_sendBuf.empty()) {
+                m_sendBuf.resize(s_record_size);
+            }
+            size_t n = std::min(left, s_record_size - used);
+            memcpy(&m_sendBuf[used], ptr, n);
+            used += n;
+            ptr += n;
+            left -= n;
+            if(used == s_record_size) {
+                if(!write_all(&m_sendBuf[0], used)) {
+                    return total > 0 ? total : rt;
+                }
+                used = 0;
+            }
         }
-        total += tmp;
-        if(tmp != (int)buffers[i].iov_len) {
+    }
+    if(used > 0 && !write_all(&m_sendBuf[0], used)) {
+        return total > 0 ? total : rt;
+    }
+    return total;
+}
+
+// kTLS相关的接口(BIO_get_ktls_*、SSL_sendfile)OpenSSL 3.0才有，
+// 和enable_ktls一样按SSL_OP_ENABLE_KTLS判断，老版本总是走用户态加密
+bool SSLSocket::isKtlsSend() const {
+#ifdef SSL_OP_ENABLE_KTLS
+    return m_ssl && BIO_get_ktls_send(SSL_get_wbio(m_ssl.get()));
+#else
+    return false;
+#endif
+}
+
+bool SSLSocket::isKtlsRecv() const {
+#ifdef SSL_OP_ENABLE_KTLS
+    return m_ssl && BIO_get_ktls_recv(SSL_get_rbio(m_ssl.get()));
+#else
+    return false;
+#endif
+}
+
+int64_t SSLSocket::sendFile(int fd, off_t offset, size_t length) {
+    if(!m_ssl) {
+        return -1;
+    }
+    uint64_t timeout_ms = getIOTimeout(SO_SNDTIMEO);
+    int64_t total = 0;
+#ifdef SSL_OP_ENABLE_KTLS
+    if(isKtlsSend()) {
+        // 内核加密，文件数据不经过用户态
+        while(length > 0) {
+            size_t n = std::min(length, (size_t)INT_MAX);
+            int rt = doSSL([fd, offset, n](SSL* ssl) {
+                return (int)SSL_sendfile(ssl, fd, offset, n, 0);
+            }, timeout_ms);
+            if(rt <= 0) {
+                return total > 0 ? total : rt;
+            }
+            total += rt;
+            offset += rt;
+            length -= rt;
+        }
+        return total;
+    }
+#endif
+
+    std::vector<char> buf(std::min(length, (size_t)64 * 1024));
+    while(length > 0) {
+        ssize_t n = ::pread(fd, &buf[0], std::min(length, buf.size()), offset);
+        if(n < 0) {
+            SYLAR_LOG_ERROR(g_logger) << "sendFile pread(" << fd << ", " << offset
+                << ") errno=" << errno << " errstr=" << strerror(errno);
+            return total > 0 ? total : -1;
+        }
+        if(n == 0) {
             break;
         }
+        const char* data = &buf[0];
+        int rt = doSSL([data, n](SSL* ssl) {
+            return SSL_write(ssl, data, n);
+        }, timeout_ms);
+        if(rt <= 0) {
+            return total > 0 ? total : rt;
+        }
+        total += rt;
+        offset += rt;
+        length -= rt;
     }
     return total;
 }
@@ -563,7 +1131,9 @@ int SSLSocket::sendTo(const iovec* buffers, size_t length, const Address::ptr to
 
 int SSLSocket::recv(void* buffer, size_t length, int flags) {
     if(m_ssl) {
-        return SSL_read(m_ssl.get(), buffer, length);
+        return doSSL([buffer, length](SSL* ssl) {
+            return SSL_read(ssl, buffer, length);
+        }, getIOTimeout(SO_RCVTIMEO));
     }
     return -1;
 }
@@ -573,13 +1143,22 @@ int SSLSocket::recv(iovec* buffers, size_t length, int flags) {
         return -1;
     }
     int total = 0;
+    uint64_t timeout_ms = getIOTimeout(SO_RCVTIMEO);
     for(size_t i = 0; i < length; ++i) {
-        int tmp = SSL_read(m_ssl.get(), buffers[i].iov_base, buffers[i].iov_len);
+        if(buffers[i].iov_len == 0) {
+            continue;
+        }
+        void* base = buffers[i].iov_base;
+        size_t len = buffers[i].iov_len;
+        int tmp = doSSL([base, len](SSL* ssl) {
+            return SSL_read(ssl, base, len);
+        }, timeout_ms);
         if(tmp <= 0) {
-            return tmp;
+            return total > 0 ? total : tmp;
         }
         total += tmp;
-        if(tmp != (int)buffers[i].iov_len) {
+        // 只有已经解密好的数据才接着填下一个iovec，不为填满iovec去等网络数据
+        if(tmp != (int)buffers[i].iov_len || SSL_pending(m_ssl.get()) <= 0) {
             break;
         }
     }
@@ -599,30 +1178,61 @@ int SSLSocket::recvFrom(iovec* buffers, size_t length, Address::ptr from, int fl
 bool SSLSocket::init(int sock) {
     bool v = Socket::init(sock);
     if(v) {
-        m_ssl.reset(SSL_new(m_ctx.get()),  SSL_free);
-        SSL_set_fd(m_ssl.get(), m_sock);
-        v = (SSL_accept(m_ssl.get()) == 1);
+        newSSL();
+        // 握手放到第一次读写时，由处理这个连接的协程完成
+        SSL_set_accept_state(m_ssl.get());
     }
     return v;
 }
 
 bool SSLSocket::loadCertificates(const std::string& cert_file, const std::string& key_file) {
-    m_ctx.reset(SSL_CTX_new(SSLv23_server_method()), SSL_CTX_free);
-    if(SSL_CTX_use_certificate_chain_file(m_ctx.get(), cert_file.c_str()) != 1) {
+    _SSLServerContexts& ctxs = GetServerContexts();
+    std::string key = cert_file + "\n" + key_file;
+    std::string stamp;
+    if(!file_stamp(cert_file, stamp) || !file_stamp(key_file, stamp)) {
+        SYLAR_LOG_ERROR(g_logger) << "loadCertificates stat cert_file=" << cert_file
+            << " key_file=" << key_file << " errno=" << errno
+            << " errstr=" << strerror(errno);
+        return false;
+    }
+    Mutex::Lock lock(ctxs.mutex);
+    auto it = ctxs.ctxs.find(key);
+    if(it != ctxs.ctxs.end() && it->second.stamp == stamp) {
+        m_ctx = it->second.ctx;
+        return true;
+    }
+    std::shared_ptr<SSL_CTX> ctx(SSL_CTX_new(SSLv23_server_method()), SSL_CTX_free);
+    if(SSL_CTX_use_certificate_chain_file(ctx.get(), cert_file.c_str()) != 1) {
         SYLAR_LOG_ERROR(g_logger) << "SSL_CTX_use_certificate_chain_file("
             << cert_file << ") error";
         return false;
     }
-    if(SSL_CTX_use_PrivateKey_file(m_ctx.get(), key_file.c_str(), SSL_FILETYPE_PEM) != 1) {
+    if(SSL_CTX_use_PrivateKey_file(ctx.get(), key_file.c_str(), SSL_FILETYPE_PEM) != 1) {
         SYLAR_LOG_ERROR(g_logger) << "SSL_CTX_use_PrivateKey_file("
             << key_file << ") error";
         return false;
     }
-    if(SSL_CTX_check_private_key(m_ctx.get()) != 1) {
+    if(SSL_CTX_check_private_key(ctx.get()) != 1) {
         SYLAR_LOG_ERROR(g_logger) << "SSL_CTX_check_private_key cert_file="
             << cert_file << " key_file=" << key_file;
         return false;
     }
+    static const unsigned char s_sid_ctx[] = "sylar";
+    SSL_CTX_set_session_id_context(ctx.get(), s_sid_ctx, sizeof(s_sid_ctx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx.get(), SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx.get(), g_ssl_session_cache_size->getValue());
+    SSL_CTX_set_timeout(ctx.get(), g_ssl_session_timeout->getValue());
+    SSL_CTX_clear_options(ctx.get(), SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    // TLS1.3默认每次握手发两个ticket，客户端只留最新的一个
+    SSL_CTX_set_num_tickets(ctx.get(), 1);
+#endif
+    SSL_CTX_set_read_ahead(ctx.get(), 1);
+    enable_ktls(ctx.get());
+    _SSLServerContexts::Entry& entry = ctxs.ctxs[key];
+    entry.stamp = stamp;
+    entry.ctx = ctx;
+    m_ctx = ctx;
     return true;
 }
 
@@ -10,6 +10,7 @@
 #define __SYLAR_SOCKET_H__
 
 #include <memory>
+#include <vector>
 #include <netinet/tcp.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -288,6 +289,27 @@ public:
      */
     virtual int recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags = 0);
 
+    /**
+     * @brief 发送文件fd从offset开始的length字节(sendfile)，数据不经过用户态
+     * @details socket写满时挂起协程等可写，超时时间同send；
+     *          对端已经关闭时会产生SIGPIPE，服务需要忽略SIGPIPE
+     * @return 发送的字节数，文件不够length字节时发到文件结尾为止；
+     *         一个字节都没有发出时返回<0
+     */
+    virtual int64_t sendFile(int fd, off_t offset, size_t length);
+
+    /**
+     * @brief 把from收到的最多length字节转发到本socket(splice经过pipe)，数据不经过用户态
+     * @details from没有数据时等可读(超时同from的recv)，本socket写满时等可写(超时同send)；
+     *          任一端是SSLSocket时退化为recv/send拷贝
+     * @param[in] from 数据来源
+     * @param[in] length 最多转发的字节数，默认转发到from的对端关闭为止
+     * @return 转发的字节数，from的对端关闭时可能少于length；
+     *         一个字节都没有转发时，对端关闭返回0，出错或超时返回<0；
+     *         已经从from读出、还没写到本socket的数据丢了时也返回<0(errno保留)，流已经不完整
+     */
+    int64_t splice(Socket::ptr from, size_t length = (size_t)-1);
+
     /**
      * @brief 获取远端地址
      */
@@ -340,6 +362,13 @@ public:
      */
     int getSocket() const { return m_sock;}
 
+    /**
+     * @brief 设置SO_REUSEPORT，必须在bind之前调用
+     * @details 多个socket可以bind同一个地址，各自listen、accept，由内核分配新连接
+     * @param[in] v 是否开启
+     */
+    bool setReusePort(bool v);
+
     /**
      * @brief 取消读
      */
@@ -374,6 +403,14 @@ protected:
      * @brief 初始化sock
      */
     virtual bool init(int sock);
+
+    /**
+     * @brief 等fd上的读/写事件，在IOManager里挂起协程，否则poll
+     * @param[in] event IOManager::READ或IOManager::WRITE
+     * @param[in] timeout_ms 超时时间，-1表示不超时
+     * @return 就绪返回true，超时(errno为ETIMEDOUT)或出错返回false
+     */
+    bool waitEvent(uint32_t event, uint64_t timeout_ms);
 protected:
     /// socket句柄
     int m_sock;
@@ -391,6 +428,22 @@ protected:
     Address::ptr m_remoteAddress;
 };
 
+/**
+ * @brief SSL Socket
+ * @details 客户端共用一个进程级的SSL_CTX，服务端按证书共用SSL_CTX，
+ *          握手前不再为每个连接新建上下文。
+ *          客户端按远端地址缓存会话(session id或session ticket)，
+ *          再次连接同一地址时走简化握手；服务端打开会话缓存和ticket。
+ *          缓存大小和超时由配置ssl.session_cache_size/ssl.session_timeout决定，
+ *          上下文创建时读取。
+ *          fd对OpenSSL是非阻塞的，SSL_*返回WANT_READ/WANT_WRITE时把协程挂到
+ *          fd的读/写事件上，醒来后重试；accept不做握手，握手在第一次读写时
+ *          由处理连接的协程完成，慢客户端不会卡住accept。
+ *          握手最长ssl.handshake_timeout毫秒，和读写超时取小的那个。
+ *          ssl.ktls打开时(默认)握手后由OpenSSL把密钥交给内核(kTLS)，
+ *          之后的加密在内核里做，sendFile不把文件读到用户态；
+ *          内核或加密套件不支持时自动退回用户态加密
+ */
 class SSLSocket : public Socket {
 public:
     typedef std::shared_ptr<SSLSocket> ptr;
@@ -400,6 +453,12 @@ public:
     static SSLSocket::ptr CreateTCPSocket6();
 
     SSLSocket(int family, int type, int protocol = 0);
+
+    /**
+     * @brief 析构函数，正常关闭SSL，会话留在缓存里可以复用
+     */
+    ~SSLSocket();
+
     virtual Socket::ptr accept() override;
     virtual bool bind(const Address::ptr addr) override;
     virtual bool connect(const Address::ptr addr, uint64_t timeout_ms = -1) override;
@@ -414,13 +473,96 @@ public:
     virtual int recvFrom(void* buffer, size_t length, Address::ptr from, int flags = 0) override;
     virtual int recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags = 0) override;
 
+    /**
+     * @brief 加载服务端证书
+     * @details 同一对证书和私钥在进程内只创建一个SSL_CTX，
+     *          多个监听Socket共用会话缓存和ticket密钥；
+     *          文件修改过(证书轮换)时重新加载，之后的调用拿到新的SSL_CTX
+     */
     bool loadCertificates(const std::string& cert_file, const std::string& key_file);
     virtual std::ostream& dump(std::ostream& os) const override;
+
+    /**
+     * @brief 本次握手是否复用了之前的会话
+     */
+    bool isSessionReused() const;
+
+    /**
+     * @brief 设置客户端是否使用会话缓存，默认true，在connect之前设置
+     * @details false时每次都是完整握手，拿到的会话也不放进缓存
+     */
+    void setSessionReuse(bool v) { m_sessionReuse = v;}
+
+    /**
+     * @brief 发送方向是否由内核加密(kTLS)
+     */
+    bool isKtlsSend() const;
+
+    /**
+     * @brief 接收方向是否由内核解密(kTLS)
+     */
+    bool isKtlsRecv() const;
+
+    /**
+     * @brief 发送文件fd从offset开始的length字节
+     * @details 发送方向打开了kTLS时用SSL_sendfile，文件数据不经过用户态；
+     *          否则pread到缓冲区再SSL_write
+     * @return 发送的字节数，文件不够length字节时发到文件结尾为止；
+     *         一个字节都没有发出时返回0(对端关闭)或<0(出错)
+     */
+    virtual int64_t sendFile(int fd, off_t offset, size_t length) override;
+
+    /**
+     * @brief 清空客户端会话缓存，之后的连接都是完整握手
+     */
+    static void ClearSessionCache();
+
+    /**
+     * @brief 客户端会话缓存里的会话数
+     */
+    static size_t GetSessionCacheSize();
 protected:
     virtual bool init(int sock) override;
+private:
+    /**
+     * @brief 客户端收到新会话时的回调(TLS1.3的ticket在握手之后才到)
+     */
+    static int OnNewSession(SSL* ssl, SSL_SESSION* session);
+
+    /**
+     * @brief 进程级的客户端SSL_CTX
+     */
+    static std::shared_ptr<SSL_CTX> GetClientContext();
+
+    /**
+     * @brief 创建SSL对象，fd对OpenSSL设为非阻塞
+     */
+    void newSSL();
+
+    /**
+     * @brief 执行一次SSL操作，WANT_READ/WANT_WRITE时等fd就绪后重试
+     * @param[in] op 以SSL*为参数调用SSL_connect/SSL_read/SSL_write等
+     * @param[in] timeout_ms 总超时时间，-1表示不超时
+     * @return op的返回值，超时返回-1，errno为ETIMEDOUT
+     */
+    template<class Op>
+    int doSSL(Op op, uint64_t timeout_ms);
+
+    /**
+     * @brief 读写超时，握手还没完成时不超过ssl.handshake_timeout
+     * @param[in] type SO_RCVTIMEO或SO_SNDTIMEO
+     */
+    uint64_t getIOTimeout(int type);
+
 private:
     std::shared_ptr<SSL_CTX> m_ctx;
     std::shared_ptr<SSL> m_ssl;
+    /// 客户端会话缓存的key(远端地址)
+    std::string m_sessionKey;
+    /// 客户端是否使用会话缓存
+    bool m_sessionReuse;
+    /// send(iovec)把小块数据拼成整条记录的缓冲区
+    std::vector<char> m_sendBuf;
 };
 
 /**
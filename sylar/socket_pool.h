@@ -0,0 +1,564 @@
+/**
+ * @file socket_pool.h
+ * @brief 通用的协程连接池
+ * @details SocketPool<Conn>缓存到一个后端地址的连接，Conn是包装了Socket的连接对象
+ *          (需要提供Socket::ptr getSocket())。
+ *          同时借出的连接数由FiberTimedSemaphore限制，取连接可以带超时；
+ *          空闲连接后进先出，优先复用刚归还的连接(对端和本机的缓存都还是热的)；
+ *          IOManager的定时器淘汰空闲太久的连接，并对长时间没用的连接做保活探测；
+ *          每个池统计自己的等待时间、命中率等指标
+ */
+#ifndef __SYLAR_SOCKET_POOL_H__
+#define __SYLAR_SOCKET_POOL_H__
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <errno.h>
+#include <stdint.h>
+
+#include "socket.h"
+#include "address.h"
+#include "iomanager.h"
+#include "fiber_sync.h"
+#include "mutex.h"
+#include "hook.h"
+#include "util.h"
+
+namespace sylar {
+
+/**
+ * @brief 连接池的配置
+ */
+struct SocketPoolOptions {
+    /// 最多同时借出的连接数，也是池里连接的总数上限
+    uint32_t max_active = 64;
+    /// 最多缓存的空闲连接数
+    uint32_t max_idle = 16;
+    /// 连接超时时间(毫秒)
+    uint64_t connect_timeout = 3000;
+    /// 空闲连接的最长保留时间(毫秒)，0表示不淘汰
+    uint64_t idle_timeout = 30000;
+    /// 空闲连接超过这个时间没用过就做一次保活探测(毫秒)，0表示不探测
+    uint64_t probe_interval = 10000;
+};
+
+/**
+ * @brief 连接池的统计指标
+ */
+struct SocketPoolMetrics {
+    /// 取连接次数
+    uint64_t acquires = 0;
+    /// 复用了空闲连接的次数
+    uint64_t hits = 0;
+    /// 新建连接的次数
+    uint64_t misses = 0;
+    /// 等待名额超时的次数
+    uint64_t timeouts = 0;
+    /// 连接失败的次数
+    uint64_t connect_fails = 0;
+    /// 归还时标记为损坏或者取出时发现已经断开的连接数
+    uint64_t broken = 0;
+    /// 空闲太久被淘汰的连接数
+    uint64_t evicted = 0;
+    /// 保活探测次数
+    uint64_t probes = 0;
+    /// 保活探测失败的次数
+    uint64_t probe_fails = 0;
+    /// 等待名额的总时间(微秒)
+    uint64_t wait_us_total = 0;
+    /// 等待名额的最长时间(微秒)
+    uint64_t wait_us_max = 0;
+
+    /**
+     * @brief 复用率
+     */
+    double hitRate() const { return acquires ? (double)hits / acquires : 0;}
+
+    /**
+     * @brief 平均等待时间(微秒)
+     */
+    uint64_t avgWaitUs() const { return acquires ? wait_us_total / acquires : 0;}
+
+    std::string toString() const {
+        std::stringstream ss;
+        ss << "acquires=" << acquires
+           << " hits=" << hits
+           << " misses=" << misses
+           << " hit_rate=" << (int)(hitRate() * 100) << "%"
+           << " timeouts=" << timeouts
+           << " connect_fails=" << connect_fails
+           << " broken=" << broken
+           << " evicted=" << evicted
+           << " probes=" << probes
+           << " probe_fails=" << probe_fails
+           << " wait_avg_us=" << avgWaitUs()
+           << " wait_max_us=" << wait_us_max;
+        return ss.str();
+    }
+};
+
+/**
+ * @brief 通用的协程连接池，一个池对应一个后端地址
+ * @details 借出的连接包在Lease里，Lease析构时自动归还。
+ *          名额在取连接时占用、归还时释放，只有没有空闲连接时才新建，
+ *          所以池里的连接(空闲的加借出的)不会超过max_active
+ */
+template<class Conn>
+class SocketPool : public std::enable_shared_from_this<SocketPool<Conn> >
+                 , Noncopyable {
+public:
+    typedef std::shared_ptr<SocketPool> ptr;
+    typedef std::shared_ptr<Conn> ConnPtr;
+    typedef Mutex MutexType;
+    /// 用连接好的Socket创建连接对象
+    typedef std::function<ConnPtr(Socket::ptr)> Factory;
+    /// 保活探测，返回false表示连接不可用
+    typedef std::function<bool(Conn&)> Prober;
+
+    /**
+     * @brief 取连接的结果
+     */
+    enum Error {
+        /// 成功
+        OK = 0,
+        /// 等待名额超时
+        TIMEOUT = 1,
+        /// 连接失败
+        CONNECT_FAIL = 2,
+        /// 连接池已经关闭
+        CLOSED = 3,
+    };
+
+    /**
+     * @brief 借出的连接，析构时归还给连接池
+     */
+    class Lease : Noncopyable {
+    public:
+        Lease(Error err = OK)
+            :m_error(err) {
+        }
+
+        Lease(ptr pool, ConnPtr conn)
+            :m_pool(pool)
+            ,m_conn(conn) {
+        }
+
+        Lease(Lease&& o)
+            :m_pool(std::move(o.m_pool))
+            ,m_conn(std::move(o.m_conn))
+            ,m_error(o.m_error)
+            ,m_reuse(o.m_reuse) {
+        }
+
+        Lease& operator=(Lease&& o) {
+            if(this != &o) {
+                release();
+                m_pool = std::move(o.m_pool);
+                m_conn = std::move(o.m_conn);
+                m_error = o.m_error;
+                m_reuse = o.m_reuse;
+            }
+            return *this;
+        }
+
+        ~Lease() {
+            release();
+        }
+
+        /**
+         * @brief 提前归还
+         * @param[in] reuse 连接是否还能继续使用，false或者已经markBroken时关闭连接
+         */
+        void release(bool reuse = true) {
+            if(m_conn) {
+                m_pool->release(m_conn, reuse && m_reuse);
+                m_conn.reset();
+                m_pool.reset();
+            }
+        }
+
+        /**
+         * @brief 标记连接已经损坏(读写出错、协议错乱)，归还时关闭
+         */
+        void markBroken() { m_reuse = false;}
+
+        Conn* get() const { return m_conn.get();}
+        Conn* operator->() const { return m_conn.get();}
+        Conn& operator*() const { return *m_conn;}
+        const ConnPtr& getConn() const { return m_conn;}
+        explicit operator bool() const { return (bool)m_conn;}
+
+        /**
+         * @brief 取连接失败的原因
+         */
+        Error getError() const { return m_error;}
+    private:
+        ptr m_pool;
+        ConnPtr m_conn;
+        Error m_error = OK;
+        bool m_reuse = true;
+    };
+
+    /**
+     * @brief 创建连接池
+     * @param[in] addr 后端地址
+     * @param[in] opts 配置
+     * @param[in] factory 创建连接对象，nullptr时用Conn(Socket::ptr)构造
+     * @param[in] prober 保活探测，nullptr时只检查对端是否已经关闭
+     * @param[in] iom 运行淘汰/探测定时器的IOManager，nullptr时不启动定时器
+     */
+    static ptr Create(Address::ptr addr
+                      ,const SocketPoolOptions& opts = SocketPoolOptions()
+                      ,Factory factory = nullptr
+                      ,Prober prober = nullptr
+                      ,IOManager* iom = IOManager::GetThis()) {
+        ptr pool(new SocketPool(addr, opts, factory, prober));
+        uint64_t period = 0;
+        if(opts.idle_timeout) {
+            period = opts.idle_timeout / 2;
+        }
+        if(opts.probe_interval) {
+            period = period ? std::min(period, opts.probe_interval / 2)
+                            : opts.probe_interval / 2;
+        }
+        if(iom && period) {
+            std::weak_ptr<SocketPool> weak(pool);
+            pool->m_timer = iom->addConditionTimer(std::max<uint64_t>(period, 10)
+                    , [weak]() {
+                auto self = weak.lock();
+                if(self) {
+                    self->check();
+                }
+            }, weak, true);
+        }
+        return pool;
+    }
+
+    ~SocketPool() {
+        close();
+    }
+
+    /**
+     * @brief 借一个连接
+     * @details 先等名额，再取最近归还的空闲连接，没有可用的空闲连接时新建
+     * @param[in] timeout_ms 等待名额的超时时间(毫秒)，~0ull表示一直等
+     * @return 失败时Lease为空，getError()返回原因
+     */
+    Lease acquire(uint64_t timeout_ms = ~0ull) {
+        ++m_acquires;
+        if(m_closed) {
+            return Lease(CLOSED);
+        }
+        uint64_t start = GetCurrentUS();
+        if(!m_sem.waitFor(timeout_ms)) {
+            ++m_timeouts;
+            return Lease(TIMEOUT);
+        }
+        addWait(GetCurrentUS() - start);
+        if(m_closed) {
+            m_sem.notify();
+            return Lease(CLOSED);
+        }
+
+        while(true) {
+            ConnPtr conn;
+            {
+                MutexType::Lock lock(m_mutex);
+                if(m_idle.empty()) {
+                    break;
+                }
+                conn = m_idle.back().conn;
+                m_idle.pop_back();
+            }
+            // 对端关闭了空闲连接时换下一个
+            if(IsAlive(*conn)) {
+                ++m_hits;
+                ++m_active;
+                return Lease(this->shared_from_this(), conn);
+            }
+            ++m_broken;
+            closeConn(conn);
+        }
+
+        ConnPtr conn = connect();
+        if(!conn) {
+            ++m_connectFails;
+            m_sem.notify();
+            return Lease(CONNECT_FAIL);
+        }
+        ++m_misses;
+        ++m_active;
+        return Lease(this->shared_from_this(), conn);
+    }
+
+    /**
+     * @brief 淘汰空闲太久的连接，探测长时间没用的连接(定时器调用)
+     * @return 关闭的连接数
+     */
+    size_t check() {
+        // 探测可能阻塞，上一轮还没结束时跳过
+        if(m_checking.exchange(true)) {
+            return 0;
+        }
+        size_t closed = evict();
+        if(m_opts.probe_interval) {
+            closed += probe();
+        }
+        m_checking = false;
+        return closed;
+    }
+
+    /**
+     * @brief 关闭连接池，关闭空闲连接，借出的连接归还时关闭
+     */
+    void close() {
+        std::deque<Idle> idle;
+        {
+            MutexType::Lock lock(m_mutex);
+            m_closed = true;
+            idle.swap(m_idle);
+            if(m_timer) {
+                m_timer->cancel();
+                m_timer.reset();
+            }
+        }
+        for(auto& i : idle) {
+            closeConn(i.conn);
+        }
+    }
+
+    /**
+     * @brief 返回统计指标的快照
+     */
+    SocketPoolMetrics getMetrics() const {
+        SocketPoolMetrics m;
+        m.acquires = m_acquires;
+        m.hits = m_hits;
+        m.misses = m_misses;
+        m.timeouts = m_timeouts;
+        m.connect_fails = m_connectFails;
+        m.broken = m_broken;
+        m.evicted = m_evicted;
+        m.probes = m_probes;
+        m.probe_fails = m_probeFails;
+        m.wait_us_total = m_waitUsTotal;
+        m.wait_us_max = m_waitUsMax;
+        return m;
+    }
+
+    std::string toString() {
+        std::stringstream ss;
+        ss << "[SocketPool addr=" << *m_addr
+           << " active=" << m_active
+           << " idle=" << getIdleCount()
+           << " " << getMetrics().toString() << "]";
+        return ss.str();
+    }
+
+    size_t getIdleCount() {
+        MutexType::Lock lock(m_mutex);
+        return m_idle.size();
+    }
+
+    /**
+     * @brief 借出未归还的连接数
+     */
+    size_t getActiveCount() const { return m_active;}
+
+    Address::ptr getAddress() const { return m_addr;}
+    const SocketPoolOptions& getOptions() const { return m_opts;}
+    bool isClosed() const { return m_closed;}
+private:
+    /**
+     * @brief 空闲连接
+     */
+    struct Idle {
+        ConnPtr conn;
+        /// 最后一次归还的时间(毫秒)
+        uint64_t last_used;
+        /// 最后一次归还或者探测成功的时间(毫秒)
+        uint64_t last_check;
+    };
+
+    SocketPool(Address::ptr addr, const SocketPoolOptions& opts
+               ,Factory factory, Prober prober)
+        :m_addr(addr)
+        ,m_opts(opts)
+        ,m_factory(factory)
+        ,m_prober(prober)
+        ,m_sem(opts.max_active) {
+        if(m_opts.max_idle > m_opts.max_active) {
+            m_opts.max_idle = m_opts.max_active;
+        }
+    }
+
+    /**
+     * @brief 不阻塞地窥探socket，对端已经关闭或者出错时返回false
+     * @details 空闲连接上不应该有数据，有数据说明协议已经错乱，也当作不可用
+     */
+    static bool IsAlive(Conn& conn) {
+        Socket::ptr sock = conn.getSocket();
+        if(!sock || !sock->isConnected()) {
+            return false;
+        }
+        char c;
+        int rt = recv_f(sock->getSocket(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    static void closeConn(const ConnPtr& conn) {
+        Socket::ptr sock = conn->getSocket();
+        if(sock) {
+            sock->close();
+        }
+    }
+
+    ConnPtr connect() {
+        Socket::ptr sock = Socket::CreateTCP(m_addr);
+        if(!sock->connect(m_addr, m_opts.connect_timeout)) {
+            return nullptr;
+        }
+        return m_factory ? m_factory(sock) : std::make_shared<Conn>(sock);
+    }
+
+    void release(const ConnPtr& conn, bool reuse) {
+        --m_active;
+        bool closed = true;
+        if(reuse && IsUsable(*conn)) {
+            uint64_t now = GetCurrentMS();
+            MutexType::Lock lock(m_mutex);
+            if(!m_closed && m_idle.size() < m_opts.max_idle) {
+                m_idle.push_back(Idle{conn, now, now});
+                closed = false;
+            }
+        } else if(!reuse) {
+            ++m_broken;
+        }
+        if(closed) {
+            closeConn(conn);
+        }
+        m_sem.notify();
+    }
+
+    static bool IsUsable(Conn& conn) {
+        Socket::ptr sock = conn.getSocket();
+        return sock && sock->isConnected();
+    }
+
+    size_t evict() {
+        if(!m_opts.idle_timeout) {
+            return 0;
+        }
+        std::vector<ConnPtr> dead;
+        uint64_t now = GetCurrentMS();
+        {
+            MutexType::Lock lock(m_mutex);
+            for(auto it = m_idle.begin(); it != m_idle.end();) {
+                if(now - it->last_used >= m_opts.idle_timeout) {
+                    dead.push_back(it->conn);
+                    it = m_idle.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        m_evicted += dead.size();
+        for(auto& i : dead) {
+            closeConn(i);
+        }
+        return dead.size();
+    }
+
+    /**
+     * @brief 从冷端开始探测长时间没用的空闲连接
+     * @details 探测期间连接占一个名额，不会和借出的连接一起超过max_active；
+     *          名额用完(池很忙)时不探测，忙的池里连接很快会被用到
+     */
+    size_t probe() {
+        size_t fails = 0;
+        size_t n = getIdleCount();
+        for(size_t i = 0; i < n && !m_closed; ++i) {
+            if(!m_sem.tryWait()) {
+                break;
+            }
+            Idle item;
+            uint64_t now = GetCurrentMS();
+            {
+                // 探测过的连接放回了冷端，跳过它们找下一个到期的
+                MutexType::Lock lock(m_mutex);
+                auto it = m_idle.begin();
+                while(it != m_idle.end() && now - it->last_check < m_opts.probe_interval) {
+                    ++it;
+                }
+                if(it == m_idle.end()) {
+                    lock.unlock();
+                    m_sem.notify();
+                    break;
+                }
+                item = *it;
+                m_idle.erase(it);
+            }
+            ++m_probes;
+            bool ok = IsAlive(*item.conn) && (!m_prober || m_prober(*item.conn));
+            if(ok) {
+                // 放回冷端，保留原来的归还时间，不影响淘汰
+                item.last_check = GetCurrentMS();
+                MutexType::Lock lock(m_mutex);
+                if(!m_closed) {
+                    m_idle.push_front(item);
+                    item.conn.reset();
+                }
+            } else {
+                ++m_probeFails;
+                ++fails;
+            }
+            if(item.conn) {
+                closeConn(item.conn);
+            }
+            m_sem.notify();
+        }
+        return fails;
+    }
+
+    void addWait(uint64_t us) {
+        m_waitUsTotal += us;
+        uint64_t m = m_waitUsMax;
+        while(us > m && !m_waitUsMax.compare_exchange_weak(m, us));
+    }
+private:
+    Address::ptr m_addr;
+    SocketPoolOptions m_opts;
+    Factory m_factory;
+    Prober m_prober;
+    /// 借出的名额
+    FiberTimedSemaphore m_sem;
+
+    MutexType m_mutex;
+    /// 空闲连接，尾部是最近归还的
+    std::deque<Idle> m_idle;
+    std::atomic<bool> m_closed{false};
+    std::atomic<bool> m_checking{false};
+    std::atomic<size_t> m_active{0};
+    /// 淘汰/探测定时器
+    Timer::ptr m_timer;
+
+    std::atomic<uint64_t> m_acquires{0};
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_timeouts{0};
+    std::atomic<uint64_t> m_connectFails{0};
+    std::atomic<uint64_t> m_broken{0};
+    std::atomic<uint64_t> m_evicted{0};
+    std::atomic<uint64_t> m_probes{0};
+    std::atomic<uint64_t> m_probeFails{0};
+    std::atomic<uint64_t> m_waitUsTotal{0};
+    std::atomic<uint64_t> m_waitUsMax{0};
+};
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ * @file stream.h
+ * @brief 流接口
+ * @details read/write和系统调用一样可能只处理了一部分数据，
+ *          readFixSize/writeFixSize循环直到处理完指定长度或者出错
+ */
+#ifndef __SYLAR_STREAM_H__
+#define __SYLAR_STREAM_H__
+
+#include <memory>
+#include "bytearray.h"
+
+namespace sylar {
+
+/**
+ * @brief 流结构
+ */
+class Stream {
+public:
+    typedef std::shared_ptr<Stream> ptr;
+
+    /**
+     * @brief 析构函数
+     */
+    virtual ~Stream() {}
+
+    /**
+     * @brief 读数据
+     * @param[out] buffer 接收数据的内存
+     * @param[in] length 接收数据的内存大小
+     * @return
+     *      @retval >0 返回实际读到的数据长度
+     *      @retval =0 对端关闭
+     *      @retval <0 出错
+     */
+    virtual int read(void* buffer, size_t length) = 0;
+
+    /**
+     * @brief 读数据写入ba的当前位置，之后ba的position前移读到的长度
+     * @param[out] ba 接收数据的ByteArray
+     * @param[in] length 最多读取的长度
+     * @return 同read(void*, size_t)
+     */
+    virtual int read(ByteArray::ptr ba, size_t length) = 0;
+
+    /**
+     * @brief 读固定长度的数据
+     * @return
+     *      @retval >0 读满了length
+     *      @retval =0 读满之前对端关闭
+     *      @retval <0 出错
+     */
+    virtual int readFixSize(void* buffer, size_t length);
+
+    /**
+     * @brief 读固定长度的数据写入ba
+     * @return 同readFixSize(void*, size_t)
+     */
+    virtual int readFixSize(ByteArray::ptr ba, size_t length);
+
+    /**
+     * @brief 写数据
+     * @param[in] buffer 要写的数据
+     * @param[in] length 数据长度
+     * @return
+     *      @retval >0 返回实际写入的数据长度
+     *      @retval =0 对端关闭
+     *      @retval <0 出错
+     */
+    virtual int write(const void* buffer, size_t length) = 0;
+
+    /**
+     * @brief 从ba的当前位置写数据，之后ba的position前移写出的长度
+     * @return 同write(const void*, size_t)
+     */
+    virtual int write(ByteArray::ptr ba, size_t length) = 0;
+
+    /**
+     * @brief 写固定长度的数据
+     * @return
+     *      @retval >0 全部写出
+     *      @retval =0 对端关闭
+     *      @retval <0 出错
+     */
+    virtual int writeFixSize(const void* buffer, size_t length);
+
+    /**
+     * @brief 从ba的当前位置写固定长度的数据
+     * @return 同writeFixSize(const void*, size_t)
+     */
+    virtual int writeFixSize(ByteArray::ptr ba, size_t length);
+
+    /**
+     * @brief 关闭流
+     */
+    virtual void close() = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,142 @@
+#include "buffered_stream.h"
+
+namespace sylar {
+
+BufferedStream::BufferedStream(Stream::ptr stream
+                               ,size_t read_buffer_size
+                               ,size_t write_buffer_size)
+    :m_stream(stream)
+    ,m_rbuf(new ByteArray(read_buffer_size))
+    ,m_rbufSize(read_buffer_size)
+    ,m_wbufSize(write_buffer_size)
+    ,m_writeError(1) {
+    if(write_buffer_size) {
+        m_wbuf.reset(new ByteArray(write_buffer_size));
+    }
+}
+
+BufferedStream::~BufferedStream() {
+    flush();
+}
+
+int BufferedStream::fill() {
+    // 只在缓冲区读空之后调用，clear只重置位置，保留第一个内存块
+    m_rbuf->clear();
+    int rt = m_stream->read(m_rbuf, m_rbufSize);
+    m_rbuf->setPosition(0);
+    return rt;
+}
+
+size_t BufferedStream::take(void* buffer, size_t length) {
+    size_t n = std::min(length, m_rbuf->getReadSize());
+    m_rbuf->read(buffer, n);
+    return n;
+}
+
+int BufferedStream::read(void* buffer, size_t length) {
+    if(m_rbuf->getReadSize() == 0) {
+        if(length >= m_rbufSize) {
+            // 大块读取不经过缓冲区
+            return m_stream->read(buffer, length);
+        }
+        int rt = fill();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    return take(buffer, length);
+}
+
+int BufferedStream::read(ByteArray::ptr ba, size_t length) {
+    if(m_rbuf->getReadSize() == 0) {
+        if(length >= m_rbufSize) {
+            return m_stream->read(ba, length);
+        }
+        int rt = fill();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    size_t n = std::min(length, m_rbuf->getReadSize());
+    m_iovs.clear();
+    m_rbuf->getReadBuffers(m_iovs, n);
+    for(auto& i : m_iovs) {
+        ba->write(i.iov_base, i.iov_len);
+    }
+    m_rbuf->setPosition(m_rbuf->getPosition() + n);
+    return n;
+}
+
+int BufferedStream::write(const void* buffer, size_t length) {
+    if(!m_wbuf) {
+        return m_stream->write(buffer, length);
+    }
+    if(m_writeError <= 0) {
+        return m_writeError;
+    }
+    if(m_wbuf->getSize() + length > m_wbufSize) {
+        int rt = flush();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    if(length >= m_wbufSize) {
+        // 前面的数据已经写出，大块数据直接写，顺序不变
+        return m_stream->write(buffer, length);
+    }
+    m_wbuf->write(buffer, length);
+    return length;
+}
+
+int BufferedStream::write(ByteArray::ptr ba, size_t length) {
+    if(!m_wbuf) {
+        return m_stream->write(ba, length);
+    }
+    if(m_writeError <= 0) {
+        return m_writeError;
+    }
+    length = std::min(length, ba->getReadSize());
+    if(m_wbuf->getSize() + length > m_wbufSize) {
+        int rt = flush();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    if(length >= m_wbufSize) {
+        return m_stream->write(ba, length);
+    }
+    m_iovs.clear();
+    ba->getReadBuffers(m_iovs, length);
+    for(auto& i : m_iovs) {
+        m_wbuf->write(i.iov_base, i.iov_len);
+    }
+    ba->setPosition(ba->getPosition() + length);
+    return length;
+}
+
+int BufferedStream::flush() {
+    if(!m_wbuf) {
+        return 1;
+    }
+    if(m_writeError <= 0) {
+        return m_writeError;
+    }
+    size_t size = m_wbuf->getSize();
+    if(size == 0) {
+        return 1;
+    }
+    m_wbuf->setPosition(0);
+    int rt = m_stream->writeFixSize(m_wbuf, size);
+    m_wbuf->clear();
+    if(rt <= 0) {
+        m_writeError = rt;
+    }
+    return rt;
+}
+
+void BufferedStream::close() {
+    flush();
+    m_stream->close();
+}
+
+}
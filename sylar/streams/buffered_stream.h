@@ -0,0 +1,101 @@
+/**
+ * @file buffered_stream.h
+ * @brief 带缓冲的流
+ * @details 读：一次从下层流读一大块到ByteArray，之后的小读取直接从缓冲区返回，
+ *          读协议头这类小数据时系统调用从每条消息几次降到每一大块一次；
+ *          不小于缓冲区的读取在缓冲区为空时直接读下层流，不多拷贝一次。
+ *          写：小数据先攒在缓冲区里，满了或者flush时一次写出；
+ *          写缓冲默认关闭，打开后必须在等待对端响应之前调用flush
+ */
+#ifndef __SYLAR_BUFFERED_STREAM_H__
+#define __SYLAR_BUFFERED_STREAM_H__
+
+#include <vector>
+#include "../stream.h"
+
+namespace sylar {
+
+/**
+ * @brief 带缓冲的流
+ */
+class BufferedStream : public Stream {
+public:
+    typedef std::shared_ptr<BufferedStream> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] stream 下层流
+     * @param[in] read_buffer_size 读缓冲区大小
+     * @param[in] write_buffer_size 写缓冲区大小，0表示不缓冲写
+     */
+    BufferedStream(Stream::ptr stream
+                   ,size_t read_buffer_size = 16 * 1024
+                   ,size_t write_buffer_size = 0);
+
+    /**
+     * @brief 析构函数，写出缓冲区里剩余的数据
+     */
+    ~BufferedStream();
+
+    /**
+     * @brief 读数据，缓冲区里有数据时只返回缓冲区里的数据
+     */
+    virtual int read(void* buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 写数据，打开写缓冲时数据可能还在缓冲区里
+     * @details 之前的flush出过错时返回那次的错误
+     */
+    virtual int write(const void* buffer, size_t length) override;
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 写出缓冲区里的数据后关闭下层流
+     */
+    virtual void close() override;
+
+    /**
+     * @brief 写出写缓冲区里的数据
+     * @return 成功返回>0(没有数据时返回1)，对端关闭返回0，出错返回<0
+     */
+    int flush();
+
+    /**
+     * @brief 读缓冲区里还没读的字节数
+     */
+    size_t getReadBufferedSize() const { return m_rbuf->getReadSize();}
+
+    /**
+     * @brief 写缓冲区里还没写出的字节数
+     */
+    size_t getWriteBufferedSize() const { return m_wbuf ? m_wbuf->getSize() : 0;}
+
+    Stream::ptr getStream() const { return m_stream;}
+private:
+    /**
+     * @brief 缓冲区为空时从下层流读一块
+     */
+    int fill();
+
+    /**
+     * @brief 从读缓冲区拷出最多length字节
+     */
+    size_t take(void* buffer, size_t length);
+private:
+    /// 下层流
+    Stream::ptr m_stream;
+    /// 读缓冲区，[position, size)是还没读的数据
+    ByteArray::ptr m_rbuf;
+    size_t m_rbufSize;
+    /// 写缓冲区，nullptr表示不缓冲写
+    ByteArray::ptr m_wbuf;
+    size_t m_wbufSize;
+    /// flush出错时的返回值，之后的写都返回它
+    int m_writeError;
+    std::vector<iovec> m_iovs;
+};
+
+}
+
+#endif
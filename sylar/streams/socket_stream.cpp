@@ -0,0 +1,91 @@
+#include "socket_stream.h"
+
+namespace sylar {
+
+SocketStream::SocketStream(Socket::ptr sock, bool owner)
+    :m_socket(sock)
+    ,m_owner(owner) {
+}
+
+SocketStream::~SocketStream() {
+    if(m_owner && m_socket) {
+        m_socket->close();
+    }
+}
+
+bool SocketStream::isConnected() const {
+    return m_socket && m_socket->isConnected();
+}
+
+int SocketStream::read(void* buffer, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    return m_socket->recv(buffer, length);
+}
+
+int SocketStream::read(ByteArray::ptr ba, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    m_iovs.clear();
+    ba->getWriteBuffers(m_iovs, length);
+    if(m_iovs.empty()) {
+        return 0;
+    }
+    int rt = m_socket->recv(&m_iovs[0], m_iovs.size());
+    if(rt > 0) {
+        ba->setPosition(ba->getPosition() + rt);
+    }
+    return rt;
+}
+
+int SocketStream::write(const void* buffer, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    // 对端已经关闭时返回EPIPE，不产生SIGPIPE
+    return m_socket->send(buffer, length, MSG_NOSIGNAL);
+}
+
+int SocketStream::write(ByteArray::ptr ba, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    m_iovs.clear();
+    ba->getReadBuffers(m_iovs, length);
+    if(m_iovs.empty()) {
+        return 0;
+    }
+    int rt = m_socket->send(&m_iovs[0], m_iovs.size(), MSG_NOSIGNAL);
+    if(rt > 0) {
+        ba->setPosition(ba->getPosition() + rt);
+    }
+    return rt;
+}
+
+void SocketStream::close() {
+    if(m_socket) {
+        m_socket->close();
+    }
+}
+
+Address::ptr SocketStream::getRemoteAddress() {
+    return m_socket ? m_socket->getRemoteAddress() : nullptr;
+}
+
+Address::ptr SocketStream::getLocalAddress() {
+    return m_socket ? m_socket->getLocalAddress() : nullptr;
+}
+
+std::string SocketStream::getRemoteAddressString() {
+    Address::ptr addr = getRemoteAddress();
+    return addr ? addr->toString() : "";
+}
+
+std::string SocketStream::getLocalAddressString() {
+    Address::ptr addr = getLocalAddress();
+    return addr ? addr->toString() : "";
+}
+
+}
@@ -0,0 +1,64 @@
+/**
+ * @file socket_stream.h
+ * @brief Socket流
+ */
+#ifndef __SYLAR_SOCKET_STREAM_H__
+#define __SYLAR_SOCKET_STREAM_H__
+
+#include <vector>
+#include "../stream.h"
+#include "../socket.h"
+
+namespace sylar {
+
+/**
+ * @brief Socket流
+ */
+class SocketStream : public Stream {
+public:
+    typedef std::shared_ptr<SocketStream> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] sock Socket类
+     * @param[in] owner 是否由流负责关闭Socket
+     */
+    SocketStream(Socket::ptr sock, bool owner = true);
+
+    /**
+     * @brief 析构函数，owner为true时关闭Socket
+     */
+    ~SocketStream();
+
+    virtual int read(void* buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+    virtual int write(const void* buffer, size_t length) override;
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+    virtual void close() override;
+
+    /**
+     * @brief 返回Socket类
+     */
+    Socket::ptr getSocket() const { return m_socket;}
+
+    /**
+     * @brief 返回是否连接
+     */
+    bool isConnected() const;
+
+    Address::ptr getRemoteAddress();
+    Address::ptr getLocalAddress();
+    std::string getRemoteAddressString();
+    std::string getLocalAddressString();
+protected:
+    /// Socket类
+    Socket::ptr m_socket;
+    /// 是否由流负责关闭Socket
+    bool m_owner;
+    /// read/write(ByteArray)复用的iovec
+    std::vector<iovec> m_iovs;
+};
+
+}
+
+#endif
@@ -0,0 +1,230 @@
+#include "tcp_server.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "log.h"
+#include "macro.h"
+#include <sstream>
+#include <string.h>
+#include <unistd.h>
+
+namespace sylar {
+
+static sylar::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
+    sylar::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
+            "tcp server read timeout");
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+TcpServer::TcpServer(sylar::IOManager* io_worker, sylar::IOManager* accept_worker)
+    :m_ioWorker(io_worker)
+    ,m_acceptWorker(accept_worker)
+    ,m_recvTimeout(g_tcp_server_read_timeout->getValue())
+    ,m_listeners(1)
+    ,m_name("sylar/1.0.0")
+    ,m_isStop(true)
+    ,m_stopped(false) {
+    SYLAR_ASSERT2(m_ioWorker && m_acceptWorker, "TcpServer needs IOManagers");
+}
+
+TcpServer::~TcpServer() {
+    for(auto& i : m_socks) {
+        i->close();
+    }
+    m_socks.clear();
+}
+
+bool TcpServer::bind(sylar::Address::ptr addr) {
+    std::vector<Address::ptr> addrs;
+    std::vector<Address::ptr> fails;
+    addrs.push_back(addr);
+    return bind(addrs, fails);
+}
+
+bool TcpServer::bind(const std::vector<Address::ptr>& addrs
+                        ,std::vector<Address::ptr>& fails) {
+    std::vector<Socket::ptr> socks;
+    for(auto& addr : addrs) {
+        // 端口为0时，后面的监听socket要用第一个实际分到的端口
+        Address::ptr bind_addr = addr;
+        for(uint32_t i = 0; i < m_listeners; ++i) {
+            Socket::ptr sock = Socket::CreateTCP(bind_addr);
+            if(m_listeners > 1 && !sock->setReusePort(true)) {
+                SYLAR_LOG_ERROR(g_logger) << "set SO_REUSEPORT fail errno="
+                    << errno << " errstr=" << strerror(errno) << " addr=["
+                    << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->bind(bind_addr)) {
+                SYLAR_LOG_ERROR(g_logger) << "bind fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->listen()) {
+                SYLAR_LOG_ERROR(g_logger) << "listen fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            // 在没开hook的线程里创建的socket不在FdMgr里，accept会阻塞整个线程
+            FdMgr::GetInstance().get(sock->getSocket(), true);
+            bind_addr = sock->getLocalAddress();
+            socks.push_back(sock);
+        }
+    }
+
+    if(!fails.empty()) {
+        for(auto& i : socks) {
+            i->close();
+        }
+        return false;
+    }
+
+    for(auto& i : socks) {
+        SYLAR_LOG_INFO(g_logger) << "server name=" << m_name
+            << " bind success: " << *i;
+    }
+    MutexType::Lock lock(m_mutex);
+    m_socks.insert(m_socks.end(), socks.begin(), socks.end());
+    return true;
+}
+
+void TcpServer::startAccept(Socket::ptr sock) {
+    while(!m_isStop) {
+        Socket::ptr client = sock->accept();
+        if(client) {
+            client->setRecvTimeout(m_recvTimeout);
+            {
+                // stop可能已经shutdownClients过了，这时加进来的连接没人再关，直接关掉
+                MutexType::Lock lock(m_mutex);
+                if(m_isStop) {
+                    lock.unlock();
+                    client->close();
+                    break;
+                }
+                m_clients.insert(client);
+            }
+            m_ioWorker->schedule(std::bind(&TcpServer::runClient,
+                        shared_from_this(), client));
+        } else {
+            if(m_isStop) {
+                break;
+            }
+            // fd用完时accept会立即失败，稍等再试，避免空转
+            if(errno == EMFILE || errno == ENFILE) {
+                usleep(10 * 1000);
+            }
+        }
+    }
+}
+
+void TcpServer::runClient(Socket::ptr client) {
+    handleClient(client);
+    {
+        // 先移出集合再close，shutdownClients不会碰到正在关闭或已被复用的fd
+        MutexType::Lock lock(m_mutex);
+        m_clients.erase(client);
+        if(m_isStop && m_clients.empty() && m_stopTimer) {
+            // 连接都结束了，不必再等定时器
+            m_stopTimer->cancel();
+            m_stopTimer.reset();
+        }
+    }
+    client->close();
+}
+
+void TcpServer::handleClient(Socket::ptr client) {
+    SYLAR_LOG_INFO(g_logger) << "handleClient: " << *client;
+}
+
+bool TcpServer::start() {
+    MutexType::Lock lock(m_mutex);
+    if(m_stopped) {
+        SYLAR_LOG_ERROR(g_logger) << "server name=" << m_name << " start after stop";
+        return false;
+    }
+    if(!m_isStop) {
+        return true;
+    }
+    m_isStop = false;
+    for(auto& sock : m_socks) {
+        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
+                    shared_from_this(), sock));
+    }
+    return true;
+}
+
+void TcpServer::stop(uint64_t timeout_ms) {
+    {
+        MutexType::Lock lock(m_mutex);
+        m_stopped = true;
+    }
+    if(m_isStop.exchange(true)) {
+        return;
+    }
+    auto self = shared_from_this();
+    // 监听socket的事件注册在accept_worker上，要在那里取消
+    m_acceptWorker->schedule([this, self]() {
+        std::vector<Socket::ptr> socks;
+        {
+            MutexType::Lock lock(m_mutex);
+            socks.swap(m_socks);
+        }
+        for(auto& sock : socks) {
+            sock->cancelAll();
+            sock->close();
+        }
+    });
+
+    if(timeout_ms == 0) {
+        shutdownClients();
+        return;
+    }
+    MutexType::Lock lock(m_mutex);
+    if(m_clients.empty()) {
+        return;
+    }
+    m_stopTimer = m_ioWorker->addTimer(timeout_ms, [self]() {
+        self->shutdownClients();
+    });
+}
+
+void TcpServer::shutdownClients() {
+    MutexType::Lock lock(m_mutex);
+    m_stopTimer.reset();
+    for(auto& i : m_clients) {
+        // 不直接close: 连接协程可能正在读写这个fd，shutdown让读写返回，由它自己close
+        ::shutdown(i->getSocket(), SHUT_RDWR);
+    }
+}
+
+std::vector<Socket::ptr> TcpServer::getSocks() const {
+    MutexType::Lock lock(m_mutex);
+    return m_socks;
+}
+
+size_t TcpServer::getConnectionCount() {
+    MutexType::Lock lock(m_mutex);
+    return m_clients.size();
+}
+
+std::string TcpServer::toString(const std::string& prefix) {
+    std::stringstream ss;
+    ss << prefix << "[type=TcpServer"
+       << " name=" << m_name
+       << " io_worker=" << (m_ioWorker ? m_ioWorker->getName() : "")
+       << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
+       << " recv_timeout=" << m_recvTimeout
+       << " listeners=" << m_listeners
+       << " connections=" << getConnectionCount() << "]" << std::endl;
+    std::string pfx = prefix.empty() ? "    " : prefix;
+    for(auto& i : getSocks()) {
+        ss << pfx << pfx << *i << std::endl;
+    }
+    return ss.str();
+}
+
+}
@@ -0,0 +1,176 @@
+/**
+ * @file tcp_server.h
+ * @brief TCP服务器封装
+ * @details accept和连接的读写可以放在不同的IOManager里，
+ *          每个连接一个协程，子类重载handleClient处理连接
+ */
+#ifndef __SYLAR_TCP_SERVER_H__
+#define __SYLAR_TCP_SERVER_H__
+
+#include <memory>
+#include <functional>
+#include <vector>
+#include <unordered_set>
+#include <atomic>
+#include "address.h"
+#include "iomanager.h"
+#include "socket.h"
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief TCP服务器
+ * @details 每个监听socket一个accept协程(跑在accept_worker上)，
+ *          每个新连接一个协程(跑在io_worker上)执行handleClient。
+ *          同一个fd上只能有一个协程等待读事件，所以多个accept协程需要多个监听socket：
+ *          setListeners(n)让每个地址用SO_REUSEPORT开n个监听socket，由内核分配连接
+ */
+class TcpServer : public std::enable_shared_from_this<TcpServer>
+                    , Noncopyable {
+public:
+    typedef std::shared_ptr<TcpServer> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 构造函数
+     * @param[in] io_worker 连接协程的调度器
+     * @param[in] accept_worker accept协程的调度器
+     */
+    TcpServer(sylar::IOManager* io_worker = sylar::IOManager::GetThis()
+              ,sylar::IOManager* accept_worker = sylar::IOManager::GetThis());
+
+    /**
+     * @brief 析构函数
+     */
+    virtual ~TcpServer();
+
+    /**
+     * @brief 绑定地址
+     * @return 是否绑定成功
+     */
+    virtual bool bind(sylar::Address::ptr addr);
+
+    /**
+     * @brief 绑定地址数组
+     * @param[in] addrs 需要绑定的地址数组
+     * @param[out] fails 绑定失败的地址
+     * @return 全部成功返回true，否则已经绑定的也会被关掉
+     */
+    virtual bool bind(const std::vector<Address::ptr>& addrs
+                        ,std::vector<Address::ptr>& fails);
+
+    /**
+     * @brief 启动服务，每个监听socket开一个accept协程
+     * @pre 需要bind成功后执行
+     * @return stop之后不能再启动(监听socket已经关闭)，返回false
+     */
+    virtual bool start();
+
+    /**
+     * @brief 停止服务
+     * @details 先关掉监听socket不再接受新连接，已有的连接继续处理；
+     *          timeout_ms之后还没结束的连接被shutdown，读写立即返回，handleClient随之退出
+     * @param[in] timeout_ms 等待已有连接的时间(毫秒)，0表示立即shutdown
+     * @attention stop之后不能再start，要重新监听就新建一个server
+     */
+    virtual void stop(uint64_t timeout_ms = 0);
+
+    /**
+     * @brief 返回读取超时时间(毫秒)
+     */
+    uint64_t getRecvTimeout() const { return m_recvTimeout;}
+
+    /**
+     * @brief 设置读取超时时间(毫秒)
+     */
+    void setRecvTimeout(uint64_t v) { m_recvTimeout = v;}
+
+    /**
+     * @brief 返回每个地址的监听socket数
+     */
+    uint32_t getListeners() const { return m_listeners;}
+
+    /**
+     * @brief 设置每个地址的监听socket数，大于1时开启SO_REUSEPORT，需要在bind之前设置
+     */
+    void setListeners(uint32_t v) { m_listeners = v ? v : 1;}
+
+    /**
+     * @brief 返回服务器名称
+     */
+    std::string getName() const { return m_name;}
+
+    /**
+     * @brief 设置服务器名称
+     */
+    virtual void setName(const std::string& v) { m_name = v;}
+
+    /**
+     * @brief 是否停止
+     */
+    bool isStop() const { return m_isStop;}
+
+    /**
+     * @brief 返回当前的连接数
+     */
+    size_t getConnectionCount();
+
+    /**
+     * @brief 返回监听socket
+     */
+    std::vector<Socket::ptr> getSocks() const;
+
+    /**
+     * @brief 以字符串形式dump server信息
+     */
+    virtual std::string toString(const std::string& prefix = "");
+protected:
+    /**
+     * @brief 处理新连接，在io_worker的协程里执行，返回后连接被关闭
+     */
+    virtual void handleClient(Socket::ptr client);
+
+    /**
+     * @brief 开始接受连接
+     */
+    virtual void startAccept(Socket::ptr sock);
+private:
+    /**
+     * @brief 连接协程的入口，handleClient返回后把连接移出连接表
+     */
+    void runClient(Socket::ptr client);
+
+    /**
+     * @brief shutdown所有还在处理的连接
+     */
+    void shutdownClients();
+protected:
+    /// 监听Socket数组，由m_mutex保护
+    std::vector<Socket::ptr> m_socks;
+    /// 新连接的Socket工作的调度器
+    IOManager* m_ioWorker;
+    /// 服务器Socket接收连接的调度器
+    IOManager* m_acceptWorker;
+    /// 接收超时时间(毫秒)
+    uint64_t m_recvTimeout;
+    /// 每个地址的监听socket数
+    uint32_t m_listeners;
+    /// 服务器名称
+    std::string m_name;
+    /// 服务是否停止
+    std::atomic<bool> m_isStop;
+private:
+    mutable MutexType m_mutex;
+    /// 是否调用过stop，由m_mutex保护
+    bool m_stopped;
+    /// 正在处理的连接
+    std::unordered_set<Socket::ptr> m_clients;
+    /// stop之后强制shutdown连接的定时器
+    Timer::ptr m_stopTimer;
+};
+
+}
+
+#endif
@@ -5,6 +5,7 @@
 #ifndef __SYLAR_THREAD_H__
 #define __SYLAR_THREAD_H__
 
+#include <string>
 #include "mutex.h"
 
 namespace sylar {
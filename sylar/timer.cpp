@@ -140,6 +140,10 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
         }
     }
     RWMutexType::WriteLock lock(m_mutex);
+    // 换写锁的间隙里别的线程可能已经取走了所有timer
+    if(m_timers.empty()) {
+        return;
+    }
 
     bool rollover = detectClockRollover(now_ms);
     if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
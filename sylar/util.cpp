@@ -8,8 +8,16 @@ namespace sylar {
 
 Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+// 每条日志都要取线程id，缓存起来省掉系统调用
+static thread_local pid_t t_thread_id = 0;
+// fork出来的子进程里线程id变了，需要重新取
+static int s_thread_id_atfork = pthread_atfork(nullptr, nullptr, [](){ t_thread_id = 0; });
+
 pid_t GetThreadId() {
-    return syscall(SYS_gettid);
+    if(__builtin_expect(!t_thread_id, 0)) {
+        t_thread_id = syscall(SYS_gettid);
+    }
+    return t_thread_id;
 }
 
 uint32_t GetFiberId() {
@@ -85,7 +85,263 @@ void test() {
 #undef XX
 }
 
+// 不同量级的随机数,覆盖1~10字节的Varint
+template<class T>
+static T rand_varint() {
+    int bits = rand() % (sizeof(T) * 8) + 1;
+    uint64_t v = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 2) ^ rand();
+    return bits >= 64 ? v : (T)(v & ((1ull << bits) - 1));
+}
+
+void test_array() {
+#define XX(type, len, write_fun, read_fun, write_arr, read_arr, base_len) { \
+    std::vector<type> vec; \
+    for(int i = 0; i < len; ++i) { \
+        vec.push_back(i % 3 ? rand_varint<type>() : rand() % 0x80); \
+    } \
+    sylar::ByteArray::ptr ba(new sylar::ByteArray(base_len)); \
+    ba->write_arr(&vec[0], vec.size()); \
+    sylar::ByteArray::ptr ba2(new sylar::ByteArray(base_len)); \
+    for(auto& i : vec) { \
+        ba2->write_fun(i); \
+    } \
+    SYLAR_ASSERT(ba->getSize() == ba2->getSize()); \
+    ba->setPosition(0); \
+    ba2->setPosition(0); \
+    SYLAR_ASSERT(ba->toString() == ba2->toString()); \
+    std::vector<type> out(vec.size()); \
+    ba->read_arr(&out[0], out.size()); \
+    SYLAR_ASSERT(out == vec); \
+    SYLAR_ASSERT(ba->getReadSize() == 0); \
+    for(size_t i = 0; i < vec.size(); ++i) { \
+        SYLAR_ASSERT(ba2->read_fun() == vec[i]); \
+    } \
+    SYLAR_LOG_INFO(g_logger) << #write_arr "/" #read_arr \
+            " (" #type ") len=" << len \
+            << " base_len=" << base_len \
+            << " size=" << ba->getSize(); \
+}
+    XX(uint32_t, 1000, writeUint32, readUint32, writeUint32Array, readUint32Array, 1);
+    XX(uint32_t, 1000, writeUint32, readUint32, writeUint32Array, readUint32Array, 7);
+    XX(uint32_t, 1000, writeUint32, readUint32, writeUint32Array, readUint32Array, 4096);
+    XX(uint64_t, 1000, writeUint64, readUint64, writeUint64Array, readUint64Array, 1);
+    XX(uint64_t, 1000, writeUint64, readUint64, writeUint64Array, readUint64Array, 13);
+    XX(uint64_t, 1000, writeUint64, readUint64, writeUint64Array, readUint64Array, 4096);
+#undef XX
+
+    // 数据不足时抛出std::out_of_range
+    sylar::ByteArray::ptr ba(new sylar::ByteArray(3));
+    uint32_t in[4] = {1, 300, 70000, 5};
+    ba->writeUint32Array(in, 3);
+    ba->setPosition(0);
+    uint32_t out[4] = {0};
+    bool thrown = false;
+    try {
+        ba->readUint32Array(out, 4);
+    } catch(std::out_of_range&) {
+        thrown = true;
+    }
+    SYLAR_ASSERT(thrown);
+    SYLAR_ASSERT(out[0] == 1 && out[1] == 300 && out[2] == 70000);
+}
+
+void bench_varint() {
+    const size_t count = 1000000;
+    std::vector<uint32_t> vec(count);
+    for(auto& i : vec) {
+        i = rand() % 3 ? rand() % 0x80 : rand_varint<uint32_t>();
+    }
+    std::vector<uint32_t> out(count);
+
+    sylar::ByteArray::ptr ba(new sylar::ByteArray());
+    uint64_t start = sylar::GetCurrentUS();
+    for(auto& i : vec) {
+        ba->writeUint32(i);
+    }
+    uint64_t write_one = sylar::GetCurrentUS() - start;
+    ba->setPosition(0);
+    start = sylar::GetCurrentUS();
+    for(auto& i : out) {
+        i = ba->readUint32();
+    }
+    uint64_t read_one = sylar::GetCurrentUS() - start;
+    SYLAR_ASSERT(out == vec);
+
+    ba->clear();
+    start = sylar::GetCurrentUS();
+    ba->writeUint32Array(&vec[0], count);
+    uint64_t write_arr = sylar::GetCurrentUS() - start;
+    ba->setPosition(0);
+    start = sylar::GetCurrentUS();
+    ba->readUint32Array(&out[0], count);
+    uint64_t read_arr = sylar::GetCurrentUS() - start;
+    SYLAR_ASSERT(out == vec);
+
+    SYLAR_LOG_INFO(g_logger) << "varint32 count=" << count
+        << " writeUint32=" << write_one << "us readUint32=" << read_one << "us"
+        << " writeUint32Array=" << write_arr << "us readUint32Array=" << read_arr << "us";
+}
+
+void test_seek() {
+    // 跨块回填长度字段
+    sylar::ByteArray::ptr ba(new sylar::ByteArray(7));
+    std::vector<size_t> marks;
+    std::vector<uint32_t> lens;
+    for(int i = 0; i < 1000; ++i) {
+        marks.push_back(ba->getPosition());
+        ba->writeFuint32(0);
+        size_t begin = ba->getPosition();
+        int n = rand() % 20;
+        for(int j = 0; j < n; ++j) {
+            ba->writeUint64(rand_varint<uint64_t>());
+        }
+        lens.push_back(ba->getPosition() - begin);
+        ba->writeFuint32At(marks.back(), lens.back());
+    }
+    size_t size = ba->getSize();
+    SYLAR_ASSERT(ba->getPosition() == size);
+    for(size_t i = 0; i < marks.size(); ++i) {
+        ba->setPosition(marks[i]);
+        SYLAR_ASSERT(ba->readFuint32() == lens[i]);
+    }
+
+    // 随机定位与顺序读结果一致
+    ba->setPosition(0);
+    std::string data = ba->toString();
+    for(int i = 0; i < 10000; ++i) {
+        size_t pos = rand() % size;
+        size_t len = std::min<size_t>(rand() % 32 + 1, size - pos);
+        ba->setPosition(pos);
+        std::string tmp(len, 0);
+        ba->read(&tmp[0], len);
+        SYLAR_ASSERT(tmp == data.substr(pos, len));
+        ba->read(&tmp[0], len, pos);
+        SYLAR_ASSERT(tmp == data.substr(pos, len));
+    }
+    ba->setPosition(ba->getSize());
+    ba->writeFuint8(1);
+    SYLAR_ASSERT(ba->getSize() == size + 1);
+
+    bool thrown = false;
+    try {
+        ba->writeAt(ba->getSize() - 1, "ab", 2);
+    } catch(std::out_of_range& e) {
+        thrown = true;
+    }
+    SYLAR_ASSERT(thrown);
+
+    // 大缓冲区上的随机定位
+    sylar::ByteArray::ptr big(new sylar::ByteArray(4096));
+    std::string buf(64 * 1024 * 1024, 'x');
+    big->write(buf.c_str(), buf.size());
+    const int count = 1000000;
+    uint64_t ts = sylar::GetCurrentUS();
+    uint64_t sum = 0;
+    for(int i = 0; i < count; ++i) {
+        big->setPosition((size_t)rand() % buf.size());
+        sum += big->getPosition();
+    }
+    uint64_t ts2 = sylar::GetCurrentUS();
+    SYLAR_LOG_INFO(g_logger) << "test_seek size=" << size
+        << " setPosition count=" << count << " nodes=" << buf.size() / 4096
+        << " cost=" << (ts2 - ts) << "us sum=" << sum;
+}
+
+void test_file() {
+    sylar::ByteArray::ptr ba(new sylar::ByteArray(1000));
+    for(int i = 0; i < 100000; ++i) {
+        ba->writeUint32(rand_varint<uint32_t>());
+    }
+    ba->setPosition(0);
+    std::string data = ba->toString();
+
+    // O_DIRECT写入,尾部不足4K
+    SYLAR_ASSERT(ba->writeToFile("/tmp/test_bytearray_direct.dat", true));
+    SYLAR_ASSERT(ba->getPosition() == 0);
+
+    // 整个文件映射
+    sylar::ByteArray::ptr mba = sylar::ByteArray::MapFile("/tmp/test_bytearray_direct.dat");
+    SYLAR_ASSERT(mba && mba->isReadOnly());
+    SYLAR_ASSERT(mba->getSize() == data.size());
+    SYLAR_ASSERT(mba->toString() == data);
+    for(int i = 0; i < 100000; ++i) {
+        SYLAR_ASSERT(mba->readUint32() == ba->readUint32());
+    }
+    bool thrown = false;
+    try {
+        mba->writeFuint8(1);
+    } catch(std::logic_error& e) {
+        thrown = true;
+    }
+    SYLAR_ASSERT(thrown);
+
+    // 非页对齐的偏移
+    sylar::ByteArray::ptr part = sylar::ByteArray::MapFile("/tmp/test_bytearray_direct.dat", 5001, 1234);
+    SYLAR_ASSERT(part && part->toString() == data.substr(5001, 1234));
+    part = sylar::ByteArray::MapFile("/tmp/test_bytearray_direct.dat", data.size() - 10);
+    SYLAR_ASSERT(part && part->toString() == data.substr(data.size() - 10));
+    // 空区域返回空ByteArray
+    part = sylar::ByteArray::MapFile("/tmp/test_bytearray_direct.dat", 5001, 0);
+    SYLAR_ASSERT(part && part->getSize() == 0);
+    part = sylar::ByteArray::MapFile("/tmp/test_bytearray_direct.dat", data.size());
+    SYLAR_ASSERT(part && part->getSize() == 0);
+
+    // 分批追加写
+    sylar::ByteArrayFileWriter writer(4096);
+    SYLAR_ASSERT(writer.open("/tmp/test_bytearray_writer.dat", false, true));
+    for(size_t i = 0; i < data.size(); i += 777) {
+        SYLAR_ASSERT(writer.write(data.c_str() + i, std::min<size_t>(777, data.size() - i)));
+    }
+    SYLAR_ASSERT(writer.getSize() == data.size());
+    SYLAR_ASSERT(writer.close());
+    sylar::ByteArray::ptr ba2(new sylar::ByteArray(333));
+    SYLAR_ASSERT(ba2->readFromFile("/tmp/test_bytearray_writer.dat"));
+    ba2->setPosition(0);
+    SYLAR_ASSERT(ba2->toString() == data);
+
+    // st_size为0的文件要读到EOF
+    sylar::ByteArray::ptr proc(new sylar::ByteArray(16));
+    SYLAR_ASSERT(proc->readFromFile("/proc/self/status"));
+    proc->setPosition(0);
+    SYLAR_ASSERT(proc->toString().find("Name:") == 0);
+    SYLAR_LOG_INFO(g_logger) << "test_file size=" << data.size()
+        << " direct=" << writer.isDirect();
+}
+
+void bench_file() {
+    const size_t len = 64 * 1024 * 1024;
+    sylar::ByteArray::ptr ba(new sylar::ByteArray(1024 * 1024));
+    std::string buf(len / 64, 'x');
+    for(int i = 0; i < 64; ++i) {
+        ba->write(buf.c_str(), buf.size());
+    }
+    ba->setPosition(0);
+
+    uint64_t ts = sylar::GetCurrentMS();
+    SYLAR_ASSERT(ba->writeToFile("/tmp/test_bytearray_bench.dat"));
+    uint64_t ts2 = sylar::GetCurrentMS();
+    sylar::ByteArray::ptr rba(new sylar::ByteArray(1024 * 1024));
+    SYLAR_ASSERT(rba->readFromFile("/tmp/test_bytearray_bench.dat"));
+    uint64_t ts3 = sylar::GetCurrentMS();
+    sylar::ByteArray::ptr mba = sylar::ByteArray::MapFile("/tmp/test_bytearray_bench.dat");
+    uint64_t sum = 0;
+    while(mba->getReadSize() >= 8) {
+        sum += mba->readFuint64();
+    }
+    uint64_t ts4 = sylar::GetCurrentMS();
+    SYLAR_LOG_INFO(g_logger) << "bench_file size=" << len
+        << " writeToFile=" << (ts2 - ts) << "ms"
+        << " readFromFile=" << (ts3 - ts2) << "ms"
+        << " MapFile+read=" << (ts4 - ts3) << "ms"
+        << " sum=" << sum;
+}
+
 int main(int argc, char** argv) {
     test();
+    test_array();
+    bench_varint();
+    test_seek();
+    test_file();
+    bench_file();
     return 0;
 }
@@ -0,0 +1,331 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/channel.h"
+#include <list>
+#include <time.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+void test_channel() {
+    const int producers = 4;
+    const int consumers = 4;
+    const int count = 5000;
+    sylar::Channel<int> ch(8);
+    std::atomic<int64_t> sum(0);
+    std::atomic<int> received(0);
+    {
+        sylar::IOManager iom(4, false, "channel");
+        sylar::FiberWaitGroup* wg = new sylar::FiberWaitGroup(producers);
+        for(int i = 0; i < producers; ++i) {
+            iom.schedule([&ch, wg, count]() {
+                for(int j = 1; j <= count; ++j) {
+                    SYLAR_ASSERT(ch.send(j));
+                }
+                wg->done();
+            });
+        }
+        for(int i = 0; i < consumers; ++i) {
+            iom.schedule([&ch, &sum, &received]() {
+                int v;
+                while(ch.recv(v)) {
+                    sum += v;
+                    ++received;
+                }
+            });
+        }
+        iom.schedule([&ch, wg]() {
+            wg->wait();
+            ch.close();
+            delete wg;
+        });
+    }
+    SYLAR_ASSERT(received == producers * count);
+    SYLAR_ASSERT(sum == (int64_t)producers * count * (count + 1) / 2);
+    SYLAR_ASSERT(ch.size() == 0);
+    SYLAR_LOG_INFO(g_logger) << "test_channel ok";
+}
+
+void test_close_timeout() {
+    sylar::Channel<std::string>::ptr ch(new sylar::Channel<std::string>());
+    std::atomic<int> woken(0);
+    {
+        sylar::IOManager iom(2, false, "close");
+        iom.schedule([]() {
+            sylar::Channel<int> ch(2);
+            int v = 0;
+            uint64_t ts = now_ms();
+            SYLAR_ASSERT(!ch.recvFor(v, 50));
+            SYLAR_ASSERT(now_ms() - ts >= 45);
+            SYLAR_ASSERT(ch.trySend(1));
+            SYLAR_ASSERT(ch.trySend(2));
+            SYLAR_ASSERT(!ch.trySend(3));
+            ts = now_ms();
+            SYLAR_ASSERT(!ch.sendFor(3, 50));
+            SYLAR_ASSERT(now_ms() - ts >= 45);
+            ch.close();
+            SYLAR_ASSERT(!ch.send(3));
+            // 关闭前的消息还能取出来
+            SYLAR_ASSERT(ch.recv(v) && v == 1);
+            SYLAR_ASSERT(ch.tryRecv(v) && v == 2);
+            SYLAR_ASSERT(!ch.recv(v));
+        });
+
+        // close唤醒挂起的接收者
+        for(int i = 0; i < 4; ++i) {
+            iom.schedule([ch, &woken]() {
+                std::string v;
+                SYLAR_ASSERT(!ch->recv(v));
+                ++woken;
+            });
+        }
+        iom.schedule([ch]() {
+            usleep(20 * 1000);
+            ch->close();
+        });
+    }
+    SYLAR_ASSERT(woken == 4);
+    SYLAR_LOG_INFO(g_logger) << "test_close_timeout ok";
+}
+
+void test_select() {
+    sylar::Channel<int> ints(4);
+    sylar::Channel<std::string> strs;
+    sylar::Channel<int> out(1);
+    int got_int = 0;
+    int got_str = 0;
+    {
+        sylar::IOManager iom(2, false, "select");
+        iom.schedule([&]() {
+            // 没有就绪的分支
+            int i;
+            std::string s;
+            sylar::Channel<int> empty_ints;
+            sylar::Channel<std::string> empty_strs;
+            sylar::ChannelSelect sel0;
+            sel0.recv(empty_ints, i).recv(empty_strs, s);
+            SYLAR_ASSERT(sel0.tryWait() == -1);
+            uint64_t ts = now_ms();
+            SYLAR_ASSERT(sel0.wait(50) == -1);
+            SYLAR_ASSERT(now_ms() - ts >= 45);
+
+            bool ints_open = true;
+            bool strs_open = true;
+            while(ints_open || strs_open) {
+                bool ok = false;
+                sylar::ChannelSelect sel;
+                if(ints_open) {
+                    sel.recv(ints, i, &ok);
+                }
+                if(strs_open) {
+                    sel.recv(strs, s, &ok);
+                }
+                int rt = sel.wait(2000);
+                SYLAR_ASSERT(rt >= 0);
+                bool is_int = ints_open && rt == 0;
+                if(is_int) {
+                    if(ok) {
+                        ++got_int;
+                    } else {
+                        ints_open = false;
+                    }
+                } else {
+                    if(ok) {
+                        SYLAR_ASSERT(s == "str");
+                        ++got_str;
+                    } else {
+                        strs_open = false;
+                    }
+                }
+            }
+
+            // 发送分支
+            int v = 7;
+            sylar::ChannelSelect sel2;
+            sel2.send(out, v);
+            SYLAR_ASSERT(sel2.tryWait() == 0);
+            SYLAR_ASSERT(sel2.wait(20) == -1);
+            SYLAR_ASSERT(out.tryRecv(v) && v == 7);
+        });
+        iom.schedule([&]() {
+            for(int j = 0; j < 100; ++j) {
+                ints.send(j);
+                if(j % 10 == 0) {
+                    usleep(1000);
+                }
+            }
+            ints.close();
+        });
+        iom.schedule([&]() {
+            for(int j = 0; j < 100; ++j) {
+                strs.send("str");
+                if(j % 7 == 0) {
+                    usleep(1000);
+                }
+            }
+            strs.close();
+        });
+    }
+    SYLAR_ASSERT(got_int == 100);
+    SYLAR_ASSERT(got_str == 100);
+    SYLAR_LOG_INFO(g_logger) << "test_select ok";
+}
+
+void test_spsc() {
+    const int count = 100000;
+    sylar::SpscChannel<int> ch(64);
+    SYLAR_ASSERT(ch.getCapacity() == 64);
+    int received = 0;
+    {
+        sylar::IOManager iom(2, false, "spsc");
+        iom.schedule([&ch, count]() {
+            for(int i = 0; i < count; ++i) {
+                SYLAR_ASSERT(ch.send(i));
+            }
+            ch.close();
+        });
+        iom.schedule([&ch, &received]() {
+            int v;
+            while(ch.recv(v)) {
+                // 顺序不能乱
+                SYLAR_ASSERT(v == received);
+                ++received;
+            }
+        });
+    }
+    SYLAR_ASSERT(received == count);
+    SYLAR_LOG_INFO(g_logger) << "test_spsc ok";
+}
+
+// 现在各处的写法: list + Mutex + FiberSemaphore
+class AdhocQueue {
+public:
+    void send(int v) {
+        {
+            sylar::Mutex::Lock lock(m_mutex);
+            m_list.push_back(v);
+        }
+        m_sem.notify();
+    }
+    bool recv(int& v) {
+        m_sem.wait();
+        sylar::Mutex::Lock lock(m_mutex);
+        v = m_list.front();
+        m_list.pop_front();
+        return v >= 0;
+    }
+    void close(int consumers) {
+        for(int i = 0; i < consumers; ++i) {
+            send(-1);
+        }
+    }
+private:
+    sylar::Mutex m_mutex;
+    std::list<int> m_list;
+    sylar::FiberSemaphore m_sem;
+};
+
+class ChannelQueue {
+public:
+    ChannelQueue(size_t capacity)
+        :m_ch(capacity) {
+    }
+    void send(int v) { m_ch.send(v);}
+    bool recv(int& v) { return m_ch.recv(v);}
+    void close(int) { m_ch.close();}
+private:
+    sylar::Channel<int> m_ch;
+};
+
+class SpscQueue {
+public:
+    SpscQueue(size_t capacity)
+        :m_ch(capacity) {
+    }
+    void send(int v) { m_ch.send(v);}
+    bool recv(int& v) { return m_ch.recv(v);}
+    void close(int) { m_ch.close();}
+private:
+    sylar::SpscChannel<int> m_ch;
+};
+
+// producers个协程各发count条，consumers个协程接收，返回每秒消息数
+template<class Queue>
+static uint64_t bench_queue(Queue& queue, int producers, int consumers, int count) {
+    std::atomic<int64_t> received(0);
+    uint64_t ts = now_ms();
+    {
+        sylar::IOManager iom(4, false, "bench");
+        sylar::FiberWaitGroup* wg = new sylar::FiberWaitGroup(producers);
+        for(int i = 0; i < producers; ++i) {
+            iom.schedule([&queue, wg, count]() {
+                for(int j = 0; j < count; ++j) {
+                    queue.send(j);
+                }
+                wg->done();
+            });
+        }
+        for(int i = 0; i < consumers; ++i) {
+            iom.schedule([&queue, &received]() {
+                int v;
+                int64_t n = 0;
+                while(queue.recv(v)) {
+                    ++n;
+                }
+                received += n;
+            });
+        }
+        iom.schedule([&queue, wg, consumers]() {
+            wg->wait();
+            queue.close(consumers);
+            delete wg;
+        });
+    }
+    uint64_t cost = now_ms() - ts;
+    SYLAR_ASSERT(received == (int64_t)producers * count);
+    return received * 1000 / (cost ? cost : 1);
+}
+
+void bench() {
+    const int count = 1000000;
+    {
+        AdhocQueue q;
+        SYLAR_LOG_INFO(g_logger) << "bench 4x4 list+mutex+sem msgs/s=" << bench_queue(q, 4, 4, count);
+    }
+    {
+        ChannelQueue q(0);
+        SYLAR_LOG_INFO(g_logger) << "bench 4x4 channel(unbounded) msgs/s=" << bench_queue(q, 4, 4, count);
+    }
+    {
+        ChannelQueue q(1024);
+        SYLAR_LOG_INFO(g_logger) << "bench 4x4 channel(1024) msgs/s=" << bench_queue(q, 4, 4, count);
+    }
+    {
+        AdhocQueue q;
+        SYLAR_LOG_INFO(g_logger) << "bench 1x1 list+mutex+sem msgs/s=" << bench_queue(q, 1, 1, count * 4);
+    }
+    {
+        ChannelQueue q(1024);
+        SYLAR_LOG_INFO(g_logger) << "bench 1x1 channel(1024) msgs/s=" << bench_queue(q, 1, 1, count * 4);
+    }
+    {
+        SpscQueue q(1024);
+        SYLAR_LOG_INFO(g_logger) << "bench 1x1 spsc(1024) msgs/s=" << bench_queue(q, 1, 1, count * 4);
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_channel();
+    test_close_timeout();
+    test_select();
+    test_spsc();
+    bench();
+    return 0;
+}
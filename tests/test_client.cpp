@@ -3,6 +3,7 @@
 #include "../sylar/bytearray.h"
 #include "../sylar/address.h"
 #include "../sylar/socket.h"
+#include "../sylar/streams/socket_stream.h"
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
@@ -23,8 +24,8 @@ void client() {
     std::string record = "hello world, client";  // 19
     ba->writeStringF16(record);  // 二进制序列化
     ba->setPosition(0);
-    record = ba->toString();     // 获取要发送的二进制
-    int rt = sock->send(&record[0], record.size());
+    sylar::SocketStream stream(sock, false);
+    int rt = stream.writeFixSize(ba, ba->getSize());
     // SYLAR_LOG_INFO(g_logger) << "send size=" << rt;
     if(rt <= 0) {
         SYLAR_LOG_INFO(g_logger) << "send fail rt=" << rt;
@@ -32,20 +33,21 @@ void client() {
     }
 
     ba->clear();
-    // 接受数据
-    std::string buffs;
-    buffs.resize(4096);
-    rt = sock->recv(&buffs[0], buffs.size());
-    // SYLAR_LOG_INFO(g_logger) << "recv size=" << rt;
+    // 接受数据：先读2字节长度，再读内容
+    rt = stream.readFixSize(ba, 2);
+    if(rt > 0) {
+        ba->setPosition(0);
+        uint16_t len = ba->readFuint16();
+        rt = stream.readFixSize(ba, len);
+    }
+    // SYLAR_LOG_INFO(g_logger) << "recv size=" << ba->getSize();
     if(rt <= 0) {
         SYLAR_LOG_INFO(g_logger) << "recv fail rt=" << rt;
         return;
     }
-    buffs.resize(rt);
     // 二进制反序列化
-    ba->writeStringWithoutLength(buffs);
     ba->setPosition(0);
-    buffs = ba->readStringF16();
+    std::string buffs = ba->readStringF16();
     // SYLAR_LOG_INFO(g_logger) << buffs;
 }
 
@@ -0,0 +1,230 @@
+#include "../sylar/sylar.h"
+#include <fstream>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<int>::ptr g_port =
+    sylar::Config::Lookup("reload.port", 80, "port");
+static sylar::ConfigVar<std::string>::ptr g_name =
+    sylar::Config::Lookup("reload.name", std::string("none"), "name");
+static sylar::ConfigVar<std::vector<int> >::ptr g_vec =
+    sylar::Config::Lookup("reload.vec", std::vector<int>(), "vec");
+static sylar::ConfigVar<std::map<std::string, std::vector<int> > >::ptr g_map =
+    sylar::Config::Lookup("reload.map", std::map<std::string, std::vector<int> >(), "map");
+static sylar::ConfigVar<std::set<std::string> >::ptr g_set =
+    sylar::Config::Lookup("reload.set", std::set<std::string>(), "set");
+
+static void write_file(const std::string& file, const std::string& content) {
+    // 先写临时文件再rename，和大多数编辑器/发布工具一样
+    std::string tmp = file + ".tmp";
+    std::ofstream ofs(tmp);
+    ofs << content;
+    ofs.close();
+    rename(tmp.c_str(), file.c_str());
+}
+
+void test_load() {
+    YAML::Node root = YAML::Load(
+        "reload:\n"
+        "  port: 8080\n"
+        "  name: 'a: b # c'\n"
+        "  vec: [1, 2, 3]\n"
+        "  map:\n"
+        "    x: [1]\n"
+        "    y: [2, 3]\n"
+        "  set: [b, a, b]\n");
+    SYLAR_ASSERT(sylar::Config::LoadFromYaml(root) == 5);
+    SYLAR_ASSERT(g_port->getValue() == 8080);
+    SYLAR_ASSERT(g_name->getValue() == "a: b # c");
+    SYLAR_ASSERT(g_vec->getValue() == std::vector<int>({1, 2, 3}));
+    SYLAR_ASSERT(g_map->getValue().size() == 2);
+    SYLAR_ASSERT(g_map->getValue().at("y") == std::vector<int>({2, 3}));
+    SYLAR_ASSERT(g_set->getValue().size() == 2);
+
+    // 和上一次相同的节点跳过
+    YAML::Node root2 = YAML::Load(
+        "reload:\n"
+        "  port: 8081\n"
+        "  name: 'a: b # c'\n"
+        "  vec: [1, 2, 3]\n"
+        "  map:\n"
+        "    x: [1]\n"
+        "    y: [2, 3]\n"
+        "  set: [b, a, b]\n");
+    SYLAR_ASSERT(sylar::Config::LoadFromYaml(root2, root) == 1);
+    SYLAR_ASSERT(g_port->getValue() == 8081);
+
+    // 转换失败不影响其他项
+    YAML::Node root3 = YAML::Load("reload: {port: abc, vec: [4]}");
+    SYLAR_ASSERT(sylar::Config::LoadFromYaml(root3) == 1);
+    SYLAR_ASSERT(g_port->getValue() == 8081);
+    SYLAR_ASSERT(g_vec->getValue() == std::vector<int>({4}));
+    SYLAR_LOG_INFO(g_logger) << "test_load ok";
+}
+
+void test_batch() {
+    int called = 0;
+    // 通知时其他配置项已经是新值
+    uint64_t id1 = g_port->addListener([&called](const int& old_value, const int& new_value) {
+        SYLAR_ASSERT(g_name->getValue() == "batch");
+        ++called;
+    });
+    uint64_t id2 = g_name->addListener([&called](const std::string& old_value, const std::string& new_value) {
+        SYLAR_ASSERT(g_port->getValue() == 9000);
+        ++called;
+    });
+    sylar::Config::LoadFromYaml(YAML::Load("reload: {port: 9000, name: batch}"));
+    SYLAR_ASSERT(called == 2);
+    g_port->delListener(id1);
+    g_name->delListener(id2);
+    SYLAR_LOG_INFO(g_logger) << "test_batch ok";
+}
+
+void test_watch() {
+    std::string dir = "/tmp/test_config_reload_" + std::to_string(getpid());
+    mkdir(dir.c_str(), 0755);
+    std::string file = dir + "/app.yml";
+    write_file(file, "reload:\n  port: 1000\n");
+
+    sylar::ConfigWatcher::ptr watcher(new sylar::ConfigWatcher(dir, 50));
+    SYLAR_ASSERT(watcher->start());
+    SYLAR_ASSERT(g_port->getValue() == 1000);
+
+    std::atomic<int> changed(0);
+    uint64_t id = g_port->addListener([&changed](const int& old_value, const int& new_value) {
+        ++changed;
+    });
+    // 连续的几次改动合并成一次加载
+    write_file(file, "reload:\n  port: 1001\n");
+    write_file(file, "reload:\n  port: 1002\n");
+    write_file(dir + "/ignore.txt", "reload:\n  port: 1\n");
+    for(int i = 0; i < 300 && g_port->getValue() != 1002; ++i) {
+        usleep(10 * 1000);
+    }
+    SYLAR_ASSERT(g_port->getValue() == 1002);
+    SYLAR_ASSERT(watcher->getReloads() == 1);
+    SYLAR_ASSERT(changed == 1);
+
+    // 解析失败保留原值
+    write_file(file, "reload: [port: \n");
+    for(int i = 0; i < 50; ++i) {
+        usleep(10 * 1000);
+    }
+    SYLAR_ASSERT(g_port->getValue() == 1002);
+    g_port->delListener(id);
+    watcher->stop();
+
+    // 文件没变，但配置被setValue改过，重新加载要恢复成文件里的值
+    write_file(file, "reload:\n  port: 2000\n  name: file\n");
+    SYLAR_ASSERT(sylar::Config::LoadFromFile(file));
+    SYLAR_ASSERT(g_port->getValue() == 2000);
+    g_port->setValue(2001);
+    SYLAR_ASSERT(sylar::Config::LoadFromFile(file));
+    SYLAR_ASSERT(g_port->getValue() == 2000);
+    // 被别的来源改过
+    sylar::Config::LoadFromYaml(YAML::Load("reload: {name: other}"));
+    SYLAR_ASSERT(sylar::Config::LoadFromFile(file));
+    SYLAR_ASSERT(g_name->getValue() == "file");
+
+    unlink(file.c_str());
+    unlink((dir + "/ignore.txt").c_str());
+    rmdir(dir.c_str());
+    SYLAR_LOG_INFO(g_logger) << "test_watch ok";
+}
+
+// 原来的加载方式：平铺所有节点，非标量序列化成字符串再fromString
+static void legacy_load(const std::string& prefix, const YAML::Node& node) {
+    if(!prefix.empty()) {
+        sylar::ConfigVarBase::ptr var = sylar::Config::LookupBase(prefix);
+        if(var) {
+            if(node.IsScalar()) {
+                var->fromString(node.Scalar());
+            } else {
+                std::stringstream ss;
+                ss << node;
+                var->fromString(ss.str());
+            }
+        }
+    }
+    if(node.IsMap()) {
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            legacy_load(prefix.empty() ? it->first.Scalar() : prefix + "." + it->first.Scalar(), it->second);
+        }
+    }
+}
+
+static std::string make_config(int keys, int value) {
+    std::stringstream ss;
+    ss << "bench:\n";
+    for(int i = 0; i < keys; ++i) {
+        if(i % 10 == 0) {
+            ss << "  v" << i << ": [" << value << ", " << i << ", 3, 4, 5]\n";
+        } else {
+            ss << "  i" << i << ": " << value + i << "\n";
+        }
+    }
+    return ss.str();
+}
+
+void bench() {
+    const int keys = 10000;
+    for(int i = 0; i < keys; ++i) {
+        if(i % 10 == 0) {
+            sylar::Config::Lookup("bench.v" + std::to_string(i), std::vector<int>(), "");
+        } else {
+            sylar::Config::Lookup("bench.i" + std::to_string(i), 0, "");
+        }
+    }
+    std::string file = "/tmp/test_config_reload_bench.yml";
+    write_file(file, make_config(keys, 1));
+    YAML::Node root1 = YAML::Load(make_config(keys, 1));
+    YAML::Node root2 = YAML::Load(make_config(keys, 2));
+    YAML::Node root3 = YAML::Load(make_config(keys, 2));
+    root3["bench"]["i1"] = 12345;
+
+    uint64_t ts = sylar::GetCurrentUS();
+    legacy_load("", root1);
+    uint64_t legacy = sylar::GetCurrentUS() - ts;
+
+    ts = sylar::GetCurrentUS();
+    size_t all = sylar::Config::LoadFromYaml(root2);
+    uint64_t typed = sylar::GetCurrentUS() - ts;
+
+    ts = sylar::GetCurrentUS();
+    size_t one = sylar::Config::LoadFromYaml(root3, root2);
+    uint64_t diff = sylar::GetCurrentUS() - ts;
+    SYLAR_ASSERT(all == (size_t)keys);
+    SYLAR_ASSERT(one == 1);
+
+    YAML::Node root4 = YAML::Load(make_config(keys, 2));
+    ts = sylar::GetCurrentUS();
+    size_t none = sylar::Config::LoadFromYaml(root4, root2);
+    uint64_t same = sylar::GetCurrentUS() - ts;
+    SYLAR_ASSERT(none == 0);
+
+    // 包括读文件和解析
+    sylar::Config::LoadFromFile(file);
+    write_file(file, make_config(keys, 3));
+    ts = sylar::GetCurrentUS();
+    sylar::Config::LoadFromFile(file);
+    uint64_t reload = sylar::GetCurrentUS() - ts;
+    unlink(file.c_str());
+
+    SYLAR_LOG_INFO(g_logger) << "bench keys=" << keys
+        << " legacy_load_all=" << legacy / 1000.0 << "ms"
+        << " typed_load_all=" << typed / 1000.0 << "ms"
+        << " diff_load_one_changed=" << diff / 1000.0 << "ms"
+        << " diff_load_unchanged=" << same / 1000.0 << "ms"
+        << " file_reload_all=" << reload / 1000.0 << "ms";
+}
+
+int main(int argc, char** argv) {
+    test_load();
+    test_batch();
+    test_watch();
+    bench();
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "../sylar/sylar.h"
+#include <time.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<uint32_t>::ptr g_int =
+    sylar::Config::Lookup<uint32_t>("snapshot.int", 10, "snapshot int");
+static sylar::ConfigVar<std::vector<int> >::ptr g_vec =
+    sylar::Config::Lookup("snapshot.vec", std::vector<int>(1000, 0), "snapshot vec");
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void test_snapshot() {
+    auto snap = g_vec->getSnapshot();
+    uint64_t version = g_vec->getVersion();
+    bool called = false;
+    uint64_t id = g_vec->addListener([&called](const std::vector<int>& old_value
+                    ,const std::vector<int>& new_value) {
+        // 回调在锁外执行，可以读到新值
+        SYLAR_ASSERT(g_vec->getValue() == new_value);
+        SYLAR_ASSERT(old_value[0] == 0);
+        called = true;
+    });
+    g_vec->setValue(std::vector<int>(1000, 1));
+    g_vec->delListener(id);
+    SYLAR_ASSERT(called);
+    // 旧快照不受影响
+    SYLAR_ASSERT((*snap)[0] == 0);
+    SYLAR_ASSERT(g_vec->getVersion() == version + 1);
+    // 相同的值不换快照
+    g_vec->setValue(std::vector<int>(1000, 1));
+    SYLAR_ASSERT(g_vec->getVersion() == version + 1);
+
+    sylar::ConfigVar<std::vector<int> >::Cache cache(g_vec);
+    SYLAR_ASSERT(cache.get()[0] == 1);
+    g_vec->setValue(std::vector<int>(1000, 2));
+    SYLAR_ASSERT(cache.get()[0] == 2);
+    SYLAR_LOG_INFO(g_logger) << "test_snapshot ok";
+}
+
+// 读者看到的快照必须是完整的某一版
+void test_concurrent() {
+    std::atomic<bool> stop(false);
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < 3; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([&stop](){
+            static thread_local sylar::ConfigVar<std::vector<int> >::Cache t_vec(g_vec);
+            int last = 0;
+            while(!stop) {
+                const std::vector<int>& v = t_vec.get();
+                SYLAR_ASSERT(v.front() == v.back());
+                SYLAR_ASSERT(v.front() >= last);
+                last = v.front();
+            }
+        }, "snapshot_" + std::to_string(i))));
+    }
+    for(int i = 3; i < 10000; ++i) {
+        g_vec->setValue(std::vector<int>(1000, i));
+    }
+    stop = true;
+    for(auto& i : thrs) {
+        i->join();
+    }
+    SYLAR_LOG_INFO(g_logger) << "test_concurrent ok";
+}
+
+// 并发setValue时回调串行执行，最后收到的new_value就是当前值
+void test_notify_order() {
+    std::atomic<int> inside(0);
+    uint32_t last = 0;
+    uint64_t id = g_int->addListener([&inside, &last](const uint32_t& old_value
+                    ,const uint32_t& new_value) {
+        SYLAR_ASSERT(++inside == 1);
+        last = new_value;
+        --inside;
+    });
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < 4; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([i](){
+            for(uint32_t j = 0; j < 20000; ++j) {
+                g_int->setValue(1000 + j * 4 + i);
+            }
+        }, "notify_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    g_int->delListener(id);
+    SYLAR_ASSERT(last == g_int->getValue());
+    SYLAR_LOG_INFO(g_logger) << "test_notify_order ok";
+}
+
+template<class F>
+static double bench(F f, int count) {
+    uint64_t ts = now_ns();
+    uint64_t sum = 0;
+    for(int i = 0; i < count; ++i) {
+        sum += f();
+    }
+    uint64_t cost = now_ns() - ts;
+    SYLAR_ASSERT(sum != 1);
+    return (double)cost / count;
+}
+
+void test_bench() {
+    const int count = 1000000;
+    static thread_local sylar::ConfigVar<uint32_t>::Cache t_int(g_int);
+    static thread_local sylar::ConfigVar<std::vector<int> >::Cache t_vec(g_vec);
+    SYLAR_LOG_INFO(g_logger) << "bench uint32 getValue="
+        << bench([](){ return g_int->getValue(); }, count) << "ns"
+        << " cache=" << bench([](){ return t_int.get(); }, count) << "ns";
+    SYLAR_LOG_INFO(g_logger) << "bench vector<int>(1000) getValue="
+        << bench([](){ return g_vec->getValue().size(); }, count) << "ns"
+        << " snapshot=" << bench([](){ return g_vec->getSnapshot()->size(); }, count) << "ns"
+        << " cache=" << bench([](){ return t_vec.get().size(); }, count) << "ns";
+}
+
+int main(int argc, char** argv) {
+    test_snapshot();
+    test_concurrent();
+    test_notify_order();
+    test_bench();
+    return 0;
+}
@@ -0,0 +1,346 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/fiber_sync.h"
+#include <deque>
+#include <time.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+void test_mutex() {
+    sylar::FiberMutex mutex;
+    int64_t count = 0;
+    int inside = 0;
+    {
+        sylar::IOManager iom(4, false, "mutex");
+        for(int i = 0; i < 64; ++i) {
+            iom.schedule([&mutex, &count, &inside]() {
+                for(int j = 0; j < 200; ++j) {
+                    sylar::FiberMutex::Lock lock(mutex);
+                    SYLAR_ASSERT(++inside == 1);
+                    // 持有锁时让出，线程锁在这里会卡住整个线程
+                    if(j % 50 == 0) {
+                        usleep(100);
+                    }
+                    ++count;
+                    SYLAR_ASSERT(--inside == 0);
+                }
+            });
+        }
+    }
+    SYLAR_ASSERT(count == 64 * 200);
+
+    // 超时
+    {
+        sylar::IOManager iom(2, false, "mutex_timeout");
+        iom.schedule([&mutex]() {
+            mutex.lock();
+            usleep(200 * 1000);
+            mutex.unlock();
+        });
+        iom.schedule([&mutex]() {
+            usleep(10 * 1000);
+            uint64_t ts = now_ms();
+            SYLAR_ASSERT(!mutex.lockFor(50));
+            uint64_t cost = now_ms() - ts;
+            SYLAR_ASSERT(cost >= 45 && cost < 150);
+            SYLAR_ASSERT(mutex.lockFor(1000));
+            mutex.unlock();
+        });
+    }
+    SYLAR_ASSERT(mutex.tryLock());
+    mutex.unlock();
+    SYLAR_LOG_INFO(g_logger) << "test_mutex ok";
+}
+
+void test_condition() {
+    sylar::FiberMutex mutex;
+    sylar::FiberCondition cond;
+    std::deque<int> queue;
+    int64_t sum = 0;
+    bool closed = false;
+    // 比IOManager活得久，所有协程结束之后才销毁
+    sylar::FiberWaitGroup wg(4);
+    {
+        sylar::IOManager iom(4, false, "cond");
+        for(int i = 0; i < 4; ++i) {
+            iom.schedule([&, i]() {
+                for(int j = 1; j <= 1000; ++j) {
+                    sylar::FiberMutex::Lock lock(mutex);
+                    queue.push_back(j);
+                    cond.notifyOne();
+                }
+                wg.done();
+            });
+        }
+        for(int i = 0; i < 8; ++i) {
+            iom.schedule([&]() {
+                while(true) {
+                    sylar::FiberMutex::Lock lock(mutex);
+                    cond.wait(mutex, [&]() { return !queue.empty() || closed; });
+                    if(queue.empty()) {
+                        break;
+                    }
+                    sum += queue.front();
+                    queue.pop_front();
+                }
+            });
+        }
+        iom.schedule([&]() {
+            wg.wait();
+            sylar::FiberMutex::Lock lock(mutex);
+            closed = true;
+            cond.notifyAll();
+        });
+        iom.schedule([&]() {
+            sylar::FiberCondition c;
+            sylar::FiberMutex m;
+            sylar::FiberMutex::Lock lock(m);
+            SYLAR_ASSERT(!c.waitFor(m, 30));
+        });
+    }
+    SYLAR_ASSERT(sum == 4 * 500500);
+    SYLAR_LOG_INFO(g_logger) << "test_condition ok";
+}
+
+void test_rwlock() {
+    sylar::FiberRWLock rwlock;
+    std::atomic<int> readers(0);
+    std::atomic<int> writers(0);
+    int64_t value = 0;
+    {
+        sylar::IOManager iom(4, false, "rwlock");
+        for(int i = 0; i < 32; ++i) {
+            iom.schedule([&, i]() {
+                for(int j = 0; j < 100; ++j) {
+                    if((i + j) % 8 == 0) {
+                        sylar::FiberRWLock::WriteLock lock(rwlock);
+                        SYLAR_ASSERT(++writers == 1 && readers == 0);
+                        ++value;
+                        if(j % 20 == 0) {
+                            usleep(100);
+                        }
+                        --writers;
+                    } else {
+                        sylar::FiberRWLock::ReadLock lock(rwlock);
+                        ++readers;
+                        SYLAR_ASSERT(writers == 0);
+                        if(j % 20 == 0) {
+                            usleep(100);
+                        }
+                        --readers;
+                    }
+                }
+            });
+        }
+        iom.schedule([&]() {
+            usleep(1000);
+            sylar::FiberRWLock::ReadLock lock(rwlock);
+            usleep(100 * 1000);
+        });
+        iom.schedule([&]() {
+            usleep(20 * 1000);
+            SYLAR_ASSERT(!rwlock.wrlockFor(20));
+        });
+    }
+    SYLAR_ASSERT(value == 32 * 100 / 8);
+    SYLAR_LOG_INFO(g_logger) << "test_rwlock ok";
+}
+
+// 限时写者超时放弃后，排在它后面的读者要放行，不能等到当前读者释放
+void test_rwlock_writer_timeout() {
+    sylar::FiberRWLock rwlock;
+    sylar::FiberEvent entered;
+    std::atomic<bool> admitted(false);
+    {
+        sylar::IOManager iom(2, false, "rwlock_timeout");
+        iom.schedule([&]() {
+            sylar::FiberRWLock::ReadLock lock(rwlock);
+            iom.schedule([&]() {
+                SYLAR_ASSERT(!rwlock.wrlockFor(20));
+            });
+            iom.schedule([&]() {
+                // 等写者入队后再来，会排到写者后面
+                usleep(5 * 1000);
+                sylar::FiberRWLock::ReadLock lock2(rwlock);
+                entered.set();
+            });
+            // 持有读锁等后面的读者，写者超时后它应该能拿到
+            admitted = entered.waitFor(1000);
+        });
+    }
+    SYLAR_ASSERT(admitted);
+    SYLAR_LOG_INFO(g_logger) << "test_rwlock_writer_timeout ok";
+}
+
+void test_waitgroup_event() {
+    std::atomic<int> done(0);
+    std::atomic<int> woken(0);
+    sylar::FiberEvent event;
+    sylar::FiberWaitGroup wg;
+    {
+        sylar::IOManager iom(4, false, "wg");
+        wg.add(16);
+        for(int i = 0; i < 16; ++i) {
+            iom.schedule([&, i]() {
+                event.wait();
+                ++woken;
+                usleep(1000 * (i % 4));
+                ++done;
+                wg.done();
+            });
+        }
+        iom.schedule([&]() {
+            SYLAR_ASSERT(!wg.waitFor(20));
+            SYLAR_ASSERT(woken == 0);
+            event.set();
+            wg.wait();
+            SYLAR_ASSERT(done == 16);
+            // set之后的wait立即返回
+            SYLAR_ASSERT(event.waitFor(0));
+            SYLAR_ASSERT(wg.waitFor(0));
+        });
+    }
+    SYLAR_ASSERT(done == 16);
+    SYLAR_LOG_INFO(g_logger) << "test_waitgroup_event ok";
+}
+
+/**
+ * wait返回后马上销毁对象，唤醒它的done()/set()不能再访问对象
+ */
+void test_destroy_after_wait() {
+    std::atomic<int> rounds(0);
+    {
+        sylar::IOManager iom(4, false, "destroy");
+        for(int i = 0; i < 4; ++i) {
+            iom.schedule([&]() {
+                for(int j = 0; j < 2000; ++j) {
+                    sylar::FiberWaitGroup* wg = new sylar::FiberWaitGroup(2);
+                    sylar::FiberEvent* event = new sylar::FiberEvent;
+                    sylar::IOManager::GetThis()->schedule([wg]() { wg->done();});
+                    sylar::IOManager::GetThis()->schedule([wg, event]() {
+                        wg->done();
+                        event->set();
+                    });
+                    event->wait();
+                    delete event;
+                    // 两个done()都已经调用过，wait返回后就可以销毁
+                    wg->wait();
+                    delete wg;
+                    ++rounds;
+                }
+            });
+        }
+    }
+    SYLAR_ASSERT(rounds == 4 * 2000);
+    SYLAR_LOG_INFO(g_logger) << "test_destroy_after_wait ok";
+}
+
+void test_semaphore() {
+    std::atomic<int> running(0);
+    std::atomic<int> max_running(0);
+    std::atomic<int> done(0);
+    sylar::FiberTimedSemaphore sem(3);
+    sylar::FiberWaitGroup wg(32);
+    {
+        sylar::IOManager iom(4, false, "sem");
+        for(int i = 0; i < 32; ++i) {
+            iom.schedule([&]() {
+                sem.wait();
+                int cur = ++running;
+                int m = max_running;
+                while(cur > m && !max_running.compare_exchange_weak(m, cur));
+                usleep(1000);
+                --running;
+                ++done;
+                sem.notify();
+                wg.done();
+            });
+        }
+        iom.schedule([&]() {
+            wg.wait();
+            SYLAR_ASSERT(done == 32);
+            SYLAR_ASSERT(max_running <= 3);
+            SYLAR_ASSERT(sem.getCount() == 3);
+            // 名额用完之后tryWait失败，waitFor超时
+            SYLAR_ASSERT(sem.tryWait() && sem.tryWait() && sem.tryWait());
+            SYLAR_ASSERT(!sem.tryWait());
+            uint64_t ts = now_ms();
+            SYLAR_ASSERT(!sem.waitFor(20));
+            SYLAR_ASSERT(now_ms() - ts >= 15);
+            sem.notify(3);
+            SYLAR_ASSERT(sem.getCount() == 3);
+        });
+    }
+    SYLAR_ASSERT(done == 32);
+    SYLAR_LOG_INFO(g_logger) << "test_semaphore ok";
+}
+
+// 同样的临界区，分别用线程锁和协程锁
+template<class MutexType>
+static uint64_t bench_mutex(int fibers, int count, int work, int sleep_us = 0) {
+    MutexType mutex;
+    volatile uint64_t value = 0;
+    uint64_t ts = now_ms();
+    {
+        sylar::IOManager iom(4, false, "bench");
+        for(int i = 0; i < fibers; ++i) {
+            iom.schedule([&]() {
+                for(int j = 0; j < count; ++j) {
+                    {
+                        typename MutexType::Lock lock(mutex);
+                        for(int k = 0; k < work; ++k) {
+                            value = value + 1;
+                        }
+                    }
+                    // 锁外的IO等待，hook之后只挂起协程
+                    if(sleep_us) {
+                        usleep(sleep_us);
+                    }
+                }
+            });
+        }
+    }
+    SYLAR_ASSERT(value == (uint64_t)fibers * count * work);
+    return now_ms() - ts;
+}
+
+void bench() {
+    const int fibers = 64;
+    const int count = 20000;
+    for(int work : {1, 100, 1000}) {
+        uint64_t pthread_cost = bench_mutex<sylar::Mutex>(fibers, count, work);
+        uint64_t fiber_cost = bench_mutex<sylar::FiberMutex>(fibers, count, work);
+        SYLAR_LOG_INFO(g_logger) << "bench fibers=" << fibers << " count=" << count
+            << " work=" << work
+            << " pthread_mutex=" << pthread_cost << "ms"
+            << " fiber_mutex=" << fiber_cost << "ms";
+    }
+    // 每次加锁之后有一次IO等待
+    const int io_count = 200;
+    uint64_t pthread_cost = bench_mutex<sylar::Mutex>(fibers, io_count, 100, 1000);
+    uint64_t fiber_cost = bench_mutex<sylar::FiberMutex>(fibers, io_count, 100, 1000);
+    SYLAR_LOG_INFO(g_logger) << "bench fibers=" << fibers << " count=" << io_count
+        << " work=100 io=1ms"
+        << " pthread_mutex=" << pthread_cost << "ms"
+        << " fiber_mutex=" << fiber_cost << "ms";
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_mutex();
+    test_condition();
+    test_rwlock();
+    test_rwlock_writer_timeout();
+    test_waitgroup_event();
+    test_destroy_after_wait();
+    test_semaphore();
+    bench();
+    return 0;
+}
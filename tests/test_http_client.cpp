@@ -0,0 +1,321 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/address.h"
+#include "../sylar/socket.h"
+#include "../sylar/tcp_server.h"
+#include "../sylar/http/http_server.h"
+#include "../sylar/http/http_connection.h"
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+using namespace sylar::http;
+
+static sylar::Address::ptr local_addr(uint16_t port) {
+    return sylar::IPv4Address::Create("127.0.0.1", port);
+}
+
+static uint16_t get_port(sylar::TcpServer::ptr server) {
+    return std::dynamic_pointer_cast<sylar::IPAddress>(
+            server->getSocks()[0]->getLocalAddress())->getPort();
+}
+
+static const char s_hello[] = "hello world";
+
+static HttpServer::ptr create_server(sylar::IOManager* iom) {
+    HttpServer::ptr server(new HttpServer(true, iom, iom));
+    auto sd = server->getServletDispatch();
+    sd->addServlet("/hello", [](HttpRequest& req, HttpResponse& rsp, HttpSession& session) {
+        rsp.setBodyRef(StringRef(s_hello, sizeof(s_hello) - 1));
+        return 0;
+    });
+    sd->addServlet("/echo", [](HttpRequest& req, HttpResponse& rsp, HttpSession& session) {
+        rsp.setHeader("X-Path", req.getUri());
+        rsp.setBody(req.getBody());
+        return 0;
+    });
+    sd->addServlet("/sleep", [](HttpRequest& req, HttpResponse& rsp, HttpSession& session) {
+        usleep(200 * 1000);
+        return 0;
+    });
+    sd->addServlet("/close", [](HttpRequest& req, HttpResponse& rsp, HttpSession& session) {
+        rsp.setClose(true);
+        return 0;
+    });
+    SYLAR_ASSERT(server->bind(local_addr(0)));
+    SYLAR_ASSERT(server->start());
+    return server;
+}
+
+/**
+ * @brief 按路径返回固定报文的服务器，用来测试chunked和读到关闭为止的body
+ */
+class RawServer : public sylar::TcpServer {
+public:
+    RawServer(sylar::IOManager* iom)
+        :sylar::TcpServer(iom, iom) {
+    }
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        std::string buf;
+        char tmp[4096];
+        while(true) {
+            size_t pos;
+            while((pos = buf.find("\r\n\r\n")) == std::string::npos) {
+                int rt = client->recv(tmp, sizeof(tmp));
+                if(rt <= 0) {
+                    return;
+                }
+                buf.append(tmp, rt);
+            }
+            std::string rsp;
+            bool keepalive = false;
+            if(buf.find("GET /chunked ") == 0) {
+                rsp = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                      "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nX-Trailer: a\r\n\r\n";
+            } else if(buf.find("GET /huge ") == 0) {
+                rsp = "HTTP/1.1 200 OK\r\nContent-Length: 99999999999999999\r\n\r\nhuge";
+            } else if(buf.find("GET /huge_chunk ") == 0) {
+                rsp = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                      "5\r\nhello\r\nffffffffffffffff\r\nhuge";
+            } else if(buf.find("GET /eof ") == 0) {
+                rsp = "HTTP/1.0 200 OK\r\nX-Test: eof\r\n\r\nuntil close";
+            } else if(buf.find("GET /nocontent ") == 0) {
+                // 没有长度但也没有body，连接可以继续用
+                rsp = "HTTP/1.1 204 No Content\r\n\r\n";
+                keepalive = true;
+            } else if(buf.find("HEAD /nolen ") == 0) {
+                rsp = "HTTP/1.1 200 OK\r\n\r\n";
+                keepalive = true;
+            } else {
+                rsp = "HTTP/1.1 100 Continue\r\n\r\n"
+                      "HTTP/1.1 201 Created\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok";
+            }
+            client->send(&rsp[0], rsp.size());
+            if(!keepalive) {
+                return;
+            }
+            buf.erase(0, pos + 4);
+        }
+    }
+};
+
+void test_client() {
+    sylar::IOManager iom(2, false, "http");
+    auto server = create_server(&iom);
+    uint16_t port = get_port(server);
+    RawServer::ptr raw(new RawServer(&iom));
+    SYLAR_ASSERT(raw->bind(local_addr(0)));
+    SYLAR_ASSERT(raw->start());
+    uint16_t raw_port = get_port(raw);
+
+    iom.schedule([=]() {
+        std::string base = "http://127.0.0.1:" + std::to_string(port);
+        auto r = HttpConnection::DoGet(base + "/hello", 1000);
+        SYLAR_ASSERT(r->result == 0);
+        SYLAR_ASSERT(r->response->getStatus() == HttpStatus::OK);
+        SYLAR_ASSERT(r->response->getBody() == s_hello);
+        SYLAR_ASSERT(r->response->isClose());
+
+        r = HttpConnection::DoPost(base + "/echo?a=1#frag", 1000, {{"X-Test", "1"}}, "body");
+        SYLAR_ASSERT(r->result == 0 && r->response->getBody() == "body");
+        SYLAR_ASSERT(r->response->getHeader("x-path") == "/echo?a=1");
+
+        r = HttpConnection::DoGet(base + "/none", 1000);
+        SYLAR_ASSERT(r->result == 0 && r->response->getStatus() == HttpStatus::NOT_FOUND);
+
+        r = HttpConnection::DoGet(base + "/sleep", 50);
+        SYLAR_ASSERT(r->result == (int)HttpResult::Error::TIMEOUT);
+
+        r = HttpConnection::DoGet("https://127.0.0.1/", 1000);
+        SYLAR_ASSERT(r->result == (int)HttpResult::Error::INVALID_URL);
+        r = HttpConnection::DoGet("http://127.0.0.1:99999/", 1000);
+        SYLAR_ASSERT(r->result == (int)HttpResult::Error::INVALID_URL);
+
+        std::string raw_base = "http://127.0.0.1:" + std::to_string(raw_port);
+        r = HttpConnection::DoGet(raw_base + "/chunked", 1000);
+        SYLAR_ASSERT(r->result == 0 && r->response->getBody() == "hello world");
+        r = HttpConnection::DoGet(raw_base + "/eof", 1000);
+        SYLAR_ASSERT(r->result == 0 && r->response->getBody() == "until close");
+        SYLAR_ASSERT(r->response->getVersion() == 0x10 && r->response->getHeader("X-Test") == "eof");
+        // 服务端给的长度超过http.client.max_body_size
+        r = HttpConnection::DoGet(raw_base + "/huge", 1000);
+        SYLAR_ASSERT(r->result == (int)HttpResult::Error::PARSE_ERROR);
+        r = HttpConnection::DoGet(raw_base + "/huge_chunk", 1000);
+        SYLAR_ASSERT(r->result == (int)HttpResult::Error::PARSE_ERROR);
+        r = HttpConnection::DoGet(raw_base + "/continue", 1000);
+        SYLAR_ASSERT(r->result == 0 && r->response->getStatus() == HttpStatus::CREATED);
+        SYLAR_ASSERT(r->response->getBody() == "ok");
+
+        // 204和HEAD的响应没有长度也没有body，连接留着复用
+        {
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(local_addr(raw_port));
+            SYLAR_ASSERT(sock->connect(local_addr(raw_port), 1000));
+            HttpConnection conn(sock, "127.0.0.1");
+            r = conn.request(HttpClientRequest(HttpMethod::GET, "/nocontent"), 1000);
+            SYLAR_ASSERT(r->result == 0 && r->response->getStatus() == HttpStatus::NO_CONTENT);
+            SYLAR_ASSERT(!r->response->isClose() && !conn.isClose());
+            r = conn.request(HttpClientRequest(HttpMethod::HEAD, "/nolen"), 1000);
+            SYLAR_ASSERT(r->result == 0 && r->response->getBody().empty());
+            SYLAR_ASSERT(!r->response->isClose() && !conn.isClose());
+            SYLAR_ASSERT(conn.getRequestCount() == 2);
+        }
+
+        server->stop();
+        raw->stop();
+        SYLAR_LOG_INFO(g_logger) << "test_client ok";
+    });
+}
+
+void test_pool() {
+    sylar::IOManager iom(2, false, "http");
+    auto server = create_server(&iom);
+    uint16_t port = get_port(server);
+
+    iom.schedule([=]() {
+        auto pool = HttpConnectionPool::Create("127.0.0.1", port, 2, 4, 100, 1000);
+        // 顺序请求复用同一个连接
+        for(int i = 0; i < 10; ++i) {
+            auto r = pool->doGet("/hello", 1000);
+            SYLAR_ASSERT(r->result == 0 && r->response->getBody() == s_hello);
+        }
+        SYLAR_ASSERT(pool->getTotalCount() == 1 && pool->getIdleCount() == 1);
+        SYLAR_ASSERT(server->getConnectionCount() == 1);
+
+        // 服务器要求关闭的连接不放回
+        auto r = pool->doGet("/close", 1000);
+        SYLAR_ASSERT(r->result == 0 && r->response->isClose());
+        SYLAR_ASSERT(pool->getTotalCount() == 0);
+
+        // 并发请求不超过max_total，空闲不超过max_idle
+        std::atomic<int> ok(0);
+        std::atomic<size_t> max_total(0);
+        sylar::FiberWaitGroup wg(20);
+        for(int i = 0; i < 20; ++i) {
+            sylar::IOManager::GetThis()->schedule([&, pool]() {
+                for(int j = 0; j < 10; ++j) {
+                    auto r = pool->doPost("/echo", 1000, {}, std::to_string(j));
+                    size_t total = pool->getTotalCount();
+                    size_t cur = max_total;
+                    while(total > cur && !max_total.compare_exchange_weak(cur, total));
+                    if(r->result == 0 && r->response->getBody() == std::to_string(j)) {
+                        ++ok;
+                    }
+                }
+                wg.done();
+            });
+        }
+        wg.wait();
+        SYLAR_ASSERT(ok == 200);
+        SYLAR_ASSERT(max_total <= 4);
+        SYLAR_ASSERT(pool->getIdleCount() <= 2);
+
+        // 流水线
+        std::vector<HttpClientRequest> reqs;
+        for(int i = 0; i < 10; ++i) {
+            HttpClientRequest req(HttpMethod::POST, "/echo");
+            req.body = "pipeline " + std::to_string(i);
+            reqs.push_back(req);
+        }
+        reqs.push_back(HttpClientRequest(HttpMethod::HEAD, "/hello"));
+        reqs.push_back(HttpClientRequest(HttpMethod::GET, "/hello"));
+        auto results = pool->pipeline(reqs, 1000);
+        SYLAR_ASSERT(results.size() == reqs.size());
+        for(int i = 0; i < 10; ++i) {
+            SYLAR_ASSERT(results[i]->result == 0);
+            SYLAR_ASSERT(results[i]->response->getBody() == "pipeline " + std::to_string(i));
+        }
+        SYLAR_ASSERT(results[10]->result == 0 && results[10]->response->getBody().empty());
+        SYLAR_ASSERT(results[11]->result == 0 && results[11]->response->getBody() == s_hello);
+
+        // 空闲超过max_idle_time被定时器淘汰
+        SYLAR_ASSERT(pool->getIdleCount() > 0);
+        usleep(300 * 1000);
+        SYLAR_ASSERT(pool->getIdleCount() == 0 && pool->getTotalCount() == 0);
+
+        // 服务器关闭了空闲连接：取连接时发现不可用，换新连接
+        auto pool2 = HttpConnectionPool::Create("127.0.0.1", port, 4, 4, 0, 1000);
+        SYLAR_ASSERT(pool2->doGet("/hello", 1000)->result == 0);
+        SYLAR_ASSERT(pool2->getIdleCount() == 1);
+        auto conns_before = server->getConnectionCount();
+        SYLAR_ASSERT(conns_before == 1);
+        server->stop(0);
+        usleep(50 * 1000);
+        SYLAR_ASSERT(pool2->evict() == 1);
+        r = pool2->doGet("/hello", 1000);
+        SYLAR_ASSERT(r->result == (int)HttpResult::Error::CONNECT_FAIL);
+        SYLAR_ASSERT(pool2->getTotalCount() == 0);
+        pool->close();
+        pool2->close();
+        SYLAR_LOG_INFO(g_logger) << "test_pool ok";
+    });
+}
+
+void bench() {
+    const int total = 5000;
+    for(int conns : {1, 20}) {
+        sylar::IOManager server_iom(1, false, "server");
+        auto server = create_server(&server_iom);
+        uint16_t port = get_port(server);
+        std::string url = "http://127.0.0.1:" + std::to_string(port) + "/hello";
+        auto pool = HttpConnectionPool::Create("127.0.0.1", port, conns, conns, 0, 1000, nullptr);
+        for(int mode = 0; mode < 2; ++mode) {
+            std::atomic<int> ok(0);
+            uint64_t ts = sylar::GetCurrentMS();
+            {
+                sylar::IOManager iom(1, false, "client");
+                for(int i = 0; i < conns; ++i) {
+                    iom.schedule([&]() {
+                        for(int j = 0; j < total / conns; ++j) {
+                            auto r = mode ? pool->doGet("/hello", 1000)
+                                          : HttpConnection::DoGet(url, 1000);
+                            if(r->result == 0) {
+                                ++ok;
+                            }
+                        }
+                    });
+                }
+            }
+            uint64_t cost = std::max<uint64_t>(sylar::GetCurrentMS() - ts, 1);
+            SYLAR_LOG_INFO(g_logger) << "bench " << (mode ? "pool" : "connect_per_request")
+                << " conns=" << conns << " ok=" << ok
+                << " req/s=" << ok * 1000 / cost;
+        }
+        // 流水线，每批16个
+        {
+            std::vector<HttpClientRequest> reqs(16, HttpClientRequest(HttpMethod::GET, "/hello"));
+            std::atomic<int> ok(0);
+            uint64_t ts = sylar::GetCurrentMS();
+            {
+                sylar::IOManager iom(1, false, "client");
+                for(int i = 0; i < conns; ++i) {
+                    iom.schedule([&]() {
+                        for(int j = 0; j < total * 4 / conns / 16; ++j) {
+                            for(auto& r : pool->pipeline(reqs, 1000)) {
+                                if(r->result == 0) {
+                                    ++ok;
+                                }
+                            }
+                        }
+                    });
+                }
+            }
+            uint64_t cost = std::max<uint64_t>(sylar::GetCurrentMS() - ts, 1);
+            SYLAR_LOG_INFO(g_logger) << "bench pool_pipeline16 conns=" << conns
+                << " ok=" << ok << " req/s=" << ok * 1000 / cost;
+        }
+        pool->close();
+        server->stop();
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_client();
+    test_pool();
+    bench();
+    return 0;
+}
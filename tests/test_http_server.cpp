@@ -0,0 +1,455 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/address.h"
+#include "../sylar/socket.h"
+#include "../sylar/http/http_parser.h"
+#include "../sylar/http/http_server.h"
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 统计进程内的内存分配次数
+static std::atomic<uint64_t> s_allocs(0);
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+using sylar::http::HttpMethod;
+using sylar::http::HttpStatus;
+using sylar::http::HttpRequest;
+using sylar::http::HttpRequestParser;
+using sylar::http::StringRef;
+
+static int parse(const std::string& data, HttpRequest& req, HttpStatus* err = nullptr) {
+    HttpRequestParser parser(req);
+    int rt = parser.execute(data.c_str(), data.size());
+    if(err) {
+        *err = parser.getError();
+    }
+    return rt;
+}
+
+void test_parser() {
+    HttpRequest req;
+    std::string data = "GET /index.html?a=1&b=2#frag HTTP/1.1\r\n"
+                       "Host: www.sylar.top\r\n"
+                       "User-Agent:  test-agent/1.0  \r\n"
+                       "Content-Length: 5\r\n"
+                       "\r\n"
+                       "hello";
+    int rt = parse(data, req);
+    SYLAR_ASSERT(rt == (int)data.size() - 5);
+    SYLAR_ASSERT(req.getMethod() == HttpMethod::GET);
+    SYLAR_ASSERT(req.getVersion() == 0x11);
+    SYLAR_ASSERT(req.getUri() == "/index.html?a=1&b=2#frag");
+    SYLAR_ASSERT(req.getPath() == "/index.html");
+    SYLAR_ASSERT(req.getQuery() == "a=1&b=2");
+    SYLAR_ASSERT(req.getFragment() == "frag");
+    SYLAR_ASSERT(req.getHeaders().size() == 3);
+    SYLAR_ASSERT(req.getHeader("host") == "www.sylar.top");
+    SYLAR_ASSERT(req.getHeader("USER-AGENT") == "test-agent/1.0");
+    SYLAR_ASSERT(req.getContentLength() == 5);
+    SYLAR_ASSERT(!req.isClose());
+    SYLAR_ASSERT(!req.hasHeader("Cookie"));
+
+    // 一个字节一个字节地喂，结果一样
+    {
+        HttpRequest r;
+        HttpRequestParser parser(r);
+        size_t head = data.size() - 5;
+        for(size_t i = 1; i < head; ++i) {
+            SYLAR_ASSERT(parser.execute(data.c_str(), i) == 0);
+        }
+        SYLAR_ASSERT(parser.execute(data.c_str(), head) == (int)head);
+        SYLAR_ASSERT(r.getPath() == "/index.html");
+        SYLAR_ASSERT(r.getHeader("Host") == "www.sylar.top");
+    }
+
+    // 增量解析过程中数据整体搬移
+    {
+        HttpRequest r;
+        HttpRequestParser parser(r);
+        std::string a = data.substr(0, 30);
+        SYLAR_ASSERT(parser.execute(a.c_str(), a.size()) == 0);
+        std::string b = data;
+        SYLAR_ASSERT(parser.execute(b.c_str(), b.size()) == (int)data.size() - 5);
+        SYLAR_ASSERT(r.getPath().data() == b.c_str() + 4);
+        SYLAR_ASSERT(r.getHeader("Host") == "www.sylar.top");
+    }
+
+    // keep-alive规则
+    SYLAR_ASSERT(parse("GET / HTTP/1.1\r\nConnection: close\r\n\r\n", req) > 0 && req.isClose());
+    SYLAR_ASSERT(parse("GET / HTTP/1.0\r\n\r\n", req) > 0 && req.isClose());
+    SYLAR_ASSERT(parse("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", req) > 0 && !req.isClose());
+    // 只有\n的行尾和请求行之前的空行
+    SYLAR_ASSERT(parse("\r\nPOST /a HTTP/1.1\nTransfer-Encoding: chunked\n\n", req) > 0);
+    SYLAR_ASSERT(req.getMethod() == HttpMethod::POST && req.isChunked());
+
+    HttpStatus err;
+    SYLAR_ASSERT(parse("GARBAGE\r\n\r\n", req, &err) < 0 && err == HttpStatus::BAD_REQUEST);
+    SYLAR_ASSERT(parse("FOO / HTTP/1.1\r\n\r\n", req, &err) < 0 && err == HttpStatus::NOT_IMPLEMENTED);
+    SYLAR_ASSERT(parse("GET / HTTP/2.0\r\n\r\n", req, &err) < 0 && err == HttpStatus::HTTP_VERSION_NOT_SUPPORTED);
+    SYLAR_ASSERT(parse("GET / HTTX/1.1\r\n\r\n", req, &err) < 0 && err == HttpStatus::BAD_REQUEST);
+    SYLAR_ASSERT(parse("GET / HTTP/1.1\r\nHost : a\r\n\r\n", req, &err) < 0 && err == HttpStatus::BAD_REQUEST);
+    SYLAR_ASSERT(parse("GET / HTTP/1.1\r\nHost: a\r\n b\r\n\r\n", req, &err) < 0 && err == HttpStatus::BAD_REQUEST);
+    SYLAR_ASSERT(parse("GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n", req, &err) < 0 && err == HttpStatus::BAD_REQUEST);
+    SYLAR_ASSERT(parse("GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n", req, &err) < 0);
+    SYLAR_ASSERT(parse("GET / HTTP/1.1\r\nHost: a\rb\r\n\r\n", req, &err) < 0 && err == HttpStatus::BAD_REQUEST);
+    // 最后的编码不是chunked无法确定body长度，按最后一个逗号分隔的编码判断
+    SYLAR_ASSERT(parse("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\nContent-Length: 3\r\n\r\n", req, &err) < 0
+                    && err == HttpStatus::BAD_REQUEST);
+    SYLAR_ASSERT(parse("POST / HTTP/1.1\r\nTransfer-Encoding: xchunked\r\n\r\n", req, &err) < 0
+                    && err == HttpStatus::BAD_REQUEST);
+    SYLAR_ASSERT(parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n", req, &err) < 0);
+    SYLAR_ASSERT(parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: gzip\r\n\r\n", req, &err) < 0);
+    SYLAR_ASSERT(parse("POST / HTTP/1.1\r\nTransfer-Encoding: gzip ,Chunked\r\n\r\n", req) > 0 && req.isChunked());
+    // 控制字符分别落在SSE2和逐字节的扫描里
+    SYLAR_ASSERT(parse("GET / HTTP/1.1\r\nX-Long-Header-Name: abc\x01" "def\r\n\r\n", req, &err) < 0
+                    && err == HttpStatus::BAD_REQUEST);
+    SYLAR_ASSERT(parse(std::string("GET / HTTP/1.1\r\nX: a\0b\r\n\r\n", 27), req, &err) < 0
+                    && err == HttpStatus::BAD_REQUEST);
+    // 非ASCII的字节(obs-text)是允许的
+    SYLAR_ASSERT(parse("GET / HTTP/1.1\r\nX-Name: \xe4\xbd\xa0\xe5\xa5\xbd\xe4\xb8\x96\xe7\x95\x8c\r\n\r\n", req) > 0);
+
+    {
+        HttpRequest r;
+        HttpRequestParser parser(r);
+        parser.setMaxHeaderSize(64);
+        std::string uri = "GET /" + std::string(100, 'a');
+        SYLAR_ASSERT(parser.execute(uri.c_str(), uri.size()) < 0);
+        SYLAR_ASSERT(parser.getError() == HttpStatus::URI_TOO_LONG);
+        parser.reset();
+        std::string h = "GET / HTTP/1.1\r\nX: " + std::string(100, 'a');
+        SYLAR_ASSERT(parser.execute(h.c_str(), h.size()) < 0);
+        SYLAR_ASSERT(parser.getError() == HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE);
+    }
+    SYLAR_LOG_INFO(g_logger) << "test_parser ok";
+}
+
+/**
+ * @brief 测试用的HTTP客户端连接，解析响应不分配内存
+ */
+struct ClientConn {
+    sylar::Socket::ptr sock;
+    std::vector<char> buf;
+    size_t begin = 0;
+    size_t end = 0;
+
+    ClientConn(sylar::Socket::ptr s)
+        :sock(s)
+        ,buf(256 * 1024) {
+    }
+
+    bool send(const std::string& data) {
+        size_t offset = 0;
+        while(offset < data.size()) {
+            int rt = sock->send(&data[offset], data.size() - offset);
+            if(rt <= 0) {
+                return false;
+            }
+            offset += rt;
+        }
+        return true;
+    }
+
+    // 读取一个响应，返回状态码，出错返回-1；body在下次调用前有效
+    int read(StringRef* body = nullptr, bool* close = nullptr, bool head_only = false) {
+        while(true) {
+            const char* b = &buf[begin];
+            const char* h = (const char*)memmem(b, end - begin, "\r\n\r\n", 4);
+            if(h) {
+                size_t hl = h + 4 - b;
+                const char* cl = (const char*)memmem(b, hl, "Content-Length: ", 16);
+                size_t len = (cl && !head_only) ? strtoul(cl + 16, nullptr, 10) : 0;
+                if(end - begin >= hl + len) {
+                    int status = atoi(b + 9);
+                    if(body) {
+                        *body = StringRef(b + hl, len);
+                    }
+                    if(close) {
+                        *close = memmem(b, hl, "Connection: close", 17) != nullptr;
+                    }
+                    begin += hl + len;
+                    return status;
+                }
+            }
+            if(begin > 0) {
+                memmove(&buf[0], &buf[begin], end - begin);
+                end -= begin;
+                begin = 0;
+            }
+            if(end == buf.size()) {
+                return -1;
+            }
+            int rt = sock->recv(&buf[end], buf.size() - end);
+            if(rt <= 0) {
+                return -1;
+            }
+            end += rt;
+        }
+    }
+
+    // 连接是否已经被对端关闭
+    bool closed() {
+        char c;
+        return begin == end && sock->recv(&c, 1) == 0;
+    }
+};
+
+static sylar::Address::ptr local_addr(uint16_t port) {
+    return sylar::IPv4Address::Create("127.0.0.1", port);
+}
+
+static uint16_t get_port(sylar::TcpServer::ptr server) {
+    return std::dynamic_pointer_cast<sylar::IPAddress>(
+            server->getSocks()[0]->getLocalAddress())->getPort();
+}
+
+static std::shared_ptr<ClientConn> connect(uint16_t port) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(local_addr(port));
+    if(!sock->connect(local_addr(port))) {
+        return nullptr;
+    }
+    return std::make_shared<ClientConn>(sock);
+}
+
+static const char s_hello[] = "hello world";
+
+static sylar::http::HttpServer::ptr create_server(sylar::IOManager* io, sylar::IOManager* accept) {
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(true, io, accept));
+    auto sd = server->getServletDispatch();
+    sd->addServlet("/hello", [](HttpRequest& req, sylar::http::HttpResponse& rsp
+                                ,sylar::http::HttpSession& session) {
+        rsp.setContentType("text/plain");
+        rsp.setBodyRef(StringRef(s_hello, sizeof(s_hello) - 1));
+        return 0;
+    });
+    sd->addServlet("/echo", [](HttpRequest& req, sylar::http::HttpResponse& rsp
+                                ,sylar::http::HttpSession& session) {
+        rsp.setBodyRef(req.getBody());
+        return 0;
+    });
+    sd->addGlobServlet("/glob/*", [](HttpRequest& req, sylar::http::HttpResponse& rsp
+                                ,sylar::http::HttpSession& session) {
+        rsp.setBody(req.getPath());
+        return 0;
+    });
+    SYLAR_ASSERT(server->bind(local_addr(0)));
+    SYLAR_ASSERT(server->start());
+    return server;
+}
+
+static std::string get(const std::string& path, const std::string& extra = "") {
+    return "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n" + extra + "\r\n";
+}
+
+static std::string post(const std::string& path, const std::string& body) {
+    return "POST " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: "
+        + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+void test_server() {
+    sylar::IOManager accept_worker(1, false, "accept");
+    sylar::IOManager io_worker(2, false, "io");
+    auto server = create_server(&io_worker, &accept_worker);
+    uint16_t port = get_port(server);
+
+    sylar::IOManager client(1, false, "client");
+    client.schedule([port]() {
+        StringRef body;
+        bool close = true;
+        // keep-alive
+        auto conn = connect(port);
+        SYLAR_ASSERT(conn);
+        for(int i = 0; i < 3; ++i) {
+            SYLAR_ASSERT(conn->send(get("/hello")));
+            SYLAR_ASSERT(conn->read(&body, &close) == 200);
+            SYLAR_ASSERT(body == s_hello && !close);
+        }
+
+        // 流水线
+        SYLAR_ASSERT(conn->send(get("/hello") + post("/echo", "abc") + get("/nope") + get("/glob/x?y=1")));
+        SYLAR_ASSERT(conn->read(&body) == 200 && body == s_hello);
+        SYLAR_ASSERT(conn->read(&body) == 200 && body == "abc");
+        SYLAR_ASSERT(conn->read(&body) == 404);
+        SYLAR_ASSERT(conn->read(&body) == 200 && body == "/glob/x");
+
+        // HEAD只有头部
+        SYLAR_ASSERT(conn->send("HEAD /hello HTTP/1.1\r\n\r\n" + get("/hello")));
+        SYLAR_ASSERT(conn->read(&body, nullptr, true) == 200 && body.empty());
+        SYLAR_ASSERT(conn->read(&body) == 200 && body == s_hello);
+
+        // 分几次发送
+        std::string req = post("/echo", "split body");
+        for(size_t i = 0; i < req.size(); i += 7) {
+            SYLAR_ASSERT(conn->send(req.substr(i, 7)));
+            usleep(1000);
+        }
+        SYLAR_ASSERT(conn->read(&body) == 200 && body == "split body");
+
+        // 大body跨多个内存块，响应走writev
+        std::string big(100 * 1024 + 3, 'x');
+        for(size_t i = 0; i < big.size(); i += 1000) {
+            big[i] = 'a' + i % 26;
+        }
+        SYLAR_ASSERT(conn->send(post("/echo", big)));
+        SYLAR_ASSERT(conn->read(&body) == 200 && body == big);
+
+        // 流水线请求超过一个内存块，请求头跨块时compact
+        std::string many;
+        for(int i = 0; i < 300; ++i) {
+            many += get("/glob/" + std::to_string(i), "X-Pad: " + std::string(i % 50, 'p') + "\r\n");
+        }
+        SYLAR_ASSERT(many.size() > 16 * 1024);
+        SYLAR_ASSERT(conn->send(many));
+        for(int i = 0; i < 300; ++i) {
+            SYLAR_ASSERT(conn->read(&body) == 200);
+            SYLAR_ASSERT(body == "/glob/" + std::to_string(i));
+        }
+
+        // Connection: close
+        SYLAR_ASSERT(conn->send(get("/hello", "Connection: close\r\n")));
+        SYLAR_ASSERT(conn->read(&body, &close) == 200 && close);
+        SYLAR_ASSERT(conn->closed());
+
+        // HTTP/1.0默认关闭
+        conn = connect(port);
+        SYLAR_ASSERT(conn->send("GET /hello HTTP/1.0\r\n\r\n"));
+        SYLAR_ASSERT(conn->read(&body, &close) == 200 && close);
+        SYLAR_ASSERT(conn->closed());
+
+        // 格式错误回复400后关闭
+        conn = connect(port);
+        SYLAR_ASSERT(conn->send("GARBAGE\r\n\r\n"));
+        SYLAR_ASSERT(conn->read(&body, &close) == 400 && close);
+        SYLAR_ASSERT(conn->closed());
+
+        // 请求头过大
+        conn = connect(port);
+        SYLAR_ASSERT(conn->send(get("/hello", "X-Big: " + std::string(20 * 1024, 'b') + "\r\n")));
+        SYLAR_ASSERT(conn->read(&body, &close) == 431 && close);
+
+        // body过大
+        conn = connect(port);
+        SYLAR_ASSERT(conn->send("POST /echo HTTP/1.1\r\nContent-Length: 999999999999\r\n\r\n"));
+        SYLAR_ASSERT(conn->read(&body, &close) == 413 && close);
+    });
+    client.stop();
+    server->stop();
+    SYLAR_LOG_INFO(g_logger) << "test_server ok";
+}
+
+struct BenchResult {
+    uint64_t requests = 0;
+    uint64_t cost_ms = 0;
+    uint64_t allocs = 0;
+    std::vector<uint64_t> latency_us;
+};
+
+// conns个连接，每个连接每次发depth个流水线请求再读回所有响应，持续ms毫秒
+static BenchResult run_clients(uint16_t port, int conns, int depth, uint64_t ms) {
+    BenchResult result;
+    sylar::Mutex mutex;
+    std::string req;
+    for(int i = 0; i < depth; ++i) {
+        req += get("/hello");
+    }
+    // 延迟只采样固定个数，测量期间客户端不分配内存
+    const size_t max_samples = 1000000 / conns;
+    std::vector<std::vector<uint64_t> > lats(conns);
+    for(auto& i : lats) {
+        i.reserve(max_samples);
+    }
+    std::vector<std::shared_ptr<ClientConn> > clients;
+    for(int i = 0; i < conns; ++i) {
+        clients.push_back(connect(port));
+        SYLAR_ASSERT(clients.back());
+    }
+
+    uint64_t allocs = s_allocs;
+    uint64_t ts = sylar::GetCurrentMS();
+    uint64_t deadline = ts + ms;
+    {
+        sylar::IOManager iom(2, false, "client");
+        for(int i = 0; i < conns; ++i) {
+            iom.schedule([&, i]() {
+                auto conn = clients[i];
+                auto& lat = lats[i];
+                uint64_t count = 0;
+                StringRef body;
+                while(sylar::GetCurrentMS() < deadline) {
+                    uint64_t b = sylar::GetCurrentUS();
+                    if(!conn->send(req)) {
+                        SYLAR_LOG_ERROR(g_logger) << "send fail";
+                        return;
+                    }
+                    for(int j = 0; j < depth; ++j) {
+                        if(conn->read(&body) != 200) {
+                            SYLAR_LOG_ERROR(g_logger) << "read fail";
+                            return;
+                        }
+                    }
+                    count += depth;
+                    if(lat.size() < max_samples) {
+                        lat.push_back(sylar::GetCurrentUS() - b);
+                    }
+                }
+                sylar::Mutex::Lock lock(mutex);
+                result.requests += count;
+            });
+        }
+    }
+    result.cost_ms = sylar::GetCurrentMS() - ts;
+    result.allocs = s_allocs - allocs;
+    for(auto& i : lats) {
+        result.latency_us.insert(result.latency_us.end(), i.begin(), i.end());
+    }
+    std::sort(result.latency_us.begin(), result.latency_us.end());
+    return result;
+}
+
+void bench() {
+    for(int depth : {1, 16}) {
+        for(int conns : {1, 50}) {
+            sylar::IOManager accept_worker(1, false, "accept");
+            sylar::IOManager io_worker(2, false, "io");
+            auto server = create_server(&io_worker, &accept_worker);
+            BenchResult r = run_clients(get_port(server), conns, depth, 2000);
+            server->stop();
+            if(r.latency_us.empty()) {
+                SYLAR_LOG_INFO(g_logger) << "bench no result";
+                continue;
+            }
+            uint64_t cost = r.cost_ms ? r.cost_ms : 1;
+            SYLAR_LOG_INFO(g_logger) << "bench http_server conns=" << conns
+                << " pipeline=" << depth
+                << " req/s=" << r.requests * 1000 / cost
+                << " p50=" << r.latency_us[r.latency_us.size() / 2] << "us"
+                << " p99=" << r.latency_us[r.latency_us.size() * 99 / 100] << "us"
+                << " allocs/req=" << (double)r.allocs / (r.requests ? r.requests : 1);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_parser();
+    test_server();
+    bench();
+    return 0;
+}
@@ -0,0 +1,266 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <time.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t count_lines(const std::string& file) {
+    std::ifstream ifs(file);
+    std::string line;
+    size_t n = 0;
+    while(std::getline(ifs, line)) {
+        ++n;
+    }
+    return n;
+}
+
+// 多线程打日志，统计单次调用耗时的分位数
+static void bench(const std::string& name, sylar::LogAppender::ptr appender
+                  ,int thread_count, int count) {
+    sylar::Logger::ptr logger(new sylar::Logger("bench_" + name));
+    logger->addAppender(appender);
+
+    std::vector<std::vector<uint64_t> > costs(thread_count);
+    std::vector<sylar::Thread::ptr> thrs;
+    uint64_t ts = now_ns();
+    for(int i = 0; i < thread_count; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([&, i](){
+            auto& vec = costs[i];
+            vec.reserve(count);
+            for(int j = 0; j < count; ++j) {
+                uint64_t b = now_ns();
+                SYLAR_LOG_INFO(logger) << "bench " << name << " i=" << j
+                    << " some payload to make the line look real";
+                vec.push_back(now_ns() - b);
+            }
+        }, "bench_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    uint64_t ts2 = now_ns();
+    appender->flush();
+    uint64_t ts3 = now_ns();
+
+    std::vector<uint64_t> all;
+    for(auto& i : costs) {
+        all.insert(all.end(), i.begin(), i.end());
+    }
+    std::sort(all.begin(), all.end());
+    SYLAR_LOG_INFO(g_logger) << "bench " << name << " threads=" << thread_count
+        << " count=" << all.size()
+        << " p50=" << all[all.size() / 2] << "ns"
+        << " p99=" << all[all.size() * 99 / 100] << "ns"
+        << " p999=" << all[all.size() * 999 / 1000] << "ns"
+        << " max=" << all.back() << "ns"
+        << " total=" << (ts2 - ts) / 1000000 << "ms"
+        << " flush=" << (ts3 - ts2) / 1000000 << "ms";
+}
+
+void test_async() {
+    const std::string file = "/tmp/test_log_async.log";
+    unlink(file.c_str());
+    sylar::Logger::ptr logger(new sylar::Logger("async"));
+    sylar::AsyncLogAppender::ptr appender(new sylar::AsyncLogAppender(
+                sylar::LogAppender::ptr(new sylar::FileLogAppender(file))));
+    logger->addAppender(appender);
+
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < 4; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([logger](){
+            for(int j = 0; j < 10000; ++j) {
+                SYLAR_LOG_INFO(logger) << "async i=" << j;
+            }
+        }, "async_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    appender->flush();
+    // BLOCK策略不丢日志
+    SYLAR_ASSERT(count_lines(file) == 40000);
+    SYLAR_ASSERT(appender->getDropped() == 0);
+    SYLAR_LOG_INFO(g_logger) << "test_async ok";
+}
+
+// 线程名和内容都比缓冲区的1/4长，截断后照样写出
+void test_truncate() {
+    const std::string file = "/tmp/test_log_async_truncate.log";
+    unlink(file.c_str());
+    auto size = sylar::Config::Lookup<uint32_t>("log.async_buffer_size");
+    uint32_t old_size = size->getValue();
+    size->setValue(4096);
+    sylar::Logger::ptr logger(new sylar::Logger("async_truncate"));
+    sylar::AsyncLogAppender::ptr appender(new sylar::AsyncLogAppender(
+                sylar::LogAppender::ptr(new sylar::FileLogAppender(file))));
+    logger->addAppender(appender);
+    // 新线程才会按新的大小创建缓冲区
+    sylar::Thread::ptr thr(new sylar::Thread([logger](){
+        SYLAR_LOG_INFO(logger) << std::string(5000, 'c');
+        SYLAR_LOG_INFO(logger) << "short";
+    }, std::string(5000, 't')));
+    thr->join();
+    appender->flush();
+    size->setValue(old_size);
+    SYLAR_ASSERT(count_lines(file) == 2);
+    std::ifstream ifs(file);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    SYLAR_ASSERT(content.find("short") != std::string::npos);
+    SYLAR_ASSERT(content.size() < 4096);
+    SYLAR_ASSERT(appender->getDropped() == 0);
+    SYLAR_LOG_INFO(g_logger) << "test_truncate ok";
+}
+
+// 别的线程一直在打日志时flush也要返回，并且调用前写的日志都已落盘
+void test_flush_busy() {
+    const std::string file = "/tmp/test_log_async_busy.log";
+    unlink(file.c_str());
+    sylar::Logger::ptr logger(new sylar::Logger("async_busy"));
+    sylar::AsyncLogAppender::ptr appender(new sylar::AsyncLogAppender(
+                sylar::LogAppender::ptr(new sylar::FileLogAppender(file))));
+    logger->addAppender(appender);
+
+    std::atomic<bool> running(true);
+    sylar::Thread::ptr thr(new sylar::Thread([logger, &running](){
+        while(running) {
+            SYLAR_LOG_INFO(logger) << "busy";
+        }
+    }, "async_busy"));
+
+    for(int i = 0; i < 100; ++i) {
+        SYLAR_LOG_INFO(logger) << "before flush";
+    }
+    uint64_t ts = now_ns();
+    appender->flush();
+    uint64_t cost = now_ns() - ts;
+    std::ifstream ifs(file);
+    std::string line;
+    size_t lines = 0;
+    while(std::getline(ifs, line)) {
+        if(line.find("before flush") != std::string::npos) {
+            ++lines;
+        }
+    }
+    running = false;
+    thr->join();
+    SYLAR_ASSERT(lines == 100);
+    SYLAR_LOG_INFO(g_logger) << "test_flush_busy ok flush=" << cost / 1000 << "us";
+}
+
+// 每条日志睡一会儿，让缓冲区写满
+class SlowAppender : public sylar::LogAppender {
+public:
+    SlowAppender(std::atomic<int>& lines, std::atomic<bool>& destroyed)
+        :m_lines(lines)
+        ,m_destroyed(destroyed) {
+    }
+    ~SlowAppender() { m_destroyed = true;}
+    void log(const sylar::Logger::ptr& logger, sylar::LogLevel::Level level
+             ,const sylar::LogEvent::ptr& event) override {
+        usleep(200);
+        ++m_lines;
+    }
+    std::string toYamlString() override { return "";}
+private:
+    std::atomic<int>& m_lines;
+    std::atomic<bool>& m_destroyed;
+};
+
+// BLOCK策略缓冲区满时只挂起打日志的协程，同一线程的其他协程照常运行；
+// 没有引用以后AsyncLogAppender由后台线程释放
+void test_block_fiber() {
+    auto size = sylar::Config::Lookup<uint32_t>("log.async_buffer_size");
+    uint32_t old_size = size->getValue();
+    size->setValue(4096);
+    std::atomic<int> lines(0);
+    std::atomic<bool> destroyed(false);
+    std::atomic<bool> logged(false);
+    std::atomic<bool> ran_while_blocked(false);
+    {
+        sylar::Logger::ptr logger(new sylar::Logger("async_fiber"));
+        logger->addAppender(sylar::LogAppender::ptr(new sylar::AsyncLogAppender(
+                        sylar::LogAppender::ptr(new SlowAppender(lines, destroyed)))));
+        sylar::IOManager iom(1, false, "async_fiber");
+        iom.schedule([logger, &logged]() {
+            for(int i = 0; i < 500; ++i) {
+                SYLAR_LOG_INFO(logger) << "fiber " << i << std::string(100, 'x');
+            }
+            logged = true;
+        });
+        iom.schedule([&logged, &ran_while_blocked]() {
+            ran_while_blocked = !logged;
+        });
+        // 挂起的协程不算调度器的任务，等它写完再停止
+        while(!logged) {
+            usleep(1000);
+        }
+    }
+    size->setValue(old_size);
+    SYLAR_ASSERT(ran_while_blocked);
+    // 最后一个引用在后台线程释放，释放前写完所有记录；
+    // 再打几条别的异步日志，后台线程缓存的LogEvent也就不再引用原来的logger
+    // 函数返回后kick的记录可能还没写完，计数不能放在栈上
+    static std::atomic<int> kick_lines(0);
+    static std::atomic<bool> kick_destroyed(false);
+    sylar::Logger::ptr kick(new sylar::Logger("async_kick"));
+    kick->addAppender(sylar::LogAppender::ptr(new sylar::AsyncLogAppender(
+                    sylar::LogAppender::ptr(new SlowAppender(kick_lines, kick_destroyed)))));
+    for(int i = 0; i < 1000 && !destroyed; ++i) {
+        SYLAR_LOG_INFO(kick) << "kick";
+        usleep(1000);
+    }
+    SYLAR_ASSERT(destroyed);
+    SYLAR_ASSERT(lines == 500);
+    SYLAR_LOG_INFO(g_logger) << "test_block_fiber ok";
+}
+
+void test_config() {
+    YAML::Node root = YAML::Load(
+        "logs:\n"
+        "  - name: async_conf\n"
+        "    level: info\n"
+        "    appenders:\n"
+        "      - type: FileLogAppender\n"
+        "        file: /tmp/test_log_async_conf.log\n"
+        "        async: true\n"
+        "        overflow: count\n");
+    sylar::Config::LoadFromYaml(root);
+    sylar::Logger::ptr logger = SYLAR_LOG_NAME("async_conf");
+    std::string yaml = logger->toYamlString();
+    SYLAR_ASSERT(yaml.find("async: true") != std::string::npos);
+    SYLAR_ASSERT(yaml.find("overflow: COUNT") != std::string::npos);
+    SYLAR_LOG_INFO(logger) << "from config";
+    SYLAR_LOG_INFO(g_logger) << "test_config ok";
+}
+
+int main(int argc, char** argv) {
+    test_async();
+    test_truncate();
+    test_flush_busy();
+    test_block_fiber();
+    test_config();
+
+    const int threads = 4;
+    const int count = 50000;
+    bench("sync", sylar::LogAppender::ptr(new sylar::FileLogAppender("/tmp/test_log_sync_bench.log"))
+          ,threads, count);
+    bench("async_block", sylar::LogAppender::ptr(new sylar::AsyncLogAppender(
+                    sylar::LogAppender::ptr(new sylar::FileLogAppender("/tmp/test_log_async_bench.log"))))
+          ,threads, count);
+    sylar::AsyncLogAppender::ptr drop(new sylar::AsyncLogAppender(
+                    sylar::LogAppender::ptr(new sylar::FileLogAppender("/tmp/test_log_drop_bench.log"))
+                    ,sylar::AsyncLogAppender::DROP));
+    bench("async_drop", drop, threads, count);
+    SYLAR_LOG_INFO(g_logger) << "async_drop dropped=" << drop->getDropped();
+    return 0;
+}
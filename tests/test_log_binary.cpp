@@ -0,0 +1,198 @@
+#include "../sylar/sylar.h"
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static std::string read_file(const std::string& file) {
+    std::ifstream ifs(file);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+static std::vector<std::string> sorted_lines(const std::string& data) {
+    std::vector<std::string> lines;
+    std::stringstream ss(data);
+    std::string line;
+    while(std::getline(ss, line)) {
+        lines.push_back(line);
+    }
+    std::sort(lines.begin(), lines.end());
+    return lines;
+}
+
+// 编码后再还原，和snprintf的结果比较
+#define CHECK_RENDER(fmt, ...) \
+    do { \
+        std::string args; \
+        sylar::LogArgs::Append(args, __VA_ARGS__); \
+        std::string out; \
+        sylar::LogArgs::Render(out, fmt, args.data(), args.size()); \
+        char buf[256]; \
+        snprintf(buf, sizeof(buf), fmt, __VA_ARGS__); \
+        if(out != buf) { \
+            SYLAR_LOG_ERROR(g_logger) << "render fmt=" << fmt << " got=" << out << " expect=" << buf; \
+        } \
+        SYLAR_ASSERT(out == buf); \
+    } while(0)
+
+void test_render() {
+    int i = -42;
+    CHECK_RENDER("%d %i %u", i, 7, 8u);
+    CHECK_RENDER("%ld %lu %lld %llu", -1l, 2ul, -3ll, 18446744073709551615ull);
+    CHECK_RENDER("%hd %hhu %zu", (short)-5, (unsigned char)200, (size_t)123456789);
+    CHECK_RENDER("[%5d] [%-5d] [%05d] [%+d] [% d]", 12, 12, 12, 12, 12);
+    CHECK_RENDER("%x %X %o %#x", 255u, 255u, 8u, 255u);
+    CHECK_RENDER("%f %.2f %10.3f %e %g %G", 3.14159, 2.5, -1.0, 12345.678, 0.0001, 1e20);
+    CHECK_RENDER("%Lf", (long double)1.5);
+    CHECK_RENDER("%s|%10s|%-10s|%.3s", "abc", "right", "left", "truncate");
+    CHECK_RENDER("%c%c%c", 'a', 'b', 'c');
+    CHECK_RENDER("%*d|%-*d|%.*f|%.*s", 6, 1, 6, 2, 3, 1.23456, 2, "xyz");
+    CHECK_RENDER("100%% %s", "done");
+    CHECK_RENDER("%p", (void*)&i);
+    // 整数按参数宽度或者长度修饰符截断，和printf一样
+    CHECK_RENDER("%x %X %o %u", -1, -2, -3, -4);
+    CHECK_RENDER("%x %u %d", (char)-1, (short)-1, (unsigned char)255);
+    CHECK_RENDER("%hx %hhx %hd %hhd %hu", -1, -1, 70000, 200, 70000);
+    CHECK_RENDER("%lx %lu %llx %zx", -1l, -1l, -1ll, (size_t)-1);
+    CHECK_RENDER("%d %x", 4294967295u, 4294967295u);
+    const char * null_str = nullptr;
+    std::string out;
+    std::string args;
+    sylar::LogArgs::Append(args, null_str, std::string("str"), true);
+    sylar::LogArgs::Render(out, "%s %s %d", args.data(), args.size());
+    SYLAR_ASSERT(out == "(null) str 1");
+
+    // 参数不足时转换说明原样输出
+    args.clear();
+    out.clear();
+    sylar::LogArgs::Append(args, 1);
+    sylar::LogArgs::Render(out, "a=%d b=%d", args.data(), args.size());
+    SYLAR_ASSERT(out == "a=1 b=%d");
+    SYLAR_LOG_INFO(g_logger) << "test_render ok";
+}
+
+void test_roundtrip() {
+    const std::string text_file = "/tmp/test_log_binary.log";
+    const std::string bin_file = "/tmp/test_log_binary.bin";
+    unlink(text_file.c_str());
+    unlink(bin_file.c_str());
+
+    sylar::Logger::ptr logger(new sylar::Logger("binary"));
+    sylar::FileLogAppender::ptr text(new sylar::FileLogAppender(text_file));
+    sylar::BinaryLogAppender::ptr bin(new sylar::BinaryLogAppender(bin_file));
+    logger->addAppender(text);
+    logger->addAppender(bin);
+
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < 2; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([logger, i](){
+            for(int j = 0; j < 1000; ++j) {
+                SYLAR_LOG_FMT_INFO(logger, "thread=%d j=%d value=%.3f name=%s", i, j, j / 7.0, "binary");
+                SYLAR_LOG_INFO(logger) << "stream j=" << j;
+                if(j % 100 == 0) {
+                    SYLAR_LOG_FMT_ERROR(logger, "%s|%-6u|%lld", std::string("err"), (unsigned)j, -1ll * j);
+                }
+            }
+        }, "binary_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    text->flush();
+    bin->flush();
+
+    sylar::LogFormatter::ptr fmt = logger->getFormatter();
+    sylar::BinaryLogReader reader(bin_file);
+    SYLAR_ASSERT(reader.isValid());
+    std::string decoded;
+    size_t count = 0;
+    while(sylar::LogEvent::ptr event = reader.next()) {
+        fmt->format(decoded, event->getLogger(), event->getLevel(), event);
+        ++count;
+    }
+    SYLAR_ASSERT(!reader.isError());
+    SYLAR_ASSERT(count == 2 * (2000 + 10));
+    // 两个appender之间不加锁，多线程时各自的先后顺序可能不同，按行比较
+    SYLAR_ASSERT(sorted_lines(decoded) == sorted_lines(read_file(text_file)));
+
+    // 追加写的第二段从新的文件头开始
+    bin->reopen();
+    SYLAR_LOG_FMT_WARN(logger, "after reopen %d", 1);
+    bin->flush();
+    sylar::BinaryLogReader reader2(bin_file);
+    count = 0;
+    sylar::LogEvent::ptr last;
+    while(sylar::LogEvent::ptr event = reader2.next()) {
+        last = event;
+        ++count;
+    }
+    SYLAR_ASSERT(count == 2 * (2000 + 10) + 1);
+    SYLAR_ASSERT(last->getContent() == "after reopen 1");
+
+    // 截断的文件
+    std::string data = read_file(bin_file);
+    const std::string cut_file = "/tmp/test_log_binary_cut.bin";
+    std::ofstream ofs(cut_file, std::ios::trunc);
+    ofs.write(data.data(), data.size() - 3);
+    ofs.close();
+    sylar::BinaryLogReader reader3(cut_file);
+    count = 0;
+    while(reader3.next()) {
+        ++count;
+    }
+    SYLAR_ASSERT(reader3.isError());
+    SYLAR_ASSERT(count == 2 * (2000 + 10));
+    SYLAR_LOG_INFO(g_logger) << "test_roundtrip ok";
+}
+
+void test_config() {
+    YAML::Node root = YAML::Load(
+        "logs:\n"
+        "  - name: binary_conf\n"
+        "    level: info\n"
+        "    appenders:\n"
+        "      - type: BinaryLogAppender\n"
+        "        file: /tmp/test_log_binary_conf.bin\n");
+    sylar::Config::LoadFromYaml(root);
+    sylar::Logger::ptr logger = SYLAR_LOG_NAME("binary_conf");
+    SYLAR_ASSERT(logger->toYamlString().find("BinaryLogAppender") != std::string::npos);
+    SYLAR_LOG_FMT_INFO(logger, "from config %d", 1);
+    SYLAR_LOG_INFO(g_logger) << "test_config ok";
+}
+
+static void bench(const std::string& name, sylar::LogAppender::ptr appender, int count) {
+    sylar::Logger::ptr logger(new sylar::Logger("bench_" + name));
+    logger->addAppender(appender);
+    uint64_t ts = now_ns();
+    for(int i = 0; i < count; ++i) {
+        SYLAR_LOG_FMT_INFO(logger, "bench i=%d value=%f name=%s", i, 3.25, "binary");
+    }
+    appender->flush();
+    uint64_t cost = now_ns() - ts;
+    SYLAR_LOG_INFO(g_logger) << "bench " << name << " count=" << count
+        << " ns/line=" << cost / count;
+}
+
+int main(int argc, char** argv) {
+    test_render();
+    test_roundtrip();
+    test_config();
+
+    const int count = 1000000;
+    unlink("/tmp/test_log_binary_bench.log");
+    unlink("/tmp/test_log_binary_bench.bin");
+    bench("file", sylar::LogAppender::ptr(new sylar::FileLogAppender("/tmp/test_log_binary_bench.log")), count);
+    bench("binary", sylar::LogAppender::ptr(new sylar::BinaryLogAppender("/tmp/test_log_binary_bench.bin")), count);
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "../sylar/sylar.h"
+#include <time.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 只统计条数，并记下最后一条内容
+class CountLogAppender : public sylar::LogAppender {
+public:
+    typedef std::shared_ptr<CountLogAppender> ptr;
+    void log(const sylar::Logger::ptr& logger, sylar::LogLevel::Level level, const sylar::LogEvent::ptr& event) override {
+        sylar::Mutex::Lock lock(m_mutex);
+        ++m_count;
+        m_last = event->getContent();
+    }
+    std::string toYamlString() override { return ""; }
+    uint64_t getCount() { sylar::Mutex::Lock lock(m_mutex); return m_count; }
+    std::string getLast() { sylar::Mutex::Lock lock(m_mutex); return m_last; }
+private:
+    sylar::Mutex m_mutex;
+    uint64_t m_count = 0;
+    std::string m_last;
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void test_every_n() {
+    sylar::Logger::ptr logger(new sylar::Logger("limit_n"));
+    CountLogAppender::ptr appender(new CountLogAppender);
+    logger->addAppender(appender);
+    for(int i = 0; i < 1000; ++i) {
+        SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::ERROR, 100) << "every_n i=" << i;
+    }
+    SYLAR_ASSERT(appender->getCount() == 10);
+    SYLAR_ASSERT(appender->getLast() == "[suppressed 99] every_n i=900");
+
+    // 多线程同时走到同一个调用点
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < 4; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([logger](){
+            for(int j = 0; j < 10000; ++j) {
+                SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::ERROR, 10) << "mt";
+            }
+        }, "limit_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    SYLAR_ASSERT(appender->getCount() == 10 + 4000);
+    SYLAR_LOG_INFO(g_logger) << "test_every_n ok";
+}
+
+void test_every_ms() {
+    sylar::Logger::ptr logger(new sylar::Logger("limit_ms"));
+    CountLogAppender::ptr appender(new CountLogAppender);
+    logger->addAppender(appender);
+    uint64_t end = now_ns() + 350 * 1000000ull;
+    while(now_ns() < end) {
+        SYLAR_LOG_EVERY_MS(logger, sylar::LogLevel::ERROR, 100) << "every_ms";
+    }
+    // 0, 100, 200, 300ms
+    SYLAR_ASSERT(appender->getCount() == 4);
+    SYLAR_ASSERT(appender->getLast().find("[suppressed ") == 0);
+    SYLAR_LOG_INFO(g_logger) << "test_every_ms ok last=" << appender->getLast();
+}
+
+void test_rate() {
+    sylar::Logger::ptr logger(new sylar::Logger("limit_rate"));
+    CountLogAppender::ptr appender(new CountLogAppender);
+    logger->addAppender(appender);
+    // 同一个调用点：先放行burst条，之后按速率放行
+    uint64_t end = now_ns() + 500 * 1000000ull;
+    for(int i = 0; now_ns() < end; ++i) {
+        SYLAR_LOG_RATE_LIMITED(logger, sylar::LogLevel::ERROR, 100, 20) << "rate";
+        if(i == 100) {
+            SYLAR_ASSERT(appender->getCount() == 20);
+        }
+    }
+    uint64_t count = appender->getCount();
+    SYLAR_ASSERT(count >= 20 + 45 && count <= 20 + 55);
+    SYLAR_LOG_INFO(g_logger) << "test_rate ok count=" << count;
+}
+
+void test_level() {
+    sylar::Logger::ptr logger(new sylar::Logger("limit_level"));
+    CountLogAppender::ptr appender(new CountLogAppender);
+    logger->addAppender(appender);
+    logger->setLevel(sylar::LogLevel::ERROR);
+    // 级别不够的调用不计入限流
+    for(int i = 0; i < 10; ++i) {
+        SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::INFO, 3) << "info";
+    }
+    SYLAR_ASSERT(appender->getCount() == 0);
+    SYLAR_LOG_INFO(g_logger) << "test_level ok";
+}
+
+// 刷屏停止后，还没带出的抑制条数由后台线程单独输出
+void test_summary() {
+    sylar::Config::Lookup<uint32_t>("log.limit_summary_interval")->setValue(100);
+    sylar::Logger::ptr logger(new sylar::Logger("limit_summary"));
+    CountLogAppender::ptr appender(new CountLogAppender);
+    logger->addAppender(appender);
+    auto flood = [logger](uint64_t ms) {
+        uint64_t calls = 0;
+        uint64_t end = now_ns() + ms * 1000000ull;
+        do {
+            SYLAR_LOG_EVERY_MS(logger, sylar::LogLevel::ERROR, 100000) << "summary";
+            ++calls;
+        } while(now_ns() < end);
+        return calls;
+    };
+    auto wait_count = [appender](uint64_t count) {
+        uint64_t end = now_ns() + 2000 * 1000000ull;
+        while(appender->getCount() < count && now_ns() < end) {
+            usleep(10 * 1000);
+        }
+        return appender->getCount() == count;
+    };
+
+    // 刷屏期间每次扫描都有新的抑制，不输出汇总
+    uint64_t calls = flood(350);
+    SYLAR_ASSERT(appender->getCount() == 1);
+    SYLAR_ASSERT(appender->getLast() == "summary");
+    SYLAR_ASSERT(wait_count(2));
+    SYLAR_ASSERT(appender->getLast() == "suppressed " + std::to_string(calls - 1) + " messages");
+
+    // 已经汇总过的条数不再重复报告
+    calls = flood(0);
+    SYLAR_ASSERT(wait_count(3));
+    SYLAR_ASSERT(appender->getLast() == "suppressed " + std::to_string(calls) + " messages");
+    usleep(300 * 1000);
+    SYLAR_ASSERT(appender->getCount() == 3);
+    SYLAR_LOG_INFO(g_logger) << "test_summary ok";
+}
+
+void bench() {
+    sylar::Logger::ptr logger(new sylar::Logger("limit_bench"));
+    CountLogAppender::ptr appender(new CountLogAppender);
+    logger->addAppender(appender);
+    const int count = 10000000;
+    uint64_t ts = now_ns();
+    for(int i = 0; i < count; ++i) {
+        SYLAR_LOG_RATE_LIMITED(logger, sylar::LogLevel::ERROR, 10, 10) << "bench i=" << i;
+    }
+    uint64_t cost = now_ns() - ts;
+    SYLAR_LOG_INFO(g_logger) << "bench rate_limited count=" << count
+        << " logged=" << appender->getCount()
+        << " ns/call=" << (double)cost / count;
+}
+
+int main(int argc, char** argv) {
+    test_every_n();
+    test_every_ms();
+    test_rate();
+    test_level();
+    test_summary();
+    bench();
+    return 0;
+}
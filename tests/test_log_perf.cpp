@@ -0,0 +1,101 @@
+#include "../sylar/sylar.h"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <time.h>
+
+// 统计分配次数
+static std::atomic<uint64_t> s_alloc_count(0);
+
+void* operator new(size_t size) {
+    ++s_alloc_count;
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 只格式化不输出,衡量日志本身的开销
+class NullLogAppender : public sylar::LogAppender {
+public:
+    void log(const sylar::Logger::ptr& logger, sylar::LogLevel::Level level, const sylar::LogEvent::ptr& event) override {
+        m_buf.clear();
+        m_formatter->format(m_buf, logger, level, event);
+        m_bytes += m_buf.size();
+    }
+    std::string toYamlString() override { return ""; }
+    uint64_t getBytes() const { return m_bytes; }
+private:
+    std::string m_buf;
+    uint64_t m_bytes = 0;
+};
+
+static void bench(const std::string& name, sylar::Logger::ptr logger, int count) {
+    // 预热,让线程局部缓冲区就位
+    for(int i = 0; i < 100; ++i) {
+        SYLAR_LOG_INFO(logger) << "warm up " << i;
+    }
+    uint64_t allocs = s_alloc_count;
+    uint64_t ts = now_ns();
+    for(int i = 0; i < count; ++i) {
+        SYLAR_LOG_INFO(logger) << "bench i=" << i << " value=" << 3.25 << " name=" << name;
+    }
+    uint64_t cost = now_ns() - ts;
+    allocs = s_alloc_count - allocs;
+    SYLAR_LOG_INFO(g_logger) << "bench " << name << " count=" << count
+        << " ns/line=" << cost / count
+        << " allocs/line=" << (double)allocs / count;
+}
+
+// 只测LogFormatter::format本身
+static void bench_format(const std::string& pattern, int count) {
+    sylar::Logger::ptr logger(new sylar::Logger("perf"));
+    sylar::LogFormatter::ptr fmt(new sylar::LogFormatter(pattern));
+    sylar::LogEvent::ptr event(new sylar::LogEvent(logger, sylar::LogLevel::INFO, __FILE__, __LINE__
+                , 0, sylar::GetThreadId(), sylar::GetFiberId(), time(0), "perf"));
+    event->getSs() << "bench format message";
+    std::string buf;
+    uint64_t bytes = 0;
+    uint64_t ts = now_ns();
+    for(int i = 0; i < count; ++i) {
+        buf.clear();
+        fmt->format(buf, logger, sylar::LogLevel::INFO, event);
+        bytes += buf.size();
+    }
+    uint64_t cost = now_ns() - ts;
+    SYLAR_LOG_INFO(g_logger) << "bench_format pattern=" << pattern
+        << " ns/line=" << (double)cost / count << " bytes=" << bytes;
+}
+
+int main(int argc, char** argv) {
+    const int count = 1000000;
+    bench_format("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n", count);
+    bench_format("%d%T {%p} %t%m%n", count);
+    bench_format("%m%n", count);
+
+    sylar::Logger::ptr logger(new sylar::Logger("perf"));
+    NullLogAppender* null_appender = new NullLogAppender;
+    logger->addAppender(sylar::LogAppender::ptr(null_appender));
+    bench("null", logger, count);
+
+    logger->clearAppenders();
+    logger->addAppender(sylar::LogAppender::ptr(new sylar::FileLogAppender("/tmp/test_log_perf.log")));
+    bench("file", logger, count);
+
+    logger->setLevel(sylar::LogLevel::ERROR);
+    bench("disabled", logger, count);
+    return 0;
+}
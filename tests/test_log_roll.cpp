@@ -0,0 +1,235 @@
+#include "../sylar/sylar.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const std::string s_dir = "/tmp/test_log_roll";
+
+static std::vector<std::string> list_dir() {
+    std::vector<std::string> files;
+    DIR* d = opendir(s_dir.c_str());
+    while(struct dirent* dp = readdir(d)) {
+        if(dp->d_name[0] != '.') {
+            files.push_back(dp->d_name);
+        }
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static void clear_dir() {
+    mkdir(s_dir.c_str(), 0755);
+    for(auto& i : list_dir()) {
+        unlink((s_dir + "/" + i).c_str());
+    }
+}
+
+static std::string gunzip(const std::string& file) {
+    gzFile in = gzopen(file.c_str(), "rb");
+    SYLAR_ASSERT(in);
+    std::string data;
+    char buf[4096];
+    int n;
+    while((n = gzread(in, buf, sizeof(buf))) > 0) {
+        data.append(buf, n);
+    }
+    gzclose(in);
+    return data;
+}
+
+// 归档按(时间, 序号)从旧到新排序，没有序号的是这一秒的第一个
+static void sort_archives(std::vector<std::string>& files, const std::string& prefix) {
+    auto key = [&prefix](const std::string& name) {
+        std::string suffix = name.substr(prefix.size());
+        std::string time = suffix.substr(0, 15);
+        uint64_t seq = 0;
+        if(suffix.size() > 15 && suffix[15] == '.' && isdigit((unsigned char)suffix[16])) {
+            seq = strtoull(suffix.c_str() + 16, nullptr, 10);
+        }
+        return std::make_pair(time, seq);
+    };
+    std::sort(files.begin(), files.end(), [&key](const std::string& a, const std::string& b) {
+        return key(a) < key(b);
+    });
+}
+
+void test_size() {
+    clear_dir();
+    const std::string file = s_dir + "/roll.log";
+    sylar::Logger::ptr logger(new sylar::Logger("roll"));
+    sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(file));
+    appender->setFormatter("%m%n");
+    appender->setMaxSize(4096);
+    appender->setMaxFiles(3);
+    appender->setCompress(true);
+    logger->addAppender(appender);
+
+    for(int i = 0; i < 2000; ++i) {
+        SYLAR_LOG_INFO(logger) << "roll line " << i;
+    }
+    appender->flush();
+    sylar::FileLogAppender::WaitArchived();
+
+    // 当前文件 + 最新的3个压缩文件
+    std::vector<std::string> files = list_dir();
+    for(auto& i : files) {
+        SYLAR_LOG_INFO(g_logger) << "file: " << i;
+    }
+    SYLAR_ASSERT(files.size() == 4);
+    SYLAR_ASSERT(files[0] == "roll.log");
+    for(size_t i = 1; i < files.size(); ++i) {
+        SYLAR_ASSERT(files[i].compare(0, 9, "roll.log.") == 0);
+        SYLAR_ASSERT(files[i].compare(files[i].size() - 3, 3, ".gz") == 0);
+    }
+    files.erase(files.begin());
+    sort_archives(files, "roll.log.");
+    // 最后一个压缩文件的内容紧接着当前文件
+    std::string last = gunzip(s_dir + "/" + files.back());
+    SYLAR_ASSERT(last.size() >= 4096 && last.size() < 4096 + 64);
+    std::string tail = last.substr(last.rfind('\n', last.size() - 2) + 1);
+    int n = atoi(tail.c_str() + strlen("roll line "));
+    std::ifstream ifs(file);
+    std::string first;
+    std::getline(ifs, first);
+    SYLAR_ASSERT(first == "roll line " + std::to_string(n + 1));
+    SYLAR_LOG_INFO(g_logger) << "test_size ok";
+}
+
+void test_manual() {
+    clear_dir();
+    const std::string file = s_dir + "/manual.log";
+    sylar::Logger::ptr logger(new sylar::Logger("manual"));
+    sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(file));
+    appender->setFormatter("%m%n");
+    logger->addAppender(appender);
+    for(int i = 0; i < 3; ++i) {
+        SYLAR_LOG_INFO(logger) << "manual " << i;
+        SYLAR_ASSERT(appender->roll());
+    }
+    // 空文件不滚动
+    SYLAR_ASSERT(appender->roll());
+    sylar::FileLogAppender::WaitArchived();
+    std::vector<std::string> files = list_dir();
+    SYLAR_ASSERT(files.size() == 4);
+    SYLAR_LOG_INFO(g_logger) << "test_manual ok";
+}
+
+// 同目录下以roll.log.开头的别的文件不算作归档，不会被清理
+void test_retain_other() {
+    clear_dir();
+    const std::string file = s_dir + "/roll.log";
+    const std::string err = s_dir + "/roll.log.err";
+    sylar::FileLogAppender::ptr err_appender(new sylar::FileLogAppender(err));
+    err_appender->setFormatter("%m%n");
+    sylar::Logger::ptr err_logger(new sylar::Logger("roll_err"));
+    err_logger->addAppender(err_appender);
+    for(int i = 0; i < 3; ++i) {
+        SYLAR_LOG_INFO(err_logger) << "err " << i;
+        SYLAR_ASSERT(err_appender->roll());
+    }
+    SYLAR_LOG_INFO(err_logger) << "err live";
+    err_appender->flush();
+
+    sylar::Logger::ptr logger(new sylar::Logger("roll_retain"));
+    sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(file));
+    appender->setFormatter("%m%n");
+    appender->setMaxFiles(1);
+    logger->addAppender(appender);
+    for(int i = 0; i < 3; ++i) {
+        SYLAR_LOG_INFO(logger) << "retain " << i;
+        SYLAR_ASSERT(appender->roll());
+    }
+    sylar::FileLogAppender::WaitArchived();
+
+    size_t own = 0;
+    size_t other = 0;
+    for(auto& i : list_dir()) {
+        if(i.compare(0, 12, "roll.log.err") == 0) {
+            ++other;
+        } else if(i.compare(0, 9, "roll.log.") == 0) {
+            ++own;
+        }
+    }
+    // roll.log.err + 它的3个归档都还在，自己只留1个归档
+    SYLAR_ASSERT(other == 4);
+    SYLAR_ASSERT(own == 1);
+    SYLAR_LOG_INFO(g_logger) << "test_retain_other ok";
+}
+
+// 同一秒内多次滚动，清理后留下的必须是最新的归档，不能复用被删掉的文件名
+void test_retain_newest() {
+    clear_dir();
+    const std::string file = s_dir + "/newest.log";
+    sylar::Logger::ptr logger(new sylar::Logger("roll_newest"));
+    sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender(file));
+    appender->setFormatter("%m%n");
+    appender->setMaxFiles(1);
+    logger->addAppender(appender);
+    for(int i = 0; i < 4; ++i) {
+        SYLAR_LOG_INFO(logger) << "seg " << i;
+        SYLAR_ASSERT(appender->roll());
+        sylar::FileLogAppender::WaitArchived();
+    }
+    std::vector<std::string> files = list_dir();
+    SYLAR_ASSERT(files.size() == 2);
+    SYLAR_ASSERT(files[0] == "newest.log");
+    std::ifstream ifs(s_dir + "/" + files[1]);
+    std::string line;
+    std::getline(ifs, line);
+    SYLAR_ASSERT(line == "seg 3");
+
+    // 压缩后的.gz和带序号的归档一起排序
+    appender->setMaxFiles(2);
+    appender->setCompress(true);
+    for(int i = 4; i < 7; ++i) {
+        SYLAR_LOG_INFO(logger) << "seg " << i;
+        SYLAR_ASSERT(appender->roll());
+        sylar::FileLogAppender::WaitArchived();
+    }
+    files = list_dir();
+    SYLAR_ASSERT(files.size() == 3);
+    std::vector<std::string> segs;
+    for(size_t i = 1; i < files.size(); ++i) {
+        segs.push_back(gunzip(s_dir + "/" + files[i]));
+    }
+    std::sort(segs.begin(), segs.end());
+    SYLAR_ASSERT(segs[0] == "seg 5\n");
+    SYLAR_ASSERT(segs[1] == "seg 6\n");
+    SYLAR_LOG_INFO(g_logger) << "test_retain_newest ok";
+}
+
+void test_config() {
+    YAML::Node root = YAML::Load(
+        "logs:\n"
+        "  - name: roll_conf\n"
+        "    level: info\n"
+        "    appenders:\n"
+        "      - type: FileLogAppender\n"
+        "        file: /tmp/test_log_roll/conf.log\n"
+        "        max_size: 10M\n"
+        "        roll: day\n"
+        "        max_files: 7\n"
+        "        compress: true\n");
+    sylar::Config::LoadFromYaml(root);
+    sylar::Logger::ptr logger = SYLAR_LOG_NAME("roll_conf");
+    std::string yaml = logger->toYamlString();
+    SYLAR_LOG_INFO(g_logger) << yaml;
+    SYLAR_ASSERT(yaml.find("max_size: 10485760") != std::string::npos);
+    SYLAR_ASSERT(yaml.find("roll: DAY") != std::string::npos);
+    SYLAR_ASSERT(yaml.find("max_files: 7") != std::string::npos);
+    SYLAR_ASSERT(yaml.find("compress: true") != std::string::npos);
+    SYLAR_LOG_INFO(g_logger) << "test_config ok";
+}
+
+int main(int argc, char** argv) {
+    test_size();
+    test_manual();
+    test_retain_other();
+    test_retain_newest();
+    test_config();
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include "../sylar/sylar.h"
+#include "../sylar/rcu.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+struct Data {
+    Data(uint64_t v) : magic(0x5359), value(v) {}
+    ~Data() { magic = 0; }
+    uint64_t magic;
+    uint64_t value;
+};
+
+static std::atomic<Data*> s_data(new Data(0));
+static std::atomic<bool> s_stop(false);
+
+// 读者在临界区里反复检查，写者释放得太早时magic会被清零
+void test_rcu() {
+    std::atomic<uint64_t> reads(0);
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < 3; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([&reads](){
+            uint64_t last = 0;
+            while(!s_stop) {
+                sylar::RcuReadLock lock;
+                Data* data = s_data.load(std::memory_order_acquire);
+                for(int j = 0; j < 100; ++j) {
+                    SYLAR_ASSERT(data->magic == 0x5359);
+                }
+                SYLAR_ASSERT(data->value >= last);
+                last = data->value;
+                ++reads;
+            }
+        }, "rcu_" + std::to_string(i))));
+    }
+    for(uint64_t i = 1; i <= 1000; ++i) {
+        Data* old = s_data.exchange(new Data(i));
+        sylar::Rcu::Synchronize();
+        delete old;
+    }
+    s_stop = true;
+    for(auto& i : thrs) {
+        i->join();
+    }
+    SYLAR_LOG_INFO(g_logger) << "test_rcu ok reads=" << reads;
+}
+
+// 打日志的同时不停地增删appender
+void test_logger() {
+    sylar::Logger::ptr logger(new sylar::Logger("rcu"));
+    std::atomic<bool> stop(false);
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < 2; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([logger, &stop](){
+            while(!stop) {
+                SYLAR_LOG_INFO(logger) << "rcu logger";
+            }
+        }, "rcu_log_" + std::to_string(i))));
+    }
+    for(int i = 0; i < 1000; ++i) {
+        sylar::LogAppender::ptr appender(new sylar::FileLogAppender("/tmp/test_rcu.log"));
+        logger->addAppender(appender);
+        if(i % 2) {
+            logger->delAppender(appender);
+        } else {
+            logger->clearAppenders();
+        }
+        SYLAR_LOG_NAME("rcu_" + std::to_string(i));
+    }
+    stop = true;
+    for(auto& i : thrs) {
+        i->join();
+    }
+    SYLAR_LOG_INFO(g_logger) << "test_logger ok";
+}
+
+static pthread_key_t s_late_key;
+static std::atomic<int> s_late_count(0);
+
+// 在RCU注销读者之后执行的pthread key析构里再进入读临界区
+static void late_reader(void* arg) {
+    sylar::RcuReadLock lock;
+    ++s_late_count;
+}
+
+void test_thread_exit() {
+    // 先让RCU创建它的key，后创建的key析构时排在后面
+    {
+        sylar::RcuReadLock lock;
+    }
+    pthread_key_create(&s_late_key, &late_reader);
+    std::vector<sylar::Thread::ptr> thrs;
+    for(int i = 0; i < 8; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([](){
+            {
+                sylar::RcuReadLock lock;
+            }
+            pthread_setspecific(s_late_key, (void*)1);
+        }, "rcu_exit_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    SYLAR_ASSERT(s_late_count == 8);
+    // 退出的线程重新登记的读者也已经回收，不会卡住宽限期
+    sylar::Rcu::Synchronize();
+    SYLAR_LOG_INFO(g_logger) << "test_thread_exit ok";
+}
+
+// 登记的槽在离开临界区、线程退出后仍然有效，可以在别的线程清掉
+void test_hazard() {
+    Data* data = new Data(1);
+    std::atomic<const void*>* slots[sylar::Rcu::HAZARDS + 1];
+    sylar::Thread::ptr thr(new sylar::Thread([data, &slots](){
+        sylar::RcuReadLock lock;
+        for(auto& i : slots) {
+            i = sylar::Rcu::Protect(data);
+        }
+    }, "rcu_hazard"));
+    thr->join();
+    // 槽用完时返回nullptr
+    SYLAR_ASSERT(slots[sylar::Rcu::HAZARDS] == nullptr);
+    for(size_t i = 0; i < sylar::Rcu::HAZARDS; ++i) {
+        SYLAR_ASSERT(slots[i]);
+        SYLAR_ASSERT(sylar::Rcu::IsProtected(data));
+        sylar::Rcu::Unprotect(slots[i]);
+    }
+    SYLAR_ASSERT(!sylar::Rcu::IsProtected(data));
+    delete data;
+    SYLAR_LOG_INFO(g_logger) << "test_hazard ok";
+}
+
+// appender里嵌套打日志(用完hazard槽后改加引用)，并且把自己从logger里删掉
+class NestAppender : public sylar::LogAppender {
+public:
+    NestAppender(int& lines) :m_lines(lines) {}
+    void log(const sylar::Logger::ptr& logger, sylar::LogLevel::Level level
+             ,const sylar::LogEvent::ptr& event) override {
+        ++m_lines;
+        if(m_lines < 10) {
+            SYLAR_LOG_INFO(logger) << "nest " << m_lines;
+        } else if(m_lines == 10) {
+            logger->clearAppenders();
+        }
+    }
+    std::string toYamlString() override { return "";}
+private:
+    int& m_lines;
+};
+
+void test_nest() {
+    int lines = 0;
+    {
+        sylar::Logger::ptr logger(new sylar::Logger("rcu_nest"));
+        sylar::LogAppender::ptr appender(new NestAppender(lines));
+        logger->addAppender(appender);
+        SYLAR_LOG_INFO(logger) << "nest 0";
+        SYLAR_ASSERT(lines == 10);
+        // 删掉时快照还在本线程的槽里，留到下次换下时释放
+        SYLAR_ASSERT(appender.use_count() == 2);
+        logger->addAppender(sylar::LogAppender::ptr(new sylar::StdoutLogAppender));
+        logger->clearAppenders();
+        SYLAR_ASSERT(appender.unique());
+    }
+    SYLAR_LOG_INFO(g_logger) << "test_nest ok";
+}
+
+int main(int argc, char** argv) {
+    test_rcu();
+    test_logger();
+    test_thread_exit();
+    test_hazard();
+    test_nest();
+    return 0;
+}
@@ -0,0 +1,202 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/address.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/serialize.h"
+#include "../sylar/rpc/rpc_server.h"
+#include "../sylar/rpc/rpc_client.h"
+#include <algorithm>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+namespace proto {
+
+struct AddRequest {
+    int32_t a;
+    int32_t b;
+    std::string tag;
+};
+
+struct AddResponse {
+    int64_t sum;
+    std::string tag;
+};
+
+}
+
+SYLAR_SERIALIZE(proto::AddRequest, a, b, tag)
+SYLAR_SERIALIZE(proto::AddResponse, sum, tag)
+
+using sylar::rpc::RpcStatus;
+using sylar::rpc::RpcClient;
+using sylar::rpc::RpcServer;
+
+static const char* SOCK_PATH = "/tmp/sylar_test_rpc.sock";
+
+static RpcServer::ptr start_server(sylar::IOManager* iom) {
+    RpcServer::ptr server(new RpcServer(iom, iom));
+    server->registerMethod("echo", [](const std::string& req, std::string& rsp) {
+        rsp = req;
+        return 0;
+    });
+    server->registerMethod("sleep", [](const std::string& req, std::string& rsp) {
+        usleep(atoi(req.c_str()) * 1000);
+        rsp = req;
+        return 0;
+    });
+    server->registerMethod("fail", [](const std::string& req, std::string& rsp) {
+        rsp = "ignored";
+        return 123;
+    });
+    server->registerMethod("throw", [](const std::string& req, std::string& rsp) -> int {
+        throw std::runtime_error("boom");
+    });
+    server->registerMethod<proto::AddRequest, proto::AddResponse>("add"
+            , [](const proto::AddRequest& req, proto::AddResponse& rsp) {
+        rsp.sum = (int64_t)req.a + req.b;
+        rsp.tag = req.tag;
+        return 0;
+    });
+    unlink(SOCK_PATH);
+    SYLAR_ASSERT(server->bind(sylar::Address::ptr(new sylar::UnixAddress(SOCK_PATH))));
+    SYLAR_ASSERT(server->start());
+    return server;
+}
+
+static RpcClient::ptr connect() {
+    RpcClient::ptr client = RpcClient::Connect(
+            sylar::Address::ptr(new sylar::UnixAddress(SOCK_PATH)), 1000);
+    SYLAR_ASSERT(client);
+    return client;
+}
+
+void test_call() {
+    sylar::IOManager iom(2, false, "rpc");
+    RpcServer::ptr server = start_server(&iom);
+    iom.schedule([server]() {
+        RpcClient::ptr client = connect();
+        std::string rsp;
+        SYLAR_ASSERT(client->call("echo", "hello", rsp, 1000) == 0);
+        SYLAR_ASSERT(rsp == "hello");
+        SYLAR_ASSERT(client->call("echo", "", rsp, 1000) == 0);
+        SYLAR_ASSERT(rsp.empty());
+
+        // 大于接收缓冲区的帧
+        std::string big(1024 * 1024 + 17, 'x');
+        for(size_t i = 0; i < big.size(); i += 4096) {
+            big[i] = 'a' + i % 26;
+        }
+        SYLAR_ASSERT(client->call("echo", big, rsp, 3000) == 0);
+        SYLAR_ASSERT(rsp == big);
+
+        SYLAR_ASSERT(client->call("none", "x", rsp, 1000) == (int)RpcStatus::NOT_FOUND);
+        SYLAR_ASSERT(client->call("fail", "x", rsp, 1000) == 123);
+        SYLAR_ASSERT(rsp.empty());
+        SYLAR_ASSERT(client->call("throw", "x", rsp, 1000) == (int)RpcStatus::HANDLER_ERROR);
+
+        proto::AddRequest req;
+        req.a = 40;
+        req.b = 2;
+        req.tag = "t";
+        proto::AddResponse ar;
+        SYLAR_ASSERT(client->call("add", req, ar, 1000) == 0);
+        SYLAR_ASSERT(ar.sum == 42 && ar.tag == "t");
+        // 请求解码失败
+        SYLAR_ASSERT(client->call("add", "\x01", rsp, 1000) == (int)RpcStatus::BAD_REQUEST);
+
+        // 超时：调用方按时返回，迟到的响应被丢弃，连接继续可用
+        uint64_t ts = sylar::GetCurrentMS();
+        SYLAR_ASSERT(client->call("sleep", "200", rsp, 50) == (int)RpcStatus::TIMEOUT);
+        uint64_t used = sylar::GetCurrentMS() - ts;
+        SYLAR_ASSERT(used >= 45 && used < 150);
+        SYLAR_ASSERT(client->getPendingCount() == 0);
+        SYLAR_ASSERT(client->call("echo", "after", rsp, 1000) == 0);
+        SYLAR_ASSERT(rsp == "after");
+
+        // 一个连接上并发的调用：慢请求不挡住快请求，总时间接近最慢的那个
+        const int n = 50;
+        std::shared_ptr<sylar::FiberWaitGroup> wg(new sylar::FiberWaitGroup(n));
+        std::shared_ptr<std::vector<uint64_t> > done(new std::vector<uint64_t>(n));
+        ts = sylar::GetCurrentMS();
+        for(int i = 0; i < n; ++i) {
+            sylar::IOManager::GetThis()->schedule([client, wg, done, i, ts]() {
+                std::string out;
+                std::string in = std::to_string(i % 2 ? 100 : 1);
+                SYLAR_ASSERT(client->call("sleep", in, out, 2000) == 0);
+                SYLAR_ASSERT(out == in);
+                (*done)[i] = sylar::GetCurrentMS() - ts;
+                wg->done();
+            });
+        }
+        wg->wait();
+        used = sylar::GetCurrentMS() - ts;
+        SYLAR_ASSERT(used < 500);
+        for(int i = 0; i < n; i += 2) {
+            SYLAR_ASSERT((*done)[i] < 90);
+        }
+
+        // 连接关闭时等待中的调用返回CLOSED
+        sylar::IOManager::GetThis()->schedule([client]() {
+            usleep(30 * 1000);
+            client->close();
+        });
+        SYLAR_ASSERT(client->call("sleep", "200", rsp, 2000) == (int)RpcStatus::CLOSED);
+        SYLAR_ASSERT(client->call("echo", "x", rsp, 1000) == (int)RpcStatus::CLOSED);
+        server->stop();
+    });
+}
+
+/**
+ * 一个连接上conc个协程并发调用，统计QPS和p99
+ */
+static void bench_one(RpcClient::ptr client, int conc, int total) {
+    int per = total / conc;
+    std::shared_ptr<sylar::FiberWaitGroup> wg(new sylar::FiberWaitGroup(conc));
+    std::shared_ptr<std::vector<uint32_t> > lat(new std::vector<uint32_t>(per * conc));
+    std::string payload(64, 'p');
+    uint64_t ts = sylar::GetCurrentUS();
+    for(int c = 0; c < conc; ++c) {
+        sylar::IOManager::GetThis()->schedule([client, wg, lat, payload, c, per]() {
+            std::string rsp;
+            for(int i = 0; i < per; ++i) {
+                uint64_t start = sylar::GetCurrentUS();
+                SYLAR_ASSERT(client->call("echo", payload, rsp, 5000) == 0);
+                (*lat)[c * per + i] = sylar::GetCurrentUS() - start;
+            }
+            wg->done();
+        });
+    }
+    wg->wait();
+    uint64_t us = sylar::GetCurrentUS() - ts;
+    std::sort(lat->begin(), lat->end());
+    SYLAR_LOG_INFO(g_logger) << "bench concurrency=" << conc
+        << " calls=" << lat->size()
+        << " qps=" << (uint64_t)(lat->size() * 1000000.0 / us)
+        << " p50=" << (*lat)[lat->size() / 2] << "us"
+        << " p99=" << (*lat)[lat->size() * 99 / 100] << "us";
+}
+
+void bench() {
+    sylar::IOManager server_iom(1, false, "server");
+    RpcServer::ptr server = start_server(&server_iom);
+    {
+        sylar::IOManager client_iom(1, false, "client");
+        client_iom.schedule([]() {
+            RpcClient::ptr client = connect();
+            bench_one(client, 1, 20000);
+            bench_one(client, 10, 100000);
+            bench_one(client, 100, 200000);
+            client->close();
+        });
+    }
+    server->stop();
+}
+
+int main(int argc, char** argv) {
+    test_call();
+    SYLAR_LOG_INFO(g_logger) << "test_call ok";
+    bench();
+    unlink(SOCK_PATH);
+    return 0;
+}
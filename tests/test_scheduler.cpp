@@ -1,5 +1,6 @@
 #include "../sylar/sylar.h"
 #include "../sylar/hook.h"
+#include <atomic>
 
 // 虽然没导入hook文件，但因为CMakeLists.txt 生成文件是的库连接，所以会使用hook的sleep，这是错误的
 // Schedule模块还无法使用hook函数，IOManager模块才能正确使用
@@ -43,8 +44,32 @@ void test_cb() {
     SYLAR_LOG_INFO(g_logger) << "test_cb over";
 }
 
+// 协程先把自己交给调度器再YieldToHold，其他线程可能在它切出去之前就取到它，
+// 这时不能切进一个上下文还没保存完的协程
+void test_hold_wakeup() {
+    std::atomic<int> count(0);
+    {
+        sylar::Scheduler sc(4, false, "hold");
+        sc.start();
+        for(int i = 0; i < 16; ++i) {
+            sc.schedule([&count]() {
+                for(int j = 0; j < 10000; ++j) {
+                    sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis());
+                    sylar::Fiber::YieldToHold();
+                    ++count;
+                }
+            });
+        }
+        sc.stop();
+    }
+    SYLAR_ASSERT(count == 16 * 10000);
+    SYLAR_LOG_INFO(g_logger) << "test_hold_wakeup ok";
+}
+
 int main(int argc, char** argv) {
     // test_cb();
     test_scheduler();
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_hold_wakeup();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,283 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/address.h"
+#include "../sylar/socket.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/streams/socket_stream.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const std::string s_file = "/tmp/sylar_test_sendfile.dat";
+
+/**
+ * 建立一对相连的Socket
+ */
+static std::pair<sylar::Socket::ptr, sylar::Socket::ptr> make_pair() {
+    sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+    SYLAR_ASSERT(listener->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+    SYLAR_ASSERT(listener->listen());
+    sylar::Socket::ptr client = sylar::Socket::CreateTCPSocket();
+    SYLAR_ASSERT(client->connect(listener->getLocalAddress()));
+    sylar::Socket::ptr server = listener->accept();
+    SYLAR_ASSERT(server);
+    return std::make_pair(client, server);
+}
+
+static std::string make_data(size_t len) {
+    std::string data(len, '\0');
+    for(size_t i = 0; i < len; ++i) {
+        data[i] = 'a' + (i * 7 + i / 26) % 26;
+    }
+    return data;
+}
+
+/**
+ * 生成size字节的文件，返回只读的fd
+ */
+static int make_file(size_t size) {
+    std::string data = make_data(1024 * 1024);
+    FILE* f = fopen(s_file.c_str(), "w");
+    SYLAR_ASSERT(f);
+    for(size_t i = 0; i < size; i += data.size()) {
+        size_t n = std::min(data.size(), size - i);
+        SYLAR_ASSERT(fwrite(data.c_str(), 1, n, f) == n);
+    }
+    fclose(f);
+    int fd = open(s_file.c_str(), O_RDONLY);
+    SYLAR_ASSERT(fd >= 0);
+    return fd;
+}
+
+/**
+ * 读到对端关闭或者读满length字节，返回读到的字节数
+ */
+static uint64_t sink(sylar::Socket::ptr sock, uint64_t length) {
+    std::vector<char> buf(256 * 1024);
+    uint64_t total = 0;
+    while(total < length) {
+        int n = sock->recv(&buf[0], std::min((uint64_t)buf.size(), length - total));
+        if(n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+void test_send_file() {
+    sylar::IOManager iom(2, false, "sendfile");
+    iom.schedule([]() {
+        const size_t size = 16 * 1024 * 1024 + 123;
+        int fd = make_file(size);
+        std::string data = make_data(1024 * 1024);
+        auto p = make_pair();
+        sylar::SocketStream::ptr in(new sylar::SocketStream(p.second, false));
+
+        // 大于socket缓冲区，中间要等可写
+        std::shared_ptr<sylar::FiberEvent> done(new sylar::FiberEvent);
+        std::shared_ptr<int64_t> sent(new int64_t(0));
+        sylar::Socket::ptr out = p.first;
+        sylar::IOManager::GetThis()->schedule([out, fd, done, sent]() {
+            *sent = out->sendFile(fd, 1000, 2 * 1024 * 1024);
+            done->set();
+        });
+        std::string buf(2 * 1024 * 1024, '\0');
+        SYLAR_ASSERT(in->readFixSize(&buf[0], buf.size()) > 0);
+        done->wait();
+        SYLAR_ASSERT(*sent == 2 * 1024 * 1024);
+        for(size_t i = 0; i < buf.size(); ++i) {
+            SYLAR_ASSERT(buf[i] == data[(1000 + i) % data.size()]);
+        }
+
+        // 文件不够长时发到文件结尾
+        SYLAR_ASSERT(out->sendFile(fd, size - 100, 1000) == 100);
+        SYLAR_ASSERT(in->readFixSize(&buf[0], 100) > 0);
+        for(size_t i = 0; i < 100; ++i) {
+            SYLAR_ASSERT(buf[i] == data[(size - 100 + i) % data.size()]);
+        }
+        SYLAR_ASSERT(out->sendFile(fd, size, 1000) == 0);
+
+        // 对端不读，写满之后按发送超时返回已经发出的字节数
+        out->setSendTimeout(200);
+        uint64_t ts = sylar::GetCurrentMS();
+        int64_t rt = out->sendFile(fd, 0, size);
+        SYLAR_ASSERT(rt > 0 && rt < (int64_t)size);
+        SYLAR_ASSERT(sylar::GetCurrentMS() - ts >= 200);
+
+        out->close();
+        SYLAR_ASSERT(out->sendFile(fd, 0, 100) < 0);
+        p.second->close();
+        close(fd);
+        unlink(s_file.c_str());
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_send_file ok";
+}
+
+void test_splice() {
+    sylar::IOManager iom(2, false, "sendfile");
+    iom.schedule([]() {
+        // src -> a ==splice==> b -> dst
+        auto p1 = make_pair();
+        auto p2 = make_pair();
+        sylar::Socket::ptr src = p1.first;
+        sylar::Socket::ptr a = p1.second;
+        sylar::Socket::ptr b = p2.first;
+        sylar::Socket::ptr dst = p2.second;
+        sylar::SocketStream::ptr in(new sylar::SocketStream(dst, false));
+
+        std::string data = make_data(3 * 1024 * 1024);
+        sylar::IOManager::GetThis()->schedule([src, data]() {
+            sylar::SocketStream::ptr out(new sylar::SocketStream(src, false));
+            SYLAR_ASSERT(out->writeFixSize(data.c_str(), data.size()) > 0);
+        });
+
+        // 只转发length字节
+        SYLAR_ASSERT(b->splice(a, 1000) == 1000);
+        std::string buf(data.size(), '\0');
+        SYLAR_ASSERT(in->readFixSize(&buf[0], 1000) > 0);
+        SYLAR_ASSERT(buf.compare(0, 1000, data, 0, 1000) == 0);
+
+        // 转发剩下的数据，同时对端在读
+        std::shared_ptr<sylar::FiberEvent> done(new sylar::FiberEvent);
+        std::shared_ptr<int64_t> moved(new int64_t(0));
+        sylar::IOManager::GetThis()->schedule([a, b, done, moved, data]() {
+            *moved = b->splice(a, data.size() - 1000);
+            done->set();
+        });
+        SYLAR_ASSERT(in->readFixSize(&buf[1000], data.size() - 1000) > 0);
+        done->wait();
+        SYLAR_ASSERT(*moved == (int64_t)data.size() - 1000);
+        SYLAR_ASSERT(buf == data);
+
+        // 来源没有数据时按接收超时返回
+        a->setRecvTimeout(200);
+        uint64_t ts = sylar::GetCurrentMS();
+        SYLAR_ASSERT(b->splice(a) < 0);
+        SYLAR_ASSERT(errno == ETIMEDOUT);
+        SYLAR_ASSERT(sylar::GetCurrentMS() - ts >= 200);
+
+        // 转发到来源关闭为止
+        SYLAR_ASSERT(src->send("tail", 4) == 4);
+        src->close();
+        SYLAR_ASSERT(b->splice(a) == 4);
+        SYLAR_ASSERT(in->readFixSize(&buf[0], 4) > 0);
+        SYLAR_ASSERT(buf.compare(0, 4, "tail") == 0);
+        SYLAR_ASSERT(b->splice(a) == 0);
+
+        a->close();
+        b->close();
+        dst->close();
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_splice ok";
+}
+
+static void log_result(const char* name, uint64_t bytes, uint64_t us) {
+    SYLAR_LOG_INFO(g_logger) << name << " bytes=" << bytes
+        << " time=" << us / 1000 << "ms"
+        << " speed=" << (uint64_t)(bytes / 1024.0 / 1024 * 1000000 / us) << "MB/s";
+}
+
+/**
+ * 发送文件：pread+send对比sendFile
+ */
+void bench_send_file(size_t size) {
+    int fd = make_file(size);
+    for(int zero_copy = 0; zero_copy < 2; ++zero_copy) {
+        sylar::IOManager iom(2, false, "sendfile");
+        iom.schedule([fd, size, zero_copy]() {
+            auto p = make_pair();
+            sylar::Socket::ptr out = p.first;
+            sylar::Socket::ptr in = p.second;
+            std::shared_ptr<sylar::FiberEvent> done(new sylar::FiberEvent);
+            uint64_t ts = sylar::GetCurrentUS();
+            sylar::IOManager::GetThis()->schedule([out, fd, size, zero_copy, done]() {
+                if(zero_copy) {
+                    SYLAR_ASSERT(out->sendFile(fd, 0, size) == (int64_t)size);
+                } else {
+                    std::vector<char> buf(256 * 1024);
+                    for(size_t off = 0; off < size;) {
+                        ssize_t n = pread(fd, &buf[0], buf.size(), off);
+                        SYLAR_ASSERT(n > 0);
+                        for(ssize_t i = 0; i < n;) {
+                            int rt = out->send(&buf[i], n - i);
+                            SYLAR_ASSERT(rt > 0);
+                            i += rt;
+                        }
+                        off += n;
+                    }
+                }
+                done->set();
+            });
+            SYLAR_ASSERT(sink(in, size) == size);
+            done->wait();
+            log_result(zero_copy ? "sendFile     " : "pread+send   ", size
+                    ,sylar::GetCurrentUS() - ts);
+        });
+    }
+    close(fd);
+    unlink(s_file.c_str());
+}
+
+/**
+ * 代理转发：recv+send拷贝对比splice
+ */
+void bench_splice(size_t size) {
+    for(int zero_copy = 0; zero_copy < 2; ++zero_copy) {
+        sylar::IOManager iom(2, false, "sendfile");
+        iom.schedule([size, zero_copy]() {
+            auto p1 = make_pair();
+            auto p2 = make_pair();
+            sylar::Socket::ptr src = p1.first;
+            sylar::Socket::ptr a = p1.second;
+            sylar::Socket::ptr b = p2.first;
+            sylar::Socket::ptr dst = p2.second;
+            uint64_t ts = sylar::GetCurrentUS();
+            sylar::IOManager::GetThis()->schedule([src, size]() {
+                std::string data = make_data(1024 * 1024);
+                sylar::SocketStream::ptr out(new sylar::SocketStream(src, false));
+                for(size_t i = 0; i < size; i += data.size()) {
+                    SYLAR_ASSERT(out->writeFixSize(data.c_str()
+                                ,std::min(data.size(), size - i)) > 0);
+                }
+                src->close();
+            });
+            sylar::IOManager::GetThis()->schedule([a, b, zero_copy]() {
+                if(zero_copy) {
+                    SYLAR_ASSERT(b->splice(a) > 0);
+                } else {
+                    std::vector<char> buf(256 * 1024);
+                    while(true) {
+                        int n = a->recv(&buf[0], buf.size());
+                        if(n <= 0) {
+                            break;
+                        }
+                        for(int i = 0; i < n;) {
+                            int rt = b->send(&buf[i], n - i);
+                            SYLAR_ASSERT(rt > 0);
+                            i += rt;
+                        }
+                    }
+                }
+                b->close();
+            });
+            SYLAR_ASSERT(sink(dst, (uint64_t)-1) == size);
+            log_result(zero_copy ? "splice proxy " : "recv+send    ", size
+                    ,sylar::GetCurrentUS() - ts);
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    test_send_file();
+    test_splice();
+    size_t size = 2048;
+    if(argc > 1) {
+        size = atoi(argv[1]);
+    }
+    size *= 1024 * 1024;
+    bench_send_file(size);
+    bench_splice(size);
+    return 0;
+}
@@ -0,0 +1,249 @@
+#include "../sylar/serialize.h"
+#include "../sylar/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+namespace proto {
+
+enum Type : uint8_t {
+    LOGIN = 1,
+    LOGOUT = 2
+};
+
+struct Header {
+    uint32_t magic;
+    uint16_t version;
+    Type type;
+};
+
+struct Item {
+    uint32_t id;
+    std::string name;
+};
+
+struct Message {
+    int32_t id;
+    std::string name;
+    uint64_t uid;
+    double score;
+    Header head;
+    std::vector<uint32_t> tags;
+    bool flag;
+    std::vector<Item> items;
+    std::map<std::string, int64_t> attrs;
+};
+
+}
+
+SYLAR_SERIALIZE(proto::Header, magic, version, type)
+SYLAR_SERIALIZE(proto::Item, id, name)
+SYLAR_SERIALIZE(proto::Message, id, name, uid, score, head, tags, flag, items, attrs)
+
+static_assert(sylar::Serializer<proto::Header>::FIXED, "Header fixed");
+static_assert(sylar::Serializer<proto::Header>::SIZE == 7, "Header size");
+static_assert(!sylar::Serializer<proto::Message>::FIXED, "Message var");
+static_assert(sylar::Schema<proto::Message>::FIXED_SIZE == 4 + 8 + 8 + 7 + 1, "Message fixed size");
+
+static proto::Message rand_message() {
+    proto::Message m;
+    m.id = rand();
+    m.name = "name_" + std::to_string(rand());
+    m.uid = ((uint64_t)rand() << 32) | rand();
+    m.score = rand() / 3.0;
+    m.head.magic = 0x5359;
+    m.head.version = rand() % 10;
+    m.head.type = rand() % 2 ? proto::LOGIN : proto::LOGOUT;
+    m.flag = rand() % 2;
+    int n = rand() % 8;
+    for(int i = 0; i < n; ++i) {
+        m.tags.push_back(rand());
+    }
+    n = rand() % 3;
+    for(int i = 0; i < n; ++i) {
+        proto::Item item;
+        item.id = rand();
+        item.name = std::to_string(rand());
+        m.items.push_back(item);
+    }
+    return m;
+}
+
+// 手写的等价编码,定长字段在前
+static void manual_encode(sylar::ByteArray& ba, const proto::Message& m) {
+    ba.writeFint32(m.id);
+    ba.writeFuint64(m.uid);
+    ba.writeDouble(m.score);
+    ba.writeFuint32(m.head.magic);
+    ba.writeFuint16(m.head.version);
+    ba.writeFuint8(m.head.type);
+    ba.writeFuint8(m.flag);
+    ba.writeStringVint(m.name);
+    ba.writeUint64(m.tags.size());
+    for(auto& i : m.tags) {
+        ba.writeFuint32(i);
+    }
+    ba.writeUint64(m.items.size());
+    for(auto& i : m.items) {
+        ba.writeFuint32(i.id);
+        ba.writeStringVint(i.name);
+    }
+    ba.writeUint64(m.attrs.size());
+    for(auto& i : m.attrs) {
+        ba.writeStringVint(i.first);
+        ba.writeFint64(i.second);
+    }
+}
+
+static void manual_decode(sylar::ByteArray& ba, proto::Message& m) {
+    m.id = ba.readFint32();
+    m.uid = ba.readFuint64();
+    m.score = ba.readDouble();
+    m.head.magic = ba.readFuint32();
+    m.head.version = ba.readFuint16();
+    m.head.type = (proto::Type)ba.readFuint8();
+    m.flag = ba.readFuint8();
+    m.name = ba.readStringVint();
+    m.tags.resize(ba.readUint64());
+    for(auto& i : m.tags) {
+        i = ba.readFuint32();
+    }
+    m.items.resize(ba.readUint64());
+    for(auto& i : m.items) {
+        i.id = ba.readFuint32();
+        i.name = ba.readStringVint();
+    }
+    size_t n = ba.readUint64();
+    m.attrs.clear();
+    for(size_t i = 0; i < n; ++i) {
+        std::string key = ba.readStringVint();
+        m.attrs[key] = ba.readFint64();
+    }
+}
+
+static bool equal(const proto::Message& a, const proto::Message& b) {
+    if(a.items.size() != b.items.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < a.items.size(); ++i) {
+        if(a.items[i].id != b.items[i].id || a.items[i].name != b.items[i].name) {
+            return false;
+        }
+    }
+    return a.id == b.id && a.name == b.name && a.uid == b.uid
+        && a.score == b.score && a.head.magic == b.head.magic
+        && a.head.version == b.head.version && a.head.type == b.head.type
+        && a.tags == b.tags && a.flag == b.flag && a.attrs == b.attrs;
+}
+
+void test() {
+    for(int i = 0; i < 2; ++i) {
+        for(size_t base : {1, 7, 4096}) {
+            proto::Message m = rand_message();
+            m.attrs["a"] = -1;
+            m.attrs["bb"] = (int64_t)rand() << 20;
+
+            sylar::ByteArray ba(base);
+            sylar::ByteArray ba2(base);
+            ba.setIsLittleEndian(i);
+            ba2.setIsLittleEndian(i);
+            sylar::Serialize(ba, m);
+            manual_encode(ba2, m);
+            ba.setPosition(0);
+            ba2.setPosition(0);
+            SYLAR_ASSERT(ba.toString() == ba2.toString());
+
+            proto::Message out;
+            sylar::Deserialize(ba, out);
+            SYLAR_ASSERT(ba.getReadSize() == 0);
+            SYLAR_ASSERT(equal(m, out));
+
+            // 截断的数据抛出std::out_of_range
+            sylar::ByteArray ba3(base);
+            std::string data = ba2.toString();
+            ba3.write(data.c_str(), data.size() - 1);
+            ba3.setPosition(0);
+            bool thrown = false;
+            try {
+                sylar::Deserialize(ba3, out);
+            } catch(std::out_of_range& e) {
+                thrown = true;
+            }
+            SYLAR_ASSERT(thrown);
+        }
+    }
+
+    // 伪造的超大数量
+    sylar::ByteArray ba(64);
+    ba.writeUint64(1ull << 40);
+    ba.setPosition(0);
+    std::vector<uint64_t> vec;
+    bool thrown = false;
+    try {
+        sylar::Deserialize(ba, vec);
+    } catch(std::out_of_range& e) {
+        thrown = true;
+    }
+    SYLAR_ASSERT(thrown);
+
+    // bool按1字节0/1编码，收到0/1以外的字节当作true
+    sylar::ByteArray bba(64);
+    sylar::Serialize(bba, true);
+    bba.writeFuint8(2);
+    bba.writeFuint8(0);
+    bba.setPosition(0);
+    SYLAR_ASSERT(bba.toString() == std::string("\x01\x02\x00", 3));
+    bool b = false;
+    sylar::Deserialize(bba, b);
+    SYLAR_ASSERT(b == true);
+    sylar::Deserialize(bba, b);
+    SYLAR_ASSERT(b == true);
+    sylar::Deserialize(bba, b);
+    SYLAR_ASSERT(b == false);
+    SYLAR_LOG_INFO(g_logger) << "test ok";
+}
+
+// protobuf不在依赖里,这里只和手写的ByteArray调用比较
+void bench() {
+    const int count = 1000000;
+    std::vector<proto::Message> msgs;
+    for(int i = 0; i < 1000; ++i) {
+        msgs.push_back(rand_message());
+    }
+
+    sylar::ByteArray ba(4096);
+    uint64_t ts = sylar::GetCurrentUS();
+    for(int i = 0; i < count; ++i) {
+        manual_encode(ba, msgs[i % msgs.size()]);
+    }
+    uint64_t ts2 = sylar::GetCurrentUS();
+    size_t size = ba.getSize();
+    ba.setPosition(0);
+    proto::Message m;
+    for(int i = 0; i < count; ++i) {
+        manual_decode(ba, m);
+    }
+    uint64_t ts3 = sylar::GetCurrentUS();
+
+    sylar::ByteArray ba2(4096);
+    uint64_t ts4 = sylar::GetCurrentUS();
+    for(int i = 0; i < count; ++i) {
+        sylar::Serialize(ba2, msgs[i % msgs.size()]);
+    }
+    uint64_t ts5 = sylar::GetCurrentUS();
+    ba2.setPosition(0);
+    for(int i = 0; i < count; ++i) {
+        sylar::Deserialize(ba2, m);
+    }
+    uint64_t ts6 = sylar::GetCurrentUS();
+    SYLAR_ASSERT(size == ba2.getSize());
+
+    SYLAR_LOG_INFO(g_logger) << "bench count=" << count << " size=" << size
+        << " manual encode=" << (ts2 - ts) << "us decode=" << (ts3 - ts2) << "us"
+        << " serialize encode=" << (ts5 - ts4) << "us decode=" << (ts6 - ts5) << "us";
+}
+
+int main(int argc, char** argv) {
+    test();
+    bench();
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include "../sylar/bytearray.h"
 #include "../sylar/address.h"
 #include "../sylar/socket.h"
+#include "../sylar/streams/socket_stream.h"
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
@@ -24,20 +25,22 @@ void server() {
         ba->clear();
         auto client_sock = sock->accept();
         SYLAR_ASSERT(client_sock);
-        // 接受数据
-        std::string buffs;
-        buffs.resize(4096);
-        int rt = client_sock->recv(&buffs[0], buffs.size());
-        SYLAR_LOG_INFO(g_logger) << "recv size=" << rt;
+        // 接受数据：先读2字节长度，再读内容，recv返回的长度可能不够
+        sylar::SocketStream stream(client_sock, false);
+        int rt = stream.readFixSize(ba, 2);
+        if(rt > 0) {
+            ba->setPosition(0);
+            uint16_t len = ba->readFuint16();
+            rt = stream.readFixSize(ba, len);
+        }
+        SYLAR_LOG_INFO(g_logger) << "recv size=" << ba->getSize();
         if(rt <= 0) {
             SYLAR_LOG_INFO(g_logger) << "recv fail rt=" << rt;
             return;
         }
-        buffs.resize(rt);
         // 二进制反序列化
-        ba->writeStringWithoutLength(buffs);
         ba->setPosition(0);
-        buffs = ba->readStringF16();
+        std::string buffs = ba->readStringF16();
         std::cout << buffs << std::endl;
 
         ba->clear();
@@ -45,8 +48,7 @@ void server() {
         std::string record = "The server receives the message";
         ba->writeStringF16(record);  // 二进制序列化
         ba->setPosition(0);
-        record = ba->toString();     // 获取要发送的二进制
-        rt = client_sock->send(&record[0], record.size());
+        rt = stream.writeFixSize(ba, ba->getSize());
         SYLAR_LOG_INFO(g_logger) << "send size=" << rt;
         if(rt <= 0) {
             SYLAR_LOG_INFO(g_logger) << "send fail rt=" << rt;
@@ -0,0 +1,326 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/address.h"
+#include "../sylar/socket.h"
+#include "../sylar/tcp_server.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/socket_pool.h"
+#include <string.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * 回显服务器，记下所有客户端连接，closeAll模拟服务器关闭空闲连接
+ */
+class EchoServer : public sylar::TcpServer {
+public:
+    typedef std::shared_ptr<EchoServer> ptr;
+    EchoServer(sylar::IOManager* io_worker, sylar::IOManager* accept_worker)
+        :sylar::TcpServer(io_worker, accept_worker) {
+    }
+
+    void closeAll() {
+        sylar::Mutex::Lock lock(m_mutex);
+        for(auto& i : m_clients) {
+            ::shutdown(i->getSocket(), SHUT_RDWR);
+        }
+        m_clients.clear();
+    }
+
+    size_t getAccepts() const { return m_accepts;}
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        ++m_accepts;
+        {
+            sylar::Mutex::Lock lock(m_mutex);
+            m_clients.push_back(client);
+        }
+        char buf[4096];
+        while(true) {
+            int rt = client->recv(buf, sizeof(buf));
+            if(rt <= 0) {
+                break;
+            }
+            if(client->send(buf, rt) != rt) {
+                break;
+            }
+        }
+    }
+private:
+    sylar::Mutex m_mutex;
+    std::vector<sylar::Socket::ptr> m_clients;
+    std::atomic<size_t> m_accepts{0};
+};
+
+class EchoConn {
+public:
+    typedef std::shared_ptr<EchoConn> ptr;
+    EchoConn(sylar::Socket::ptr sock)
+        :m_sock(sock) {
+    }
+
+    sylar::Socket::ptr getSocket() const { return m_sock;}
+
+    bool echo(const std::string& msg) {
+        if(m_sock->send(msg.c_str(), msg.size()) != (int)msg.size()) {
+            return false;
+        }
+        std::string buf(msg.size(), '\0');
+        size_t offset = 0;
+        while(offset < buf.size()) {
+            int rt = m_sock->recv(&buf[offset], buf.size() - offset);
+            if(rt <= 0) {
+                return false;
+            }
+            offset += rt;
+        }
+        return buf == msg;
+    }
+private:
+    sylar::Socket::ptr m_sock;
+};
+
+typedef sylar::SocketPool<EchoConn> EchoPool;
+
+static uint64_t now_ms() {
+    return sylar::GetCurrentMS();
+}
+
+/**
+ * 定时器里的探测和测试协程并发，轮询等待结果
+ */
+static bool wait_until(std::function<bool()> cond, uint64_t timeout_ms) {
+    uint64_t deadline = now_ms() + timeout_ms;
+    while(!cond()) {
+        if(now_ms() >= deadline) {
+            return false;
+        }
+        usleep(5 * 1000);
+    }
+    return true;
+}
+
+/**
+ * 在独立的IOManager里起回显服务器，cb在客户端IOManager里执行
+ */
+static void run(std::function<void(EchoServer::ptr, sylar::Address::ptr)> cb) {
+    sylar::IOManager accept_worker(1, false, "accept");
+    sylar::IOManager io_worker(2, false, "io");
+    EchoServer::ptr server(new EchoServer(&io_worker, &accept_worker));
+    SYLAR_ASSERT(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+    sylar::Address::ptr addr = server->getSocks()[0]->getLocalAddress();
+    SYLAR_ASSERT(server->start());
+    {
+        sylar::IOManager client(2, false, "client");
+        client.schedule([server, addr, cb]() {
+            cb(server, addr);
+        });
+    }
+    server->stop();
+}
+
+void test_reuse() {
+    run([](EchoServer::ptr server, sylar::Address::ptr addr) {
+        sylar::SocketPoolOptions opts;
+        opts.max_active = 4;
+        EchoPool::ptr pool = EchoPool::Create(addr, opts);
+        for(int i = 0; i < 100; ++i) {
+            EchoPool::Lease conn = pool->acquire(1000);
+            SYLAR_ASSERT(conn);
+            SYLAR_ASSERT(conn->echo("hello " + std::to_string(i)));
+        }
+        auto m = pool->getMetrics();
+        SYLAR_ASSERT(m.acquires == 100);
+        SYLAR_ASSERT(m.misses == 1);
+        SYLAR_ASSERT(m.hits == 99);
+        SYLAR_ASSERT(server->getAccepts() == 1);
+        SYLAR_ASSERT(pool->getIdleCount() == 1);
+        SYLAR_ASSERT(pool->getActiveCount() == 0);
+
+        // 后进先出：最后归还的先被借出
+        EchoPool::Lease a = pool->acquire();
+        EchoPool::Lease b = pool->acquire();
+        EchoConn* pa = a.get();
+        EchoConn* pb = b.get();
+        SYLAR_ASSERT(pa && pb && pa != pb);
+        a.release();
+        b.release();
+        SYLAR_ASSERT(pool->getIdleCount() == 2);
+        SYLAR_ASSERT(pool->acquire().get() == pb);
+        // 上一行的Lease已经归还，pb又回到尾部
+        EchoPool::Lease c = pool->acquire();
+        SYLAR_ASSERT(c.get() == pb);
+
+        // 损坏的连接归还时关闭
+        c.markBroken();
+        c.release();
+        SYLAR_ASSERT(pool->getIdleCount() == 1);
+        SYLAR_ASSERT(pool->getMetrics().broken == 1);
+
+        // 空闲连接被服务器关闭，取出时发现并换新连接
+        server->closeAll();
+        usleep(20 * 1000);
+        EchoPool::Lease d = pool->acquire();
+        SYLAR_ASSERT(d && d->echo("again"));
+        SYLAR_ASSERT(pool->getMetrics().broken == 2);
+        SYLAR_LOG_INFO(g_logger) << pool->toString();
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_reuse ok";
+}
+
+void test_bounded() {
+    run([](EchoServer::ptr server, sylar::Address::ptr addr) {
+        sylar::SocketPoolOptions opts;
+        opts.max_active = 2;
+        EchoPool::ptr pool = EchoPool::Create(addr, opts);
+        EchoPool::Lease a = pool->acquire();
+        EchoPool::Lease b = pool->acquire();
+        SYLAR_ASSERT(a && b);
+
+        uint64_t ts = now_ms();
+        EchoPool::Lease c = pool->acquire(50);
+        SYLAR_ASSERT(!c);
+        SYLAR_ASSERT(c.getError() == EchoPool::TIMEOUT);
+        SYLAR_ASSERT(now_ms() - ts >= 45);
+        SYLAR_ASSERT(pool->getMetrics().timeouts == 1);
+
+        // 另一个协程30ms后归还，等待者拿到同一个连接
+        EchoConn* pa = a.get();
+        std::shared_ptr<EchoPool::Lease> holder(new EchoPool::Lease(std::move(a)));
+        sylar::IOManager::GetThis()->schedule([holder]() {
+            usleep(30 * 1000);
+            holder->release();
+        });
+        c = pool->acquire(1000);
+        SYLAR_ASSERT(c && c.get() == pa);
+        SYLAR_ASSERT(pool->getMetrics().wait_us_max >= 20 * 1000);
+        c.release();
+        b.release();
+
+        // 并发使用时借出的连接和新建的连接都不超过max_active
+        sylar::SocketPoolOptions opts3;
+        opts3.max_active = 3;
+        EchoPool::ptr pool3 = EchoPool::Create(addr, opts3);
+        std::shared_ptr<std::atomic<size_t> > peak(new std::atomic<size_t>(0));
+        // 最后一个done之后wg还会被访问，不能放在等待者的栈上
+        std::shared_ptr<sylar::FiberWaitGroup> wg(new sylar::FiberWaitGroup(20));
+        for(int i = 0; i < 20; ++i) {
+            sylar::IOManager::GetThis()->schedule([pool3, peak, wg, i]() {
+                for(int j = 0; j < 20; ++j) {
+                    EchoPool::Lease conn = pool3->acquire();
+                    SYLAR_ASSERT(conn);
+                    size_t active = pool3->getActiveCount();
+                    size_t m = *peak;
+                    while(active > m && !peak->compare_exchange_weak(m, active));
+                    SYLAR_ASSERT(conn->echo("msg " + std::to_string(i * 100 + j)));
+                }
+                wg->done();
+            });
+        }
+        wg->wait();
+        auto m = pool3->getMetrics();
+        SYLAR_ASSERT(*peak <= 3);
+        SYLAR_ASSERT(m.misses <= 3);
+        SYLAR_ASSERT(m.acquires == 400);
+        SYLAR_ASSERT(m.hits + m.misses == 400);
+        SYLAR_LOG_INFO(g_logger) << pool3->toString();
+
+        // 关闭后取连接失败
+        pool3->close();
+        SYLAR_ASSERT(pool3->getIdleCount() == 0);
+        SYLAR_ASSERT(pool3->acquire().getError() == EchoPool::CLOSED);
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_bounded ok";
+}
+
+void test_probe() {
+    run([](EchoServer::ptr server, sylar::Address::ptr addr) {
+        // 保活探测：服务器关闭的空闲连接在探测时被移除
+        sylar::SocketPoolOptions opts;
+        opts.idle_timeout = 0;
+        opts.probe_interval = 40;
+        std::shared_ptr<std::atomic<int> > pings(new std::atomic<int>(0));
+        EchoPool::ptr pool = EchoPool::Create(addr, opts, nullptr
+                , [pings](EchoConn& conn) {
+            ++*pings;
+            return conn.echo("ping");
+        });
+        {
+            EchoPool::Lease a = pool->acquire();
+            EchoPool::Lease b = pool->acquire();
+            EchoPool::Lease c = pool->acquire();
+        }
+        SYLAR_ASSERT(pool->getIdleCount() == 3);
+        // 活着的连接探测后还在池里
+        SYLAR_ASSERT(wait_until([pings]() { return *pings >= 3;}, 1000));
+        SYLAR_ASSERT(wait_until([pool]() { return pool->getIdleCount() == 3;}, 1000));
+        SYLAR_ASSERT(pool->getMetrics().probe_fails == 0);
+
+        server->closeAll();
+        SYLAR_ASSERT(wait_until([pool]() { return pool->getIdleCount() == 0;}, 1000));
+        SYLAR_ASSERT(pool->getMetrics().probe_fails == 3);
+        SYLAR_LOG_INFO(g_logger) << pool->toString();
+
+        // 空闲超时淘汰
+        sylar::SocketPoolOptions opts2;
+        opts2.idle_timeout = 40;
+        opts2.probe_interval = 0;
+        EchoPool::ptr pool2 = EchoPool::Create(addr, opts2);
+        {
+            EchoPool::Lease a = pool2->acquire();
+            EchoPool::Lease b = pool2->acquire();
+        }
+        SYLAR_ASSERT(pool2->getIdleCount() == 2);
+        SYLAR_ASSERT(wait_until([pool2]() { return pool2->getIdleCount() == 0;}, 1000));
+        SYLAR_ASSERT(pool2->getMetrics().evicted == 2);
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_probe ok";
+}
+
+/**
+ * 连接池和每次新建连接的对比
+ */
+void bench() {
+    const int fibers = 20;
+    const int count = 500;
+    run([=](EchoServer::ptr server, sylar::Address::ptr addr) {
+        sylar::SocketPoolOptions opts;
+        opts.max_active = fibers;
+        EchoPool::ptr pool = EchoPool::Create(addr, opts);
+        for(int mode = 0; mode < 2; ++mode) {
+            std::shared_ptr<sylar::FiberWaitGroup> wg(new sylar::FiberWaitGroup(fibers));
+            uint64_t ts = sylar::GetCurrentUS();
+            for(int i = 0; i < fibers; ++i) {
+                sylar::IOManager::GetThis()->schedule([=]() {
+                    for(int j = 0; j < count; ++j) {
+                        if(mode == 0) {
+                            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+                            SYLAR_ASSERT(sock->connect(addr));
+                            EchoConn conn(sock);
+                            SYLAR_ASSERT(conn.echo("bench"));
+                        } else {
+                            EchoPool::Lease conn = pool->acquire();
+                            SYLAR_ASSERT(conn && conn->echo("bench"));
+                        }
+                    }
+                    wg->done();
+                });
+            }
+            wg->wait();
+            uint64_t us = sylar::GetCurrentUS() - ts;
+            SYLAR_LOG_INFO(g_logger) << (mode == 0 ? "connect per use" : "socket pool")
+                << ": " << fibers * count << " echos in " << us / 1000 << "ms, "
+                << (uint64_t)(fibers * count * 1000000.0 / us) << " ops/s";
+        }
+        SYLAR_LOG_INFO(g_logger) << pool->toString();
+    });
+}
+
+int main(int argc, char** argv) {
+    test_reuse();
+    test_bounded();
+    test_probe();
+    bench();
+    return 0;
+}
@@ -0,0 +1,578 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/address.h"
+#include "../sylar/socket.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/streams/socket_stream.h"
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const std::string s_cert_file = "/tmp/sylar_test_ssl.crt";
+static const std::string s_key_file = "/tmp/sylar_test_ssl.key";
+
+/**
+ * 生成自签名的本地证书(EC P-256)
+ */
+static void make_cert() {
+    EVP_PKEY* pkey = nullptr;
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    SYLAR_ASSERT(EVP_PKEY_keygen_init(pctx) == 1);
+    SYLAR_ASSERT(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) == 1);
+    SYLAR_ASSERT(EVP_PKEY_keygen(pctx, &pkey) == 1);
+    EVP_PKEY_CTX_free(pctx);
+
+    X509* x509 = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_get_notBefore(x509), 0);
+    X509_gmtime_adj(X509_get_notAfter(x509), 3600);
+    X509_set_pubkey(x509, pkey);
+    X509_NAME* name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC
+            ,(const unsigned char*)"localhost", -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    SYLAR_ASSERT(X509_sign(x509, pkey, EVP_sha256()) > 0);
+
+    FILE* f = fopen(s_key_file.c_str(), "w");
+    SYLAR_ASSERT(f);
+    PEM_write_PrivateKey(f, pkey, nullptr, nullptr, 0, nullptr, nullptr);
+    fclose(f);
+    f = fopen(s_cert_file.c_str(), "w");
+    SYLAR_ASSERT(f);
+    PEM_write_X509(f, x509);
+    fclose(f);
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+}
+
+static std::string make_data(size_t len) {
+    std::string data(len, '\0');
+    for(size_t i = 0; i < len; ++i) {
+        data[i] = 'a' + (i * 7 + i / 26) % 26;
+    }
+    return data;
+}
+
+/**
+ * 测试服务端
+ * 握手后先发一个字节'h'(TLS1.3的ticket随之到达客户端)，然后读一个命令字节：
+ * 'e' 把之后收到的数据原样发回去；
+ * 's' 读uint64长度和数据，读完回一个字节'd'
+ */
+class TestServer {
+public:
+    typedef std::shared_ptr<TestServer> ptr;
+
+    TestServer() {
+        m_sock = sylar::SSLSocket::CreateTCPSocket();
+        SYLAR_ASSERT(m_sock->loadCertificates(s_cert_file, s_key_file));
+        SYLAR_ASSERT(m_sock->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+        SYLAR_ASSERT(m_sock->listen());
+    }
+
+    void start() {
+        m_stopped = std::make_shared<sylar::FiberEvent>();
+        sylar::Socket::ptr listener = m_sock;
+        auto stop = m_stop;
+        auto stopped = m_stopped;
+        sylar::IOManager::GetThis()->schedule([listener, stop, stopped]() {
+            while(true) {
+                sylar::Socket::ptr client = listener->accept();
+                if(*stop) {
+                    break;
+                }
+                if(!client) {
+                    continue;
+                }
+                sylar::IOManager::GetThis()->schedule(std::bind(&TestServer::handle, client));
+            }
+            stopped->set();
+        });
+    }
+
+    /**
+     * 关闭监听Socket和accept协程注册事件之间有竞争，
+     * 用一个普通TCP连接唤醒accept，accept返回后看到stop标志退出
+     */
+    void stop() {
+        *m_stop = true;
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCP(getAddress());
+        SYLAR_ASSERT(sock->connect(getAddress()));
+        sock->close();
+        m_stopped->wait();
+        m_sock->close();
+    }
+
+    sylar::Address::ptr getAddress() const { return m_sock->getLocalAddress();}
+private:
+    static void handle(sylar::Socket::ptr sock) {
+        sylar::SocketStream::ptr stream(new sylar::SocketStream(sock));
+        char cmd = 'h';
+        if(stream->writeFixSize(&cmd, 1) <= 0 || stream->readFixSize(&cmd, 1) <= 0) {
+            return;
+        }
+        std::vector<char> buf(64 * 1024);
+        if(cmd == 'e') {
+            while(true) {
+                int rt = stream->read(&buf[0], buf.size());
+                if(rt <= 0 || stream->writeFixSize(&buf[0], rt) <= 0) {
+                    break;
+                }
+            }
+        } else if(cmd == 's') {
+            uint64_t len = 0;
+            if(stream->readFixSize(&len, sizeof(len)) <= 0) {
+                return;
+            }
+            while(len > 0) {
+                int rt = stream->read(&buf[0], std::min(len, (uint64_t)buf.size()));
+                if(rt <= 0) {
+                    return;
+                }
+                len -= rt;
+            }
+            cmd = 'd';
+            stream->writeFixSize(&cmd, 1);
+        }
+    }
+private:
+    sylar::SSLSocket::ptr m_sock;
+    std::shared_ptr<std::atomic<bool> > m_stop = std::make_shared<std::atomic<bool> >(false);
+    std::shared_ptr<sylar::FiberEvent> m_stopped;
+};
+
+/**
+ * 连接并读到服务端的'h'
+ */
+static sylar::SSLSocket::ptr dial(sylar::Address::ptr addr, bool reuse = true) {
+    sylar::SSLSocket::ptr sock = sylar::SSLSocket::CreateTCP(addr);
+    sock->setSessionReuse(reuse);
+    SYLAR_ASSERT(sock->connect(addr));
+    char c = 0;
+    SYLAR_ASSERT(sock->recv(&c, 1) == 1);
+    SYLAR_ASSERT(c == 'h');
+    return sock;
+}
+
+void test_resume() {
+    make_cert();
+    sylar::IOManager iom(2, false, "ssl");
+    iom.schedule([]() {
+        TestServer::ptr server(new TestServer);
+        // 同一证书的第二个监听Socket共用SSL_CTX
+        TestServer::ptr server2(new TestServer);
+        server->start();
+        server2->start();
+        sylar::SSLSocket::ClearSessionCache();
+
+        sylar::SSLSocket::ptr sock = dial(server->getAddress());
+        SYLAR_ASSERT(!sock->isSessionReused());
+        sock->close();
+        SYLAR_ASSERT(sylar::SSLSocket::GetSessionCacheSize() == 1);
+
+        for(int i = 0; i < 3; ++i) {
+            sock = dial(server->getAddress());
+            SYLAR_ASSERT(sock->isSessionReused());
+            sock->close();
+        }
+        // 析构时也要正常关闭，会话还能复用
+        sock = dial(server->getAddress());
+        sock.reset();
+
+        // 不使用会话缓存时是完整握手，也不覆盖缓存里的会话
+        sock = dial(server->getAddress(), false);
+        SYLAR_ASSERT(!sock->isSessionReused());
+        sock->close();
+        sock = dial(server->getAddress());
+        SYLAR_ASSERT(sock->isSessionReused());
+        sock->close();
+
+        // 会话按地址缓存，另一个地址还是完整握手
+        sock = dial(server2->getAddress());
+        SYLAR_ASSERT(!sock->isSessionReused());
+        sock->close();
+        SYLAR_ASSERT(sylar::SSLSocket::GetSessionCacheSize() == 2);
+
+        sylar::SSLSocket::ClearSessionCache();
+        sock = dial(server->getAddress());
+        SYLAR_ASSERT(!sock->isSessionReused());
+        sock->close();
+
+        server->stop();
+        server2->stop();
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_resume ok";
+}
+
+void test_vectored() {
+    sylar::IOManager iom(2, false, "ssl");
+    iom.schedule([]() {
+        TestServer::ptr server(new TestServer);
+        server->start();
+        sylar::SSLSocket::ptr sock = dial(server->getAddress());
+        SYLAR_ASSERT(sock->send("e", 1) == 1);
+        sylar::SocketStream::ptr stream(new sylar::SocketStream(sock, false));
+
+        // 小块、正好一条记录、跨记录的大块混在一起
+        std::string data = make_data(128 * 1024);
+        size_t sizes[] = {10, 16384, 5, 40000, 1, 16383, 3, 32768};
+        std::vector<iovec> iovs;
+        size_t total = 0;
+        for(auto i : sizes) {
+            iovec iov;
+            iov.iov_base = &data[total];
+            iov.iov_len = i;
+            iovs.push_back(iov);
+            total += i;
+        }
+        SYLAR_ASSERT(sock->send(&iovs[0], iovs.size()) == (int)total);
+        std::string buf(total, '\0');
+        SYLAR_ASSERT(stream->readFixSize(&buf[0], total) == (int)total);
+        SYLAR_ASSERT(buf.compare(0, total, data, 0, total) == 0);
+
+        // ByteArray用很小的块，write/read都是一长串iovec
+        // (SSL对象不能在两个协程里同时读写，先写完再读)
+        sylar::ByteArray::ptr ba(new sylar::ByteArray(100));
+        ba->write(data.c_str(), data.size());
+        ba->setPosition(0);
+        SYLAR_ASSERT(stream->writeFixSize(ba, ba->getSize()) > 0);
+        sylar::ByteArray::ptr rba(new sylar::ByteArray(1000));
+        SYLAR_ASSERT(stream->readFixSize(rba, data.size()) == (int)data.size());
+        rba->setPosition(0);
+        SYLAR_ASSERT(rba->toString() == data);
+
+        // 已经读到的数据先返回，不为填满后面的iovec去等
+        SYLAR_ASSERT(sock->send("abc", 3) == 3);
+        char a[2];
+        char b[100];
+        iovec riov[2] = {{a, sizeof(a)}, {b, sizeof(b)}};
+        SYLAR_ASSERT(sock->recv(riov, 2) == 3);
+        SYLAR_ASSERT(memcmp(a, "ab", 2) == 0 && b[0] == 'c');
+
+        sock->close();
+        server->stop();
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_vectored ok";
+}
+
+/**
+ * 写一个size字节的临时文件，返回只读的fd
+ */
+static int make_file(const std::string& path, size_t size) {
+    std::string data = make_data(size);
+    FILE* f = fopen(path.c_str(), "w");
+    SYLAR_ASSERT(f);
+    SYLAR_ASSERT(fwrite(data.c_str(), 1, data.size(), f) == data.size());
+    fclose(f);
+    int fd = open(path.c_str(), O_RDONLY);
+    SYLAR_ASSERT(fd >= 0);
+    return fd;
+}
+
+void test_send_file() {
+    sylar::IOManager iom(2, false, "ssl");
+    iom.schedule([]() {
+        TestServer::ptr server(new TestServer);
+        server->start();
+        sylar::SSLSocket::ptr sock = dial(server->getAddress());
+        SYLAR_LOG_INFO(g_logger) << "ktls send=" << sock->isKtlsSend()
+            << " recv=" << sock->isKtlsRecv();
+        SYLAR_ASSERT(sock->send("e", 1) == 1);
+        sylar::SocketStream::ptr stream(new sylar::SocketStream(sock, false));
+
+        const size_t size = 200 * 1024;
+        std::string data = make_data(size);
+        int fd = make_file("/tmp/sylar_test_ssl.dat", size);
+        SYLAR_ASSERT(sock->sendFile(fd, 1000, 150000) == 150000);
+        std::string buf(150000, '\0');
+        SYLAR_ASSERT(stream->readFixSize(&buf[0], buf.size()) > 0);
+        SYLAR_ASSERT(buf == data.substr(1000, 150000));
+
+        // 文件不够长时发到文件结尾
+        SYLAR_ASSERT(sock->sendFile(fd, size - 100, 1000) == 100);
+        SYLAR_ASSERT(stream->readFixSize(&buf[0], 100) > 0);
+        SYLAR_ASSERT(buf.compare(0, 100, data, size - 100, 100) == 0);
+        close(fd);
+        unlink("/tmp/sylar_test_ssl.dat");
+        sock->close();
+        server->stop();
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_send_file ok";
+}
+
+/**
+ * 没收到close_notify就读到EOF是错误，不能当成正常关闭
+ */
+void test_unexpected_eof() {
+    sylar::IOManager iom(2, false, "ssl");
+    iom.schedule([]() {
+        TestServer::ptr server(new TestServer);
+        server->start();
+        sylar::SSLSocket::ptr sock = dial(server->getAddress());
+        SYLAR_ASSERT(sock->send("e", 1) == 1);
+        // 本端关掉读方向，SSL_read在TCP层直接读到EOF
+        SYLAR_ASSERT(shutdown(sock->getSocket(), SHUT_RD) == 0);
+        char c = 0;
+        SYLAR_ASSERT(sock->recv(&c, 1) == -1);
+        SYLAR_ASSERT(errno == ECONNRESET);
+        sock->close();
+
+        // 服务端关闭时发了close_notify，读到的是正常关闭
+        sylar::SSLSocket::ptr client = dial(server->getAddress());
+        SYLAR_ASSERT(client->send("s", 1) == 1);
+        uint64_t len = 0;
+        SYLAR_ASSERT(client->send(&len, sizeof(len)) == sizeof(len));
+        SYLAR_ASSERT(client->recv(&c, 1) == 1 && c == 'd');
+        SYLAR_ASSERT(client->recv(&c, 1) == 0);
+        client->close();
+        server->stop();
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_unexpected_eof ok";
+}
+
+static std::string read_file(const std::string& path) {
+    std::ifstream ifs(path);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+/**
+ * 证书文件轮换后loadCertificates重新加载，不能一直用缓存的SSL_CTX
+ */
+void test_reload_cert() {
+    sylar::SSLSocket::ptr sock = sylar::SSLSocket::CreateTCPSocket();
+    SYLAR_ASSERT(sock->loadCertificates(s_cert_file, s_key_file));
+    // 只换私钥，证书和私钥对不上，重新加载时必须失败
+    std::string cert = read_file(s_cert_file);
+    make_cert();
+    std::ofstream(s_cert_file) << cert;
+    sock = sylar::SSLSocket::CreateTCPSocket();
+    SYLAR_ASSERT(!sock->loadCertificates(s_cert_file, s_key_file));
+
+    make_cert();
+    sylar::IOManager iom(2, false, "ssl");
+    iom.schedule([]() {
+        TestServer::ptr server(new TestServer);
+        server->start();
+        sylar::SSLSocket::ptr sock = dial(server->getAddress());
+        sock->close();
+        server->stop();
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_reload_cert ok";
+}
+
+/**
+ * 不握手的慢客户端不能卡住accept，握手超时后服务端关闭连接
+ */
+void test_slow_handshake() {
+    auto timeout = sylar::Config::Lookup<uint32_t>("ssl.handshake_timeout");
+    uint32_t old_timeout = timeout->getValue();
+    timeout->setValue(300);
+    {
+        sylar::IOManager iom(2, false, "ssl");
+        iom.schedule([]() {
+            TestServer::ptr server(new TestServer);
+            server->start();
+            std::vector<sylar::Socket::ptr> slows;
+            for(int i = 0; i < 10; ++i) {
+                sylar::Socket::ptr sock = sylar::Socket::CreateTCP(server->getAddress());
+                SYLAR_ASSERT(sock->connect(server->getAddress()));
+                slows.push_back(sock);
+            }
+            uint64_t ts = sylar::GetCurrentMS();
+            dial(server->getAddress())->close();
+            // 握手超时之前就连上了
+            SYLAR_ASSERT(sylar::GetCurrentMS() - ts < 250);
+
+            for(auto& i : slows) {
+                char c;
+                SYLAR_ASSERT(i->recv(&c, 1) == 0);
+            }
+            uint64_t used = sylar::GetCurrentMS() - ts;
+            SYLAR_LOG_INFO(g_logger) << "slow clients closed after " << used << "ms";
+            SYLAR_ASSERT(used >= 200 && used < 2000);
+            server->stop();
+        });
+    }
+    timeout->setValue(old_timeout);
+    SYLAR_LOG_INFO(g_logger) << "test_slow_handshake ok";
+}
+
+/**
+ * count个协程同时握手，两个线程
+ */
+void bench_concurrent() {
+    sylar::IOManager iom(2, false, "ssl");
+    iom.schedule([]() {
+        TestServer::ptr server(new TestServer);
+        server->start();
+        const int count = 2000;
+        for(int resume = 0; resume < 2; ++resume) {
+            sylar::SSLSocket::ClearSessionCache();
+            if(resume) {
+                dial(server->getAddress())->close();
+            }
+            std::shared_ptr<sylar::FiberWaitGroup> wg(new sylar::FiberWaitGroup);
+            std::shared_ptr<std::atomic<int> > reused(new std::atomic<int>(0));
+            std::vector<sylar::SSLSocket::ptr> socks(count);
+            uint64_t ts = sylar::GetCurrentUS();
+            for(int i = 0; i < count; ++i) {
+                wg->add(1);
+                sylar::Address::ptr addr = server->getAddress();
+                sylar::SSLSocket::ptr* sock = &socks[i];
+                sylar::IOManager::GetThis()->schedule([wg, reused, addr, sock, resume]() {
+                    // 连接都保持着，服务端同时有count个握手在进行
+                    *sock = dial(addr, resume);
+                    *reused += (*sock)->isSessionReused();
+                    wg->done();
+                });
+            }
+            wg->wait();
+            uint64_t us = sylar::GetCurrentUS() - ts;
+            SYLAR_LOG_INFO(g_logger) << (resume ? "resumed" : "full   ")
+                << " concurrent handshakes=" << count << " reused=" << *reused
+                << " time=" << us / 1000 << "ms"
+                << " handshakes/s=" << (uint64_t)(count * 1000000.0 / us);
+            for(auto& i : socks) {
+                i->close();
+            }
+        }
+        server->stop();
+    });
+}
+
+/**
+ * 顺序建立count个连接，对比完整握手和复用会话的握手速度
+ */
+void bench_handshake() {
+    sylar::IOManager iom(2, false, "ssl");
+    iom.schedule([]() {
+        TestServer::ptr server(new TestServer);
+        server->start();
+        const int count = 500;
+        for(int resume = 0; resume < 2; ++resume) {
+            sylar::SSLSocket::ClearSessionCache();
+            if(resume) {
+                dial(server->getAddress())->close();
+            }
+            int reused = 0;
+            uint64_t ts = sylar::GetCurrentUS();
+            for(int i = 0; i < count; ++i) {
+                sylar::SSLSocket::ptr sock = dial(server->getAddress(), resume);
+                reused += sock->isSessionReused();
+                sock->close();
+            }
+            uint64_t us = sylar::GetCurrentUS() - ts;
+            SYLAR_ASSERT(reused == (resume ? count : 0));
+            SYLAR_LOG_INFO(g_logger) << (resume ? "resumed" : "full   ")
+                << " handshakes=" << count << " time=" << us / 1000 << "ms"
+                << " handshakes/s=" << (uint64_t)(count * 1000000.0 / us);
+        }
+        server->stop();
+    });
+}
+
+/**
+ * 每次1K的小块，对比每块一次SSL_write和一次send(iovec)拼成整条记录
+ */
+void bench_bulk() {
+    sylar::IOManager iom(2, false, "ssl");
+    iom.schedule([]() {
+        TestServer::ptr server(new TestServer);
+        server->start();
+        const uint64_t total = 64 * 1024 * 1024;
+        const size_t chunk = 1024;
+        const size_t batch = 64;
+        std::string data = make_data(chunk * batch);
+        std::vector<iovec> iovs(batch);
+        for(size_t i = 0; i < batch; ++i) {
+            iovs[i].iov_base = &data[i * chunk];
+            iovs[i].iov_len = chunk;
+        }
+        for(int vectored = 0; vectored < 2; ++vectored) {
+            sylar::SSLSocket::ptr sock = dial(server->getAddress());
+            sylar::SocketStream::ptr stream(new sylar::SocketStream(sock, false));
+            SYLAR_ASSERT(stream->writeFixSize("s", 1) == 1);
+            SYLAR_ASSERT(stream->writeFixSize(&total, sizeof(total)) > 0);
+            uint64_t ts = sylar::GetCurrentUS();
+            for(uint64_t sent = 0; sent < total; sent += data.size()) {
+                if(vectored) {
+                    SYLAR_ASSERT(sock->send(&iovs[0], iovs.size()) == (int)data.size());
+                } else {
+                    for(size_t i = 0; i < batch; ++i) {
+                        SYLAR_ASSERT(sock->send(iovs[i].iov_base, chunk) == (int)chunk);
+                    }
+                }
+            }
+            char c = 0;
+            SYLAR_ASSERT(stream->readFixSize(&c, 1) == 1 && c == 'd');
+            uint64_t us = sylar::GetCurrentUS() - ts;
+            SYLAR_LOG_INFO(g_logger) << (vectored ? "send(iovec) " : "SSL_write/1K")
+                << " bytes=" << total << " time=" << us / 1000 << "ms"
+                << " MB/s=" << (uint64_t)(total / 1.048576 / us);
+            sock->close();
+        }
+        server->stop();
+    });
+}
+
+/**
+ * 发送文件：sendFile(kTLS时不经过用户态) 对比 读到内存再send
+ */
+void bench_send_file() {
+    sylar::IOManager iom(2, false, "ssl");
+    iom.schedule([]() {
+        TestServer::ptr server(new TestServer);
+        server->start();
+        const uint64_t size = 256 * 1024 * 1024;
+        int fd = make_file("/tmp/sylar_test_ssl.dat", size);
+        for(int use_send_file = 0; use_send_file < 2; ++use_send_file) {
+            sylar::SSLSocket::ptr sock = dial(server->getAddress());
+            sylar::SocketStream::ptr stream(new sylar::SocketStream(sock, false));
+            SYLAR_ASSERT(stream->writeFixSize("s", 1) == 1);
+            SYLAR_ASSERT(stream->writeFixSize(&size, sizeof(size)) > 0);
+            uint64_t ts = sylar::GetCurrentUS();
+            if(use_send_file) {
+                SYLAR_ASSERT(sock->sendFile(fd, 0, size) == (int64_t)size);
+            } else {
+                std::vector<char> buf(64 * 1024);
+                for(uint64_t off = 0; off < size; off += buf.size()) {
+                    SYLAR_ASSERT(pread(fd, &buf[0], buf.size(), off) == (ssize_t)buf.size());
+                    SYLAR_ASSERT(stream->writeFixSize(&buf[0], buf.size()) > 0);
+                }
+            }
+            char c = 0;
+            SYLAR_ASSERT(stream->readFixSize(&c, 1) == 1 && c == 'd');
+            uint64_t us = sylar::GetCurrentUS() - ts;
+            SYLAR_LOG_INFO(g_logger) << (use_send_file ? "sendFile   " : "pread+send ")
+                << " ktls=" << sock->isKtlsSend()
+                << " bytes=" << size << " time=" << us / 1000 << "ms"
+                << " MB/s=" << (uint64_t)(size / 1.048576 / us);
+            sock->close();
+        }
+        close(fd);
+        unlink("/tmp/sylar_test_ssl.dat");
+        server->stop();
+    });
+}
+
+int main(int argc, char** argv) {
+    test_resume();
+    test_vectored();
+    test_send_file();
+    test_unexpected_eof();
+    test_reload_cert();
+    test_slow_handshake();
+    bench_handshake();
+    bench_concurrent();
+    bench_bulk();
+    bench_send_file();
+    return 0;
+}
@@ -0,0 +1,237 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/address.h"
+#include "../sylar/socket.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/streams/socket_stream.h"
+#include "../sylar/streams/buffered_stream.h"
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * 统计下层read/write的调用次数
+ */
+class CountingStream : public sylar::Stream {
+public:
+    typedef std::shared_ptr<CountingStream> ptr;
+    CountingStream(sylar::Stream::ptr s)
+        :m_stream(s) {
+    }
+
+    int read(void* buffer, size_t length) override {
+        ++reads;
+        return m_stream->read(buffer, length);
+    }
+    int read(sylar::ByteArray::ptr ba, size_t length) override {
+        ++reads;
+        return m_stream->read(ba, length);
+    }
+    int write(const void* buffer, size_t length) override {
+        ++writes;
+        return m_stream->write(buffer, length);
+    }
+    int write(sylar::ByteArray::ptr ba, size_t length) override {
+        ++writes;
+        return m_stream->write(ba, length);
+    }
+    void close() override {
+        m_stream->close();
+    }
+
+    size_t reads = 0;
+    size_t writes = 0;
+private:
+    sylar::Stream::ptr m_stream;
+};
+
+/**
+ * 建立一对相连的Socket
+ */
+static std::pair<sylar::Socket::ptr, sylar::Socket::ptr> make_pair() {
+    sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+    SYLAR_ASSERT(listener->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+    SYLAR_ASSERT(listener->listen());
+    sylar::Socket::ptr client = sylar::Socket::CreateTCPSocket();
+    SYLAR_ASSERT(client->connect(listener->getLocalAddress()));
+    sylar::Socket::ptr server = listener->accept();
+    SYLAR_ASSERT(server);
+    return std::make_pair(client, server);
+}
+
+static std::string make_data(size_t len) {
+    std::string data(len, '\0');
+    for(size_t i = 0; i < len; ++i) {
+        data[i] = 'a' + (i * 7 + i / 26) % 26;
+    }
+    return data;
+}
+
+void test_fix_size() {
+    sylar::IOManager iom(2, false, "stream");
+    iom.schedule([]() {
+        auto p = make_pair();
+        sylar::SocketStream::ptr out(new sylar::SocketStream(p.first));
+        sylar::SocketStream::ptr in(new sylar::SocketStream(p.second));
+        std::string data = make_data(10000);
+
+        // 对端一次只写7个字节，readFixSize要拼起来
+        sylar::IOManager::GetThis()->schedule([out, data]() {
+            for(size_t i = 0; i < data.size(); i += 7) {
+                size_t n = std::min((size_t)7, data.size() - i);
+                SYLAR_ASSERT(out->writeFixSize(&data[i], n) == (int)n);
+                if(i % 700 == 0) {
+                    usleep(1000);
+                }
+            }
+            // 再写一份给ByteArray版本读，最后关闭
+            SYLAR_ASSERT(out->writeFixSize(data.c_str(), data.size()) == (int)data.size());
+            out->close();
+        });
+
+        std::string buf(data.size(), '\0');
+        SYLAR_ASSERT(in->readFixSize(&buf[0], buf.size()) == (int)buf.size());
+        SYLAR_ASSERT(buf == data);
+
+        sylar::ByteArray::ptr ba(new sylar::ByteArray(1024));
+        SYLAR_ASSERT(in->readFixSize(ba, data.size()) == (int)data.size());
+        SYLAR_ASSERT(ba->getPosition() == data.size());
+        ba->setPosition(0);
+        SYLAR_ASSERT(ba->toString() == data);
+
+        // 读满之前对端关闭
+        SYLAR_ASSERT(in->readFixSize(&buf[0], 10) == 0);
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_fix_size ok";
+}
+
+/**
+ * 写count条[uint16长度][body]的消息，返回下层write次数
+ */
+static size_t write_messages(sylar::Stream::ptr out, int count, size_t wbuf) {
+    CountingStream::ptr cnt(new CountingStream(out));
+    sylar::BufferedStream::ptr bs(new sylar::BufferedStream(cnt, 16 * 1024, wbuf));
+    std::string body = make_data(200);
+    for(int i = 0; i < count; ++i) {
+        uint16_t len = htons(10 + i % 100);
+        SYLAR_ASSERT(bs->writeFixSize(&len, sizeof(len)) > 0);
+        SYLAR_ASSERT(bs->writeFixSize(body.c_str(), 10 + i % 100) > 0);
+    }
+    SYLAR_ASSERT(bs->flush() > 0);
+    SYLAR_ASSERT(bs->getWriteBufferedSize() == 0);
+    return cnt->writes;
+}
+
+/**
+ * 读count条消息，返回下层read次数
+ */
+static size_t read_messages(sylar::Stream::ptr in, int count, bool buffered) {
+    CountingStream::ptr cnt(new CountingStream(in));
+    sylar::Stream::ptr s = cnt;
+    if(buffered) {
+        s.reset(new sylar::BufferedStream(cnt));
+    }
+    std::string body = make_data(200);
+    char buf[256];
+    for(int i = 0; i < count; ++i) {
+        uint16_t len = 0;
+        SYLAR_ASSERT(s->readFixSize(&len, sizeof(len)) > 0);
+        len = ntohs(len);
+        SYLAR_ASSERT(len == 10 + i % 100);
+        SYLAR_ASSERT(s->readFixSize(buf, len) > 0);
+        SYLAR_ASSERT(memcmp(buf, body.c_str(), len) == 0);
+    }
+    return cnt->reads;
+}
+
+void test_buffered() {
+    sylar::IOManager iom(2, false, "stream");
+    iom.schedule([]() {
+        auto p = make_pair();
+        sylar::SocketStream::ptr out(new sylar::SocketStream(p.first));
+        sylar::SocketStream::ptr in(new sylar::SocketStream(p.second));
+        const int count = 10000;
+        std::shared_ptr<sylar::FiberEvent> written(new sylar::FiberEvent);
+        std::shared_ptr<size_t> writes(new size_t(0));
+        sylar::IOManager::GetThis()->schedule([out, written, writes]() {
+            *writes = write_messages(out, count, 16 * 1024);
+            written->set();
+        });
+        size_t reads = read_messages(in, count, true);
+        written->wait();
+        SYLAR_LOG_INFO(g_logger) << "messages=" << count << " reads=" << reads
+            << " writes=" << *writes;
+        // 平均每条消息远少于一次系统调用
+        SYLAR_ASSERT(reads < count / 10);
+        SYLAR_ASSERT(*writes < count / 10);
+
+        // 小读取和大读取交替：缓冲区里的数据先返回，大读取在缓冲区空时直接读
+        std::string data = make_data(100 * 1024);
+        SYLAR_ASSERT(out->writeFixSize(data.c_str(), data.size()) > 0);
+        CountingStream::ptr cnt(new CountingStream(in));
+        sylar::BufferedStream bs(cnt, 4096);
+        std::string buf(data.size(), '\0');
+        SYLAR_ASSERT(bs.readFixSize(&buf[0], 10) > 0);
+        SYLAR_ASSERT(bs.getReadBufferedSize() > 0);
+        SYLAR_ASSERT(bs.readFixSize(&buf[10], data.size() - 10) > 0);
+        SYLAR_ASSERT(buf == data);
+        SYLAR_ASSERT(bs.getReadBufferedSize() == 0);
+
+        // ByteArray接口和写缓冲
+        sylar::BufferedStream::ptr wbs(new sylar::BufferedStream(out, 4096, 4096));
+        sylar::ByteArray::ptr ba(new sylar::ByteArray(128));
+        ba->writeStringF16("hello");
+        ba->writeStringF32(data);
+        ba->setPosition(0);
+        SYLAR_ASSERT(wbs->writeFixSize(ba, ba->getSize()) > 0);
+        SYLAR_ASSERT(ba->getReadSize() == 0);
+        SYLAR_ASSERT(wbs->flush() > 0);
+        sylar::ByteArray::ptr rba(new sylar::ByteArray(128));
+        SYLAR_ASSERT(bs.readFixSize(rba, ba->getSize()) > 0);
+        rba->setPosition(0);
+        SYLAR_ASSERT(rba->readStringF16() == "hello");
+        SYLAR_ASSERT(rba->readStringF32() == data);
+
+        // 关闭时写出缓冲区里剩余的数据
+        SYLAR_ASSERT(wbs->writeFixSize("tail", 4) == 4);
+        SYLAR_ASSERT(wbs->getWriteBufferedSize() == 4);
+        wbs->close();
+        SYLAR_ASSERT(bs.readFixSize(&buf[0], 4) > 0);
+        SYLAR_ASSERT(buf.compare(0, 4, "tail") == 0);
+        SYLAR_ASSERT(bs.read(&buf[0], 1) == 0);
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_buffered ok";
+}
+
+/**
+ * 每条消息读头部和body两次，对比直接读Socket和带缓冲读
+ */
+void bench() {
+    for(int buffered = 0; buffered < 2; ++buffered) {
+        sylar::IOManager iom(2, false, "stream");
+        iom.schedule([buffered]() {
+            auto p = make_pair();
+            sylar::SocketStream::ptr out(new sylar::SocketStream(p.first));
+            sylar::SocketStream::ptr in(new sylar::SocketStream(p.second));
+            const int count = 200000;
+            sylar::IOManager::GetThis()->schedule([out]() {
+                write_messages(out, count, 64 * 1024);
+            });
+            uint64_t ts = sylar::GetCurrentUS();
+            size_t reads = read_messages(in, count, buffered);
+            uint64_t us = sylar::GetCurrentUS() - ts;
+            SYLAR_LOG_INFO(g_logger) << (buffered ? "buffered" : "direct  ")
+                << " messages=" << count << " reads=" << reads
+                << " reads/msg=" << (double)reads / count
+                << " time=" << us / 1000 << "ms"
+                << " msg/s=" << (uint64_t)(count * 1000000.0 / us);
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    test_fix_size();
+    test_buffered();
+    bench();
+    return 0;
+}
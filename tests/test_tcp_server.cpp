@@ -0,0 +1,257 @@
+#include "../sylar/sylar.h"
+#include "../sylar/iomanager.h"
+#include "../sylar/address.h"
+#include "../sylar/socket.h"
+#include "../sylar/tcp_server.h"
+#include "../sylar/fiber_sync.h"
+#include "../sylar/fd_manager.h"
+#include <algorithm>
+#include <string.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+class EchoServer : public sylar::TcpServer {
+public:
+    EchoServer(sylar::IOManager* io_worker, sylar::IOManager* accept_worker)
+        :sylar::TcpServer(io_worker, accept_worker) {
+    }
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        std::string buf;
+        buf.resize(64 * 1024);
+        while(true) {
+            int rt = client->recv(&buf[0], buf.size());
+            if(rt <= 0) {
+                break;
+            }
+            int offset = 0;
+            while(offset < rt) {
+                int n = client->send(&buf[offset], rt - offset);
+                if(n <= 0) {
+                    return;
+                }
+                offset += n;
+            }
+        }
+    }
+};
+
+// 原来各服务的写法(tests/test_server.cpp)：一个协程accept，一个连接处理完再accept下一个
+static void legacy_echo(sylar::Socket::ptr sock) {
+    std::string buf;
+    buf.resize(64 * 1024);
+    while(true) {
+        sylar::Socket::ptr client = sock->accept();
+        if(!client) {
+            return;
+        }
+        while(true) {
+            int rt = client->recv(&buf[0], buf.size());
+            if(rt <= 0) {
+                break;
+            }
+            client->send(&buf[0], rt);
+        }
+    }
+}
+
+static bool recv_all(sylar::Socket::ptr sock, char* buf, size_t len) {
+    size_t offset = 0;
+    while(offset < len) {
+        int rt = sock->recv(buf + offset, len - offset);
+        if(rt <= 0) {
+            return false;
+        }
+        offset += rt;
+    }
+    return true;
+}
+
+static sylar::Address::ptr local_addr(uint16_t port) {
+    return sylar::IPv4Address::Create("127.0.0.1", port);
+}
+
+struct BenchResult {
+    uint64_t requests = 0;
+    uint64_t cost_ms = 0;
+    std::vector<uint64_t> latency_us;
+};
+
+// conns个连接并发，每个连接rounds次请求-应答，每次size字节
+static BenchResult run_clients(uint16_t port, int conns, int rounds, size_t size) {
+    BenchResult result;
+    sylar::Mutex mutex;
+    uint64_t ts = sylar::GetCurrentMS();
+    {
+        sylar::IOManager iom(2, false, "client");
+        for(int i = 0; i < conns; ++i) {
+            iom.schedule([&, i]() {
+                sylar::Socket::ptr sock = sylar::Socket::CreateTCP(local_addr(port));
+                if(!sock->connect(local_addr(port))) {
+                    SYLAR_LOG_ERROR(g_logger) << "connect fail";
+                    return;
+                }
+                std::string req(size, 'a' + i % 26);
+                std::string rsp(size, 0);
+                std::vector<uint64_t> lat;
+                lat.reserve(rounds);
+                for(int j = 0; j < rounds; ++j) {
+                    uint64_t b = sylar::GetCurrentUS();
+                    if(sock->send(&req[0], req.size()) != (int)req.size()
+                            || !recv_all(sock, &rsp[0], rsp.size())) {
+                        SYLAR_LOG_ERROR(g_logger) << "echo fail";
+                        return;
+                    }
+                    lat.push_back(sylar::GetCurrentUS() - b);
+                }
+                SYLAR_ASSERT(rsp == req);
+                sylar::Mutex::Lock lock(mutex);
+                result.requests += lat.size();
+                result.latency_us.insert(result.latency_us.end(), lat.begin(), lat.end());
+            });
+        }
+    }
+    result.cost_ms = sylar::GetCurrentMS() - ts;
+    std::sort(result.latency_us.begin(), result.latency_us.end());
+    return result;
+}
+
+static void report(const std::string& name, int conns, size_t size, const BenchResult& r) {
+    if(r.latency_us.empty()) {
+        SYLAR_LOG_INFO(g_logger) << "bench " << name << " no result";
+        return;
+    }
+    uint64_t cost = r.cost_ms ? r.cost_ms : 1;
+    SYLAR_LOG_INFO(g_logger) << "bench " << name << " conns=" << conns
+        << " size=" << size
+        << " req/s=" << r.requests * 1000 / cost
+        << " MB/s=" << (double)r.requests * size * 2 / 1024 / 1024 * 1000 / cost
+        << " p50=" << r.latency_us[r.latency_us.size() / 2] << "us"
+        << " p99=" << r.latency_us[r.latency_us.size() * 99 / 100] << "us"
+        << " max=" << r.latency_us.back() << "us";
+}
+
+void test_echo() {
+    sylar::IOManager accept_worker(1, false, "accept");
+    sylar::IOManager io_worker(2, false, "io");
+    EchoServer::ptr server(new EchoServer(&io_worker, &accept_worker));
+    std::vector<sylar::Address::ptr> addrs;
+    std::vector<sylar::Address::ptr> fails;
+    addrs.push_back(local_addr(0));
+    addrs.push_back(local_addr(0));
+    SYLAR_ASSERT(server->bind(addrs, fails));
+    SYLAR_ASSERT(server->getSocks().size() == 2);
+    SYLAR_ASSERT(server->start());
+    for(auto& sock : server->getSocks()) {
+        uint16_t port = std::dynamic_pointer_cast<sylar::IPAddress>(sock->getLocalAddress())->getPort();
+        BenchResult r = run_clients(port, 20, 50, 100);
+        SYLAR_ASSERT(r.requests == 20 * 50);
+    }
+    server->stop();
+    // stop之后不能再start
+    SYLAR_ASSERT(!server->start());
+    SYLAR_LOG_INFO(g_logger) << "test_echo ok";
+}
+
+void test_reuseport() {
+    sylar::IOManager accept_worker(2, false, "accept");
+    sylar::IOManager io_worker(2, false, "io");
+    EchoServer::ptr server(new EchoServer(&io_worker, &accept_worker));
+    server->setListeners(2);
+    SYLAR_ASSERT(server->bind(local_addr(0)));
+    auto socks = server->getSocks();
+    SYLAR_ASSERT(socks.size() == 2);
+    uint16_t port = std::dynamic_pointer_cast<sylar::IPAddress>(socks[0]->getLocalAddress())->getPort();
+    SYLAR_ASSERT(port == std::dynamic_pointer_cast<sylar::IPAddress>(socks[1]->getLocalAddress())->getPort());
+    SYLAR_ASSERT(server->start());
+    BenchResult r = run_clients(port, 100, 10, 100);
+    SYLAR_ASSERT(r.requests == 100 * 10);
+    server->stop();
+    SYLAR_LOG_INFO(g_logger) << "test_reuseport ok";
+}
+
+void test_stop() {
+    sylar::IOManager accept_worker(1, false, "accept");
+    sylar::IOManager io_worker(2, false, "io");
+    EchoServer::ptr server(new EchoServer(&io_worker, &accept_worker));
+    SYLAR_ASSERT(server->bind(local_addr(0)));
+    uint16_t port = std::dynamic_pointer_cast<sylar::IPAddress>(server->getSocks()[0]->getLocalAddress())->getPort();
+    SYLAR_ASSERT(server->start());
+
+    sylar::FiberEvent* connected = new sylar::FiberEvent;
+    std::atomic<uint64_t> closed_ms(0);
+    sylar::IOManager client(1, false, "client");
+    client.schedule([&]() {
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCP(local_addr(port));
+        SYLAR_ASSERT(sock->connect(local_addr(port)));
+        char c = 'x';
+        SYLAR_ASSERT(sock->send(&c, 1) == 1);
+        SYLAR_ASSERT(recv_all(sock, &c, 1));
+        connected->set();
+        // 连接一直空闲，直到服务器在stop超时后shutdown它
+        SYLAR_ASSERT(sock->recv(&c, 1) == 0);
+        closed_ms = sylar::GetCurrentMS();
+    });
+    client.schedule([&]() {
+        connected->wait();
+        SYLAR_ASSERT(server->getConnectionCount() == 1);
+        uint64_t ts = sylar::GetCurrentMS();
+        server->stop(100);
+        // 新连接被拒绝，已有连接还在
+        usleep(20 * 1000);
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCP(local_addr(port));
+        SYLAR_ASSERT(!sock->connect(local_addr(port)));
+        SYLAR_ASSERT(closed_ms == 0);
+        while(closed_ms == 0) {
+            usleep(10 * 1000);
+        }
+        uint64_t cost = closed_ms - ts;
+        SYLAR_ASSERT(cost >= 95 && cost < 1000);
+        SYLAR_ASSERT(server->getConnectionCount() == 0);
+        delete connected;
+    });
+    SYLAR_LOG_INFO(g_logger) << "test_stop ok";
+}
+
+void bench() {
+    const int rounds = 2000;
+    for(size_t size : {64, 16 * 1024}) {
+        for(int conns : {1, 50}) {
+            sylar::IOManager accept_worker(1, false, "accept");
+            sylar::IOManager io_worker(2, false, "io");
+            EchoServer::ptr server(new EchoServer(&io_worker, &accept_worker));
+            SYLAR_ASSERT(server->bind(local_addr(0)));
+            uint16_t port = std::dynamic_pointer_cast<sylar::IPAddress>(server->getSocks()[0]->getLocalAddress())->getPort();
+            server->start();
+            report("tcp_server", conns, size, run_clients(port, conns, rounds / conns * (conns > 1 ? 10 : 1), size));
+            server->stop();
+        }
+    }
+
+    // 原来的写法，连接只能一个一个处理
+    const int conns = 50;
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(local_addr(0));
+    SYLAR_ASSERT(sock->bind(local_addr(0)));
+    SYLAR_ASSERT(sock->listen());
+    sylar::FdMgr::GetInstance().get(sock->getSocket(), true);
+    uint16_t port = std::dynamic_pointer_cast<sylar::IPAddress>(sock->getLocalAddress())->getPort();
+    {
+        sylar::IOManager server_iom(1, false, "legacy");
+        server_iom.schedule(std::bind(legacy_echo, sock));
+        report("legacy", conns, 64, run_clients(port, conns, rounds / conns * 10, 64));
+        server_iom.schedule([&sock]() {
+            sock->cancelAll();
+            sock->close();
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_echo();
+    test_reuseport();
+    test_stop();
+    bench();
+    return 0;
+}
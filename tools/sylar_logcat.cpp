@@ -0,0 +1,59 @@
+#include "../sylar/log.h"
+#include <iostream>
+#include <unistd.h>
+
+/*
+把BinaryLogAppender写出的二进制日志还原成文本
+用法: sylar_logcat [-p pattern] file...
+pattern和LogFormatter一致，默认是Logger的默认格式
+*/
+
+static void usage(const char * name) {
+    std::cerr << "usage: " << name << " [-p pattern] file..." << std::endl;
+}
+
+int main(int argc, char** argv) {
+    sylar::Logger::ptr def(new sylar::Logger("sylar_logcat"));
+    std::string pattern = def->getFormatter()->getPattern();
+    int opt;
+    while((opt = getopt(argc, argv, "p:h")) != -1) {
+        switch(opt) {
+        case 'p':
+            pattern = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    sylar::LogFormatter::ptr fmt(new sylar::LogFormatter(pattern));
+    if(fmt->isError()) {
+        std::cerr << "invalid pattern: " << pattern << std::endl;
+        return 1;
+    }
+
+    int rt = 0;
+    std::string buf;
+    for(int i = optind; i < argc; ++i) {
+        sylar::BinaryLogReader reader(argv[i]);
+        if(!reader.isValid()) {
+            std::cerr << "open " << argv[i] << " failed" << std::endl;
+            rt = 1;
+            continue;
+        }
+        while(sylar::LogEvent::ptr event = reader.next()) {
+            buf.clear();
+            fmt->format(buf, event->getLogger(), event->getLevel(), event);
+            std::cout.write(buf.data(), buf.size());
+        }
+        if(reader.isError()) {
+            std::cerr << argv[i] << ": truncated or corrupted record" << std::endl;
+            rt = 1;
+        }
+    }
+    return rt;
+}